@@ -0,0 +1,674 @@
+/**
+   \file
+   \author Kenta Suzuki
+
+   Headless benchmark of the per-step kernels of the HAIROWorld
+   sub-simulators. The sub-simulator items run their steps only inside a
+   SimulatorItem, so the kernels they call are driven directly on a
+   synthetic world:
+
+     fdlinks    fluid forces of N bodies x M links (FDLinkArray) on T
+                worker threads
+     areagrid   area lookup of every link among K areas (AreaGrid), as
+                done by the fluid dynamics and TC simulators
+     buoyancy   the partial immersion of N x M box links among K areas
+                (ImmersionVolume), sampling the voxels of the links that
+                cross the boundary of an area
+     devices    the forces of a thruster and a rotor on each of N x M
+                links (FDDeviceArray), half of the links in water
+     tc         the step of TCSimulatorItem (TCAreaTracker) for N moving
+                bodies among K areas, with one slot for each body and
+                with a single slot
+     flowfield  trilinear sampling of a memory-mapped flow field
+     contacts   the post-dynamics step of CollisionVisualizerItem on N x M
+                links, a twentieth of which start or stop touching in a
+                step: the flips are found by ContactMaterialSwitcher, the
+                states are packed by CollisionStateRecorder, the flips
+                are pushed to ContactEventLog, and the materials of the
+                flipped links are swapped as the main thread does; then
+                the links in contact at random times of the run are
+                found in the log, as the time bar does after it
+     markers    the marker detection of MotionCaptureSimulatorItem
+                (MarkerDetector), the test of P passive markers against
+                the view of C cameras
+     image      ImageGenerator filters on a camera image
+
+   Every case runs at the given sizes and then, unless --sweep is 0,
+   with each of its sizes halved down to 1 in turn while the others are
+   kept, which gives its scaling in N, M, K, T, C and P. Each run reports
+   the wall time and the number of heap allocations per step.
+
+   usage: hairoworld-benchmark [--bodies N] [--links M] [--areas K]
+                               [--threads T] [--cameras C] [--markers P]
+                               [--steps S] [--sweep 0|1] [--image WxH]
+*/
+
+#include <cnoid/EigenUtil>
+#include <cnoid/Image>
+#include <cnoid/ImageGenerator>
+#include <cnoid/Body>
+#include <cnoid/Link>
+#include <cnoid/MeshGenerator>
+#include <cnoid/SceneDrawables>
+#include <cnoid/WorldItem>
+#include <src/CollisionSeqPlugin/CollisionStateRecorder.h>
+#include <src/CollisionSeqPlugin/ContactEventLog.h>
+#include <src/CollisionSeqPlugin/ContactMaterialSwitcher.h>
+#include <src/FluidDynamicsPlugin/AreaGrid.h>
+#include <src/FluidDynamicsPlugin/AreaItem.h>
+#include <src/FluidDynamicsPlugin/FDDeviceArray.h>
+#include <src/FluidDynamicsPlugin/FDLink.h>
+#include <src/FluidDynamicsPlugin/FDLinkArray.h>
+#include <src/FluidDynamicsPlugin/FlowField.h>
+#include <src/FluidDynamicsPlugin/ImmersionVolume.h>
+#include <src/FluidDynamicsPlugin/WorkerPool.h>
+#include <src/MotionCapturePlugin/MarkerDetector.h>
+#include <src/TCPlugin/TCAreaTracker.h>
+#include <fmt/format.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+std::atomic<long> numAllocations(0);
+
+struct Options
+{
+    int numBodies = 10;
+    int numLinks = 20;
+    int numAreas = 16;
+    int numSteps = 1000;
+    int maxThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+    int numCameras = 8;
+    int numMarkers = 64;
+    bool isSweepEnabled = true;
+    int imageWidth = 640;
+    int imageHeight = 480;
+};
+
+void report(const string& name, const int& numSteps, const function<void()>& step)
+{
+    for(int i = 0; i < std::min(numSteps, 10); ++i) {
+        step();
+    }
+    long allocations = numAllocations;
+    auto start = chrono::steady_clock::now();
+    for(int i = 0; i < numSteps; ++i) {
+        step();
+    }
+    auto end = chrono::steady_clock::now();
+    allocations = numAllocations - allocations;
+    double ns = chrono::duration<double, nano>(end - start).count() / numSteps;
+    printf("%-32s %14.1f ns/step %10.2f allocs/step\n",
+           name.c_str(), ns, (double)allocations / numSteps);
+}
+
+
+// runs a case at the given sizes, and then with each size halved down
+// to 1 while the others are kept
+void sweep(const Options& options, const vector<int>& sizes, const function<void(const vector<int>&)>& run)
+{
+    run(sizes);
+    if(!options.isSweepEnabled) {
+        return;
+    }
+    for(size_t i = 0; i < sizes.size(); ++i) {
+        vector<int> swept = sizes;
+        for(swept[i] = sizes[i] / 2; swept[i] >= 1; swept[i] /= 2) {
+            run(swept);
+        }
+    }
+}
+
+
+vector<LinkPtr> createLinks(const int& numLinks, mt19937& random)
+{
+    uniform_real_distribution<double> position(-10.0, 10.0);
+    uniform_real_distribution<double> velocity(-1.0, 1.0);
+    vector<LinkPtr> links;
+    for(int i = 0; i < numLinks; ++i) {
+        Link* link = new Link;
+        link->setMass(1.0);
+        link->T().translation() << position(random), position(random), position(random);
+        link->v() << velocity(random), velocity(random), velocity(random);
+        link->w() << velocity(random), velocity(random), velocity(random);
+        links.push_back(link);
+    }
+    return links;
+}
+
+
+void benchmarkFDLinks(const Options& options, const int& numBodies, const int& numLinksPerBody,
+                      const int& numThreads, mt19937& random)
+{
+    vector<LinkPtr> links = createLinks(numBodies * numLinksPerBody, random);
+    FDLinkArray fdLinks;
+    vector<ref_ptr<FDLink>> fdLinkRefs;
+    for(auto& link : links) {
+        FDLink* fdLink = new FDLink(link);
+        fdLink->setDensity(1200.0);
+        fdLink->setCdw(1.0);
+        fdLink->setCda(1.0);
+        fdLink->setTd(0.5);
+        fdLink->setCv(1.0);
+        Vector6 surface;
+        surface << 0.01, 0.01, 0.02, 0.02, 0.03, 0.03;
+        fdLink->setSurface(surface);
+        fdLinks.addFDLink(fdLink);
+        fdLinkRefs.push_back(fdLink);
+    }
+
+    const Vector3 gravity(0.0, 0.0, -9.80665);
+    const Vector3 flow(0.1, 0.0, 0.0);
+    const int chunkSize = 64;
+    int numLinks = fdLinks.size();
+    int numChunks = (numLinks + chunkSize - 1) / chunkSize;
+    WorkerPool workerPool;
+    workerPool.setNumThreads(numThreads);
+    report(fmt::format("fdlinks {0}x{1} links, {2} threads", numBodies, numLinksPerBody, numThreads),
+           options.numSteps, [&](){
+        workerPool.run(numChunks, [&](int chunk){
+            int begin = chunk * chunkSize;
+            int end = std::min(begin + chunkSize, numLinks);
+            for(int i = begin; i < end; ++i) {
+                fdLinks.setFluid(i, 1000.0, 0.001, flow);
+            }
+            fdLinks.update(gravity, begin, end);
+        });
+        for(auto& link : links) {
+            link->f_ext().setZero();
+            link->tau_ext().setZero();
+        }
+    });
+}
+
+
+// boxes, cylinders and spheres placed among the links
+vector<AreaItem*> createAreas(WorldItem* worldItem, const int& numAreas, mt19937& random)
+{
+    uniform_real_distribution<double> position(-10.0, 10.0);
+    uniform_real_distribution<double> size(1.0, 5.0);
+    vector<AreaItem*> areas;
+    for(int i = 0; i < numAreas; ++i) {
+        AreaItem* item = new AreaItem;
+        item->setType(i % 3);
+        item->setTranslation(Vector3(position(random), position(random), position(random)));
+        item->setSize(Vector3(size(random), size(random), size(random)));
+        item->setRadius(size(random));
+        item->setHeight(size(random));
+        worldItem->addChildItem(item);
+        areas.push_back(item);
+    }
+    return areas;
+}
+
+
+void benchmarkAreaGrid(const Options& options, const int& numBodies, const int& numLinksPerBody,
+                       const int& numAreas, mt19937& random)
+{
+    vector<LinkPtr> links = createLinks(numBodies * numLinksPerBody, random);
+    WorldItemPtr worldItem = new WorldItem;
+    AreaGrid areaGrid;
+    for(auto& area : createAreas(worldItem, numAreas, random)) {
+        areaGrid.addArea(area);
+    }
+    areaGrid.build();
+
+    int found = 0;
+    report(fmt::format("areagrid {0}x{1} links, {2} areas", numBodies, numLinksPerBody, numAreas),
+           options.numSteps, [&](){
+        for(auto& link : links) {
+            if(areaGrid.findArea(link->T().translation()) >= 0) {
+                ++found;
+            }
+        }
+    });
+}
+
+
+void benchmarkBuoyancy(const Options& options, const int& numBodies, const int& numLinksPerBody,
+                       const int& numAreas, mt19937& random)
+{
+    // the links are boxes half a metre wide, so that some of them cross
+    // the boundary of an area
+    MeshGenerator generator;
+    vector<LinkPtr> links = createLinks(numBodies * numLinksPerBody, random);
+    vector<ImmersionVolumePtr> volumes;
+    for(auto& link : links) {
+        SgShape* shape = new SgShape;
+        shape->setMesh(generator.generateBox(Vector3(0.5, 0.5, 0.5)));
+        link->addCollisionShapeNode(shape);
+        ImmersionVolumePtr volume = new ImmersionVolume;
+        if(volume->build(link, 16)) {
+            volumes.push_back(volume);
+        }
+    }
+    WorldItemPtr worldItem = new WorldItem;
+    AreaGrid areaGrid;
+    for(auto& area : createAreas(worldItem, numAreas, random)) {
+        areaGrid.addArea(area);
+    }
+    areaGrid.build();
+    vector<double> densities(numAreas, 1000.0);
+
+    Vector3 shift;
+    double sum = 0.0;
+    report(fmt::format("buoyancy {0}x{1} links, {2} areas", numBodies, numLinksPerBody, numAreas),
+           options.numSteps, [&](){
+        for(size_t i = 0; i < volumes.size(); ++i) {
+            sum += volumes[i]->submerge(links[i]->T(), areaGrid, densities, shift);
+        }
+    });
+}
+
+
+void benchmarkDevices(const Options& options, const int& numBodies, const int& numLinksPerBody, mt19937& random)
+{
+    vector<LinkPtr> links = createLinks(numBodies * numLinksPerBody, random);
+    FDDeviceArray devices;
+    vector<ref_ptr<Thruster>> thrusters;
+    vector<ref_ptr<Rotor>> rotors;
+    for(size_t i = 0; i < links.size(); ++i) {
+        Thruster* thruster = new Thruster;
+        thruster->setLink(links[i]);
+        thruster->on(true);
+        thruster->force() = 1.0;
+        devices.addThruster(thruster, i);
+        thrusters.push_back(thruster);
+        Rotor* rotor = new Rotor;
+        rotor->setLink(links[i]);
+        rotor->on(true);
+        rotor->force() = 1.0;
+        devices.addRotor(rotor, i);
+        rotors.push_back(rotor);
+    }
+
+    // water and air in turn
+    const Vector3 gravity(0.0, 0.0, -9.80665);
+    vector<double> areaDensities = { 1000.0, 1.2 };
+    vector<int> linkAreas(links.size());
+    for(size_t i = 0; i < links.size(); ++i) {
+        linkAreas[i] = i % 2;
+    }
+    report(fmt::format("devices {0}x{1} links", numBodies, numLinksPerBody), options.numSteps, [&](){
+        devices.update(gravity, linkAreas, areaDensities);
+        for(auto& link : links) {
+            link->f_ext().setZero();
+            link->tau_ext().setZero();
+        }
+    });
+}
+
+
+void benchmarkAreaTracker(const Options& options, const int& numBodies, const int& numAreas,
+                          const bool& isSlotPerBody, mt19937& random)
+{
+    vector<LinkPtr> links = createLinks(numBodies, random);
+    WorldItemPtr worldItem = new WorldItem;
+    TCAreaTracker tracker;
+    for(auto& area : createAreas(worldItem, numAreas, random)) {
+        tracker.addArea(area);
+    }
+    for(auto& link : links) {
+        tracker.addBody(link);
+    }
+    tracker.setHysteresis(0.1);
+    tracker.build(isSlotPerBody);
+
+    // every body moves at its velocity in every step, as the bodies
+    // followed in a simulation do
+    const double timeStep = 0.001;
+    double time = 0.0;
+    int numChanges = 0;
+    report(fmt::format("tc {0} bodies, {1} areas, {2}", numBodies, numAreas,
+                       isSlotPerBody ? "slot per body" : "one slot"),
+           options.numSteps, [&](){
+        for(auto& link : links) {
+            link->T().translation() += link->v() * timeStep;
+        }
+        numChanges += tracker.update(time).size();
+        time += timeStep;
+    });
+}
+
+
+bool writeFlowField(const string& filename, const int& n)
+{
+    ofstream file(filename, ios::binary);
+    file.write("CNFF", 4);
+    uint32_t version = 1;
+    file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    int32_t size[3] = { n, n, n };
+    double origin[3] = { -10.0, -10.0, -10.0 };
+    double spacing[3] = { 20.0 / (n - 1), 20.0 / (n - 1), 20.0 / (n - 1) };
+    file.write(reinterpret_cast<const char*>(size), sizeof(size));
+    file.write(reinterpret_cast<const char*>(origin), sizeof(origin));
+    file.write(reinterpret_cast<const char*>(spacing), sizeof(spacing));
+    for(int i = 0; i < n * n * n; ++i) {
+        float v[3] = { (float)(i % n) / n, 0.0f, 0.0f };
+        file.write(reinterpret_cast<const char*>(v), sizeof(v));
+    }
+    return (bool)file;
+}
+
+
+void benchmarkFlowField(const Options& options, mt19937& random)
+{
+    string filename = fmt::format("/tmp/hairoworld-benchmark-{0}.cnff", getpid());
+    if(!writeFlowField(filename, 64)) {
+        printf("flowfield: %s cannot be written\n", filename.c_str());
+        return;
+    }
+    FlowFieldPtr field = new FlowField;
+    string message;
+    if(field->load(filename, message)) {
+        sweep(options, { options.numBodies, options.numLinks }, [&](const vector<int>& sizes){
+            vector<LinkPtr> links = createLinks(sizes[0] * sizes[1], random);
+            Vector3 flow;
+            report(fmt::format("flowfield {0}x{1} samples", sizes[0], sizes[1]), options.numSteps, [&](){
+                for(auto& link : links) {
+                    field->sample(link->T().translation(), flow);
+                }
+            });
+        });
+    } else {
+        printf("flowfield: %s\n", message.c_str());
+    }
+    field.reset();
+    remove(filename.c_str());
+}
+
+
+void benchmarkContacts(const Options& options, const int& numBodies, const int& numLinksPerBody, mt19937& random)
+{
+    // every link has a box as its collision shape
+    MeshGenerator generator;
+    vector<BodyPtr> bodies;
+    vector<Link*> links;
+    ContactMaterialSwitcher materialSwitcher;
+    for(int i = 0; i < numBodies; ++i) {
+        Body* body = new Body;
+        vector<LinkPtr> bodyLinks = createLinks(numLinksPerBody, random);
+        body->setRootLink(bodyLinks[0]);
+        for(int j = 1; j < numLinksPerBody; ++j) {
+            bodyLinks[0]->appendChild(bodyLinks[j]);
+        }
+        body->updateLinkTree();
+        for(int j = 0; j < body->numLinks(); ++j) {
+            Link* link = body->link(j);
+            SgShape* shape = new SgShape;
+            shape->setMesh(generator.generateBox(Vector3(0.1, 0.1, 0.1)));
+            shape->setMaterial(new SgMaterial);
+            link->addCollisionShapeNode(shape);
+            materialSwitcher.addLink(link);
+            links.push_back(link);
+        }
+        bodies.push_back(body);
+    }
+    vector<shared_ptr<CollisionStateRecorder>> recorders;
+    ContactEventLog eventLog;
+    for(auto& body : bodies) {
+        auto recorder = make_shared<CollisionStateRecorder>();
+        recorder->initialize(body->numLinks(), 1000.0, 0);
+        recorders.push_back(recorder);
+        vector<string> linkNames;
+        for(int j = 0; j < body->numLinks(); ++j) {
+            linkNames.push_back(body->link(j)->name());
+        }
+        eventLog.addBody(body->name(), linkNames);
+    }
+    eventLog.start();
+
+    // the links that start or stop touching are drawn for a cycle of steps
+    const int numPatterns = 64;
+    uniform_int_distribution<int> linkIndex(0, links.size() - 1);
+    vector<vector<int>> flips(numPatterns);
+    for(auto& flip : flips) {
+        for(size_t i = 0; i < std::max((size_t)1, links.size() / 20); ++i) {
+            flip.push_back(linkIndex(random));
+        }
+    }
+    const Link::ContactPoint contact(Vector3::Zero(), Vector3::UnitZ(), Vector3::Zero(), Vector3::Zero(), 0.0);
+
+    const double timeStep = 0.001;
+    int step = 0;
+    report(fmt::format("contacts {0}x{1} links", numBodies, numLinksPerBody), options.numSteps, [&](){
+        const double time = step * timeStep;
+        for(auto& index : flips[step++ % numPatterns]) {
+            auto& contacts = links[index]->contactPoints();
+            ContactEventLog::Event event;
+            event.time = time;
+            event.body = index / numLinksPerBody;
+            event.link = index % numLinksPerBody;
+            event.partner = -1;
+            if(contacts.empty()) {
+                contacts.push_back(contact);
+                event.type = ContactEventLog::Enter;
+            } else {
+                contacts.clear();
+                event.type = ContactEventLog::Exit;
+            }
+            eventLog.push(event);
+        }
+
+        // the post-dynamics step, and the call it posts to the main thread
+        bool isApplyRequested = materialSwitcher.update();
+        for(size_t i = 0; i < bodies.size(); ++i) {
+            recorders[i]->record(bodies[i]);
+        }
+        if(isApplyRequested) {
+            materialSwitcher.apply();
+        }
+    });
+    eventLog.stop();
+
+    // the lookups of the time bar, each followed by the swap of the
+    // materials of the links found
+    uniform_real_distribution<double> lookupTime(0.0, step * timeStep);
+    vector<double> times(numPatterns);
+    for(auto& time : times) {
+        time = lookupTime(random);
+    }
+    vector<pair<int, int>> contactLinks;
+    vector<int> shownLinks;
+    int lookup = 0;
+    report(fmt::format("contact lookup {0}x{1} links", numBodies, numLinksPerBody), options.numSteps, [&](){
+        eventLog.findContacts(times[lookup++ % numPatterns], contactLinks);
+        shownLinks.clear();
+        for(auto& contactLink : contactLinks) {
+            shownLinks.push_back(contactLink.first * numLinksPerBody + contactLink.second);
+        }
+        materialSwitcher.show(shownLinks);
+    });
+}
+
+
+void benchmarkMarkers(const Options& options, const int& numCameras, const int& numMarkers, mt19937& random)
+{
+    // the cameras look at the origin from around it, and the detection
+    // takes the focal length as the depth of the view, so that a part of
+    // the markers is in the view of each
+    uniform_real_distribution<double> angle(-PI, PI);
+    uniform_real_distribution<double> position(-2.0, 2.0);
+    MarkerDetector detector;
+    vector<LinkPtr> links;
+    vector<MotionCaptureCameraPtr> cameras;
+    for(int i = 0; i < numCameras; ++i) {
+        Link* link = new Link;
+        double yaw = angle(random);
+        link->T().linear() = rotFromRpy(0.0, 0.0, yaw + PI);
+        link->T().translation() = Vector3(5.0 * cos(yaw), 5.0 * sin(yaw), 1.0);
+        links.push_back(link);
+        MotionCaptureCamera* camera = new MotionCaptureCamera;
+        camera->setLink(link);
+        camera->setFocalLength(10.0);
+        camera->setFieldOfView(60);
+        camera->setAspectRatio(Vector2(4.0, 3.0));
+        cameras.push_back(camera);
+        detector.addCamera(camera);
+    }
+    vector<ref_ptr<PassiveMarker>> markers;
+    for(int i = 0; i < numMarkers; ++i) {
+        Link* link = new Link;
+        link->T().translation() << position(random), position(random), position(random);
+        links.push_back(link);
+        PassiveMarker* marker = new PassiveMarker;
+        marker->setLink(link);
+        markers.push_back(marker);
+        detector.addMarker(marker);
+    }
+
+    report(fmt::format("markers {0} cameras, {1} markers", numCameras, numMarkers), options.numSteps, [&](){
+        detector.detect();
+    });
+}
+
+
+void benchmarkImage(const Options& options, mt19937& random)
+{
+    Image source;
+    source.setSize(options.imageWidth, options.imageHeight, 3);
+    unsigned char* pixels = source.pixels();
+    for(int i = 0; i < options.imageWidth * options.imageHeight * 3; ++i) {
+        pixels[i] = random() & 0xff;
+    }
+
+    ImageGenerator generator;
+    Image image;
+    int numSteps = std::max(1, options.numSteps / 100);
+    string size = fmt::format("{0}x{1}", options.imageWidth, options.imageHeight);
+    vector<pair<string, function<void()>>> filters = {
+        { "gaussian noise", [&](){ generator.gaussianNoise(image, 0.1); } },
+        { "salt and pepper", [&](){ generator.saltPepperNoise(image, 0.01, 0.01); } },
+        { "hsv", [&](){ generator.hsv(image, 0.1, 0.1, 0.1); } },
+        { "rgb", [&](){ generator.rgb(image, 0.1, 0.1, 0.1); } },
+        { "barrel distortion", [&](){ generator.barrelDistortion(image, 1.0, 1.0); } },
+        { "gaussian filter", [&](){ generator.gaussianFilter(image, 3); } },
+        { "median filter", [&](){ generator.medianFilter(image, 3); } },
+        { "sobel filter", [&](){ generator.sobelFilter(image); } },
+        { "prewitt filter", [&](){ generator.prewittFilter(image); } }
+    };
+    for(auto& filter : filters) {
+        report("image " + size + " " + filter.first, numSteps, [&](){
+            image = source;
+            filter.second();
+        });
+    }
+}
+
+
+bool parse(int argc, char** argv, Options& options)
+{
+    for(int i = 1; i < argc; ++i) {
+        string option = argv[i];
+        if(i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if(option == "--bodies") {
+            options.numBodies = std::max(1, atoi(value));
+        } else if(option == "--links") {
+            options.numLinks = std::max(1, atoi(value));
+        } else if(option == "--areas") {
+            options.numAreas = std::max(1, atoi(value));
+        } else if(option == "--steps") {
+            options.numSteps = std::max(1, atoi(value));
+        } else if(option == "--threads") {
+            options.maxThreads = std::max(1, atoi(value));
+        } else if(option == "--cameras") {
+            options.numCameras = std::max(1, atoi(value));
+        } else if(option == "--markers") {
+            options.numMarkers = std::max(1, atoi(value));
+        } else if(option == "--sweep") {
+            options.isSweepEnabled = atoi(value) != 0;
+        } else if(option == "--image") {
+            if(sscanf(value, "%dx%d", &options.imageWidth, &options.imageHeight) != 2) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+
+void* operator new(size_t size)
+{
+    ++numAllocations;
+    if(void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if(!parse(argc, argv, options)) {
+        fprintf(stderr, "usage: %s [--bodies N] [--links M] [--areas K] [--threads T] [--cameras C] [--markers P]\n"
+                "       [--steps S] [--sweep 0|1] [--image WxH]\n",
+                argv[0]);
+        return 1;
+    }
+
+    mt19937 random(1);
+    sweep(options, { options.numBodies, options.numLinks, options.maxThreads }, [&](const vector<int>& sizes){
+        benchmarkFDLinks(options, sizes[0], sizes[1], sizes[2], random);
+    });
+    sweep(options, { options.numBodies, options.numLinks, options.numAreas }, [&](const vector<int>& sizes){
+        benchmarkAreaGrid(options, sizes[0], sizes[1], sizes[2], random);
+    });
+    sweep(options, { options.numBodies, options.numLinks, options.numAreas }, [&](const vector<int>& sizes){
+        benchmarkBuoyancy(options, sizes[0], sizes[1], sizes[2], random);
+    });
+    sweep(options, { options.numBodies, options.numLinks }, [&](const vector<int>& sizes){
+        benchmarkDevices(options, sizes[0], sizes[1], random);
+    });
+    for(bool isSlotPerBody : { true, false }) {
+        sweep(options, { options.numBodies, options.numAreas }, [&](const vector<int>& sizes){
+            benchmarkAreaTracker(options, sizes[0], sizes[1], isSlotPerBody, random);
+        });
+    }
+    benchmarkFlowField(options, random);
+    sweep(options, { options.numBodies, options.numLinks }, [&](const vector<int>& sizes){
+        benchmarkContacts(options, sizes[0], sizes[1], random);
+    });
+    sweep(options, { options.numCameras, options.numMarkers }, [&](const vector<int>& sizes){
+        benchmarkMarkers(options, sizes[0], sizes[1], random);
+    });
+    benchmarkImage(options, random);
+    return 0;
+}
@@ -0,0 +1,300 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "CollisionStateRecorder.h"
+#include <cnoid/Body>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+const int FramesPerChunk = 4096;
+
+struct Chunk
+{
+    vector<uint64_t> words;  // empty after the chunk has been spilled
+    long offset;             // of the compressed chunk in the file
+    size_t size;
+};
+
+}
+
+
+namespace cnoid {
+
+class CollisionStateRecorderImpl
+{
+public:
+    CollisionStateRecorderImpl(CollisionStateRecorder* self);
+    ~CollisionStateRecorderImpl();
+
+    CollisionStateRecorder* self;
+    int numParts;
+    int numWords;
+    double frameRate;
+    int maxChunksInMemory;
+    vector<uint64_t> frameWords;
+    mutable mutex chunkMutex;
+    vector<Chunk> chunks;
+    int numFrames;
+    size_t numSpilledChunks;
+    FILE* file;
+
+    void clear();
+    void spill(Chunk& chunk);
+    bool load(const Chunk& chunk, vector<uint64_t>& out_words) const;
+    bool copyChunk(const int& index, vector<uint64_t>& out_words) const;
+};
+
+}
+
+
+CollisionStateRecorder::CollisionStateRecorder()
+{
+    impl = new CollisionStateRecorderImpl(this);
+}
+
+
+CollisionStateRecorderImpl::CollisionStateRecorderImpl(CollisionStateRecorder* self)
+    : self(self)
+{
+    numParts = 0;
+    numWords = 0;
+    frameRate = 0.0;
+    maxChunksInMemory = 0;
+    file = nullptr;
+    clear();
+}
+
+
+CollisionStateRecorder::~CollisionStateRecorder()
+{
+    delete impl;
+}
+
+
+CollisionStateRecorderImpl::~CollisionStateRecorderImpl()
+{
+    clear();
+}
+
+
+void CollisionStateRecorderImpl::clear()
+{
+    frameWords.clear();
+    chunks.clear();
+    numFrames = 0;
+    numSpilledChunks = 0;
+    if(file) {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+
+void CollisionStateRecorder::initialize(const int& numParts, const double& frameRate, const int& maxChunksInMemory)
+{
+    lock_guard<mutex> lock(impl->chunkMutex);
+    impl->clear();
+    impl->numParts = numParts;
+    impl->numWords = (numParts + 63) / 64;
+    impl->frameRate = frameRate;
+    impl->maxChunksInMemory = std::max(0, maxChunksInMemory);
+    impl->frameWords.resize(impl->numWords, 0);
+}
+
+
+int CollisionStateRecorder::numParts() const
+{
+    return impl->numParts;
+}
+
+
+double CollisionStateRecorder::frameRate() const
+{
+    return impl->frameRate;
+}
+
+
+int CollisionStateRecorder::numFrames() const
+{
+    lock_guard<mutex> lock(impl->chunkMutex);
+    return impl->numFrames;
+}
+
+
+int CollisionStateRecorder::maxChunksInMemory() const
+{
+    return impl->maxChunksInMemory;
+}
+
+
+void CollisionStateRecorder::beginFrame()
+{
+    std::fill(impl->frameWords.begin(), impl->frameWords.end(), 0);
+}
+
+
+void CollisionStateRecorder::setState(const int& part, const bool& on)
+{
+    uint64_t bit = (uint64_t)1 << (part % 64);
+    if(on) {
+        impl->frameWords[part / 64] |= bit;
+    } else {
+        impl->frameWords[part / 64] &= ~bit;
+    }
+}
+
+
+void CollisionStateRecorder::endFrame()
+{
+    lock_guard<mutex> lock(impl->chunkMutex);
+    int index = impl->numFrames % FramesPerChunk;
+    if(index == 0) {
+        // the older chunks are full when a new one is started
+        if(impl->maxChunksInMemory > 0) {
+            while(impl->chunks.size() - impl->numSpilledChunks >= (size_t)impl->maxChunksInMemory) {
+                impl->spill(impl->chunks[impl->numSpilledChunks++]);
+            }
+        }
+        impl->chunks.emplace_back();
+        impl->chunks.back().words.resize((size_t)FramesPerChunk * impl->numWords);
+        impl->chunks.back().offset = 0;
+        impl->chunks.back().size = 0;
+    }
+    std::copy(impl->frameWords.begin(), impl->frameWords.end(),
+              impl->chunks.back().words.begin() + (size_t)index * impl->numWords);
+    ++impl->numFrames;
+}
+
+
+void CollisionStateRecorder::record(Body* body)
+{
+    beginFrame();
+    for(int i = 0; i < body->numLinks(); ++i) {
+        setState(i, !body->link(i)->contactPoints().empty());
+    }
+    endFrame();
+}
+
+
+void CollisionStateRecorderImpl::spill(Chunk& chunk)
+{
+    if(!file) {
+        file = tmpfile();
+        if(!file) {
+            // the chunk is kept in memory
+            return;
+        }
+    }
+
+    // a run of unchanged words is followed by a run of changes, which are
+    // stored as the bits that flipped since the frame before
+    vector<uint32_t> data;
+    const vector<uint64_t>& words = chunk.words;
+    size_t n = words.size();
+    auto delta = [&](const size_t& i){ return i < (size_t)numWords ? words[i] : words[i] ^ words[i - numWords]; };
+    size_t i = 0;
+    while(i < n) {
+        size_t begin = i;
+        while(i < n && delta(i) == 0) {
+            ++i;
+        }
+        data.push_back((uint32_t)(i - begin));
+        begin = i;
+        while(i < n && delta(i) != 0) {
+            ++i;
+        }
+        data.push_back((uint32_t)(i - begin));
+        for(size_t j = begin; j < i; ++j) {
+            uint64_t d = delta(j);
+            data.push_back((uint32_t)d);
+            data.push_back((uint32_t)(d >> 32));
+        }
+    }
+
+    fseek(file, 0, SEEK_END);
+    long offset = ftell(file);
+    if(fwrite(data.data(), sizeof(uint32_t), data.size(), file) != data.size()) {
+        return;
+    }
+    chunk.offset = offset;
+    chunk.size = data.size();
+    vector<uint64_t>().swap(chunk.words);
+}
+
+
+bool CollisionStateRecorderImpl::load(const Chunk& chunk, vector<uint64_t>& out_words) const
+{
+    vector<uint32_t> data(chunk.size);
+    if(fseek(file, chunk.offset, SEEK_SET) != 0
+       || fread(data.data(), sizeof(uint32_t), data.size(), file) != data.size()) {
+        return false;
+    }
+
+    size_t n = (size_t)FramesPerChunk * numWords;
+    out_words.assign(n, 0);
+    size_t i = 0;
+    size_t k = 0;
+    while(k + 1 < data.size() && i < n) {
+        i += data[k++];
+        size_t numChanges = data[k++];
+        for(size_t j = 0; j < numChanges && k + 1 < data.size() && i < n; ++j, k += 2) {
+            out_words[i++] = (uint64_t)data[k] | ((uint64_t)data[k + 1] << 32);
+        }
+    }
+    for(i = numWords; i < n; ++i) {
+        out_words[i] ^= out_words[i - numWords];
+    }
+    return true;
+}
+
+
+bool CollisionStateRecorderImpl::copyChunk(const int& index, vector<uint64_t>& out_words) const
+{
+    lock_guard<mutex> lock(chunkMutex);
+    const Chunk& chunk = chunks[index];
+    if(!chunk.words.empty()) {
+        out_words = chunk.words;
+        return true;
+    }
+    return load(chunk, out_words);
+}
+
+
+bool CollisionStateRecorder::expand(MultiValueSeq& seq) const
+{
+    if(seq.numParts() != impl->numParts) {
+        return false;
+    }
+    int numFrames = this->numFrames();
+    int begin = std::min(seq.numFrames(), numFrames);
+    seq.setFrameRate(impl->frameRate);
+    seq.setNumFrames(numFrames);
+
+    // the chunk is copied so that the recording goes on while it is expanded
+    vector<uint64_t> words;
+    for(int index = begin / FramesPerChunk; index * FramesPerChunk < numFrames; ++index) {
+        if(!impl->copyChunk(index, words)) {
+            return false;
+        }
+        int first = std::max(begin, index * FramesPerChunk);
+        int last = std::min(numFrames, (index + 1) * FramesPerChunk);
+        for(int frame = first; frame < last; ++frame) {
+            MultiValueSeq::Frame p = seq.frame(frame);
+            const uint64_t* bits = &words[(size_t)(frame % FramesPerChunk) * impl->numWords];
+            for(int part = 0; part < impl->numParts; ++part) {
+                p[part] = (bits[part / 64] >> (part % 64)) & 1 ? 1.0 : 0.0;
+            }
+        }
+    }
+    return true;
+}
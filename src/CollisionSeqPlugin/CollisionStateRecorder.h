@@ -0,0 +1,58 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_COLLISIONSEQPLUGIN_COLLISIONSTATERECORDER_H
+#define CNOID_COLLISIONSEQPLUGIN_COLLISIONSTATERECORDER_H
+
+#include <cnoid/MultiValueSeq>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class Body;
+class CollisionStateRecorderImpl;
+
+/**
+   Recorder of the contact states of the links of a body, one bit for a
+   link in a frame. The frames are packed into chunks of a fixed number of
+   frames, so the recording grows by a chunk at a time. When more chunks
+   than maxChunksInMemory() are recorded, the older chunks are compressed
+   into a temporary file, each frame as the difference from the frame
+   before it with the runs of unchanged words counted.
+
+   The frames are written by one thread with beginFrame(), setState() and
+   endFrame(), or with record() for the contact states of a body, and
+   another thread may read them with expand() at the same time.
+*/
+class CNOID_EXPORT CollisionStateRecorder
+{
+public:
+    CollisionStateRecorder();
+    virtual ~CollisionStateRecorder();
+
+    void initialize(const int& numParts, const double& frameRate, const int& maxChunksInMemory = 0);
+    int numParts() const;
+    double frameRate() const;
+    int numFrames() const;
+    // 0 keeps every chunk in memory
+    int maxChunksInMemory() const;
+
+    void beginFrame();
+    void setState(const int& part, const bool& on);
+    void endFrame();
+    void record(Body* body);
+
+    // appends the frames that seq does not have yet
+    bool expand(MultiValueSeq& seq) const;
+
+private:
+    CollisionStateRecorder(const CollisionStateRecorder& org);
+    CollisionStateRecorderImpl* impl;
+    friend class CollisionStateRecorderImpl;
+};
+
+}
+
+#endif // CNOID_COLLISIONSEQPLUGIN_COLLISIONSTATERECORDER_H
@@ -5,16 +5,33 @@
 
 #include "CollisionVisualizerItem.h"
 #include <cnoid/Archive>
+#include <cnoid/CollisionLinkPair>
+#include <cnoid/ConnectionSet>
 #include <cnoid/ItemManager>
+#include <cnoid/LazyCaller>
+#include <cnoid/LogFile>
 #include <cnoid/MeshExtractor>
+#include <cnoid/MessageView>
 #include <cnoid/MultiValueSeq>
 #include <cnoid/MultiValueSeqItem>
 #include <cnoid/PutPropertyFunction>
 #include <cnoid/SceneDrawables>
 #include <cnoid/SimulatorItem>
+#include <cnoid/StageProfiler>
 #include <cnoid/StringUtil>
+#include <cnoid/TimeBar>
 #include <cnoid/Tokenizer>
 #include <cnoid/ValueTreeUtil>
+#include <fmt/format.h>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "CollisionStateRecorder.h"
+#include "ContactEventLog.h"
+#include "ContactMaterialSwitcher.h"
+#include "ContactPointLog.h"
 #include "gettext.h"
 
 using namespace cnoid;
@@ -22,9 +39,39 @@ using namespace std;
 
 namespace {
 
-string getKey(Link* link)
+enum ProfileStage { MaterialStage, RecordingStage, EventStage, ContactPointStage, HeatmapStage };
+
+// the contact points of a link counted in the cells of a grid fixed to
+// the link, with the shapes to be colored by the counts
+struct LinkHeatmap
 {
-    return link->body()->name() + " " + link->name();
+    Link* link;
+    vector<SgShapePtr> shapes;
+    vector<Affine3, Eigen::aligned_allocator<Affine3>> transforms;
+    vector<SgColorArrayPtr> orgColors;
+    vector<SgIndexArray> orgColorIndices;
+    double cellSize;
+    unordered_map<int64_t, int> counts;
+};
+
+int64_t cellKey(const int64_t& x, const int64_t& y, const int64_t& z)
+{
+    // 21 bits for each axis, which is 20 km in 1 cm cells
+    return ((x & 0x1fffff) << 42) | ((y & 0x1fffff) << 21) | (z & 0x1fffff);
+}
+
+Vector3f heatColor(const double& ratio)
+{
+    // from blue for no contact to red for the most contacts
+    double hue = (1.0 - std::max(0.0, std::min(1.0, ratio))) * 4.0;
+    int i = std::min(3, (int)hue);
+    float f = hue - i;
+    switch(i) {
+    case 3:  return Vector3f(0.0f, 1.0f - f, 1.0f);
+    case 2:  return Vector3f(0.0f, 1.0f, f);
+    case 1:  return Vector3f(1.0f - f, 1.0f, 0.0f);
+    default: return Vector3f(1.0f, f, 0.0f);
+    }
 }
 
 string getNameListString(const vector<string>& names)
@@ -64,25 +111,67 @@ class CollisionVisualizerItemImpl
 public:
     CollisionVisualizerItemImpl(CollisionVisualizerItem* self);
     CollisionVisualizerItemImpl(CollisionVisualizerItem* self, const CollisionVisualizerItemImpl& org);
+    ~CollisionVisualizerItemImpl();
     CollisionVisualizerItem* self;
 
     vector<Body*> bodies;
     MeshExtractor extractor;
-    map<string, SgMaterial*> materialMap;
+    ContactMaterialSwitcher materialSwitcher;
+    // the index in materialSwitcher of every link of bodies[], or -1
+    vector<vector<int>> switcherIndices;
+    ScopedConnection timeConnection;
+    vector<pair<int, int>> contactLinks;
+    vector<int> shownLinks;
     vector<string> bodyNames;
     string bodyNameListString;
     SimulatorItem* simulatorItem_;
 
     vector<MultiValueSeqItem*> collisionStaSeqItems;
+    // the states are packed into bits and expanded into the sequence of
+    // an item when the item is selected
+    vector<shared_ptr<CollisionStateRecorder>> recorders;
+    ScopedConnectionSet seqConnections;
+    int maxChunksInMemory;
     bool isCollisionStatesRecordingEnabled;
     int frame;
+    StageProfiler profiler;
+
+    // the contact state and the partner of every link of bodies[]
+    ContactEventLog eventLog;
+    bool isEventLogEnabled;
+    string eventLogFile;
+    vector<vector<bool>> linkContacts;
+    vector<vector<int>> linkPartners;
+    unordered_map<Body*, int> partnerIds;
+
+    ContactPointLog pointLog;
+    bool isPointLogEnabled;
+    string pointLogFile;
+
+    // the heatmaps are kept after the simulation, and the scene is only
+    // changed when they are shown
+    vector<LinkHeatmap> heatmaps;
+    mutex heatmapMutex;
+    bool isHeatmapEnabled;
+    double heatmapCellSize;
+    bool isHeatmapShown;
 
     void onPostDynamicsFunction();
     void initializeBody(Body* body);
-    void extractMaterial(Link* link);
-    void injectMaterial(Link* link);
-    void initilizeMaterial(Body* body);
-    void finalizeMaterial(Link* link);
+    void expandStates(const int& index);
+    void initializeEventLog();
+    void updateEventLog();
+    int findPartner(Link* link, const CollisionLinkPairListPtr& collisions) const;
+    void finalizeEventLog();
+    void initializePointLog();
+    void updatePointLog();
+    void finalizePointLog();
+    void addHeatmap(Link* link);
+    void updateHeatmaps();
+    bool showHeatmaps(const bool& on);
+    void initializeMaterial(Body* body);
+    void finalizeMaterial();
+    void showContacts(const double& time);
 
     bool initializeSimulation(SimulatorItem* simulatorItem);
     void finalizeSimulation();
@@ -104,12 +193,26 @@ CollisionVisualizerItemImpl::CollisionVisualizerItemImpl(CollisionVisualizerItem
     : self(self)
 {
     bodies.clear();
-    materialMap.clear();
     bodyNameListString.clear();
     simulatorItem_ = nullptr;
     collisionStaSeqItems.clear();
+    recorders.clear();
+    maxChunksInMemory = 0;
     isCollisionStatesRecordingEnabled = false;
     frame = 0;
+    isEventLogEnabled = false;
+    eventLogFile.clear();
+    profiler.setTextDomain(CNOID_GETTEXT_DOMAIN_NAME);
+    profiler.addStage(N_("materials"));
+    profiler.addStage(N_("recording"));
+    isPointLogEnabled = false;
+    pointLogFile.clear();
+    isHeatmapEnabled = false;
+    heatmapCellSize = 0.02;
+    isHeatmapShown = false;
+    profiler.addStage(N_("events"));
+    profiler.addStage(N_("contact points"));
+    profiler.addStage(N_("heatmap"));
 }
 
 
@@ -125,13 +228,22 @@ CollisionVisualizerItemImpl::CollisionVisualizerItemImpl(CollisionVisualizerItem
     : self(self),
       bodyNames(org.bodyNames)
 {
-    bodies = org.bodies;
-    materialMap = org.materialMap;
+    bodies.clear();
     bodyNameListString = getNameListString(bodyNames);
     simulatorItem_ = org.simulatorItem_;
     collisionStaSeqItems = org.collisionStaSeqItems;
+    recorders.clear();
+    maxChunksInMemory = org.maxChunksInMemory;
     isCollisionStatesRecordingEnabled = org.isCollisionStatesRecordingEnabled;
     frame = org.frame;
+    profiler = org.profiler;
+    isEventLogEnabled = org.isEventLogEnabled;
+    eventLogFile = org.eventLogFile;
+    isPointLogEnabled = org.isPointLogEnabled;
+    pointLogFile = org.pointLogFile;
+    isHeatmapEnabled = org.isHeatmapEnabled;
+    heatmapCellSize = org.heatmapCellSize;
+    isHeatmapShown = false;
 }
 
 
@@ -141,6 +253,13 @@ CollisionVisualizerItem::~CollisionVisualizerItem()
 }
 
 
+CollisionVisualizerItemImpl::~CollisionVisualizerItemImpl()
+{
+    timeConnection.disconnect();
+    materialSwitcher.clear();
+}
+
+
 void CollisionVisualizerItem::initializeClass(ExtensionManager* ext)
 {
     ext->itemManager().registerClass<CollisionVisualizerItem>(N_("CollisionVisualizerItem"));
@@ -158,9 +277,18 @@ bool CollisionVisualizerItem::initializeSimulation(SimulatorItem* simulatorItem)
 bool CollisionVisualizerItemImpl::initializeSimulation(SimulatorItem* simulatorItem)
 {
     bodies.clear();
-    materialMap.clear();
+    timeConnection.disconnect();
+    materialSwitcher.clear();
+    switcherIndices.clear();
+    showHeatmaps(false);
+    {
+        lock_guard<mutex> lock(heatmapMutex);
+        heatmaps.clear();
+    }
     simulatorItem_ = simulatorItem;
     collisionStaSeqItems.clear();
+    recorders.clear();
+    seqConnections.disconnect();
     frame = 0;
 
     vector<SimulationBody*> simulationBodies = simulatorItem->simulationBodies();
@@ -171,17 +299,25 @@ bool CollisionVisualizerItemImpl::initializeSimulation(SimulatorItem* simulatorI
                 for(auto& bodyName : bodyNames) {
                     if(body->name() == bodyName) {
                         initializeBody(body);
-                        initilizeMaterial(body);
+                        initializeMaterial(body);
                     }
                 }
             } else {
                 initializeBody(body);
-                initilizeMaterial(body);
+                initializeMaterial(body);
             }
         }
     }
 
+    if(isEventLogEnabled) {
+        initializeEventLog();
+    }
+    if(isPointLogEnabled) {
+        initializePointLog();
+    }
+
     if(bodies.size()) {
+        profiler.initialize(self, simulatorItem->worldTimeStep());
         simulatorItem->addPostDynamicsFunction([&](){ onPostDynamicsFunction(); });
     }
     return true;
@@ -196,53 +332,235 @@ void CollisionVisualizerItem::finalizeSimulation()
 
 void CollisionVisualizerItemImpl::finalizeSimulation()
 {
-    for(size_t i = 0; i < bodies.size(); ++i) {
-        Body* body = bodies[i];
-        for(int j = 0; j < body->numLinks(); ++j) {
-            Link* link = body->link(j);
-            link->mergeSensingMode(Link::LinkContactState);
-            SgGroup* group = link->collisionShape();
-            if(!extractor.extract(group, [&, link](){ finalizeMaterial(link); })) {
+    finalizeEventLog();
+    finalizeMaterial();
+    finalizePointLog();
 
-            }
+    for(size_t i = 0; i < collisionStaSeqItems.size(); ++i) {
+        if(collisionStaSeqItems[i]->isSelected()) {
+            expandStates(i);
         }
     }
+
+    profiler.finalize();
 }
 
 
 void CollisionVisualizerItemImpl::onPostDynamicsFunction()
 {
+    // only the links whose contact state has flipped are updated, and the
+    // scene is changed on the main thread
+    StageProfiler::ScopedTimer materialTimer(profiler, MaterialStage);
+    if(materialSwitcher.update()) {
+        // the item is kept until the call has run
+        CollisionVisualizerItemPtr item = self;
+        callLater([this, item](){ materialSwitcher.apply(); });
+    }
+    materialTimer.stop();
+
+    StageProfiler::ScopedTimer recordingTimer(profiler, RecordingStage);
+    if(isCollisionStatesRecordingEnabled) {
+        for(size_t i = 0; i < bodies.size(); ++i) {
+            recorders[i]->record(bodies[i]);
+        }
+    }
+
+    frame++;
+    recordingTimer.stop();
+
+    if(isEventLogEnabled) {
+        StageProfiler::ScopedTimer eventTimer(profiler, EventStage);
+        updateEventLog();
+    }
+    if(pointLog.isRunning()) {
+        StageProfiler::ScopedTimer pointTimer(profiler, ContactPointStage);
+        updatePointLog();
+    }
+    if(isHeatmapEnabled) {
+        StageProfiler::ScopedTimer heatmapTimer(profiler, HeatmapStage);
+        updateHeatmaps();
+    }
+    profiler.endFrame();
+}
+
+
+void CollisionVisualizerItemImpl::initializeEventLog()
+{
+    eventLog.clear();
+    linkContacts.clear();
+    linkPartners.clear();
+    partnerIds.clear();
+
+    // any body of the simulation may be touched
+    vector<SimulationBody*> simulationBodies = simulatorItem_->simulationBodies();
+    for(size_t i = 0; i < simulationBodies.size(); ++i) {
+        Body* body = simulationBodies[i]->body();
+        partnerIds[body] = eventLog.addPartner(body->name());
+    }
+    for(auto& body : bodies) {
+        vector<string> linkNames;
+        for(int j = 0; j < body->numLinks(); ++j) {
+            linkNames.push_back(body->link(j)->name());
+        }
+        eventLog.addBody(body->name(), linkNames);
+        linkContacts.push_back(vector<bool>(body->numLinks(), false));
+        linkPartners.push_back(vector<int>(body->numLinks(), -1));
+    }
+    eventLog.start();
+}
+
+
+void CollisionVisualizerItemImpl::updateEventLog()
+{
+    double time = simulatorItem_->currentTime();
+    // the collisions are only fetched in a step in which a contact starts
+    CollisionLinkPairListPtr collisions;
+    bool isCollisionFetched = false;
     for(size_t i = 0; i < bodies.size(); ++i) {
         Body* body = bodies[i];
         for(int j = 0; j < body->numLinks(); ++j) {
             Link* link = body->link(j);
-            SgGroup* group = link->collisionShape();
-            if(!extractor.extract(group, [&, link](){ injectMaterial(link); })) {
-
+            bool isInContact = !link->contactPoints().empty();
+            if(isInContact == linkContacts[i][j]) {
+                continue;
             }
+            linkContacts[i][j] = isInContact;
+            if(isInContact) {
+                if(!isCollisionFetched) {
+                    collisions = simulatorItem_->getCollisions();
+                    isCollisionFetched = true;
+                }
+                linkPartners[i][j] = findPartner(link, collisions);
+            }
+            ContactEventLog::Event event;
+            event.time = time;
+            event.body = i;
+            event.link = j;
+            event.type = isInContact ? ContactEventLog::Enter : ContactEventLog::Exit;
+            event.partner = linkPartners[i][j];
+            eventLog.push(event);
+        }
+    }
+}
+
+
+int CollisionVisualizerItemImpl::findPartner(Link* link, const CollisionLinkPairListPtr& collisions) const
+{
+    if(!collisions) {
+        return -1;
+    }
+    for(auto& collision : *collisions) {
+        Body* partner = nullptr;
+        if(collision->link[0] == link) {
+            partner = collision->body[1];
+        } else if(collision->link[1] == link) {
+            partner = collision->body[0];
+        } else {
+            continue;
+        }
+        auto it = partnerIds.find(partner);
+        if(it != partnerIds.end()) {
+            return it->second;
+        }
+    }
+    return -1;
+}
+
 
-//            auto& contacts = link->contactPoints();
-//            if(!contacts.empty()) {
-//                for(auto& contact : contacts) {
-//                    const Vector3& p = contact.position();
-//                }
-//            }
+void CollisionVisualizerItemImpl::initializePointLog()
+{
+    pointLog.clear();
+    if(pointLogFile.empty()) {
+        MessageView::instance()->putln(
+            _("The contact points are not logged, as no contact point file is given."),
+            MessageView::Warning);
+        return;
+    }
+    for(auto& body : bodies) {
+        vector<string> linkNames;
+        for(int j = 0; j < body->numLinks(); ++j) {
+            linkNames.push_back(body->link(j)->name());
         }
+        pointLog.addBody(body->name(), linkNames);
+    }
+    if(!pointLog.start(pointLogFile)) {
+        MessageView::instance()->putln(
+            fmt::format(_("The contact points are not logged: {0}"), pointLog.errorMessage()),
+            MessageView::Warning);
+    }
+}
+
 
-        if(isCollisionStatesRecordingEnabled) {
-            Body* body = bodies[i];
-            std::shared_ptr<MultiValueSeq> collisionStaSeq = collisionStaSeqItems[i]->seq();
-            collisionStaSeq->setNumFrames(frame + 1);
-            MultiValueSeq::Frame p = collisionStaSeq->frame(frame);
-            for(int j = 0; j < body->numLinks(); ++j) {
-                Link* link = body->link(j);
-                auto& contacts = link->contactPoints();
-                p[j] = !contacts.empty() ? 1 : 0;
+void CollisionVisualizerItemImpl::updatePointLog()
+{
+    // the points are copied into the blocks of the log as they are
+    pointLog.beginFrame(simulatorItem_->currentTime());
+    for(size_t i = 0; i < bodies.size(); ++i) {
+        Body* body = bodies[i];
+        for(int j = 0; j < body->numLinks(); ++j) {
+            Link* link = body->link(j);
+            for(auto& contact : link->contactPoints()) {
+                ContactPointLog::Point* point = pointLog.addPoint();
+                point->body = i;
+                point->link = j;
+                const Vector3& position = contact.position();
+                const Vector3& normal = contact.normal();
+                const Vector3& force = contact.force();
+                for(int k = 0; k < 3; ++k) {
+                    point->position[k] = position[k];
+                    point->normal[k] = normal[k];
+                    point->force[k] = force[k];
+                }
+                point->depth = contact.depth();
             }
         }
     }
+    pointLog.endFrame();
+}
 
-    frame++;
+
+void CollisionVisualizerItemImpl::finalizePointLog()
+{
+    if(!pointLog.isRunning()) {
+        return;
+    }
+    if(!pointLog.stop()) {
+        MessageView::instance()->putln(
+            fmt::format(_("The contact points cannot be written to \"{0}\": {1}"),
+                        pointLogFile, pointLog.errorMessage()),
+            MessageView::Warning);
+        return;
+    }
+    MessageView::instance()->putln(
+        fmt::format(_("{0} contact points of {1} frames are written to \"{2}\"."),
+                    pointLog.numPoints(), pointLog.numFrames(), pointLogFile));
+}
+
+
+void CollisionVisualizerItemImpl::finalizeEventLog()
+{
+    if(!isEventLogEnabled) {
+        return;
+    }
+    // the writer moves the events left in the ring before it stops
+    eventLog.stop();
+    MessageView::instance()->putln(
+        fmt::format(_("{0} contact events are logged."), eventLog.numEvents()));
+    if(eventLog.numDroppedEvents() > 0) {
+        MessageView::instance()->putln(
+            fmt::format(_("{0} contact events are missing from the log."), eventLog.numDroppedEvents()),
+            MessageView::Warning);
+    }
+
+    if(!eventLogFile.empty()) {
+        bool result = isCsvFile(eventLogFile) ? eventLog.writeCsv(eventLogFile)
+            : eventLog.writeBinary(eventLogFile);
+        if(!result) {
+            MessageView::instance()->putln(
+                fmt::format(_("The contact events cannot be written to \"{0}\"."), eventLogFile),
+                MessageView::Warning);
+        }
+    }
 }
 
 
@@ -262,6 +580,14 @@ void CollisionVisualizerItemImpl::initializeBody(Body* body)
         collisionStaSeq->setDimension(0, numParts, 1);
         collisionStaSeq->setFrameRate(1.0 / simulatorItem_->worldTimeStep());
 
+        auto recorder = make_shared<CollisionStateRecorder>();
+        recorder->initialize(numParts, 1.0 / simulatorItem_->worldTimeStep(), maxChunksInMemory);
+        recorders.push_back(recorder);
+        int index = collisionStaSeqItems.size() - 1;
+        seqConnections.add(
+            collisionStaSeqItem->sigSelectionChanged().connect(
+                [this, index](bool on){ if(on) { expandStates(index); } }));
+
         for(int j = 0; j < body->numLinks(); ++j) {
             Link* link = body->link(j);
             link->mergeSensingMode(Link::LinkContactState);
@@ -270,65 +596,167 @@ void CollisionVisualizerItemImpl::initializeBody(Body* body)
 }
 
 
-void CollisionVisualizerItemImpl::extractMaterial(Link* link)
+void CollisionVisualizerItemImpl::expandStates(const int& index)
 {
-    SgShape* shape = extractor.currentShape();
-    string key = getKey(link);
-    SgMaterial* material = shape->material();
-    if(!material) {
-        material = new SgMaterial();
-    } else {
-        material = new SgMaterial(*shape->material());
+    MultiValueSeqItem* collisionStaSeqItem = collisionStaSeqItems[index];
+    int numFrames = collisionStaSeqItem->seq()->numFrames();
+    if(recorders[index]->expand(*collisionStaSeqItem->seq())
+       && collisionStaSeqItem->seq()->numFrames() != numFrames) {
+        collisionStaSeqItem->notifyUpdate();
     }
-    materialMap[key] = material;
 }
 
 
-void CollisionVisualizerItemImpl::injectMaterial(Link* link)
+void CollisionVisualizerItemImpl::initializeMaterial(Body* body)
 {
-    SgShape* shape = extractor.currentShape();
-    string key = getKey(link);
-    SgMaterial* material = materialMap[key];
-    if(!material) {
-        material = new SgMaterial();
-    } else {
-        material = new SgMaterial(*materialMap[key]);
+    vector<int> indices(body->numLinks(), -1);
+    for(int j = 0; j < body->numLinks(); ++j) {
+        Link* link = body->link(j);
+        link->mergeSensingMode(Link::LinkContactState);
+        if(!materialSwitcher.addLink(link)) {
+            continue;
+        }
+        indices[j] = materialSwitcher.numLinks() - 1;
+        if(isHeatmapEnabled) {
+            addHeatmap(link);
+        }
     }
+    switcherIndices.push_back(indices);
+    bodies.push_back(body);
+}
 
-    auto& contacts = link->contactPoints();
-    if(!contacts.empty()) {
-        Vector3f color(1.0, 0.0, 0.0);
-        material->setDiffuseColor(color);
+
+void CollisionVisualizerItemImpl::addHeatmap(Link* link)
+{
+    LinkHeatmap heatmap;
+    heatmap.link = link;
+    heatmap.cellSize = heatmapCellSize;
+    if(extractor.extract(link->collisionShape(), [&](){
+            SgShape* shape = extractor.currentShape();
+            SgMesh* mesh = shape->mesh();
+            if(mesh && mesh->hasVertices()) {
+                heatmap.shapes.push_back(shape);
+                heatmap.transforms.push_back(extractor.currentTransform());
+                heatmap.orgColors.push_back(mesh->colors());
+                heatmap.orgColorIndices.push_back(mesh->colorIndices());
+            }
+        })) {
+        lock_guard<mutex> lock(heatmapMutex);
+        heatmaps.push_back(heatmap);
     }
-    shape->setMaterial(material);
 }
 
 
-void CollisionVisualizerItemImpl::initilizeMaterial(Body* body)
+void CollisionVisualizerItemImpl::updateHeatmaps()
 {
-    for(int j = 0; j < body->numLinks(); ++j) {
-        Link* link = body->link(j);
-        link->mergeSensingMode(Link::LinkContactState);
-        SgGroup* group = link->collisionShape();
-        if(!extractor.extract(group, [&, link](){ extractMaterial(link); })) {
+    lock_guard<mutex> lock(heatmapMutex);
+    for(auto& heatmap : heatmaps) {
+        auto& contacts = heatmap.link->contactPoints();
+        if(contacts.empty()) {
+            continue;
+        }
+        const Isometry3 T = heatmap.link->T().inverse();
+        for(auto& contact : contacts) {
+            const Vector3 p = T * contact.position();
+            ++heatmap.counts[cellKey(floor(p.x() / heatmap.cellSize),
+                                     floor(p.y() / heatmap.cellSize),
+                                     floor(p.z() / heatmap.cellSize))];
+        }
+    }
+}
+
 
+bool CollisionVisualizerItemImpl::showHeatmaps(const bool& on)
+{
+    lock_guard<mutex> lock(heatmapMutex);
+    if(!on) {
+        if(isHeatmapShown) {
+            for(auto& heatmap : heatmaps) {
+                for(size_t i = 0; i < heatmap.shapes.size(); ++i) {
+                    SgMesh* mesh = heatmap.shapes[i]->mesh();
+                    mesh->setColors(heatmap.orgColors[i]);
+                    mesh->colorIndices() = heatmap.orgColorIndices[i];
+                    mesh->notifyUpdate();
+                }
+            }
         }
+        isHeatmapShown = false;
+        return true;
     }
-    bodies.push_back(body);
+
+    // the counts are scaled logarithmically, so that the cells touched a
+    // few times stand out from the ones never touched
+    int maxCount = 0;
+    for(auto& heatmap : heatmaps) {
+        for(auto& count : heatmap.counts) {
+            maxCount = std::max(maxCount, count.second);
+        }
+    }
+    double scale = maxCount > 0 ? 1.0 / log1p((double)maxCount) : 0.0;
+
+    for(auto& heatmap : heatmaps) {
+        for(size_t i = 0; i < heatmap.shapes.size(); ++i) {
+            SgMesh* mesh = heatmap.shapes[i]->mesh();
+            const SgVertexArray& vertices = *mesh->vertices();
+            SgColorArray* colors = new SgColorArray(vertices.size());
+            for(size_t j = 0; j < vertices.size(); ++j) {
+                // a vertex takes the most contacts of the cells around it
+                const Vector3 p = heatmap.transforms[i] * vertices[j].cast<double>();
+                int64_t x = floor(p.x() / heatmap.cellSize);
+                int64_t y = floor(p.y() / heatmap.cellSize);
+                int64_t z = floor(p.z() / heatmap.cellSize);
+                int count = 0;
+                for(int dx = -1; dx <= 1; ++dx) {
+                    for(int dy = -1; dy <= 1; ++dy) {
+                        for(int dz = -1; dz <= 1; ++dz) {
+                            auto it = heatmap.counts.find(cellKey(x + dx, y + dy, z + dz));
+                            if(it != heatmap.counts.end()) {
+                                count = std::max(count, it->second);
+                            }
+                        }
+                    }
+                }
+                (*colors)[j] = heatColor(log1p((double)count) * scale);
+            }
+            mesh->setColors(colors);
+            mesh->colorIndices().clear();
+            mesh->notifyUpdate();
+        }
+    }
+    isHeatmapShown = true;
+    return true;
+}
+
+
+void CollisionVisualizerItemImpl::finalizeMaterial()
+{
+    if(!isEventLogEnabled) {
+        materialSwitcher.clear();
+        return;
+    }
+
+    // the links in contact at the time of the time bar are shown from the
+    // event log until the next simulation starts
+    materialSwitcher.apply();
+    TimeBar* timeBar = TimeBar::instance();
+    timeConnection.reset(
+        timeBar->sigTimeChanged().connect(
+            [&](double time){ showContacts(time); return true; }));
+    showContacts(timeBar->time());
 }
 
 
-void CollisionVisualizerItemImpl::finalizeMaterial(Link* link)
+void CollisionVisualizerItemImpl::showContacts(const double& time)
 {
-    SgShape* shape = extractor.currentShape();
-    string key = getKey(link);
-    SgMaterial* material = materialMap[key];
-    if(!material) {
-        material = new SgMaterial();
-    } else {
-        material = new SgMaterial(*materialMap[key]);
+    eventLog.findContacts(time, contactLinks);
+    shownLinks.clear();
+    for(auto& contactLink : contactLinks) {
+        int index = switcherIndices[contactLink.first][contactLink.second];
+        if(index >= 0) {
+            shownLinks.push_back(index);
+        }
     }
-    shape->setMaterial(material);
+    materialSwitcher.show(shownLinks);
 }
 
 
@@ -350,6 +778,16 @@ void CollisionVisualizerItemImpl::doPutProperties(PutPropertyFunction& putProper
     putProperty(_("Target bodies"), bodyNameListString,
                 [&](const string& names){ return updateNames(names, bodyNameListString, bodyNames); });
     putProperty(_("Record collision states"), isCollisionStatesRecordingEnabled, changeProperty(isCollisionStatesRecordingEnabled));
+    putProperty.min(0)(_("Chunks in memory"), maxChunksInMemory, changeProperty(maxChunksInMemory));
+    putProperty(_("Log contact events"), isEventLogEnabled, changeProperty(isEventLogEnabled));
+    putProperty(_("Contact event file"), eventLogFile, changeProperty(eventLogFile));
+    putProperty(_("Log contact points"), isPointLogEnabled, changeProperty(isPointLogEnabled));
+    putProperty(_("Contact point file"), pointLogFile, changeProperty(pointLogFile));
+    putProperty(_("Contact heatmap"), isHeatmapEnabled, changeProperty(isHeatmapEnabled));
+    putProperty.min(0.001)(_("Heatmap cell size"), heatmapCellSize, changeProperty(heatmapCellSize));
+    putProperty(_("Show heatmap"), isHeatmapShown,
+                [&](bool on){ return showHeatmaps(on); });
+    profiler.putProperties(putProperty);
 }
 
 
@@ -364,6 +802,18 @@ bool CollisionVisualizerItemImpl::store(Archive& archive)
 {
     writeElements(archive, "targetBodies", bodyNames, true);
     archive.write("recordCollisionStates", isCollisionStatesRecordingEnabled);
+    archive.write("chunksInMemory", maxChunksInMemory);
+    archive.write("logContactEvents", isEventLogEnabled);
+    if(!eventLogFile.empty()) {
+        archive.writeRelocatablePath("contactEventFile", eventLogFile);
+    }
+    archive.write("logContactPoints", isPointLogEnabled);
+    if(!pointLogFile.empty()) {
+        archive.writeRelocatablePath("contactPointFile", pointLogFile);
+    }
+    archive.write("contactHeatmap", isHeatmapEnabled);
+    archive.write("heatmapCellSize", heatmapCellSize);
+    profiler.store(archive);
     return true;
 }
 
@@ -380,5 +830,13 @@ bool CollisionVisualizerItemImpl::restore(const Archive& archive)
     readElements(archive, "targetBodies", bodyNames);
     bodyNameListString = getNameListString(bodyNames);
     archive.read("recordCollisionStates", isCollisionStatesRecordingEnabled);
+    archive.read("chunksInMemory", maxChunksInMemory);
+    archive.read("logContactEvents", isEventLogEnabled);
+    archive.readRelocatablePath("contactEventFile", eventLogFile);
+    archive.read("logContactPoints", isPointLogEnabled);
+    archive.readRelocatablePath("contactPointFile", pointLogFile);
+    archive.read("contactHeatmap", isHeatmapEnabled);
+    archive.read("heatmapCellSize", heatmapCellSize);
+    profiler.restore(archive);
     return true;
 }
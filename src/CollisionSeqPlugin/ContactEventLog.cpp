@@ -0,0 +1,306 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "ContactEventLog.h"
+#include <cnoid/LogFile>
+#include <cnoid/SpscRing>
+#include <fmt/format.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+// the writer drains the ring every DrainPeriod
+const int RingSize = 65536;
+const int DrainPeriod = 10;
+const uint32_t BinaryVersion = 1;
+
+}
+
+
+namespace cnoid {
+
+class ContactEventLogImpl
+{
+public:
+    ContactEventLogImpl(ContactEventLog* self);
+    ~ContactEventLogImpl();
+
+    ContactEventLog* self;
+    vector<string> bodyNames;
+    vector<vector<string>> linkNames;
+    vector<int> linkOffsets;
+    int numLinks;
+    vector<string> partnerNames;
+
+    SpscRing<ContactEventLog::Event> ring;
+
+    thread writer;
+    mutex writerMutex;
+    condition_variable writerCondition;
+    bool isWriterStopping;
+
+    // the events and the links in contact before every
+    // CheckpointInterval-th event
+    mutable mutex eventMutex;
+    vector<ContactEventLog::Event> events;
+    vector<vector<bool>> checkpoints;
+    vector<bool> contacts;
+
+    void runWriter();
+    void drain(vector<ContactEventLog::Event>& buffer);
+};
+
+}
+
+
+ContactEventLog::ContactEventLog()
+{
+    impl = new ContactEventLogImpl(this);
+}
+
+
+ContactEventLogImpl::ContactEventLogImpl(ContactEventLog* self)
+    : self(self),
+      ring(RingSize)
+{
+    numLinks = 0;
+    isWriterStopping = false;
+}
+
+
+ContactEventLog::~ContactEventLog()
+{
+    delete impl;
+}
+
+
+ContactEventLogImpl::~ContactEventLogImpl()
+{
+    self->stop();
+}
+
+
+void ContactEventLog::clear()
+{
+    stop();
+    impl->bodyNames.clear();
+    impl->linkNames.clear();
+    impl->linkOffsets.clear();
+    impl->numLinks = 0;
+    impl->partnerNames.clear();
+    impl->ring.clear();
+    lock_guard<mutex> lock(impl->eventMutex);
+    impl->events.clear();
+    impl->checkpoints.clear();
+    impl->contacts.clear();
+}
+
+
+int ContactEventLog::addBody(const string& name, const vector<string>& linkNames)
+{
+    impl->bodyNames.push_back(name);
+    impl->linkNames.push_back(linkNames);
+    impl->linkOffsets.push_back(impl->numLinks);
+    impl->numLinks += linkNames.size();
+    return impl->bodyNames.size() - 1;
+}
+
+
+int ContactEventLog::addPartner(const string& name)
+{
+    impl->partnerNames.push_back(name);
+    return impl->partnerNames.size() - 1;
+}
+
+
+int ContactEventLog::numBodies() const
+{
+    return impl->bodyNames.size();
+}
+
+
+int ContactEventLog::numPartners() const
+{
+    return impl->partnerNames.size();
+}
+
+
+void ContactEventLog::start()
+{
+    stop();
+    {
+        lock_guard<mutex> lock(impl->eventMutex);
+        impl->contacts.assign(impl->numLinks, false);
+    }
+    impl->isWriterStopping = false;
+    impl->writer = thread([&](){ impl->runWriter(); });
+}
+
+
+void ContactEventLog::stop()
+{
+    if(impl->writer.joinable()) {
+        {
+            lock_guard<mutex> lock(impl->writerMutex);
+            impl->isWriterStopping = true;
+        }
+        impl->writerCondition.notify_all();
+        impl->writer.join();
+    }
+}
+
+
+bool ContactEventLog::push(const Event& event)
+{
+    return impl->ring.push(event);
+}
+
+
+void ContactEventLogImpl::runWriter()
+{
+    vector<ContactEventLog::Event> buffer;
+    buffer.reserve(RingSize);
+    unique_lock<mutex> lock(writerMutex);
+    while(!isWriterStopping) {
+        lock.unlock();
+        drain(buffer);
+        lock.lock();
+        writerCondition.wait_for(lock, chrono::milliseconds(DrainPeriod),
+                                 [&](){ return isWriterStopping; });
+    }
+    lock.unlock();
+    // the events pushed before stop() are kept
+    drain(buffer);
+}
+
+
+void ContactEventLogImpl::drain(vector<ContactEventLog::Event>& buffer)
+{
+    buffer.clear();
+    if(ring.popAll(buffer) == 0) {
+        return;
+    }
+
+    lock_guard<mutex> lock(eventMutex);
+    for(auto& event : buffer) {
+        if(events.size() % ContactEventLog::CheckpointInterval == 0) {
+            checkpoints.push_back(contacts);
+        }
+        int index = linkOffsets[event.body] + event.link;
+        contacts[index] = (event.type == ContactEventLog::Enter);
+        events.push_back(event);
+    }
+}
+
+
+int ContactEventLog::numEvents() const
+{
+    lock_guard<mutex> lock(impl->eventMutex);
+    return impl->events.size();
+}
+
+
+ContactEventLog::Event ContactEventLog::event(const int& index) const
+{
+    lock_guard<mutex> lock(impl->eventMutex);
+    return impl->events[index];
+}
+
+
+int ContactEventLog::numDroppedEvents() const
+{
+    return impl->ring.numDroppedItems();
+}
+
+
+void ContactEventLog::findContacts(const double& time, vector<pair<int, int>>& out_links) const
+{
+    out_links.clear();
+    lock_guard<mutex> lock(impl->eventMutex);
+    auto& events = impl->events;
+    if(impl->checkpoints.empty()) {
+        return;
+    }
+
+    // the events up to the time, replayed from the checkpoint before them
+    size_t end = upper_bound(events.begin(), events.end(), time,
+                             [](const double& t, const Event& e){ return t < e.time; }) - events.begin();
+    size_t checkpoint = std::min(end / CheckpointInterval, impl->checkpoints.size() - 1);
+    vector<bool> contacts = impl->checkpoints[checkpoint];
+    for(size_t i = checkpoint * CheckpointInterval; i < end; ++i) {
+        const Event& event = events[i];
+        contacts[impl->linkOffsets[event.body] + event.link] = (event.type == Enter);
+    }
+
+    for(size_t body = 0; body < impl->bodyNames.size(); ++body) {
+        for(size_t link = 0; link < impl->linkNames[body].size(); ++link) {
+            if(contacts[impl->linkOffsets[body] + link]) {
+                out_links.push_back(make_pair((int)body, (int)link));
+            }
+        }
+    }
+}
+
+
+bool ContactEventLog::writeCsv(const string& filename) const
+{
+    ofstream file(filename);
+    if(!file) {
+        return false;
+    }
+    file << "time_s,body,link,event,partner\n";
+    lock_guard<mutex> lock(impl->eventMutex);
+    for(auto& event : impl->events) {
+        const string& partner = event.partner >= 0 ? impl->partnerNames[event.partner] : string();
+        file << fmt::format("{0:.6f},{1},{2},{3},{4}\n",
+                            event.time, impl->bodyNames[event.body],
+                            impl->linkNames[event.body][event.link],
+                            event.type == Enter ? "enter" : "exit", partner);
+    }
+    return (bool)file;
+}
+
+
+bool ContactEventLog::writeBinary(const string& filename) const
+{
+    LittleEndianWriter writer(filename);
+    if(!writer.isGood()) {
+        return false;
+    }
+    writer.writeBytes("CTEV", 4);
+    writer.write(BinaryVersion);
+    writer.write((uint32_t)impl->bodyNames.size());
+    for(size_t i = 0; i < impl->bodyNames.size(); ++i) {
+        writer.writeName(impl->bodyNames[i]);
+        writer.write((uint32_t)impl->linkNames[i].size());
+        for(auto& linkName : impl->linkNames[i]) {
+            writer.writeName(linkName);
+        }
+    }
+    writer.write((uint32_t)impl->partnerNames.size());
+    for(auto& partnerName : impl->partnerNames) {
+        writer.writeName(partnerName);
+    }
+
+    lock_guard<mutex> lock(impl->eventMutex);
+    writer.write((uint32_t)impl->events.size());
+    for(auto& event : impl->events) {
+        writer.write(event.time);
+        writer.write((int32_t)event.body);
+        writer.write((int32_t)event.link);
+        writer.write((int32_t)event.type);
+        writer.write((int32_t)event.partner);
+    }
+    return writer.isGood();
+}
@@ -0,0 +1,85 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_COLLISIONSEQPLUGIN_CONTACTEVENTLOG_H
+#define CNOID_COLLISIONSEQPLUGIN_CONTACTEVENTLOG_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class ContactEventLogImpl;
+
+/**
+   Log of the times at which the links start and stop touching. The
+   thread that runs the simulation pushes an event into a ring buffer
+   without locking, and a writer thread started by start() moves the
+   events into the log. An event that finds the ring full is dropped and
+   counted.
+
+   The events are in the order of their times, and the writer keeps the
+   links in contact at every CheckpointInterval-th event, so
+   findContacts() searches the time and replays at most
+   CheckpointInterval events.
+
+   The binary file written by writeBinary() starts with "CTEV" and the
+   version as a 32-bit integer, followed by the names: the number of
+   bodies, and for each body its name and the number and names of its
+   links, then the number and names of the partners. A name is a 32-bit
+   length and its characters. Then come the number of events and 24
+   bytes for each event: the time as a double, and the body, the link,
+   the type and the partner as 32-bit integers, all little-endian.
+*/
+class CNOID_EXPORT ContactEventLog
+{
+public:
+    static const int CheckpointInterval = 256;
+
+    enum EventType { Enter, Exit };
+
+    struct Event
+    {
+        double time;
+        int body;
+        int link;
+        int type;
+        int partner;  // -1 if the partner is not known
+    };
+
+    ContactEventLog();
+    virtual ~ContactEventLog();
+
+    void clear();
+    int addBody(const std::string& name, const std::vector<std::string>& linkNames);
+    int addPartner(const std::string& name);
+    int numBodies() const;
+    int numPartners() const;
+
+    void start();
+    void stop();
+    bool push(const Event& event);
+
+    int numEvents() const;
+    Event event(const int& index) const;
+    int numDroppedEvents() const;
+
+    // the pairs of a body and a link in contact at the time
+    void findContacts(const double& time, std::vector<std::pair<int, int>>& out_links) const;
+
+    bool writeCsv(const std::string& filename) const;
+    bool writeBinary(const std::string& filename) const;
+
+private:
+    ContactEventLog(const ContactEventLog& org);
+    ContactEventLogImpl* impl;
+    friend class ContactEventLogImpl;
+};
+
+}
+
+#endif // CNOID_COLLISIONSEQPLUGIN_CONTACTEVENTLOG_H
@@ -0,0 +1,202 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "ContactMaterialSwitcher.h"
+#include <cnoid/MeshExtractor>
+#include <cnoid/SceneDrawables>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+// the shapes of a link with the materials made for them when the link
+// is added
+struct LinkShapes
+{
+    Link* link;
+    vector<SgShapePtr> shapes;
+    vector<SgMaterialPtr> orgMaterials;
+    vector<SgMaterialPtr> normalMaterials;
+    vector<SgMaterialPtr> contactMaterials;
+    bool isInContact;         // on the simulation thread
+    bool isContactRequested;  // guarded by mutex
+    bool isPending;           // guarded by mutex
+    bool isContactShown;      // on the main thread
+};
+
+}
+
+
+namespace cnoid {
+
+class ContactMaterialSwitcherImpl
+{
+public:
+    ContactMaterialSwitcherImpl(ContactMaterialSwitcher* self);
+
+    ContactMaterialSwitcher* self;
+    MeshExtractor extractor;
+    vector<LinkShapes> linkShapes;
+
+    // the links whose contact state has flipped since the materials were
+    // last swapped on the main thread
+    std::mutex mutex;
+    vector<int> flippedLinks;
+    vector<pair<int, bool>> requests;
+    vector<bool> shownLinks;
+
+    void setMaterials(LinkShapes& linkShape, const vector<SgMaterialPtr>& materials);
+};
+
+}
+
+
+ContactMaterialSwitcher::ContactMaterialSwitcher()
+{
+    impl = new ContactMaterialSwitcherImpl(this);
+}
+
+
+ContactMaterialSwitcherImpl::ContactMaterialSwitcherImpl(ContactMaterialSwitcher* self)
+    : self(self)
+{
+
+}
+
+
+ContactMaterialSwitcher::~ContactMaterialSwitcher()
+{
+    delete impl;
+}
+
+
+void ContactMaterialSwitcher::clear()
+{
+    {
+        lock_guard<std::mutex> lock(impl->mutex);
+        impl->flippedLinks.clear();
+    }
+    for(auto& linkShape : impl->linkShapes) {
+        impl->setMaterials(linkShape, linkShape.orgMaterials);
+    }
+    impl->linkShapes.clear();
+}
+
+
+bool ContactMaterialSwitcher::addLink(Link* link)
+{
+    LinkShapes linkShape;
+    linkShape.link = link;
+    linkShape.isInContact = false;
+    linkShape.isContactRequested = false;
+    linkShape.isPending = false;
+    linkShape.isContactShown = false;
+    if(!impl->extractor.extract(link->collisionShape(), [&](){
+            SgShape* shape = impl->extractor.currentShape();
+            SgMaterial* orgMaterial = shape->material();
+            SgMaterial* normalMaterial = orgMaterial ? new SgMaterial(*orgMaterial) : new SgMaterial();
+            SgMaterial* contactMaterial = new SgMaterial(*normalMaterial);
+            contactMaterial->setDiffuseColor(Vector3f(1.0, 0.0, 0.0));
+            linkShape.shapes.push_back(shape);
+            linkShape.orgMaterials.push_back(orgMaterial);
+            linkShape.normalMaterials.push_back(normalMaterial);
+            linkShape.contactMaterials.push_back(contactMaterial);
+            shape->setMaterial(normalMaterial);
+        })) {
+        return false;
+    }
+    impl->linkShapes.push_back(linkShape);
+    return true;
+}
+
+
+int ContactMaterialSwitcher::numLinks() const
+{
+    return impl->linkShapes.size();
+}
+
+
+bool ContactMaterialSwitcher::update()
+{
+    // the lock is only taken when a link has flipped
+    unique_lock<std::mutex> lock(impl->mutex, defer_lock);
+    bool isPosted = true;
+    for(size_t i = 0; i < impl->linkShapes.size(); ++i) {
+        LinkShapes& linkShape = impl->linkShapes[i];
+        bool isInContact = !linkShape.link->contactPoints().empty();
+        if(isInContact == linkShape.isInContact) {
+            continue;
+        }
+        linkShape.isInContact = isInContact;
+        if(!lock.owns_lock()) {
+            lock.lock();
+            isPosted = !impl->flippedLinks.empty();
+        }
+        linkShape.isContactRequested = isInContact;
+        if(!linkShape.isPending) {
+            linkShape.isPending = true;
+            impl->flippedLinks.push_back(i);
+        }
+    }
+    return !isPosted;
+}
+
+
+void ContactMaterialSwitcher::apply()
+{
+    impl->requests.clear();
+    {
+        lock_guard<std::mutex> lock(impl->mutex);
+        for(auto& index : impl->flippedLinks) {
+            LinkShapes& linkShape = impl->linkShapes[index];
+            linkShape.isPending = false;
+            impl->requests.push_back(make_pair(index, linkShape.isContactRequested));
+        }
+        impl->flippedLinks.clear();
+    }
+
+    // a link that has flipped back since update() is left as it is
+    for(auto& request : impl->requests) {
+        LinkShapes& linkShape = impl->linkShapes[request.first];
+        bool isInContact = request.second;
+        if(isInContact == linkShape.isContactShown) {
+            continue;
+        }
+        linkShape.isContactShown = isInContact;
+        impl->setMaterials(linkShape, isInContact ? linkShape.contactMaterials : linkShape.normalMaterials);
+    }
+}
+
+
+void ContactMaterialSwitcher::show(const vector<int>& indices)
+{
+    impl->shownLinks.assign(impl->linkShapes.size(), false);
+    for(auto& index : indices) {
+        if(index >= 0 && index < (int)impl->linkShapes.size()) {
+            impl->shownLinks[index] = true;
+        }
+    }
+    for(size_t i = 0; i < impl->linkShapes.size(); ++i) {
+        LinkShapes& linkShape = impl->linkShapes[i];
+        bool isInContact = impl->shownLinks[i];
+        if(isInContact == linkShape.isContactShown) {
+            continue;
+        }
+        linkShape.isContactShown = isInContact;
+        impl->setMaterials(linkShape, isInContact ? linkShape.contactMaterials : linkShape.normalMaterials);
+    }
+}
+
+
+void ContactMaterialSwitcherImpl::setMaterials(LinkShapes& linkShape, const vector<SgMaterialPtr>& materials)
+{
+    for(size_t i = 0; i < linkShape.shapes.size(); ++i) {
+        linkShape.shapes[i]->setMaterial(materials[i]);
+        linkShape.shapes[i]->notifyUpdate();
+    }
+}
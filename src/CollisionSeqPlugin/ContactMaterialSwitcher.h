@@ -0,0 +1,55 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_COLLISIONSEQPLUGIN_CONTACTMATERIALSWITCHER_H
+#define CNOID_COLLISIONSEQPLUGIN_CONTACTMATERIALSWITCHER_H
+
+#include <cnoid/Link>
+#include <vector>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class ContactMaterialSwitcherImpl;
+
+/**
+   Materials of the collision shapes of the links, swapped to red while a
+   link is in contact. The materials are made when a link is added, so a
+   step only swaps them.
+
+   update() is called on the thread that runs the simulation and finds
+   the links whose contact state has flipped; it returns true when the
+   first of them has been found since the last apply(), which is then to
+   be called on the main thread to swap their materials. A link that has
+   flipped back before apply() is left as it is. clear() puts back the
+   original materials.
+
+   After the simulation, show() swaps the materials on the main thread
+   for the links of the given indices, numbered in the order they were
+   added, and puts back the normal materials of the others.
+*/
+class CNOID_EXPORT ContactMaterialSwitcher
+{
+public:
+    ContactMaterialSwitcher();
+    virtual ~ContactMaterialSwitcher();
+
+    void clear();
+    bool addLink(Link* link);
+    int numLinks() const;
+
+    bool update();
+    void apply();
+    void show(const std::vector<int>& indices);
+
+private:
+    ContactMaterialSwitcher(const ContactMaterialSwitcher& org);
+    ContactMaterialSwitcherImpl* impl;
+    friend class ContactMaterialSwitcherImpl;
+};
+
+}
+
+#endif // CNOID_COLLISIONSEQPLUGIN_CONTACTMATERIALSWITCHER_H
@@ -0,0 +1,423 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "ContactPointLog.h"
+#include <cnoid/LogFile>
+#include <fmt/format.h>
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+// blocks given to the simulation thread before the writer has returned one
+const int NumInitialBlocks = 4;
+const int FramesPerBlock = 4096;
+const uint32_t FileVersion = 1;
+
+struct FrameEntry
+{
+    double time;
+    uint32_t numPoints;
+};
+
+struct IndexEntry
+{
+    double time;
+    uint64_t offset;
+    uint32_t numPoints;
+    uint32_t padding;
+};
+
+static_assert(sizeof(ContactPointLog::Point) == 48, "a point is written as 48 bytes");
+static_assert(sizeof(IndexEntry) == 24, "an index entry is written as 24 bytes");
+
+void writePoints(LittleEndianWriter& writer, const ContactPointLog::Point* points, const size_t& size)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for(size_t i = 0; i < size; ++i) {
+        const ContactPointLog::Point& point = points[i];
+        writer.write(point.body);
+        writer.write(point.link);
+        for(int k = 0; k < 3; ++k) {
+            writer.write(point.position[k]);
+        }
+        for(int k = 0; k < 3; ++k) {
+            writer.write(point.normal[k]);
+        }
+        for(int k = 0; k < 3; ++k) {
+            writer.write(point.force[k]);
+        }
+        writer.write(point.depth);
+    }
+#else
+    // the points are already little-endian, so a block is written at once
+    writer.writeBytes((const char*)points, size * sizeof(ContactPointLog::Point));
+#endif
+}
+
+struct Block
+{
+    vector<ContactPointLog::Point> points;
+    size_t numPoints;
+    vector<FrameEntry> frames;
+    size_t numFrames;
+};
+
+}
+
+
+namespace cnoid {
+
+class ContactPointLogImpl
+{
+public:
+    ContactPointLogImpl(ContactPointLog* self);
+    ~ContactPointLogImpl();
+
+    ContactPointLog* self;
+    vector<string> bodyNames;
+    vector<vector<string>> linkNames;
+    int pointsPerBlock;
+
+    // the block filled by the simulation thread
+    unique_ptr<Block> block;
+    double frameTime;
+    uint32_t numFramePoints;
+    int64_t numFrames;
+    int64_t numPoints;
+
+    unique_ptr<LittleEndianWriter> file;
+    thread writer;
+    mutex blockMutex;
+    condition_variable blockCondition;
+    deque<unique_ptr<Block>> filledBlocks;
+    vector<unique_ptr<Block>> freeBlocks;
+    bool isWriterStopping;
+    bool isWriteFailed;
+    // written by the writer, which owns the file until it stops
+    vector<IndexEntry> index;
+    uint64_t offset;
+    uint64_t frameOffset;  // of the first point of the next frame
+    string errorMessage;
+
+    unique_ptr<Block> createBlock() const;
+    void handOver();
+    void runWriter();
+    bool writeBlock(Block& block);
+    bool writeHeader();
+    bool writeIndex();
+};
+
+}
+
+
+ContactPointLog::ContactPointLog()
+{
+    impl = new ContactPointLogImpl(this);
+}
+
+
+ContactPointLogImpl::ContactPointLogImpl(ContactPointLog* self)
+    : self(self)
+{
+    pointsPerBlock = 0;
+    frameTime = 0.0;
+    numFramePoints = 0;
+    numFrames = 0;
+    numPoints = 0;
+    isWriterStopping = false;
+    isWriteFailed = false;
+    offset = 0;
+    frameOffset = 0;
+}
+
+
+ContactPointLog::~ContactPointLog()
+{
+    delete impl;
+}
+
+
+ContactPointLogImpl::~ContactPointLogImpl()
+{
+    self->stop();
+}
+
+
+void ContactPointLog::clear()
+{
+    stop();
+    impl->bodyNames.clear();
+    impl->linkNames.clear();
+    impl->numFrames = 0;
+    impl->numPoints = 0;
+    impl->errorMessage.clear();
+}
+
+
+int ContactPointLog::addBody(const string& name, const vector<string>& linkNames)
+{
+    impl->bodyNames.push_back(name);
+    impl->linkNames.push_back(linkNames);
+    return impl->bodyNames.size() - 1;
+}
+
+
+unique_ptr<Block> ContactPointLogImpl::createBlock() const
+{
+    unique_ptr<Block> block(new Block);
+    block->points.resize(pointsPerBlock);
+    block->numPoints = 0;
+    block->frames.resize(FramesPerBlock);
+    block->numFrames = 0;
+    return block;
+}
+
+
+bool ContactPointLog::start(const string& filename, const int& pointsPerBlock)
+{
+    stop();
+    impl->file.reset(new LittleEndianWriter(filename));
+    if(!impl->file->isGood()) {
+        impl->errorMessage = fmt::format(_("\"{0}\" cannot be opened: {1}"), filename, strerror(errno));
+        impl->file.reset();
+        return false;
+    }
+    impl->errorMessage.clear();
+    impl->isWriteFailed = false;
+    if(!impl->writeHeader()) {
+        impl->file.reset();
+        return false;
+    }
+
+    impl->pointsPerBlock = std::max(1, pointsPerBlock);
+    impl->block = impl->createBlock();
+    impl->freeBlocks.clear();
+    for(int i = 1; i < NumInitialBlocks; ++i) {
+        impl->freeBlocks.push_back(impl->createBlock());
+    }
+    impl->filledBlocks.clear();
+    impl->index.clear();
+    impl->numFrames = 0;
+    impl->numPoints = 0;
+    impl->numFramePoints = 0;
+    impl->isWriterStopping = false;
+    impl->writer = thread([&](){ impl->runWriter(); });
+    return true;
+}
+
+
+bool ContactPointLogImpl::writeHeader()
+{
+    uint64_t size = 12;
+    file->writeBytes("CTPT", 4);
+    file->write(FileVersion);
+    file->write((uint32_t)bodyNames.size());
+    for(size_t i = 0; i < bodyNames.size(); ++i) {
+        file->writeName(bodyNames[i]);
+        file->write((uint32_t)linkNames[i].size());
+        size += 8 + bodyNames[i].size();
+        for(auto& linkName : linkNames[i]) {
+            file->writeName(linkName);
+            size += 4 + linkName.size();
+        }
+    }
+    // the points are aligned for a reader that maps the file
+    static const char padding[8] = { 0 };
+    file->writeBytes(padding, (8 - size % 8) % 8);
+    size = (size + 7) / 8 * 8;
+
+    if(!file->isGood()) {
+        errorMessage = fmt::format(_("The contact points cannot be written: {0}"), strerror(errno));
+        return false;
+    }
+    offset = size;
+    frameOffset = offset;
+    return true;
+}
+
+
+bool ContactPointLog::stop()
+{
+    if(!impl->file) {
+        return true;
+    }
+    if(impl->block && (impl->block->numPoints > 0 || impl->block->numFrames > 0)) {
+        impl->handOver();
+    }
+    {
+        lock_guard<mutex> lock(impl->blockMutex);
+        impl->isWriterStopping = true;
+    }
+    impl->blockCondition.notify_all();
+    if(impl->writer.joinable()) {
+        impl->writer.join();
+    }
+
+    bool result = !impl->isWriteFailed && impl->writeIndex();
+    if(!impl->file->close() && result) {
+        impl->errorMessage = fmt::format(_("The contact points cannot be written: {0}"), strerror(errno));
+        result = false;
+    }
+    impl->file.reset();
+    impl->block.reset();
+    impl->freeBlocks.clear();
+    impl->filledBlocks.clear();
+    impl->index.clear();
+    return result;
+}
+
+
+bool ContactPointLog::isRunning() const
+{
+    return impl->file != nullptr;
+}
+
+
+void ContactPointLog::beginFrame(const double& time)
+{
+    impl->frameTime = time;
+    impl->numFramePoints = 0;
+}
+
+
+ContactPointLog::Point* ContactPointLog::addPoint()
+{
+    // the points of a frame may go on in the next block, as the offsets
+    // are counted over the points of every block
+    if(impl->block->numPoints == impl->block->points.size()) {
+        impl->handOver();
+    }
+    ++impl->numFramePoints;
+    ++impl->numPoints;
+    return &impl->block->points[impl->block->numPoints++];
+}
+
+
+void ContactPointLog::endFrame()
+{
+    if(impl->block->numFrames == impl->block->frames.size()) {
+        impl->handOver();
+    }
+    FrameEntry& frame = impl->block->frames[impl->block->numFrames++];
+    frame.time = impl->frameTime;
+    frame.numPoints = impl->numFramePoints;
+    ++impl->numFrames;
+}
+
+
+void ContactPointLogImpl::handOver()
+{
+    {
+        lock_guard<mutex> lock(blockMutex);
+        filledBlocks.push_back(std::move(block));
+        if(!freeBlocks.empty()) {
+            block = std::move(freeBlocks.back());
+            freeBlocks.pop_back();
+        }
+    }
+    blockCondition.notify_all();
+    if(!block) {
+        block = createBlock();
+    }
+}
+
+
+void ContactPointLogImpl::runWriter()
+{
+    while(true) {
+        unique_ptr<Block> filledBlock;
+        {
+            unique_lock<mutex> lock(blockMutex);
+            blockCondition.wait(lock, [&](){ return !filledBlocks.empty() || isWriterStopping; });
+            if(filledBlocks.empty()) {
+                break;
+            }
+            filledBlock = std::move(filledBlocks.front());
+            filledBlocks.pop_front();
+        }
+
+        if(!isWriteFailed && !writeBlock(*filledBlock)) {
+            isWriteFailed = true;
+        }
+        filledBlock->numPoints = 0;
+        filledBlock->numFrames = 0;
+        lock_guard<mutex> lock(blockMutex);
+        freeBlocks.push_back(std::move(filledBlock));
+    }
+}
+
+
+bool ContactPointLogImpl::writeBlock(Block& block)
+{
+    // a frame starts after the points of the frames before it, which may
+    // have been in the blocks before
+    for(size_t i = 0; i < block.numFrames; ++i) {
+        IndexEntry entry;
+        entry.time = block.frames[i].time;
+        entry.offset = frameOffset;
+        entry.numPoints = block.frames[i].numPoints;
+        entry.padding = 0;
+        index.push_back(entry);
+        frameOffset += entry.numPoints * sizeof(ContactPointLog::Point);
+    }
+
+    size_t size = block.numPoints;
+    writePoints(*file, block.points.data(), size);
+    if(!file->isGood()) {
+        errorMessage = fmt::format(_("The contact points cannot be written: {0}"), strerror(errno));
+        return false;
+    }
+    offset += size * sizeof(ContactPointLog::Point);
+    return true;
+}
+
+
+bool ContactPointLogImpl::writeIndex()
+{
+    for(auto& entry : index) {
+        file->write(entry.time);
+        file->write(entry.offset);
+        file->write(entry.numPoints);
+        file->write(entry.padding);
+    }
+    file->write((uint64_t)offset);
+    file->write((uint64_t)index.size());
+    file->writeBytes("CTPI", 4);
+    file->write(FileVersion);
+    if(!file->isGood()) {
+        errorMessage = fmt::format(_("The contact points cannot be written: {0}"), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+
+int64_t ContactPointLog::numFrames() const
+{
+    return impl->numFrames;
+}
+
+
+int64_t ContactPointLog::numPoints() const
+{
+    return impl->numPoints;
+}
+
+
+const string& ContactPointLog::errorMessage() const
+{
+    return impl->errorMessage;
+}
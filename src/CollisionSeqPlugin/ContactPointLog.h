@@ -0,0 +1,76 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_COLLISIONSEQPLUGIN_CONTACTPOINTLOG_H
+#define CNOID_COLLISIONSEQPLUGIN_CONTACTPOINTLOG_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cnoid {
+
+class ContactPointLogImpl;
+
+/**
+   Log of the contact points of the links, streamed to a file. The thread
+   that runs the simulation writes the points of a frame into blocks that
+   are allocated when the log is started, and a writer thread started by
+   start() writes the filled blocks to the file. A block is only allocated
+   during the recording when the writer has not returned any block yet.
+
+   The file starts with "CTPT", the version and the number of bodies as
+   32-bit integers, and for each body its name and the number and names
+   of its links, where a name is a 32-bit length and its characters. The
+   header is padded with zeros to a multiple of 8 bytes, so that the
+   points that follow as Point records are aligned. stop() appends
+   the index of the frames, 24 bytes for each frame: the time as a double,
+   the offset of its first point from the start of the file as a 64-bit
+   integer, and the number of its points as a 32-bit integer followed by
+   4 bytes of padding. The file ends with the offset of the index and the
+   number of frames as 64-bit integers, "CTPI" and the version. All values
+   are little-endian; on a big-endian host the points are swapped value by
+   value as they are written.
+*/
+class ContactPointLog
+{
+public:
+    struct Point
+    {
+        int32_t body;
+        int32_t link;
+        float position[3];
+        float normal[3];
+        float force[3];
+        float depth;
+    };
+
+    ContactPointLog();
+    virtual ~ContactPointLog();
+
+    void clear();
+    int addBody(const std::string& name, const std::vector<std::string>& linkNames);
+
+    bool start(const std::string& filename, const int& pointsPerBlock = 65536);
+    bool stop();
+    bool isRunning() const;
+
+    void beginFrame(const double& time);
+    Point* addPoint();
+    void endFrame();
+
+    int64_t numFrames() const;
+    int64_t numPoints() const;
+    const std::string& errorMessage() const;
+
+private:
+    ContactPointLog(const ContactPointLog& org);
+    ContactPointLogImpl* impl;
+    friend class ContactPointLogImpl;
+};
+
+}
+
+#endif // CNOID_COLLISIONSEQPLUGIN_CONTACTPOINTLOG_H
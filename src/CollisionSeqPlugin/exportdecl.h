@@ -1,31 +1,37 @@
-#ifndef OPERATION_REVIEW_PLUGIN_EXPORTDECL_H_INCLUDED
-# define OPERATION_REVIEW_PLUGIN_EXPORTDECL_H_INCLUDED
+#ifndef CNOID_COLLISIONSEQPLUGIN_EXPORTDECL_H_INCLUDED
+# define CNOID_COLLISIONSEQPLUGIN_EXPORTDECL_H_INCLUDED
 
 # if defined _WIN32 || defined __CYGWIN__
-#  define OPERATION_REVIEW_PLUGIN_DLLIMPORT __declspec(dllimport)
-#  define OPERATION_REVIEW_PLUGIN_DLLEXPORT __declspec(dllexport)
-#  define OPERATION_REVIEW_PLUGIN_DLLLOCAL
+#  define CNOID_COLLISIONSEQPLUGIN_DLLIMPORT __declspec(dllimport)
+#  define CNOID_COLLISIONSEQPLUGIN_DLLEXPORT __declspec(dllexport)
+#  define CNOID_COLLISIONSEQPLUGIN_DLLLOCAL
 # else
 #  if __GNUC__ >= 4
-#   define OPERATION_REVIEW_PLUGIN_DLLIMPORT __attribute__ ((visibility("default")))
-#   define OPERATION_REVIEW_PLUGIN_DLLEXPORT __attribute__ ((visibility("default")))
-#   define OPERATION_REVIEW_PLUGIN_DLLLOCAL  __attribute__ ((visibility("hidden")))
+#   define CNOID_COLLISIONSEQPLUGIN_DLLIMPORT __attribute__ ((visibility("default")))
+#   define CNOID_COLLISIONSEQPLUGIN_DLLEXPORT __attribute__ ((visibility("default")))
+#   define CNOID_COLLISIONSEQPLUGIN_DLLLOCAL  __attribute__ ((visibility("hidden")))
 #  else
-#   define OPERATION_REVIEW_PLUGIN_DLLIMPORT
-#   define OPERATION_REVIEW_PLUGIN_DLLEXPORT
-#   define OPERATION_REVIEW_PLUGIN_DLLLOCAL
+#   define CNOID_COLLISIONSEQPLUGIN_DLLIMPORT
+#   define CNOID_COLLISIONSEQPLUGIN_DLLEXPORT
+#   define CNOID_COLLISIONSEQPLUGIN_DLLLOCAL
 #  endif
 # endif
 
-#ifdef CnoidOperationReviewPlugin_EXPORTS
-#   define OPERATION_REVIEW_PLUGIN_DLLAPI OPERATION_REVIEW_PLUGIN_DLLEXPORT
-#else
-#   define OPERATION_REVIEW_PLUGIN_DLLAPI OPERATION_REVIEW_PLUGIN_DLLIMPORT
-#endif
+# ifdef CNOID_COLLISIONSEQPLUGIN_STATIC
+#  define CNOID_COLLISIONSEQPLUGIN_DLLAPI
+#  define CNOID_COLLISIONSEQPLUGIN_LOCAL
+# else
+#  ifdef CnoidCollisionSeqPlugin_EXPORTS
+#   define CNOID_COLLISIONSEQPLUGIN_DLLAPI CNOID_COLLISIONSEQPLUGIN_DLLEXPORT
+#  else
+#   define CNOID_COLLISIONSEQPLUGIN_DLLAPI CNOID_COLLISIONSEQPLUGIN_DLLIMPORT
+#  endif
+#  define CNOID_COLLISIONSEQPLUGIN_LOCAL CNOID_COLLISIONSEQPLUGIN_DLLLOCAL
+# endif
 
 #endif
 
 #ifdef CNOID_EXPORT
 # undef CNOID_EXPORT
 #endif
-#define CNOID_EXPORT OPERATION_REVIEW_PLUGIN_DLLAPI
+#define CNOID_EXPORT CNOID_COLLISIONSEQPLUGIN_DLLAPI
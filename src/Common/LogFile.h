@@ -0,0 +1,75 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_COMMON_LOG_FILE_H
+#define CNOID_COMMON_LOG_FILE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+
+namespace cnoid {
+
+/**
+   Writer of the binary log files, which store every value little-endian
+   whatever the byte order of the host. A name is written as a 32-bit
+   length followed by its characters.
+*/
+class LittleEndianWriter
+{
+public:
+    explicit LittleEndianWriter(const std::string& filename)
+        : file(filename, std::ios::binary) { }
+
+    bool isGood() const { return (bool)file; }
+
+    // false if the file could not be written
+    bool close()
+    {
+        file.close();
+        return (bool)file;
+    }
+
+    void writeBytes(const char* data, const size_t& size)
+    {
+        file.write(data, size);
+    }
+
+    template<class T>
+    void write(const T& value)
+    {
+        static_assert(std::is_arithmetic<T>::value, "only numbers are written as values");
+        char data[sizeof(T)];
+        memcpy(data, &value, sizeof(T));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        std::reverse(data, data + sizeof(T));
+#endif
+        file.write(data, sizeof(T));
+    }
+
+    void writeName(const std::string& name)
+    {
+        write((uint32_t)name.size());
+        file.write(name.data(), name.size());
+    }
+
+private:
+    std::ofstream file;
+};
+
+// a log is written as CSV for spreadsheets when its file name ends with
+// ".csv", and as a binary file for long runs otherwise
+inline bool isCsvFile(const std::string& filename)
+{
+    size_t dot = filename.rfind('.');
+    return (dot != std::string::npos) && (filename.compare(dot, std::string::npos, ".csv") == 0);
+}
+
+}
+
+#endif // CNOID_COMMON_LOG_FILE_H
@@ -0,0 +1,90 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_COMMON_SPSC_RING_H
+#define CNOID_COMMON_SPSC_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace cnoid {
+
+/**
+   Ring buffer between one thread that pushes items and one that pops
+   them, without locking. push() and popAll() may run at the same time,
+   but neither on two threads at once. An item that finds the ring full
+   is dropped and counted.
+
+   The ring is header-only so that every plugin can use it without
+   linking to another one.
+*/
+template<class T>
+class SpscRing
+{
+public:
+    // the size is rounded up to a power of two
+    explicit SpscRing(const int& size)
+        : head(0),
+          tail(0),
+          numDroppedItems_(0)
+    {
+        uint64_t n = 1;
+        while(n < (uint64_t)size) {
+            n <<= 1;
+        }
+        items.resize(n);
+        mask = n - 1;
+    }
+
+    // neither thread may use the ring while it is cleared
+    void clear()
+    {
+        head = 0;
+        tail = 0;
+        numDroppedItems_ = 0;
+    }
+
+    bool push(const T& item)
+    {
+        uint64_t head = this->head.load(std::memory_order_relaxed);
+        if(head - tail.load(std::memory_order_acquire) > mask) {
+            numDroppedItems_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        items[head & mask] = item;
+        this->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // appends the items in the ring and frees their places
+    int popAll(std::vector<T>& out_items)
+    {
+        uint64_t tail = this->tail.load(std::memory_order_relaxed);
+        uint64_t head = this->head.load(std::memory_order_acquire);
+        int n = head - tail;
+        for(; tail != head; ++tail) {
+            out_items.push_back(items[tail & mask]);
+        }
+        this->tail.store(tail, std::memory_order_release);
+        return n;
+    }
+
+    int numDroppedItems() const { return numDroppedItems_; }
+
+private:
+    SpscRing(const SpscRing& org);
+
+    std::vector<T> items;
+    uint64_t mask;
+    // the writer and the reader of the ring each own a cache line
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    std::atomic<int> numDroppedItems_;
+};
+
+}
+
+#endif // CNOID_COMMON_SPSC_RING_H
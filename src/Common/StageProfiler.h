@@ -0,0 +1,331 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_COMMON_STAGE_PROFILER_H
+#define CNOID_COMMON_STAGE_PROFILER_H
+
+#include <cnoid/Archive>
+#include <cnoid/GettextUtil>
+#include <cnoid/MessageView>
+#include <cnoid/MultiValueSeq>
+#include <cnoid/MultiValueSeqItem>
+#include <cnoid/PutPropertyFunction>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fmt/format.h>
+
+namespace cnoid {
+
+/**
+   Wall clock timing of the stages of a sub-simulator hook.
+
+   A stage is timed with a ScopedTimer on std::chrono::steady_clock,
+   which reads the TSC through the vDSO on Linux, and recorded into a
+   histogram with one bin per power of two nanoseconds. When profiling is
+   disabled a timer costs one branch. endFrame() closes a simulation step
+   and, when a timeline is attached, appends the time of each stage in
+   that step in milliseconds. The timeline grows by TimelineChunkSize
+   frames and is trimmed to the recorded frames by finalize().
+
+   The CSV written by writeCsv() has one row per stage with the count,
+   the total in seconds, the mean, the 50th, 90th and 99th percentiles and
+   the maximum in milliseconds, the mean as a fraction of the world time
+   step, and the counts of the histogram bins, where bin b holds the
+   samples between 2^b and 2^(b+1) nanoseconds. The percentiles are the
+   upper bounds of their bins.
+
+   The profiler is header-only so that every plugin can use it without
+   linking to another one, and its messages are translated in the domain
+   set by setTextDomain(). It is not thread-safe; stages are timed on the
+   simulation thread.
+*/
+class StageProfiler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+    static const int NumBins = 40;
+    static const int TimelineChunkSize = 4096;
+
+    class ScopedTimer
+    {
+    public:
+        ScopedTimer(StageProfiler& profiler, const int& stage)
+            : profiler(profiler), stage(stage), isRunning(profiler.isEnabled_)
+        {
+            if(isRunning) {
+                start = Clock::now();
+            }
+        }
+
+        ~ScopedTimer()
+        {
+            stop();
+        }
+
+        // ends the stage before the end of the scope
+        void stop()
+        {
+            if(isRunning) {
+                profiler.record(stage, Clock::now() - start);
+                isRunning = false;
+            }
+        }
+
+    private:
+        StageProfiler& profiler;
+        int stage;
+        bool isRunning;
+        Clock::time_point start;
+    };
+
+    StageProfiler()
+    {
+        isEnabled_ = false;
+        isTimelineEnabled_ = false;
+        timeStep_ = 0.0;
+        numFrames = 0;
+        textDomain = nullptr;
+    }
+
+    // the gettext domain of the plugin that owns the profiler, in which
+    // the names of the stages are translated as well
+    void setTextDomain(const char* domain) { textDomain = domain; }
+
+    void setEnabled(const bool& on) { isEnabled_ = on; }
+    bool isEnabled() const { return isEnabled_; }
+    void setTimelineEnabled(const bool& on) { isTimelineEnabled_ = on; }
+    bool isTimelineEnabled() const { return isTimelineEnabled_; }
+    void setCsvFile(const std::string& filename) { csvFile_ = filename; }
+    const std::string& csvFile() const { return csvFile_; }
+
+    int addStage(const std::string& name)
+    {
+        stages.push_back(Stage());
+        stages.back().name = name;
+        return stages.size() - 1;
+    }
+
+    int numStages() const { return stages.size(); }
+    const std::string& stageName(const int& stage) const { return stages[stage].name; }
+
+    // resets the statistics and attaches a timeline item to the owner
+    // when the timeline is enabled
+    void initialize(Item* owner, const double& timeStep)
+    {
+        for(auto& stage : stages) {
+            stage.count = 0;
+            stage.total = Clock::duration::zero();
+            stage.max = Clock::duration::zero();
+            stage.frame = Clock::duration::zero();
+            std::fill(stage.bins, stage.bins + NumBins, 0);
+        }
+        timeStep_ = timeStep;
+        timeline.reset();
+        numFrames = 0;
+        if(isEnabled_ && isTimelineEnabled_ && owner) {
+            MultiValueSeqItem* timelineItem = new MultiValueSeqItem;
+            timelineItem->setName("Stage Times - " + owner->name());
+            owner->addSubItem(timelineItem);
+            timeline = timelineItem->seq();
+            int numParts = stages.size();
+            timeline->setSeqContentName("StageTimeSeq");
+            timeline->setNumParts(numParts);
+            timeline->setDimension(0, numParts, 1);
+            if(timeStep > 0.0) {
+                timeline->setFrameRate(1.0 / timeStep);
+            }
+        }
+    }
+
+    void record(const int& stage, const Clock::duration& duration)
+    {
+        Stage& s = stages[stage];
+        ++s.count;
+        s.total += duration;
+        s.frame += duration;
+        s.max = std::max(s.max, duration);
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+        int bin = ns > 0 ? 63 - __builtin_clzll((uint64_t)ns) : 0;
+        ++s.bins[std::min(bin, NumBins - 1)];
+    }
+
+    void endFrame()
+    {
+        if(!isEnabled_) {
+            return;
+        }
+        if(timeline) {
+            if(numFrames >= timeline->numFrames()) {
+                timeline->setNumFrames(numFrames + TimelineChunkSize);
+            }
+            MultiValueSeq::Frame p = timeline->frame(numFrames);
+            for(size_t i = 0; i < stages.size(); ++i) {
+                p[i] = toMilliseconds(stages[i].frame);
+            }
+            ++numFrames;
+        }
+        for(auto& stage : stages) {
+            stage.frame = Clock::duration::zero();
+        }
+    }
+
+    int count(const int& stage) const { return stages[stage].count; }
+
+    double mean(const int& stage) const
+    {
+        const Stage& s = stages[stage];
+        return s.count ? toMilliseconds(s.total) / s.count : 0.0;
+    }
+
+    double max(const int& stage) const { return toMilliseconds(stages[stage].max); }
+
+    double percentile(const int& stage, const double& ratio) const
+    {
+        const Stage& s = stages[stage];
+        int64_t target = (int64_t)std::ceil(ratio * s.count);
+        int64_t sum = 0;
+        for(int b = 0; b < NumBins; ++b) {
+            sum += s.bins[b];
+            if(sum >= target && sum > 0) {
+                return std::min((double)(int64_t(2) << b) / 1.0e6, max(stage));
+            }
+        }
+        return max(stage);
+    }
+
+    std::string summary(const int& stage) const
+    {
+        return fmt::format("{0:.3f} / {1:.3f} / {2:.3f}",
+                           mean(stage), percentile(stage, 0.99), max(stage));
+    }
+
+    // the properties that enable the profiling and name the CSV file,
+    // followed by the statistics of each stage
+    void putProperties(PutPropertyFunction& putProperty)
+    {
+        putProperty(text("Profile stages"), isEnabled_,
+                    [&](bool on){ isEnabled_ = on; return true; });
+        putProperty(text("Profile timeline"), isTimelineEnabled_,
+                    [&](bool on){ isTimelineEnabled_ = on; return true; });
+        putProperty(text("Profile file"), csvFile_,
+                    [&](const std::string& filename){ csvFile_ = filename; return true; });
+        putStageProperties(putProperty);
+    }
+
+    // read-only properties with the statistics of each stage
+    void putStageProperties(PutPropertyFunction& putProperty) const
+    {
+        if(!isEnabled_) {
+            return;
+        }
+        for(size_t i = 0; i < stages.size(); ++i) {
+            putProperty(fmt::format(text("{0} (mean / p99 / max ms)"), text(stages[i].name.c_str())),
+                        summary(i));
+        }
+    }
+
+    bool writeCsv(const std::string& filename) const
+    {
+        std::ofstream file(filename);
+        if(!file) {
+            return false;
+        }
+        file << "stage,count,total_s,mean_ms,p50_ms,p90_ms,p99_ms,max_ms,step_share";
+        for(int b = 0; b < NumBins; ++b) {
+            file << ",bin" << b;
+        }
+        file << "\n";
+        for(size_t i = 0; i < stages.size(); ++i) {
+            const Stage& s = stages[i];
+            double share = timeStep_ > 0.0 ? mean(i) / 1000.0 / timeStep_ : 0.0;
+            file << fmt::format("{0},{1},{2:.6f},{3:.6f},{4:.6f},{5:.6f},{6:.6f},{7:.6f},{8:.6f}",
+                                s.name, s.count, toMilliseconds(s.total) / 1000.0, mean(i),
+                                percentile(i, 0.5), percentile(i, 0.9), percentile(i, 0.99),
+                                max(i), share);
+            for(int b = 0; b < NumBins; ++b) {
+                file << "," << s.bins[b];
+            }
+            file << "\n";
+        }
+        return (bool)file;
+    }
+
+    // trims the timeline and writes the CSV file if one is set, warning
+    // when it cannot be written
+    bool finalize()
+    {
+        if(timeline) {
+            timeline->setNumFrames(numFrames);
+        }
+        if(!isEnabled_ || csvFile_.empty()) {
+            return true;
+        }
+        if(!writeCsv(csvFile_)) {
+            MessageView::instance()->putln(
+                fmt::format(text("Stage times cannot be written to \"{0}\"."), csvFile_),
+                MessageView::Warning);
+            return false;
+        }
+        return true;
+    }
+
+    void store(Archive& archive) const
+    {
+        archive.write("profileStages", isEnabled_);
+        archive.write("profileTimeline", isTimelineEnabled_);
+        if(!csvFile_.empty()) {
+            archive.writeRelocatablePath("profileFile", csvFile_);
+        }
+    }
+
+    void restore(const Archive& archive)
+    {
+        archive.read("profileStages", isEnabled_);
+        archive.read("profileTimeline", isTimelineEnabled_);
+        archive.readRelocatablePath("profileFile", csvFile_);
+    }
+
+private:
+    struct Stage
+    {
+        Stage() : count(0), total(Clock::duration::zero()), max(Clock::duration::zero()),
+                  frame(Clock::duration::zero()), bins{} { }
+        std::string name;
+        int64_t count;
+        Clock::duration total;
+        Clock::duration max;
+        Clock::duration frame;
+        int64_t bins[NumBins];
+    };
+
+    static double toMilliseconds(const Clock::duration& duration)
+    {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    }
+
+    const char* text(const char* msgid) const
+    {
+        return textDomain ? getText(textDomain, msgid) : msgid;
+    }
+
+    std::vector<Stage> stages;
+    bool isEnabled_;
+    bool isTimelineEnabled_;
+    std::string csvFile_;
+    double timeStep_;
+    std::shared_ptr<MultiValueSeq> timeline;
+    int numFrames;
+    const char* textDomain;
+};
+
+}
+
+#endif // CNOID_COMMON_STAGE_PROFILER_H
@@ -0,0 +1,390 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "AreaGrid.h"
+#include <cnoid/EigenUtil>
+#include <cnoid/WorldItem>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#define MAX_CELLS_PER_AXIS 64
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+struct AreaShape
+{
+    AreaItem* item;
+    int type;
+    bool isActive;
+    Vector3 center;
+    Matrix3 Rt;
+    Vector3 minRange;
+    Vector3 maxRange;
+    double radius;
+    double radius2;
+    double halfHeight;
+};
+
+}
+
+
+namespace cnoid {
+
+class AreaGridImpl
+{
+public:
+    AreaGridImpl(AreaGrid* self);
+
+    AreaGrid* self;
+    vector<AreaShape> shapes;
+    Vector3 origin;
+    Vector3 cellSize;
+    int numCells[3];
+    vector<int> cellStart;
+    vector<int> cellAreas;
+
+    void clear();
+    void build();
+    bool contains(const AreaShape& shape, const Vector3& p, const double& margin) const;
+    bool containsSphere(const AreaShape& shape, const Vector3& center, const double& radius) const;
+    bool findCellRange(const Vector3& lower, const Vector3& upper, int lo[3], int hi[3]) const;
+    template<class Function> bool forEachCandidate(const Vector3& center, const double& radius, Function func) const;
+    int cellIndex(const int& ix, const int& iy, const int& iz) const;
+    bool findCell(const Vector3& p, int& ix, int& iy, int& iz) const;
+};
+
+}
+
+
+AreaGrid::AreaGrid()
+{
+    impl = new AreaGridImpl(this);
+}
+
+
+AreaGridImpl::AreaGridImpl(AreaGrid* self)
+    : self(self)
+{
+    clear();
+}
+
+
+AreaGrid::~AreaGrid()
+{
+    delete impl;
+}
+
+
+void AreaGrid::clear()
+{
+    impl->clear();
+}
+
+
+void AreaGridImpl::clear()
+{
+    shapes.clear();
+    origin << 0.0, 0.0, 0.0;
+    cellSize << 1.0, 1.0, 1.0;
+    numCells[0] = numCells[1] = numCells[2] = 0;
+    cellStart.clear();
+    cellAreas.clear();
+}
+
+
+void AreaGrid::addArea(AreaItem* item)
+{
+    AreaShape shape;
+    shape.item = item;
+    impl->shapes.push_back(shape);
+}
+
+
+void AreaGrid::build()
+{
+    impl->build();
+}
+
+
+void AreaGridImpl::build()
+{
+    Vector3 lower = Vector3::Constant(std::numeric_limits<double>::max());
+    Vector3 upper = Vector3::Constant(-std::numeric_limits<double>::max());
+    int numActiveAreas = 0;
+
+    for(auto& shape : shapes) {
+        AreaItem* item = shape.item;
+        shape.type = item->type();
+        shape.isActive = item->findOwnerItem<WorldItem>() != nullptr;
+        shape.center = item->translation();
+        shape.Rt = rotFromRpy(item->rotation() * TO_RADIAN).transpose();
+        shape.radius = item->radius();
+        shape.radius2 = item->radius() * item->radius();
+        shape.halfHeight = item->height() / 2.0;
+
+        Vector3 extent;
+        if(shape.type == AreaItem::BOX) {
+            extent = item->size() / 2.0;
+        } else if(shape.type == AreaItem::CYLINDER) {
+            Vector3 axis = shape.Rt.row(1).transpose();
+            double r = item->radius();
+            for(int i = 0; i < 3; ++i) {
+                double a = std::min(fabs(axis[i]), 1.0);
+                extent[i] = a * shape.halfHeight + r * sqrt(1.0 - a * a);
+            }
+        } else if(shape.type == AreaItem::SPHERE) {
+            extent = Vector3::Constant(item->radius());
+        } else {
+            shape.isActive = false;
+            extent = Vector3::Zero();
+        }
+        shape.minRange = shape.center - extent;
+        shape.maxRange = shape.center + extent;
+
+        if(shape.isActive) {
+            lower = lower.cwiseMin(shape.minRange);
+            upper = upper.cwiseMax(shape.maxRange);
+            ++numActiveAreas;
+        }
+    }
+
+    cellStart.clear();
+    cellAreas.clear();
+    numCells[0] = numCells[1] = numCells[2] = 0;
+    if(!numActiveAreas) {
+        return;
+    }
+
+    // aim at a couple of cells per area and keep the cells roughly cubic
+    Vector3 range = (upper - lower).cwiseMax(Vector3::Constant(1.0e-6));
+    double volume = range[0] * range[1] * range[2];
+    double edge = cbrt(volume / (2.0 * numActiveAreas));
+    for(int i = 0; i < 3; ++i) {
+        int n = (int)ceil(range[i] / edge);
+        numCells[i] = std::max(1, std::min(n, MAX_CELLS_PER_AXIS));
+        cellSize[i] = range[i] / numCells[i];
+    }
+    origin = lower;
+
+    int totalCells = numCells[0] * numCells[1] * numCells[2];
+    vector<vector<int>> cells(totalCells);
+    for(size_t k = 0; k < shapes.size(); ++k) {
+        const AreaShape& shape = shapes[k];
+        if(!shape.isActive) {
+            continue;
+        }
+        int lo[3], hi[3];
+        for(int i = 0; i < 3; ++i) {
+            lo[i] = (int)floor((shape.minRange[i] - origin[i]) / cellSize[i]);
+            hi[i] = (int)floor((shape.maxRange[i] - origin[i]) / cellSize[i]);
+            lo[i] = std::max(0, std::min(lo[i], numCells[i] - 1));
+            hi[i] = std::max(0, std::min(hi[i], numCells[i] - 1));
+        }
+        for(int ix = lo[0]; ix <= hi[0]; ++ix) {
+            for(int iy = lo[1]; iy <= hi[1]; ++iy) {
+                for(int iz = lo[2]; iz <= hi[2]; ++iz) {
+                    cells[cellIndex(ix, iy, iz)].push_back(k);
+                }
+            }
+        }
+    }
+
+    cellStart.resize(totalCells + 1);
+    cellStart[0] = 0;
+    for(int i = 0; i < totalCells; ++i) {
+        cellStart[i + 1] = cellStart[i] + cells[i].size();
+    }
+    cellAreas.reserve(cellStart[totalCells]);
+    for(auto& cell : cells) {
+        cellAreas.insert(cellAreas.end(), cell.begin(), cell.end());
+    }
+}
+
+
+int AreaGrid::numAreas() const
+{
+    return impl->shapes.size();
+}
+
+
+AreaItem* AreaGrid::area(const int& index) const
+{
+    return impl->shapes[index].item;
+}
+
+
+int AreaGrid::findArea(const Vector3& p) const
+{
+    int ix, iy, iz;
+    if(!impl->findCell(p, ix, iy, iz)) {
+        return -1;
+    }
+
+    // area indices are stored in ascending order, so the first hit
+    // from the back is the area added last
+    int cell = impl->cellIndex(ix, iy, iz);
+    for(int i = impl->cellStart[cell + 1] - 1; i >= impl->cellStart[cell]; --i) {
+        int index = impl->cellAreas[i];
+        if(impl->contains(impl->shapes[index], p, 0.0)) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+
+int AreaGrid::findArea(const Vector3& center, const double& radius) const
+{
+    int index = findArea(center);
+    if(index < 0 || !impl->containsSphere(impl->shapes[index], center, radius)) {
+        return -1;
+    }
+    bool isOverlapped = impl->forEachCandidate(
+        center, radius, [&](int candidate){ return candidate > index; });
+    return isOverlapped ? -1 : index;
+}
+
+
+bool AreaGrid::overlaps(const Vector3& center, const double& radius) const
+{
+    return impl->forEachCandidate(center, radius, [](int){ return true; });
+}
+
+
+template<class Function>
+bool AreaGridImpl::forEachCandidate(const Vector3& center, const double& radius, Function func) const
+{
+    // returns true as soon as func accepts an area whose bounding box
+    // overlaps the bounding box of the sphere
+    Vector3 lower = center - Vector3::Constant(radius);
+    Vector3 upper = center + Vector3::Constant(radius);
+    int lo[3], hi[3];
+    if(!findCellRange(lower, upper, lo, hi)) {
+        return false;
+    }
+    for(int ix = lo[0]; ix <= hi[0]; ++ix) {
+        for(int iy = lo[1]; iy <= hi[1]; ++iy) {
+            for(int iz = lo[2]; iz <= hi[2]; ++iz) {
+                int cell = cellIndex(ix, iy, iz);
+                for(int i = cellStart[cell]; i < cellStart[cell + 1]; ++i) {
+                    const AreaShape& shape = shapes[cellAreas[i]];
+                    if((shape.minRange.array() <= upper.array()).all()
+                            && (lower.array() <= shape.maxRange.array()).all()
+                            && func(cellAreas[i])) {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+
+bool AreaGrid::contains(const int& index, const Vector3& p) const
+{
+    const AreaShape& shape = impl->shapes[index];
+    return shape.isActive && impl->contains(shape, p, 0.0);
+}
+
+
+bool AreaGrid::contains(const int& index, const Vector3& p, const double& margin) const
+{
+    const AreaShape& shape = impl->shapes[index];
+    return shape.isActive && impl->contains(shape, p, std::max(margin, 0.0));
+}
+
+
+bool AreaGridImpl::contains(const AreaShape& shape, const Vector3& p, const double& margin) const
+{
+    // the bounding box of a widened cylinder grows by up to sqrt(2) times the margin
+    double m = shape.type == AreaItem::BOX ? margin : margin * M_SQRT2;
+    if((p[0] < shape.minRange[0] - m) || (shape.maxRange[0] + m < p[0])
+            || (p[1] < shape.minRange[1] - m) || (shape.maxRange[1] + m < p[1])
+            || (p[2] < shape.minRange[2] - m) || (shape.maxRange[2] + m < p[2])
+            ) {
+        return false;
+    }
+
+    if(shape.type == AreaItem::BOX) {
+        return true;
+    } else if(shape.type == AreaItem::CYLINDER) {
+        Vector3 q = shape.Rt * (p - shape.center);
+        if(fabs(q[1]) < shape.halfHeight + margin) {
+            double r = shape.radius + margin;
+            return q[0] * q[0] + q[2] * q[2] < r * r;
+        }
+    } else if(shape.type == AreaItem::SPHERE) {
+        double r = shape.radius + margin;
+        return (p - shape.center).squaredNorm() <= r * r;
+    }
+    return false;
+}
+
+
+bool AreaGridImpl::containsSphere(const AreaShape& shape, const Vector3& center, const double& radius) const
+{
+    if(shape.type == AreaItem::BOX) {
+        return ((shape.minRange.array() + radius) <= center.array()).all()
+            && (center.array() <= (shape.maxRange.array() - radius)).all();
+    } else if(shape.type == AreaItem::CYLINDER) {
+        Vector3 q = shape.Rt * (center - shape.center);
+        double r = sqrt(q[0] * q[0] + q[2] * q[2]) + radius;
+        return (fabs(q[1]) + radius < shape.halfHeight) && (r * r < shape.radius2);
+    } else if(shape.type == AreaItem::SPHERE) {
+        double r = (center - shape.center).norm() + radius;
+        return r * r <= shape.radius2;
+    }
+    return false;
+}
+
+
+int AreaGridImpl::cellIndex(const int& ix, const int& iy, const int& iz) const
+{
+    return (ix * numCells[1] + iy) * numCells[2] + iz;
+}
+
+
+bool AreaGridImpl::findCell(const Vector3& p, int& ix, int& iy, int& iz) const
+{
+    if(cellStart.empty()) {
+        return false;
+    }
+    int index[3];
+    for(int i = 0; i < 3; ++i) {
+        double d = (p[i] - origin[i]) / cellSize[i];
+        if((d < 0.0) || (d > numCells[i])) {
+            return false;
+        }
+        index[i] = std::min((int)d, numCells[i] - 1);
+    }
+    ix = index[0];
+    iy = index[1];
+    iz = index[2];
+    return true;
+}
+
+
+bool AreaGridImpl::findCellRange(const Vector3& lower, const Vector3& upper, int lo[3], int hi[3]) const
+{
+    if(cellStart.empty()) {
+        return false;
+    }
+    for(int i = 0; i < 3; ++i) {
+        double l = (lower[i] - origin[i]) / cellSize[i];
+        double u = (upper[i] - origin[i]) / cellSize[i];
+        if((u < 0.0) || (l > numCells[i])) {
+            return false;
+        }
+        lo[i] = std::max(0, std::min((int)floor(l), numCells[i] - 1));
+        hi[i] = std::max(0, std::min((int)floor(u), numCells[i] - 1));
+    }
+    return true;
+}
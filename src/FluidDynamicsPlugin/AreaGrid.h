@@ -0,0 +1,55 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_FLUID_DYNAMICS_PLUGIN_AREA_GRID_H
+#define CNOID_FLUID_DYNAMICS_PLUGIN_AREA_GRID_H
+
+#include <cnoid/EigenTypes>
+#include "AreaItem.h"
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class AreaGridImpl;
+
+/**
+   Uniform grid over the bounding boxes of area items.
+   The shape parameters and the inverse transforms of the areas are
+   cached when the grid is built, so a point query does not touch the
+   items themselves. When several areas contain the point, the one added
+   last wins, which matches the order of the checked items.
+   The sphere variant of findArea() returns an area only when the whole
+   sphere lies inside it and no later area comes near the sphere, so
+   every point of the sphere is known to belong to that area.
+   The margin variant of contains() widens the area by the margin on
+   every side, which gives the current area of a body some hysteresis.
+*/
+class CNOID_EXPORT AreaGrid
+{
+public:
+    AreaGrid();
+    virtual ~AreaGrid();
+
+    void clear();
+    void addArea(AreaItem* item);
+    void build();
+
+    int numAreas() const;
+    AreaItem* area(const int& index) const;
+    int findArea(const Vector3& p) const;
+    int findArea(const Vector3& center, const double& radius) const;
+    bool overlaps(const Vector3& center, const double& radius) const;
+    bool contains(const int& index, const Vector3& p) const;
+    bool contains(const int& index, const Vector3& p, const double& margin) const;
+
+private:
+    AreaGrid(const AreaGrid& org);
+    AreaGridImpl* impl;
+    friend class AreaGridImpl;
+};
+
+}
+
+#endif // CNOID_FLUID_DYNAMICS_PLUGIN_AREA_GRID_H
@@ -0,0 +1,144 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "FDDeviceArray.h"
+#include <cnoid/EigenUtil>
+#include <cnoid/Link>
+#include <cmath>
+
+using namespace std;
+using namespace cnoid;
+
+namespace cnoid {
+
+class FDDeviceArrayImpl
+{
+public:
+    FDDeviceArrayImpl(FDDeviceArray* self);
+
+    FDDeviceArray* self;
+    vector<Thruster*> thrusters;
+    vector<Rotor*> rotors;
+    vector<int> thrusterLinkIndices;
+    vector<int> rotorLinkIndices;
+};
+
+}
+
+
+FDDeviceArray::FDDeviceArray()
+{
+    impl = new FDDeviceArrayImpl(this);
+}
+
+
+FDDeviceArrayImpl::FDDeviceArrayImpl(FDDeviceArray* self)
+    : self(self)
+{
+
+}
+
+
+FDDeviceArray::~FDDeviceArray()
+{
+    delete impl;
+}
+
+
+void FDDeviceArray::clear()
+{
+    impl->thrusters.clear();
+    impl->rotors.clear();
+    impl->thrusterLinkIndices.clear();
+    impl->rotorLinkIndices.clear();
+}
+
+
+void FDDeviceArray::addThruster(Thruster* thruster, const int& linkIndex)
+{
+    impl->thrusters.push_back(thruster);
+    impl->thrusterLinkIndices.push_back(linkIndex);
+}
+
+
+void FDDeviceArray::addRotor(Rotor* rotor, const int& linkIndex)
+{
+    impl->rotors.push_back(rotor);
+    impl->rotorLinkIndices.push_back(linkIndex);
+}
+
+
+int FDDeviceArray::numThrusters() const
+{
+    return impl->thrusters.size();
+}
+
+
+int FDDeviceArray::numRotors() const
+{
+    return impl->rotors.size();
+}
+
+
+void FDDeviceArray::update(const Vector3& gravity, const vector<int>& linkAreas,
+                           const vector<double>& areaDensities)
+{
+    // Thruster
+    for(size_t k = 0; k < impl->thrusters.size(); k++) {
+        Thruster* thruster = impl->thrusters[k];
+        Link* link = thruster->link();
+        int area = linkAreas[impl->thrusterLinkIndices[k]];
+        if(area >= 0) {
+            double density = areaDensities[area];
+            if(density > 10.0) {
+                Matrix3 R = link->R() * thruster->R_local();
+                const Vector3 f = R * (Vector3::UnitX() * (thruster->force() + thruster->forceOffset()));
+                const Vector3 p = link->T() * thruster->p_local();
+                Vector3 tau_ext = R * (Vector3::UnitX() * (thruster->torque() + thruster->torqueOffset()));
+                if(thruster->on()) {
+                    link->f_ext() += f;
+                    link->tau_ext() += p.cross(f) + tau_ext;
+                }
+            }
+        }
+    }
+
+    // Rotor
+    for(size_t k = 0; k < impl->rotors.size(); k++) {
+        Rotor* rotor = impl->rotors[k];
+        Link* link = rotor->link();
+        int area = linkAreas[impl->rotorLinkIndices[k]];
+        if(area >= 0) {
+            double density = areaDensities[area];
+            if(density < 10.0) {
+                double n = rotor->kv() * rotor->voltage();
+                double d3 = rotor->diameter() / 10.0;
+                double p1 = rotor->pitch() / 10.0;
+                double k = rotor->k();
+                double g = fabs(gravity[2]);
+                if(n <= 0.0) {
+                    n = link->dq_target() * 30.0 / PI;
+                } else {
+                    double dir = 1.0;
+                    if(rotor->reverse()) {
+                        dir *= -1.0;
+                    }
+                    link->dq_target() = n * PI / 30.0 * dir;
+                }
+                double n2 = n / 1000.0;
+                double staticForce = k * d3 * d3 * d3 * p1 * n2 * n2 * g / 1000.0;
+
+                Matrix3 R = link->R() * rotor->R_local();
+                const Vector3 f = R * (Vector3::UnitZ() * (rotor->force() + rotor->forceOffset() + staticForce));
+                const Vector3 p = link->T() * rotor->p_local();
+                Vector3 tau_ext = R * (Vector3::UnitZ() * (rotor->torque() + rotor->torqueOffset()));
+                if(rotor->on()) {
+                    link->f_ext() += f;
+                    link->tau_ext() += p.cross(f) + tau_ext;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,50 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_FLUID_DYNAMICS_PLUGIN_FD_DEVICE_ARRAY_H
+#define CNOID_FLUID_DYNAMICS_PLUGIN_FD_DEVICE_ARRAY_H
+
+#include <cnoid/EigenTypes>
+#include <vector>
+#include "Rotor.h"
+#include "Thruster.h"
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class FDDeviceArrayImpl;
+
+/**
+   Thrusters and rotors of the bodies in the fluid areas. A device is
+   added with the index of its link among the links whose areas are
+   given to update(), and update() adds the forces of the devices that
+   are on to f_ext and tau_ext of their links: a thruster pushes only in
+   water and a rotor lifts only in air, told apart by the density of the
+   area of the link.
+*/
+class CNOID_EXPORT FDDeviceArray
+{
+public:
+    FDDeviceArray();
+    virtual ~FDDeviceArray();
+
+    void clear();
+    void addThruster(Thruster* thruster, const int& linkIndex);
+    void addRotor(Rotor* rotor, const int& linkIndex);
+    int numThrusters() const;
+    int numRotors() const;
+
+    void update(const Vector3& gravity, const std::vector<int>& linkAreas,
+                const std::vector<double>& areaDensities);
+
+private:
+    FDDeviceArray(const FDDeviceArray& org);
+    FDDeviceArrayImpl* impl;
+    friend class FDDeviceArrayImpl;
+};
+
+}
+
+#endif // CNOID_FLUID_DYNAMICS_PLUGIN_FD_DEVICE_ARRAY_H
@@ -8,12 +8,13 @@
 
 #include <cnoid/EigenTypes>
 #include <cnoid/Link>
+#include "exportdecl.h"
 
 namespace cnoid {
 
 class FDLinkImpl;
 
-class FDLink : public Referenced
+class CNOID_EXPORT FDLink : public Referenced
 {
 public:
     FDLink();
@@ -0,0 +1,383 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "FDLinkArray.h"
+#include <cmath>
+#include <vector>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace cnoid;
+
+namespace cnoid {
+
+class FDLinkArrayImpl
+{
+public:
+    FDLinkArrayImpl(FDLinkArray* self);
+
+    FDLinkArray* self;
+    vector<Link*> links;
+    bool isImplicitDrag;
+    double timeStep;
+
+    // coefficients packed at simulation start
+    vector<double> volume;
+    vector<double> cdw;
+    vector<double> cda;
+    vector<double> td;
+    vector<double> cv;
+    vector<double> surface[6];
+    vector<Vector3> centerOfBuoyancy;
+    vector<double> inverseMass;
+
+    // inputs and outputs of each step
+    vector<double> density;
+    vector<double> viscosity;
+    vector<double> flow[3];
+    vector<double> buoyancyDensity;
+    vector<Vector3> buoyancyCenter;
+    vector<double> p[3];
+    vector<double> cb[3];
+    vector<double> v[3];
+    vector<double> w[3];
+    vector<double> f[3];
+    vector<double> tau[3];
+    vector<double> inverseInertia[3];
+
+    void clear();
+    void resize(const size_t& n);
+    void gather(const int& begin, const int& end);
+    void scatter(const int& begin, const int& end);
+    void compute(const int& begin, const int& end, const Vector3& gravity);
+    int computeAVX2(const int& begin, const int& end, const Vector3& gravity);
+};
+
+}
+
+
+FDLinkArray::FDLinkArray()
+{
+    impl = new FDLinkArrayImpl(this);
+}
+
+
+FDLinkArrayImpl::FDLinkArrayImpl(FDLinkArray* self)
+    : self(self)
+{
+    isImplicitDrag = false;
+    timeStep = 0.001;
+    clear();
+}
+
+
+FDLinkArray::~FDLinkArray()
+{
+    delete impl;
+}
+
+
+void FDLinkArray::clear()
+{
+    impl->clear();
+}
+
+
+void FDLinkArrayImpl::clear()
+{
+    links.clear();
+    resize(0);
+}
+
+
+void FDLinkArrayImpl::resize(const size_t& n)
+{
+    for(auto array : { &volume, &cdw, &cda, &td, &cv, &inverseMass, &density, &viscosity, &buoyancyDensity }) {
+        array->resize(n, 0.0);
+    }
+    for(int k = 0; k < 6; ++k) {
+        surface[k].resize(n, 0.0);
+    }
+    for(int k = 0; k < 3; ++k) {
+        for(auto array : { flow, p, cb, v, w, f, tau, inverseInertia }) {
+            array[k].resize(n, 0.0);
+        }
+    }
+    centerOfBuoyancy.resize(n, Vector3::Zero());
+    buoyancyCenter.resize(n, Vector3::Zero());
+}
+
+
+int FDLinkArray::addFDLink(FDLink* fdLink)
+{
+    int index = impl->links.size();
+    Link* link = fdLink->link();
+    impl->links.push_back(link);
+    impl->resize(impl->links.size());
+
+    double volume = 0.0;
+    if(fdLink->density() != 0.0) {
+        volume = link->mass() / fdLink->density();
+    }
+    impl->volume[index] = volume;
+    impl->inverseMass[index] = link->mass() > 0.0 ? 1.0 / link->mass() : 0.0;
+    impl->cdw[index] = fdLink->cdw();
+    impl->cda[index] = fdLink->cda();
+    impl->td[index] = fdLink->td();
+    impl->cv[index] = fdLink->cv();
+    const Vector6 surface = fdLink->surface();
+    for(int k = 0; k < 6; ++k) {
+        impl->surface[k][index] = surface[k];
+    }
+    impl->centerOfBuoyancy[index] = fdLink->centerOfBuoyancy();
+    return index;
+}
+
+
+int FDLinkArray::size() const
+{
+    return impl->links.size();
+}
+
+
+Link* FDLinkArray::link(const int& index) const
+{
+    return impl->links[index];
+}
+
+
+const Vector3& FDLinkArray::centerOfBuoyancy(const int& index) const
+{
+    return impl->centerOfBuoyancy[index];
+}
+
+
+void FDLinkArray::setFluid(const int& index, const double& density, const double& viscosity, const Vector3& flow)
+{
+    impl->density[index] = density;
+    impl->viscosity[index] = viscosity;
+    for(int k = 0; k < 3; ++k) {
+        impl->flow[k][index] = flow[k];
+    }
+    impl->buoyancyDensity[index] = density;
+    impl->buoyancyCenter[index] = impl->centerOfBuoyancy[index];
+}
+
+
+void FDLinkArray::setBuoyancy(const int& index, const double& density, const Vector3& centerOfBuoyancy)
+{
+    impl->buoyancyDensity[index] = density;
+    impl->buoyancyCenter[index] = centerOfBuoyancy;
+}
+
+
+void FDLinkArray::setImplicitDrag(const bool& on, const double& timeStep)
+{
+    impl->isImplicitDrag = on;
+    impl->timeStep = timeStep;
+}
+
+
+void FDLinkArray::update(const Vector3& gravity)
+{
+    update(gravity, 0, impl->links.size());
+}
+
+
+void FDLinkArray::update(const Vector3& gravity, const int& begin, const int& end)
+{
+    impl->gather(begin, end);
+    impl->compute(begin, end, gravity);
+    impl->scatter(begin, end);
+}
+
+
+void FDLinkArrayImpl::gather(const int& begin, const int& end)
+{
+    for(int i = begin; i < end; ++i) {
+        Link* link = links[i];
+        const Vector3 p = link->T().translation();
+        const Vector3 cb = link->T() * buoyancyCenter[i];
+        const Vector3& v = link->v();
+        const Vector3& w = link->w();
+        for(int k = 0; k < 3; ++k) {
+            this->p[k][i] = p[k];
+            this->cb[k][i] = cb[k];
+            this->v[k][i] = v[k];
+            this->w[k][i] = w[k];
+        }
+        if(isImplicitDrag) {
+            // diagonal of the inertia tensor in the world frame
+            const Matrix3 R = link->R();
+            const Matrix3 I = R * link->I() * R.transpose();
+            for(int k = 0; k < 3; ++k) {
+                inverseInertia[k][i] = I(k, k) > 0.0 ? 1.0 / I(k, k) : 0.0;
+            }
+        }
+    }
+}
+
+
+void FDLinkArrayImpl::scatter(const int& begin, const int& end)
+{
+    for(int i = begin; i < end; ++i) {
+        Link* link = links[i];
+        link->f_ext() += Vector3(f[0][i], f[1][i], f[2][i]);
+        link->tau_ext() += Vector3(tau[0][i], tau[1][i], tau[2][i]);
+    }
+}
+
+
+void FDLinkArrayImpl::compute(const int& begin, const int& end, const Vector3& gravity)
+{
+    // the vector path leaves the remainder to the scalar loop below,
+    // which evaluates the same expressions in the same order
+    int i = computeAVX2(begin, end, gravity);
+
+    for(; i < end; ++i) {
+        const double rho = density[i];
+        const double mu = viscosity[i];
+        const double cd = rho > 10.0 ? cdw[i] : cda[i];
+        const double cvmu = cv[i] * mu;
+
+        double fs[3], fb[3], tl[3];
+        for(int k = 0; k < 3; ++k) {
+            // drag and viscous drag oppose the velocity, the projected
+            // area is chosen by the sign of the velocity
+            const double vk = v[k][i];
+            const double s = vk >= 0.0 ? surface[k * 2][i] : surface[k * 2 + 1][i];
+            const double fd = -(0.5 * rho * vk * fabs(vk) * s * cd);
+            const double fv = -(cvmu * vk);
+            double scale = 1.0;
+            if(isImplicitDrag) {
+                const double b = rho * fabs(vk) * s * cd + cvmu;
+                scale = 1.0 / (1.0 + timeStep * inverseMass[i] * b);
+            }
+            fs[k] = flow[k][i] + fd * scale + fv * scale;
+            fb[k] = -(buoyancyDensity[i] * gravity[k] * volume[i]);
+
+            const int k0 = (k + 1) % 3;
+            const int k1 = (k + 2) % 3;
+            const double wk = w[k][i];
+            const double sw = wk >= 0.0
+                ? surface[k0 * 2][i] + surface[k1 * 2][i]
+                : surface[k0 * 2 + 1][i] + surface[k1 * 2 + 1][i];
+            const double tdk = -(rho * wk * fabs(wk) * sw * td[i]);
+            const double tvk = -(cvmu * wk);
+            double scalew = 1.0;
+            if(isImplicitDrag) {
+                const double b = 2.0 * rho * fabs(wk) * sw * td[i] + cvmu;
+                scalew = 1.0 / (1.0 + timeStep * inverseInertia[k][i] * b);
+            }
+            tl[k] = tdk * scalew + tvk * scalew;
+        }
+
+        for(int k = 0; k < 3; ++k) {
+            const int k0 = (k + 1) % 3;
+            const int k1 = (k + 2) % 3;
+            f[k][i] = fs[k] + fb[k];
+            tau[k][i] = (p[k0][i] * fs[k1] - p[k1][i] * fs[k0])
+                + (cb[k0][i] * fb[k1] - cb[k1][i] * fb[k0])
+                + tl[k];
+        }
+    }
+}
+
+
+#ifdef __AVX2__
+
+int FDLinkArrayImpl::computeAVX2(const int& begin, const int& end, const Vector3& gravity)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d threshold = _mm256_set1_pd(10.0);
+    const __m256d signMask = _mm256_set1_pd(-0.0);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d two = _mm256_set1_pd(2.0);
+    const __m256d dt = _mm256_set1_pd(timeStep);
+
+    int i = begin;
+    for(; i + 4 <= end; i += 4) {
+        const __m256d rho = _mm256_loadu_pd(&density[i]);
+        const __m256d mu = _mm256_loadu_pd(&viscosity[i]);
+        const __m256d water = _mm256_cmp_pd(rho, threshold, _CMP_GT_OQ);
+        const __m256d cd = _mm256_blendv_pd(_mm256_loadu_pd(&cda[i]), _mm256_loadu_pd(&cdw[i]), water);
+        const __m256d cvmu = _mm256_mul_pd(_mm256_loadu_pd(&cv[i]), mu);
+        const __m256d vol = _mm256_loadu_pd(&volume[i]);
+        const __m256d rhob = _mm256_loadu_pd(&buoyancyDensity[i]);
+        const __m256d tdi = _mm256_loadu_pd(&td[i]);
+        const __m256d dtim = _mm256_mul_pd(dt, _mm256_loadu_pd(&inverseMass[i]));
+
+        __m256d fs[3], fb[3], tl[3];
+        for(int k = 0; k < 3; ++k) {
+            const __m256d vk = _mm256_loadu_pd(&v[k][i]);
+            const __m256d vpos = _mm256_cmp_pd(vk, zero, _CMP_GE_OQ);
+            const __m256d s = _mm256_blendv_pd(
+                _mm256_loadu_pd(&surface[k * 2 + 1][i]), _mm256_loadu_pd(&surface[k * 2][i]), vpos);
+            __m256d fd = _mm256_mul_pd(_mm256_mul_pd(half, rho), vk);
+            fd = _mm256_mul_pd(fd, _mm256_andnot_pd(signMask, vk));
+            fd = _mm256_mul_pd(_mm256_mul_pd(fd, s), cd);
+            fd = _mm256_xor_pd(fd, signMask);
+            const __m256d fv = _mm256_xor_pd(_mm256_mul_pd(cvmu, vk), signMask);
+            __m256d scale = one;
+            if(isImplicitDrag) {
+                __m256d b = _mm256_mul_pd(rho, _mm256_andnot_pd(signMask, vk));
+                b = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(b, s), cd), cvmu);
+                scale = _mm256_div_pd(one, _mm256_add_pd(one, _mm256_mul_pd(dtim, b)));
+            }
+            fs[k] = _mm256_add_pd(_mm256_add_pd(_mm256_loadu_pd(&flow[k][i]), _mm256_mul_pd(fd, scale)),
+                                  _mm256_mul_pd(fv, scale));
+            __m256d fbk = _mm256_mul_pd(_mm256_mul_pd(rhob, _mm256_set1_pd(gravity[k])), vol);
+            fb[k] = _mm256_xor_pd(fbk, signMask);
+
+            const int k0 = (k + 1) % 3;
+            const int k1 = (k + 2) % 3;
+            const __m256d wk = _mm256_loadu_pd(&w[k][i]);
+            const __m256d wpos = _mm256_cmp_pd(wk, zero, _CMP_GE_OQ);
+            const __m256d sw = _mm256_blendv_pd(
+                _mm256_add_pd(_mm256_loadu_pd(&surface[k0 * 2 + 1][i]), _mm256_loadu_pd(&surface[k1 * 2 + 1][i])),
+                _mm256_add_pd(_mm256_loadu_pd(&surface[k0 * 2][i]), _mm256_loadu_pd(&surface[k1 * 2][i])),
+                wpos);
+            __m256d tdk = _mm256_mul_pd(rho, wk);
+            tdk = _mm256_mul_pd(tdk, _mm256_andnot_pd(signMask, wk));
+            tdk = _mm256_mul_pd(_mm256_mul_pd(tdk, sw), tdi);
+            tdk = _mm256_xor_pd(tdk, signMask);
+            const __m256d tvk = _mm256_xor_pd(_mm256_mul_pd(cvmu, wk), signMask);
+            __m256d scalew = one;
+            if(isImplicitDrag) {
+                __m256d b = _mm256_mul_pd(_mm256_mul_pd(two, rho), _mm256_andnot_pd(signMask, wk));
+                b = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(b, sw), tdi), cvmu);
+                const __m256d dtii = _mm256_mul_pd(dt, _mm256_loadu_pd(&inverseInertia[k][i]));
+                scalew = _mm256_div_pd(one, _mm256_add_pd(one, _mm256_mul_pd(dtii, b)));
+            }
+            tl[k] = _mm256_add_pd(_mm256_mul_pd(tdk, scalew), _mm256_mul_pd(tvk, scalew));
+        }
+
+        for(int k = 0; k < 3; ++k) {
+            const int k0 = (k + 1) % 3;
+            const int k1 = (k + 2) % 3;
+            _mm256_storeu_pd(&f[k][i], _mm256_add_pd(fs[k], fb[k]));
+            const __m256d tf = _mm256_sub_pd(
+                _mm256_mul_pd(_mm256_loadu_pd(&p[k0][i]), fs[k1]),
+                _mm256_mul_pd(_mm256_loadu_pd(&p[k1][i]), fs[k0]));
+            const __m256d tb = _mm256_sub_pd(
+                _mm256_mul_pd(_mm256_loadu_pd(&cb[k0][i]), fb[k1]),
+                _mm256_mul_pd(_mm256_loadu_pd(&cb[k1][i]), fb[k0]));
+            _mm256_storeu_pd(&tau[k][i], _mm256_add_pd(_mm256_add_pd(tf, tb), tl[k]));
+        }
+    }
+    return i;
+}
+
+#else
+
+int FDLinkArrayImpl::computeAVX2(const int& begin, const int& end, const Vector3& gravity)
+{
+    return begin;
+}
+
+#endif
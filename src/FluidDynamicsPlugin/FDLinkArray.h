@@ -0,0 +1,59 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_FLUID_DYNAMICS_PLUGIN_FD_LINK_ARRAY_H
+#define CNOID_FLUID_DYNAMICS_PLUGIN_FD_LINK_ARRAY_H
+
+#include <cnoid/EigenTypes>
+#include "FDLink.h"
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class FDLinkArrayImpl;
+
+/**
+   Structure-of-arrays copy of the coefficients of all FDLinks.
+   The fluid properties of each link are set every step, then update()
+   gathers the link states, computes flow, buoyancy, drag and viscous
+   drag for all links in one batch and adds them to f_ext and tau_ext.
+   setFluid() also resets the buoyancy to the fluid density at the
+   configured centre of buoyancy, which setBuoyancy() can override for
+   a partly submerged link.
+   With implicit drag, the drag and viscous terms are divided by
+   1 + dt / m * dF/dv (dt / I for the torques), which is the backward
+   Euler step of the damping linearised at the current velocity. The
+   mass and inertia are those of the link alone, so links in a chain are
+   damped slightly more than the exact implicit step would.
+   Every link is computed independently of the others, so disjoint ranges
+   of links may be updated from different threads.
+*/
+class CNOID_EXPORT FDLinkArray
+{
+public:
+    FDLinkArray();
+    virtual ~FDLinkArray();
+
+    void clear();
+    int addFDLink(FDLink* fdLink);
+    int size() const;
+    Link* link(const int& index) const;
+    const Vector3& centerOfBuoyancy(const int& index) const;
+
+    void setFluid(const int& index, const double& density, const double& viscosity, const Vector3& flow);
+    void setBuoyancy(const int& index, const double& density, const Vector3& centerOfBuoyancy);
+    void setImplicitDrag(const bool& on, const double& timeStep);
+    void update(const Vector3& gravity);
+    void update(const Vector3& gravity, const int& begin, const int& end);
+
+private:
+    FDLinkArray(const FDLinkArray& org);
+    FDLinkArrayImpl* impl;
+    friend class FDLinkArrayImpl;
+};
+
+}
+
+#endif // CNOID_FLUID_DYNAMICS_PLUGIN_FD_LINK_ARRAY_H
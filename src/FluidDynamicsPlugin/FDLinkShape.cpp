@@ -0,0 +1,315 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "FDLinkShape.h"
+#include <cnoid/MeshExtractor>
+#include <cnoid/SceneDrawables>
+#include <cnoid/stdx/filesystem>
+#include <fmt/format.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace cnoid;
+namespace filesystem = cnoid::stdx::filesystem;
+
+namespace {
+
+// bump when the analysis changes so that old cache entries are ignored
+const uint64_t ShapeCacheVersion = 1;
+
+class Hasher
+{
+public:
+    Hasher() : value(14695981039346656037ULL) { }
+
+    void add(const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for(size_t i = 0; i < size; ++i) {
+            value = (value ^ bytes[i]) * 1099511628211ULL;
+        }
+    }
+
+    uint64_t value;
+};
+
+
+double projectedArea(const SgMesh* mesh, const int& axis, const int& resolution)
+{
+    const SgVertexArray& vertices = *const_cast<SgMesh*>(mesh)->vertices();
+    const int a = (axis + 1) % 3;
+    const int b = (axis + 2) % 3;
+    double lower[2] = { vertices[0][a], vertices[0][b] };
+    double upper[2] = { lower[0], lower[1] };
+    for(auto& vertex : vertices) {
+        lower[0] = std::min(lower[0], (double)vertex[a]);
+        lower[1] = std::min(lower[1], (double)vertex[b]);
+        upper[0] = std::max(upper[0], (double)vertex[a]);
+        upper[1] = std::max(upper[1], (double)vertex[b]);
+    }
+    double cell = std::max(upper[0] - lower[0], upper[1] - lower[1]) / std::max(resolution, 1);
+    if(cell <= 0.0) {
+        return 0.0;
+    }
+    int n[2];
+    for(int i = 0; i < 2; ++i) {
+        n[i] = std::max(1, (int)ceil((upper[i] - lower[i]) / cell));
+    }
+
+    // mark every cell whose centre is covered by a projected triangle
+    vector<char> covered(n[0] * n[1], 0);
+    for(int t = 0; t < mesh->numTriangles(); ++t) {
+        auto triangle = mesh->triangle(t);
+        double x[3], y[3];
+        for(int j = 0; j < 3; ++j) {
+            x[j] = (vertices[triangle[j]][a] - lower[0]) / cell;
+            y[j] = (vertices[triangle[j]][b] - lower[1]) / cell;
+        }
+        double det = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if(fabs(det) < 1.0e-12) {
+            continue;
+        }
+        int i0 = std::max(0, (int)floor(std::min({ x[0], x[1], x[2] }) - 0.5));
+        int i1 = std::min(n[0] - 1, (int)ceil(std::max({ x[0], x[1], x[2] }) - 0.5));
+        int j0 = std::max(0, (int)floor(std::min({ y[0], y[1], y[2] }) - 0.5));
+        int j1 = std::min(n[1] - 1, (int)ceil(std::max({ y[0], y[1], y[2] }) - 0.5));
+        for(int j = j0; j <= j1; ++j) {
+            for(int i = i0; i <= i1; ++i) {
+                double px = i + 0.5 - x[0];
+                double py = j + 0.5 - y[0];
+                double u = (px * (y[2] - y[0]) - (x[2] - x[0]) * py) / det;
+                double v = ((x[1] - x[0]) * py - px * (y[1] - y[0])) / det;
+                if((u >= 0.0) && (v >= 0.0) && (u + v <= 1.0)) {
+                    covered[j * n[0] + i] = 1;
+                }
+            }
+        }
+    }
+    return std::count(covered.begin(), covered.end(), 1) * cell * cell;
+}
+
+}
+
+
+namespace cnoid {
+
+class FDLinkShapeImpl
+{
+public:
+    FDLinkShapeImpl(FDLinkShape* self);
+
+    FDLinkShape* self;
+    double volume;
+    Vector3 centroid;
+    Vector6 surface;
+    bool isCached;
+
+    bool build(Link* link, const int& resolution, const string& cacheDirectory);
+    void analyze(const SgMesh* mesh, const int& resolution);
+    bool readCache(const string& filename);
+    void writeCache(const string& filename);
+};
+
+}
+
+
+FDLinkShape::FDLinkShape()
+{
+    impl = new FDLinkShapeImpl(this);
+}
+
+
+FDLinkShapeImpl::FDLinkShapeImpl(FDLinkShape* self)
+    : self(self)
+{
+    volume = 0.0;
+    centroid << 0.0, 0.0, 0.0;
+    surface << 0.0, 0.0, 0.0, 0.0, 0.0, 0.0;
+    isCached = false;
+}
+
+
+FDLinkShape::~FDLinkShape()
+{
+    delete impl;
+}
+
+
+string FDLinkShape::defaultCacheDirectory()
+{
+    filesystem::path directory;
+    const char* cacheHome = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if(cacheHome && *cacheHome) {
+        directory = cacheHome;
+    } else if(home && *home) {
+        directory = filesystem::path(home) / ".cache";
+    } else {
+        return string();
+    }
+    return (directory / "choreonoid" / "fluid-dynamics").string();
+}
+
+
+bool FDLinkShape::build(Link* link, const int& resolution, const string& cacheDirectory)
+{
+    return impl->build(link, resolution, cacheDirectory);
+}
+
+
+bool FDLinkShapeImpl::build(Link* link, const int& resolution, const string& cacheDirectory)
+{
+    isCached = false;
+    SgNode* shape = link->collisionShape();
+    if(!shape) {
+        return false;
+    }
+    MeshExtractor extractor;
+    SgMeshPtr mesh = extractor.integrate(shape);
+    if(!mesh || !mesh->hasVertices() || !mesh->numTriangles()) {
+        return false;
+    }
+
+    string filename;
+    if(!cacheDirectory.empty()) {
+        Hasher hasher;
+        hasher.add(&ShapeCacheVersion, sizeof(ShapeCacheVersion));
+        hasher.add(&resolution, sizeof(resolution));
+        for(auto& vertex : *mesh->vertices()) {
+            float xyz[3] = { vertex[0], vertex[1], vertex[2] };
+            hasher.add(xyz, sizeof(xyz));
+        }
+        for(int t = 0; t < mesh->numTriangles(); ++t) {
+            auto triangle = mesh->triangle(t);
+            int32_t indices[3] = { triangle[0], triangle[1], triangle[2] };
+            hasher.add(indices, sizeof(indices));
+        }
+        filename = (filesystem::path(cacheDirectory) / fmt::format("{:016x}.txt", hasher.value)).string();
+        if(readCache(filename)) {
+            isCached = true;
+            return true;
+        }
+    }
+
+    analyze(mesh, resolution);
+    if(!filename.empty()) {
+        writeCache(filename);
+    }
+    return true;
+}
+
+
+void FDLinkShapeImpl::analyze(const SgMesh* mesh, const int& resolution)
+{
+    // sum of the signed tetrahedra spanned by the origin and each triangle
+    const SgVertexArray& vertices = *const_cast<SgMesh*>(mesh)->vertices();
+    double sixVolume = 0.0;
+    Vector3 moment = Vector3::Zero();
+    for(int t = 0; t < mesh->numTriangles(); ++t) {
+        auto triangle = mesh->triangle(t);
+        Vector3 a = vertices[triangle[0]].cast<double>();
+        Vector3 b = vertices[triangle[1]].cast<double>();
+        Vector3 c = vertices[triangle[2]].cast<double>();
+        double det = a.dot(b.cross(c));
+        sixVolume += det;
+        moment += det * (a + b + c);
+    }
+    volume = fabs(sixVolume) / 6.0;
+    if(fabs(sixVolume) > 1.0e-15) {
+        centroid = moment / (4.0 * sixVolume);
+    } else {
+        volume = 0.0;
+        centroid.setZero();
+    }
+
+    // a silhouette looks the same from both sides of an axis
+    for(int k = 0; k < 3; ++k) {
+        double area = projectedArea(mesh, k, resolution);
+        surface[k * 2] = area;
+        surface[k * 2 + 1] = area;
+    }
+}
+
+
+bool FDLinkShapeImpl::readCache(const string& filename)
+{
+    ifstream file(filename);
+    if(!file) {
+        return false;
+    }
+    double values[10];
+    for(int i = 0; i < 10; ++i) {
+        if(!(file >> values[i])) {
+            return false;
+        }
+    }
+    volume = values[0];
+    centroid << values[1], values[2], values[3];
+    for(int k = 0; k < 6; ++k) {
+        surface[k] = values[4 + k];
+    }
+    return true;
+}
+
+
+void FDLinkShapeImpl::writeCache(const string& filename)
+{
+    // links of the same model are analysed in parallel, so each writer
+    // uses its own temporary file and the rename publishes it atomically
+    stdx::error_code error;
+    filesystem::path path(filename);
+    filesystem::create_directories(path.parent_path(), error);
+    string temporary = fmt::format("{}.{}", filename, std::hash<std::thread::id>()(std::this_thread::get_id()));
+    {
+        ofstream file(temporary);
+        if(!file) {
+            return;
+        }
+        file.precision(17);
+        file << volume << ' ' << centroid[0] << ' ' << centroid[1] << ' ' << centroid[2];
+        for(int k = 0; k < 6; ++k) {
+            file << ' ' << surface[k];
+        }
+        file << '\n';
+        if(!file) {
+            return;
+        }
+    }
+    filesystem::rename(temporary, path, error);
+    if(error) {
+        filesystem::remove(temporary, error);
+    }
+}
+
+
+bool FDLinkShape::isCached() const
+{
+    return impl->isCached;
+}
+
+
+double FDLinkShape::volume() const
+{
+    return impl->volume;
+}
+
+
+const Vector3& FDLinkShape::centroid() const
+{
+    return impl->centroid;
+}
+
+
+const Vector6& FDLinkShape::surface() const
+{
+    return impl->surface;
+}
@@ -0,0 +1,52 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_FLUID_DYNAMICS_PLUGIN_FD_LINK_SHAPE_H
+#define CNOID_FLUID_DYNAMICS_PLUGIN_FD_LINK_SHAPE_H
+
+#include <cnoid/EigenTypes>
+#include <cnoid/Link>
+#include <string>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class FDLinkShapeImpl;
+
+/**
+   Hydrodynamic properties derived from the collision mesh of a link:
+   the enclosed volume, its centroid and the projected areas along the
+   six local axis directions in the order of FDLink::surface().
+   The projected areas are the silhouettes of the mesh rasterised on a
+   grid of the given resolution. Results are stored in the cache
+   directory under a hash of the mesh, so an unchanged mesh is not
+   analysed again. All values are in the link frame.
+*/
+class CNOID_EXPORT FDLinkShape : public Referenced
+{
+public:
+    FDLinkShape();
+    virtual ~FDLinkShape();
+
+    bool build(Link* link, const int& resolution, const std::string& cacheDirectory);
+    bool isCached() const;
+
+    double volume() const;
+    const Vector3& centroid() const;
+    const Vector6& surface() const;
+
+    static std::string defaultCacheDirectory();
+
+private:
+    FDLinkShape(const FDLinkShape& org);
+    FDLinkShapeImpl* impl;
+    friend class FDLinkShapeImpl;
+};
+
+typedef ref_ptr<FDLinkShape> FDLinkShapePtr;
+
+}
+
+#endif // CNOID_FLUID_DYNAMICS_PLUGIN_FD_LINK_SHAPE_H
@@ -0,0 +1,267 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "FlowField.h"
+#include <fmt/format.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+const char FlowFieldMagic[4] = { 'C', 'N', 'F', 'F' };
+const uint32_t FlowFieldVersion = 1;
+
+struct FlowFieldHeader
+{
+    char magic[4];
+    uint32_t version;
+    int32_t size[3];
+    double origin[3];
+    double spacing[3];
+} __attribute__((packed));
+
+}
+
+
+namespace cnoid {
+
+class FlowFieldImpl
+{
+public:
+    FlowFieldImpl(FlowField* self);
+    ~FlowFieldImpl();
+
+    FlowField* self;
+    string filename;
+    void* mappedData;
+    size_t mappedSize;
+    const float* velocities;
+    int size[3];
+    Vector3 origin;
+    Vector3 spacing;
+
+    bool load(const string& filename, string& out_errorMessage);
+    void clear();
+    const float* velocity(const int& ix, const int& iy, const int& iz) const;
+};
+
+}
+
+
+FlowField::FlowField()
+{
+    impl = new FlowFieldImpl(this);
+}
+
+
+FlowFieldImpl::FlowFieldImpl(FlowField* self)
+    : self(self)
+{
+    mappedData = nullptr;
+    mappedSize = 0;
+    clear();
+}
+
+
+FlowField::~FlowField()
+{
+    delete impl;
+}
+
+
+FlowFieldImpl::~FlowFieldImpl()
+{
+    clear();
+}
+
+
+bool FlowField::load(const string& filename, string& out_errorMessage)
+{
+    return impl->load(filename, out_errorMessage);
+}
+
+
+bool FlowFieldImpl::load(const string& filename, string& out_errorMessage)
+{
+    clear();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd < 0) {
+        out_errorMessage = fmt::format(_("Flow field file \"{0}\" cannot be opened: {1}"),
+                                       filename, strerror(errno));
+        return false;
+    }
+    struct stat status;
+    if(fstat(fd, &status) < 0 || status.st_size < (off_t)sizeof(FlowFieldHeader)) {
+        out_errorMessage = fmt::format(_("Flow field file \"{0}\" is too short."), filename);
+        ::close(fd);
+        return false;
+    }
+    size_t length = status.st_size;
+    void* data = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(data == MAP_FAILED) {
+        out_errorMessage = fmt::format(_("Flow field file \"{0}\" cannot be mapped: {1}"),
+                                       filename, strerror(errno));
+        return false;
+    }
+
+    FlowFieldHeader header;
+    memcpy(&header, data, sizeof(header));
+    size_t numPoints = 0;
+    bool isValidHeader = (memcmp(header.magic, FlowFieldMagic, 4) == 0)
+        && (header.version == FlowFieldVersion);
+    if(isValidHeader) {
+        numPoints = 1;
+        for(int i = 0; i < 3; ++i) {
+            if(header.size[i] < 1 || !(header.spacing[i] > 0.0)) {
+                isValidHeader = false;
+            }
+            numPoints *= std::max(header.size[i], 0);
+        }
+    }
+    if(!isValidHeader || length < sizeof(header) + numPoints * 3 * sizeof(float)) {
+        out_errorMessage = fmt::format(_("Flow field file \"{0}\" is not a valid flow field."), filename);
+        munmap(data, length);
+        return false;
+    }
+
+    this->filename = filename;
+    mappedData = data;
+    mappedSize = length;
+    velocities = reinterpret_cast<const float*>(static_cast<const char*>(data) + sizeof(header));
+    for(int i = 0; i < 3; ++i) {
+        size[i] = header.size[i];
+        origin[i] = header.origin[i];
+        spacing[i] = header.spacing[i];
+    }
+    madvise(mappedData, mappedSize, MADV_RANDOM);
+    return true;
+}
+
+
+void FlowField::clear()
+{
+    impl->clear();
+}
+
+
+void FlowFieldImpl::clear()
+{
+    if(mappedData) {
+        munmap(mappedData, mappedSize);
+    }
+    filename.clear();
+    mappedData = nullptr;
+    mappedSize = 0;
+    velocities = nullptr;
+    size[0] = size[1] = size[2] = 0;
+    origin << 0.0, 0.0, 0.0;
+    spacing << 1.0, 1.0, 1.0;
+}
+
+
+bool FlowField::isValid() const
+{
+    return impl->velocities != nullptr;
+}
+
+
+const string& FlowField::filename() const
+{
+    return impl->filename;
+}
+
+
+Vector3 FlowField::origin() const
+{
+    return impl->origin;
+}
+
+
+Vector3 FlowField::spacing() const
+{
+    return impl->spacing;
+}
+
+
+int FlowField::size(const int& axis) const
+{
+    return impl->size[axis];
+}
+
+
+const float* FlowFieldImpl::velocity(const int& ix, const int& iy, const int& iz) const
+{
+    return velocities + ((size_t(iz) * size[1] + iy) * size[0] + ix) * 3;
+}
+
+
+bool FlowField::sample(const Vector3& p, Vector3& out_flow) const
+{
+    if(!impl->velocities) {
+        return false;
+    }
+
+    // trilinear interpolation between the eight surrounding grid points
+    int i0[3];
+    double t[3];
+    for(int i = 0; i < 3; ++i) {
+        double x = (p[i] - impl->origin[i]) / impl->spacing[i];
+        int last = impl->size[i] - 1;
+        if((x < 0.0) || (x > last)) {
+            return false;
+        }
+        i0[i] = std::min((int)x, std::max(last - 1, 0));
+        t[i] = last > 0 ? x - i0[i] : 0.0;
+    }
+    int i1[3];
+    for(int i = 0; i < 3; ++i) {
+        i1[i] = std::min(i0[i] + 1, impl->size[i] - 1);
+    }
+
+    out_flow.setZero();
+    for(int corner = 0; corner < 8; ++corner) {
+        int ix = corner & 1 ? i1[0] : i0[0];
+        int iy = corner & 2 ? i1[1] : i0[1];
+        int iz = corner & 4 ? i1[2] : i0[2];
+        double w = (corner & 1 ? t[0] : 1.0 - t[0])
+            * (corner & 2 ? t[1] : 1.0 - t[1])
+            * (corner & 4 ? t[2] : 1.0 - t[2]);
+        const float* v = impl->velocity(ix, iy, iz);
+        out_flow += w * Vector3(v[0], v[1], v[2]);
+    }
+    return true;
+}
+
+
+void FlowField::prefetch() const
+{
+    if(!impl->mappedData) {
+        return;
+    }
+
+    // hint the kernel and then touch every page so that the file is read
+    // here rather than on the first sample of the simulation thread
+    madvise(impl->mappedData, impl->mappedSize, MADV_WILLNEED);
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    const volatile char* data = static_cast<const char*>(impl->mappedData);
+    char sum = 0;
+    for(size_t i = 0; i < impl->mappedSize; i += pageSize) {
+        sum += data[i];
+    }
+    (void)sum;
+}
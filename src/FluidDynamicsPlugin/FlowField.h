@@ -0,0 +1,59 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_FLUID_DYNAMICS_PLUGIN_FLOW_FIELD_H
+#define CNOID_FLUID_DYNAMICS_PLUGIN_FLOW_FIELD_H
+
+#include <cnoid/EigenTypes>
+#include <cnoid/Referenced>
+#include <string>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class FlowFieldImpl;
+
+/**
+   Velocity field on a regular 3D grid, memory-mapped from a binary file.
+
+   The file starts with a 68 byte little-endian header:
+     char[4]   "CNFF"
+     uint32    version (1)
+     int32[3]  number of grid points along x, y and z
+     float64[3] world position of the first grid point
+     float64[3] grid spacing along x, y and z
+   followed by nx * ny * nz velocities stored as three float32 values,
+   with x varying fastest. The data is not copied; pages are read from
+   the file as the field is sampled.
+*/
+class CNOID_EXPORT FlowField : public Referenced
+{
+public:
+    FlowField();
+    virtual ~FlowField();
+
+    bool load(const std::string& filename, std::string& out_errorMessage);
+    void clear();
+    bool isValid() const;
+    const std::string& filename() const;
+
+    Vector3 origin() const;
+    Vector3 spacing() const;
+    int size(const int& axis) const;
+
+    bool sample(const Vector3& p, Vector3& out_flow) const;
+    void prefetch() const;
+
+private:
+    FlowField(const FlowField& org);
+    FlowFieldImpl* impl;
+    friend class FlowFieldImpl;
+};
+
+typedef ref_ptr<FlowField> FlowFieldPtr;
+
+}
+
+#endif // CNOID_FLUID_DYNAMICS_PLUGIN_FLOW_FIELD_H
@@ -0,0 +1,403 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "FlowFieldSequence.h"
+#include <cnoid/LazyCaller>
+#include <cnoid/MessageView>
+#include <cnoid/YAMLReader>
+#include <cnoid/stdx/filesystem>
+#include <fmt/format.h>
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+namespace filesystem = cnoid::stdx::filesystem;
+
+namespace {
+
+// snapshots kept mapped ahead of the current one
+const int NumResidentSnapshots = 3;
+
+struct Snapshot
+{
+    double time;
+    string filename;
+};
+
+}
+
+
+namespace cnoid {
+
+class FlowFieldSequenceImpl
+{
+public:
+    FlowFieldSequenceImpl(FlowFieldSequence* self);
+    ~FlowFieldSequenceImpl();
+
+    FlowFieldSequence* self;
+    vector<Snapshot> snapshots;
+    bool isLoop;
+
+    // state owned by the simulation thread
+    int currentIndex;
+    FlowFieldPtr currentField;
+    FlowFieldPtr nextField;
+    double ratio;
+
+    // state shared with the prefetch thread
+    thread prefetchThread;
+    mutex prefetchMutex;
+    condition_variable prefetchCondition;
+    deque<int> requests;
+    map<int, FlowFieldPtr> resident;
+    set<int> failedIndices;
+    int loadingIndex;
+    bool isStopping;
+
+    bool load(const string& filename, string& out_errorMessage);
+    void clear();
+    FlowFieldPtr loadSnapshot(const int& index);
+    void reset();
+    void update(const double& time);
+    int findSegment(const double& time) const;
+    int distance(const int& from, const int& to) const;
+    void request(const int& index);
+    void prefetch();
+    void startPrefetchThread();
+    void stopPrefetchThread();
+};
+
+}
+
+
+FlowFieldSequence::FlowFieldSequence()
+{
+    impl = new FlowFieldSequenceImpl(this);
+}
+
+
+FlowFieldSequenceImpl::FlowFieldSequenceImpl(FlowFieldSequence* self)
+    : self(self)
+{
+    loadingIndex = -1;
+    isStopping = false;
+    clear();
+}
+
+
+FlowFieldSequence::~FlowFieldSequence()
+{
+    delete impl;
+}
+
+
+FlowFieldSequenceImpl::~FlowFieldSequenceImpl()
+{
+    stopPrefetchThread();
+}
+
+
+bool FlowFieldSequence::load(const string& filename, string& out_errorMessage)
+{
+    return impl->load(filename, out_errorMessage);
+}
+
+
+bool FlowFieldSequenceImpl::load(const string& filename, string& out_errorMessage)
+{
+    stopPrefetchThread();
+    clear();
+
+    YAMLReader reader;
+    if(!reader.load(filename)) {
+        out_errorMessage = reader.errorMessage();
+        return false;
+    }
+    ValueNode* topNode = reader.document();
+    Listing* snapshotList = topNode->isMapping() ? topNode->toMapping()->findListing("snapshots") : nullptr;
+    if(!snapshotList || !snapshotList->isValid() || snapshotList->empty()) {
+        out_errorMessage = fmt::format(_("Flow field sequence \"{0}\" has no snapshots."), filename);
+        return false;
+    }
+
+    filesystem::path directory = filesystem::path(filename).parent_path();
+    for(int i = 0; i < snapshotList->size(); ++i) {
+        Mapping* info = snapshotList->at(i)->toMapping();
+        Snapshot snapshot;
+        string file;
+        if(!info->read("time", snapshot.time) || !info->read("file", file)) {
+            out_errorMessage = fmt::format(_("Snapshot {0} of flow field sequence \"{1}\" needs a time and a file."),
+                                           i, filename);
+            snapshots.clear();
+            return false;
+        }
+        filesystem::path path(file);
+        snapshot.filename = path.is_absolute() ? file : (directory / path).string();
+        snapshots.push_back(snapshot);
+    }
+    std::stable_sort(snapshots.begin(), snapshots.end(),
+                     [](const Snapshot& a, const Snapshot& b){ return a.time < b.time; });
+    isLoop = false;
+    topNode->toMapping()->read("loop", isLoop);
+
+    // the first pair is mapped here so that a simulation can start at once
+    FlowFieldPtr field = loadSnapshot(0);
+    if(!field) {
+        out_errorMessage = fmt::format(_("Flow field file \"{0}\" cannot be loaded."), snapshots[0].filename);
+        snapshots.clear();
+        return false;
+    }
+    resident[0] = field;
+    startPrefetchThread();
+    reset();
+    return true;
+}
+
+
+void FlowFieldSequenceImpl::clear()
+{
+    snapshots.clear();
+    isLoop = false;
+    currentIndex = -1;
+    currentField.reset();
+    nextField.reset();
+    ratio = 0.0;
+    requests.clear();
+    resident.clear();
+    failedIndices.clear();
+}
+
+
+int FlowFieldSequence::numSnapshots() const
+{
+    return impl->snapshots.size();
+}
+
+
+FlowFieldPtr FlowFieldSequenceImpl::loadSnapshot(const int& index)
+{
+    FlowFieldPtr field = new FlowField;
+    string message;
+    if(!field->load(snapshots[index].filename, message)) {
+        return nullptr;
+    }
+    field->prefetch();
+    return field;
+}
+
+
+void FlowFieldSequence::reset()
+{
+    impl->reset();
+}
+
+
+void FlowFieldSequenceImpl::reset()
+{
+    // called before a simulation starts, where waiting for the disk is fine
+    if(snapshots.empty()) {
+        return;
+    }
+    int numSnapshots = snapshots.size();
+    {
+        lock_guard<mutex> lock(prefetchMutex);
+        for(int i = 0; i < std::min(2, numSnapshots); ++i) {
+            if(resident.find(i) == resident.end()) {
+                FlowFieldPtr field = loadSnapshot(i);
+                if(field) {
+                    resident[i] = field;
+                }
+            }
+        }
+    }
+    currentIndex = -1;
+    update(snapshots.front().time);
+}
+
+
+void FlowFieldSequence::update(const double& time)
+{
+    impl->update(time);
+}
+
+
+int FlowFieldSequenceImpl::findSegment(const double& time) const
+{
+    auto next = std::upper_bound(snapshots.begin(), snapshots.end(), time,
+                                 [](const double& t, const Snapshot& s){ return t < s.time; });
+    int index = (int)(next - snapshots.begin()) - 1;
+    return std::max(0, std::min(index, (int)snapshots.size() - 1));
+}
+
+
+int FlowFieldSequenceImpl::distance(const int& from, const int& to) const
+{
+    int d = to - from;
+    if(isLoop && d < 0) {
+        d += snapshots.size();
+    }
+    return d;
+}
+
+
+void FlowFieldSequenceImpl::update(const double& time)
+{
+    if(snapshots.empty()) {
+        return;
+    }
+
+    int numSnapshots = snapshots.size();
+    double t = time;
+    double first = snapshots.front().time;
+    double period = snapshots.back().time - first;
+    if(isLoop && period > 0.0) {
+        t = first + fmod(std::max(time - first, 0.0), period);
+    }
+    int index = findSegment(t);
+    int nextIndex = index + 1 < numSnapshots ? index + 1 : -1;
+
+    if(index != currentIndex || !nextField) {
+        FlowFieldPtr field;
+        FlowFieldPtr next;
+        {
+            lock_guard<mutex> lock(prefetchMutex);
+            auto p = resident.find(index);
+            if(p != resident.end()) {
+                field = p->second;
+            }
+            if(nextIndex >= 0) {
+                auto q = resident.find(nextIndex);
+                if(q != resident.end()) {
+                    next = q->second;
+                }
+            }
+            // release the snapshots that are behind the current one
+            for(auto it = resident.begin(); it != resident.end(); ) {
+                int d = distance(index, it->first);
+                if(d < 0 || d >= NumResidentSnapshots) {
+                    it = resident.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        // keep the previous pair until the new one has been read
+        if(field) {
+            currentIndex = index;
+            currentField = field;
+            nextField = next;
+        }
+    }
+
+    for(int i = 0; i < NumResidentSnapshots; ++i) {
+        if(isLoop) {
+            request((index + i) % numSnapshots);
+        } else if(index + i < numSnapshots) {
+            request(index + i);
+        }
+    }
+
+    ratio = 0.0;
+    if(nextField) {
+        if(currentIndex == index) {
+            double interval = snapshots[index + 1].time - snapshots[index].time;
+            if(interval > 0.0) {
+                ratio = std::max(0.0, std::min(1.0, (t - snapshots[index].time) / interval));
+            }
+        } else {
+            // the time has passed the kept pair, so its later snapshot is
+            // held instead of going back to the earlier one
+            ratio = 1.0;
+        }
+    }
+}
+
+
+void FlowFieldSequenceImpl::request(const int& index)
+{
+    {
+        lock_guard<mutex> lock(prefetchMutex);
+        if(resident.find(index) != resident.end() || index == loadingIndex
+           || std::find(requests.begin(), requests.end(), index) != requests.end()) {
+            return;
+        }
+        requests.push_back(index);
+    }
+    prefetchCondition.notify_one();
+}
+
+
+void FlowFieldSequenceImpl::startPrefetchThread()
+{
+    isStopping = false;
+    prefetchThread = thread([this](){ prefetch(); });
+}
+
+
+void FlowFieldSequenceImpl::stopPrefetchThread()
+{
+    if(prefetchThread.joinable()) {
+        {
+            lock_guard<mutex> lock(prefetchMutex);
+            isStopping = true;
+        }
+        prefetchCondition.notify_all();
+        prefetchThread.join();
+    }
+}
+
+
+void FlowFieldSequenceImpl::prefetch()
+{
+    while(true) {
+        int index;
+        {
+            unique_lock<mutex> lock(prefetchMutex);
+            prefetchCondition.wait(lock, [&](){ return isStopping || !requests.empty(); });
+            if(isStopping) {
+                break;
+            }
+            index = requests.front();
+            requests.pop_front();
+            loadingIndex = index;
+        }
+
+        // map and read the file without holding the lock
+        FlowFieldPtr field = loadSnapshot(index);
+
+        lock_guard<mutex> lock(prefetchMutex);
+        if(field) {
+            resident[index] = field;
+        } else if(failedIndices.insert(index).second) {
+            // the snapshot is requested again, but its failure is reported once
+            string message = fmt::format(_("Flow field file \"{0}\" cannot be loaded."), snapshots[index].filename);
+            callLater([message](){ MessageView::instance()->putln(message, MessageView::Warning); });
+        }
+        loadingIndex = -1;
+    }
+}
+
+
+bool FlowFieldSequence::sample(const Vector3& p, Vector3& out_flow) const
+{
+    if(!impl->currentField || !impl->currentField->sample(p, out_flow)) {
+        return false;
+    }
+    Vector3 next;
+    if(impl->ratio > 0.0 && impl->nextField->sample(p, next)) {
+        out_flow = (1.0 - impl->ratio) * out_flow + impl->ratio * next;
+    }
+    return true;
+}
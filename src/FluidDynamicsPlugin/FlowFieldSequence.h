@@ -0,0 +1,53 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_FLUID_DYNAMICS_PLUGIN_FLOW_FIELD_SEQUENCE_H
+#define CNOID_FLUID_DYNAMICS_PLUGIN_FLOW_FIELD_SEQUENCE_H
+
+#include "FlowField.h"
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class FlowFieldSequenceImpl;
+
+/**
+   Time series of flow field snapshots streamed from disk.
+
+   The sequence is described by a YAML file:
+     snapshots:
+       - { time: 0.0, file: pump_000.cnff }
+       - { time: 0.5, file: pump_001.cnff }
+     loop: true
+   Relative file names are resolved against the directory of the YAML
+   file. Only the two snapshots around the current time and the one after
+   them are kept mapped. A background thread maps and reads the next
+   snapshot ahead of time, so update() never waits for the disk; when a
+   snapshot is late the previous pair keeps being used.
+*/
+class CNOID_EXPORT FlowFieldSequence : public Referenced
+{
+public:
+    FlowFieldSequence();
+    virtual ~FlowFieldSequence();
+
+    bool load(const std::string& filename, std::string& out_errorMessage);
+    int numSnapshots() const;
+
+    void reset();
+    void update(const double& time);
+    bool sample(const Vector3& p, Vector3& out_flow) const;
+
+private:
+    FlowFieldSequence(const FlowFieldSequence& org);
+    FlowFieldSequenceImpl* impl;
+    friend class FlowFieldSequenceImpl;
+};
+
+typedef ref_ptr<FlowFieldSequence> FlowFieldSequencePtr;
+
+}
+
+#endif // CNOID_FLUID_DYNAMICS_PLUGIN_FLOW_FIELD_SEQUENCE_H
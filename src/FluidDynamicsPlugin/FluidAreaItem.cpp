@@ -8,17 +8,22 @@
 #include <cnoid/EigenArchive>
 #include <cnoid/FloatingNumberString>
 #include <cnoid/ItemManager>
+#include <cnoid/MessageView>
 #include <cnoid/PutPropertyFunction>
 #include <cnoid/YAMLReader>
 #include <cnoid/YAMLWriter>
+#include <cnoid/stdx/filesystem>
+#include "FlowField.h"
+#include "FlowFieldSequence.h"
 #include "gettext.h"
 
 using namespace std;
 using namespace cnoid;
+namespace filesystem = cnoid::stdx::filesystem;
 
 namespace {
 
-void loadItem(Mapping& node, FluidAreaItem* item)
+void loadItem(Mapping& node, FluidAreaItem* item, const filesystem::path& directory)
 {
     string s;
     Vector3 v;
@@ -28,6 +33,11 @@ void loadItem(Mapping& node, FluidAreaItem* item)
     if(node.read("density", d)) item->setDensity(d);
     if(node.read("viscosity", d)) item->setViscosity(d);
     if(read(node, "flow", v)) item->setFlow(v);
+    if(node.read("flowField", s)) {
+        // a relative path is relative to the file of the area
+        filesystem::path path(s);
+        item->setFlowFieldFile(path.is_absolute() || s.empty() ? s : (directory / path).string());
+    }
 
     if(node.read("name", s)) item->setName(s);
     if(read(node, "translation", v)) item->setTranslation(v);
@@ -56,7 +66,7 @@ bool loadDocument(const string& filename)
             for(int i = 0; i < fluidList->size(); i++) {
                 FluidAreaItem* item = new FluidAreaItem();
                 Mapping* info = fluidList->at(i)->toMapping();
-                loadItem(*info, item);
+                loadItem(*info, item, filesystem::path(filename).parent_path());
             }
         }
     }
@@ -73,7 +83,7 @@ bool loadDocument(FluidAreaItem* item, const string& filename)
         if(fluidList->isValid()) {
             for(int i = 0; i < fluidList->size(); i++) {
                 Mapping* info = fluidList->at(i)->toMapping();
-                loadItem(*info, item);
+                loadItem(*info, item, filesystem::path(filename).parent_path());
             }
         }
     }
@@ -106,10 +116,14 @@ public:
     FloatingNumberString density;
     FloatingNumberString viscosity;
     Vector3 flow;
+    string flowFieldFile;
+    FlowFieldPtr flowField;
+    FlowFieldSequencePtr flowFieldSequence;
 
     void doPutProperties(PutPropertyFunction& putProperty);
     bool store(Archive& archive);
     bool restore(const Archive& archive);
+    bool loadFlowField(const string& filename);
 };
 
 }
@@ -127,6 +141,7 @@ FluidAreaItemImpl::FluidAreaItemImpl(FluidAreaItem* self)
     density = 0.0;
     viscosity = 0.0;
     flow << 0.0, 0.0, 0.0;
+    flowFieldFile.clear();
 }
 
 
@@ -144,6 +159,20 @@ FluidAreaItemImpl::FluidAreaItemImpl(FluidAreaItem* self, const FluidAreaItemImp
     density = org.density;
     viscosity = org.viscosity;
     flow = org.flow;
+    flowFieldFile = org.flowFieldFile;
+    flowField = org.flowField;
+
+    // a sequence keeps the time of the simulation using it, so the copy
+    // reads its own one instead of sharing it
+    if(org.flowFieldSequence) {
+        string message;
+        FlowFieldSequencePtr sequence = new FlowFieldSequence;
+        if(sequence->load(flowFieldFile, message)) {
+            flowFieldSequence = sequence;
+        } else {
+            MessageView::instance()->putln(message, MessageView::Warning);
+        }
+    }
 }
 
 
@@ -203,6 +232,64 @@ Vector3 FluidAreaItem::flow() const
 }
 
 
+bool FluidAreaItem::setFlowFieldFile(const string& filename)
+{
+    return impl->loadFlowField(filename);
+}
+
+
+string FluidAreaItem::flowFieldFile() const
+{
+    return impl->flowFieldFile;
+}
+
+
+FlowField* FluidAreaItem::flowField() const
+{
+    return impl->flowField;
+}
+
+
+FlowFieldSequence* FluidAreaItem::flowFieldSequence() const
+{
+    return impl->flowFieldSequence;
+}
+
+
+bool FluidAreaItemImpl::loadFlowField(const string& filename)
+{
+    // a running simulation keeps sampling the field it took at its start,
+    // so a new field takes effect at the next run
+    flowFieldFile = filename;
+    flowField.reset();
+    flowFieldSequence.reset();
+    if(filename.empty()) {
+        return true;
+    }
+
+    // a YAML file lists the snapshots of a time-varying field
+    string extension = filesystem::path(filename).extension().string();
+    string message;
+    if(extension == ".yaml" || extension == ".yml") {
+        FlowFieldSequencePtr sequence = new FlowFieldSequence;
+        if(!sequence->load(filename, message)) {
+            MessageView::instance()->putln(message, MessageView::Warning);
+            return false;
+        }
+        flowFieldSequence = sequence;
+        return true;
+    }
+
+    FlowFieldPtr field = new FlowField;
+    if(!field->load(filename, message)) {
+        MessageView::instance()->putln(message, MessageView::Warning);
+        return false;
+    }
+    flowField = field;
+    return true;
+}
+
+
 bool FluidAreaItem::load(FluidAreaItem* item, const string& filename)
 {
     if(!loadDocument(item, filename)) {
@@ -237,6 +324,9 @@ bool FluidAreaItem::save(FluidAreaItem* item, const string& filename)
         writer.putKeyValue("density", item->density());
         writer.putKeyValue("visocosity", item->viscosity());
         putKeyVector3(&writer, "flow", item->flow());
+        if(!item->flowFieldFile().empty()) {
+            writer.putKeyValue("flowField", item->flowFieldFile());
+        }
         putKeyVector3(&writer, "diffuseColor", item->diffuseColor());
         putKeyVector3(&writer, "emissiveColor", item->emissiveColor());
         putKeyVector3(&writer, "specularColor", item->specularColor());
@@ -271,6 +361,8 @@ void FluidAreaItemImpl::doPutProperties(PutPropertyFunction& putProperty)
     putProperty(_("Viscosity"), viscosity,
                 [&](const string& v){ return viscosity.setNonNegativeValue(v); });
     putProperty(_("Flow"), str(flow), [&](const string& v){ return toVector3(v, flow); });
+    putProperty(_("Flow field"), flowFieldFile,
+                [&](const string& v){ loadFlowField(v); return true; });
 }
 
 
@@ -286,6 +378,9 @@ bool FluidAreaItemImpl::store(Archive& archive)
     archive.write("density", density);
     archive.write("viscosity", viscosity);
     write(archive, "flow", flow);
+    if(!flowFieldFile.empty()) {
+        archive.writeRelocatablePath("flowField", flowFieldFile);
+    }
     return true;
 }
 
@@ -302,5 +397,9 @@ bool FluidAreaItemImpl::restore(const Archive& archive)
     density = archive.get("density", density.string());
     viscosity = archive.get("viscosity", viscosity.string());
     read(archive, "flow", flow);
+    string filename;
+    if(archive.readRelocatablePath("flowField", filename)) {
+        loadFlowField(filename);
+    }
     return true;
 }
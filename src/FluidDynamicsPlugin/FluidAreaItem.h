@@ -10,6 +10,8 @@
 
 namespace cnoid {
 
+class FlowField;
+class FlowFieldSequence;
 class FluidAreaItemImpl;
 
 class FluidAreaItem : public AreaItem
@@ -27,6 +29,10 @@ public:
     double viscosity() const;
     void setFlow(const Vector3& flow);
     Vector3 flow() const;
+    bool setFlowFieldFile(const std::string& filename);
+    std::string flowFieldFile() const;
+    FlowField* flowField() const;
+    FlowFieldSequence* flowFieldSequence() const;
 
     static bool load(FluidAreaItem* item, const std::string& filename);
     static bool save(FluidAreaItem* item, const std::string& filename);
@@ -6,23 +6,45 @@
 #include "FluidDynamicsSimulatorItem.h"
 #include <cnoid/Archive>
 #include <cnoid/Body>
+#include <cnoid/ConnectionSet>
 #include <cnoid/EigenArchive>
 #include <cnoid/EigenUtil>
 #include <cnoid/ItemManager>
+#include <cnoid/PutPropertyFunction>
 #include <cnoid/RootItem>
 #include <cnoid/SimulatorItem>
+#include <cnoid/StageProfiler>
 #include <cnoid/WorldItem>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 #include <cmath>
+#include "AreaGrid.h"
 #include "FDBody.h"
+#include "FDDeviceArray.h"
+#include "FDLinkArray.h"
+#include "FDLinkShape.h"
+#include "FlowFieldSequence.h"
 #include "FluidAreaItem.h"
+#include "ImmersionVolume.h"
 #include "Rotor.h"
 #include "Thruster.h"
+#include "WorkerPool.h"
 #include "gettext.h"
 
+#define LINK_CHUNK_SIZE 64
+
 using namespace std;
 using namespace cnoid;
 
+namespace {
+
+enum ProfileStage { FlowFieldStage, LinkStage, DeviceStage };
+
+}
+
 namespace cnoid {
 
 class FluidDynamicsSimulatorItemImpl
@@ -32,19 +54,48 @@ public:
     FluidDynamicsSimulatorItemImpl(FluidDynamicsSimulatorItem* self, const FluidDynamicsSimulatorItemImpl& org);
 
     FluidDynamicsSimulatorItem* self;
-    FluidAreaItem* isCollided(const Link* link);
+    SimulatorItem* simulatorItem;
     Vector3 gravity;
     std::vector<FDBody*> fdBodies;
+    FDLinkArray fdLinks;
     ItemList<FluidAreaItem> items;
     DeviceList<Thruster> thrusters;
     DeviceList<Rotor> rotors;
+    std::unique_ptr<AreaGrid> areaGrid;
+    std::unique_ptr<AreaGrid> builtAreaGrid;
+    std::mutex areaGridMutex;
+    std::atomic<bool> isAreaGridBuilt;
+    ScopedConnectionSet areaConnections;
+    std::vector<int> linkAreas;
+    FDDeviceArray devices;
+    int numThreads;
+    WorkerPool workerPool;
+    bool isPartialImmersionEnabled;
+    int immersionResolution;
+    std::vector<ImmersionVolumePtr> immersionVolumes;
+    std::vector<double> areaDensities;
+    std::vector<double> areaViscosities;
+    std::vector<Vector3> areaFlows;
+    std::vector<FlowFieldPtr> flowFields;
+    std::vector<FlowFieldSequencePtr> flowFieldSequences;
+    bool isCoefficientDerivationEnabled;
+    int shapeResolution;
+    bool isImplicitDragEnabled;
+    StageProfiler profiler;
 
     bool initializeSimulation(SimulatorItem* simulatorItem);
+    void finalizeSimulation();
     void doPutProperties(PutPropertyFunction& putProperty);
     bool store(Archive& archive);
     bool restore(const Archive& archive);
     void onPreDynamicsFunction();
     void createFDBody(Body* body);
+    void buildAreaGrid();
+    void takeAreaGrid();
+    void deriveCoefficients();
+    void updateFDLinks(const int& begin, const int& end);
+    void updateBuoyancy(const int& index);
+    Vector3 sampleFlow(const int& area, const Vector3& p) const;
 };
 
 }
@@ -59,11 +110,30 @@ FluidDynamicsSimulatorItem::FluidDynamicsSimulatorItem()
 FluidDynamicsSimulatorItemImpl::FluidDynamicsSimulatorItemImpl(FluidDynamicsSimulatorItem* self)
     : self(self)
 {
+    simulatorItem = nullptr;
     gravity << 0.0, 0.0, -9.80665;
     fdBodies.clear();
     items.clear();
     thrusters.clear();
     rotors.clear();
+    isAreaGridBuilt = false;
+    linkAreas.clear();
+    numThreads = 1;
+    isPartialImmersionEnabled = false;
+    immersionResolution = 16;
+    immersionVolumes.clear();
+    areaDensities.clear();
+    areaViscosities.clear();
+    areaFlows.clear();
+    flowFields.clear();
+    flowFieldSequences.clear();
+    isCoefficientDerivationEnabled = false;
+    shapeResolution = 64;
+    isImplicitDragEnabled = false;
+    profiler.setTextDomain(CNOID_GETTEXT_DOMAIN_NAME);
+    profiler.addStage(N_("flowFields"));
+    profiler.addStage(N_("links"));
+    profiler.addStage(N_("devices"));
 }
 
 
@@ -78,11 +148,27 @@ FluidDynamicsSimulatorItem::FluidDynamicsSimulatorItem(const FluidDynamicsSimula
 FluidDynamicsSimulatorItemImpl::FluidDynamicsSimulatorItemImpl(FluidDynamicsSimulatorItem* self, const FluidDynamicsSimulatorItemImpl& org)
     : self(self)
 {
+    simulatorItem = nullptr;
     gravity = org.gravity;
     fdBodies = org.fdBodies;
     items = org.items;
     thrusters = org.thrusters;
     rotors = org.rotors;
+    isAreaGridBuilt = false;
+    linkAreas.clear();
+    numThreads = org.numThreads;
+    isPartialImmersionEnabled = org.isPartialImmersionEnabled;
+    immersionResolution = org.immersionResolution;
+    immersionVolumes.clear();
+    areaDensities.clear();
+    areaViscosities.clear();
+    areaFlows.clear();
+    flowFields.clear();
+    flowFieldSequences.clear();
+    isCoefficientDerivationEnabled = org.isCoefficientDerivationEnabled;
+    shapeResolution = org.shapeResolution;
+    isImplicitDragEnabled = org.isImplicitDragEnabled;
+    profiler = org.profiler;
 }
 
 
@@ -107,167 +193,254 @@ bool FluidDynamicsSimulatorItem::initializeSimulation(SimulatorItem* simulatorIt
 
 bool FluidDynamicsSimulatorItemImpl::initializeSimulation(SimulatorItem* simulatorItem)
 {
+    this->simulatorItem = simulatorItem;
     gravity = simulatorItem->getGravity();
     fdBodies.clear();
     items.clear();
     thrusters.clear();
     rotors.clear();
+    fdLinks.clear();
+    areaGrid.reset();
+    areaConnections.disconnect();
+    linkAreas.clear();
+    devices.clear();
+    immersionVolumes.clear();
+    areaDensities.clear();
+    areaViscosities.clear();
+    areaFlows.clear();
+    flowFields.clear();
+    flowFieldSequences.clear();
+
+    unordered_map<Link*, int> linkIndexMap;
     vector<SimulationBody*> simulationBodies = simulatorItem->simulationBodies();
     for(size_t i = 0; i < simulationBodies.size(); i++) {
         Body* body = simulationBodies[i]->body();
         createFDBody(body);
         thrusters << body->devices();
         rotors << body->devices();
+        for(int j = 0; j < body->numLinks(); j++) {
+            int index = linkIndexMap.size();
+            linkIndexMap[body->link(j)] = index;
+        }
+    }
+    workerPool.setNumThreads(numThreads);
+    if(isCoefficientDerivationEnabled) {
+        deriveCoefficients();
+    }
+    for(auto& fdBody : fdBodies) {
+        for(size_t j = 0; j < fdBody->numFDLinks(); j++) {
+            fdLinks.addFDLink(fdBody->fdLink(j));
+        }
+    }
+    fdLinks.setImplicitDrag(isImplicitDragEnabled, simulatorItem->worldTimeStep());
+    linkAreas.resize(linkIndexMap.size(), -1);
+    for(int i = 0; i < thrusters.size(); i++) {
+        devices.addThruster(thrusters[i], linkIndexMap[thrusters[i]->link()]);
+    }
+    for(int i = 0; i < rotors.size(); i++) {
+        devices.addRotor(rotors[i], linkIndexMap[rotors[i]->link()]);
+    }
+
+    if(isPartialImmersionEnabled) {
+        immersionVolumes.resize(fdLinks.size());
+        for(int i = 0; i < fdLinks.size(); i++) {
+            ImmersionVolumePtr volume = new ImmersionVolume;
+            if(volume->build(fdLinks.link(i), immersionResolution)) {
+                immersionVolumes[i] = volume;
+            }
+        }
     }
 
     if(fdBodies.size()) {
         RootItem* rootItem = RootItem::instance();
         items = rootItem->checkedItems<FluidAreaItem>();
+        for(int i = 0; i < items.size(); i++) {
+            FluidAreaItem* item = items[i];
+            // the fields are taken here, so loading another field into an
+            // area during the run does not replace one being sampled
+            flowFields.push_back(item->flowField());
+            flowFieldSequences.push_back(item->flowFieldSequence());
+            if(flowFieldSequences.back()) {
+                flowFieldSequences.back()->reset();
+            }
+            areaConnections.add(
+                item->sigUpdated().connect([&](){ buildAreaGrid(); }));
+            areaConnections.add(
+                item->sigTreePathChanged().connect([&](){ buildAreaGrid(); }));
+        }
+        buildAreaGrid();
+        takeAreaGrid();
+        areaDensities.resize(items.size(), 0.0);
+        areaViscosities.resize(items.size(), 0.0);
+        areaFlows.resize(items.size(), Vector3::Zero());
+        profiler.initialize(self, simulatorItem->worldTimeStep());
         simulatorItem->addPreDynamicsFunction([&](){ onPreDynamicsFunction(); });
     }
     return true;
 }
 
 
-void FluidDynamicsSimulatorItemImpl::onPreDynamicsFunction()
+void FluidDynamicsSimulatorItem::finalizeSimulation()
+{
+    impl->finalizeSimulation();
+}
+
+
+void FluidDynamicsSimulatorItemImpl::finalizeSimulation()
+{
+    areaConnections.disconnect();
+    profiler.finalize();
+}
+
+
+void FluidDynamicsSimulatorItemImpl::deriveCoefficients()
 {
-    for(size_t i = 0; i < fdBodies.size(); i++) {
-        FDBody* fdBody = fdBodies[i];
-        for(int j = 0; j < fdBody->numFDLinks(); j++) {
+    vector<FDLink*> targets;
+    for(auto& fdBody : fdBodies) {
+        for(size_t j = 0; j < fdBody->numFDLinks(); j++) {
             FDLink* fdLink = fdBody->fdLink(j);
-            Link* link = fdLink->link();
-            double density = 0.0;
-            double viscosity = 0.0;
-
-            //flow
-            Vector3 ff = Vector3::Zero();
-            FluidAreaItem* item = isCollided(link);
-            if(item) {
-                density = item->density();
-                viscosity = item->viscosity();
-                ff = item->flow();
-            }
-            link->f_ext() += ff;
-            Vector3 cr = link->T() * Vector3(0.0, 0.0, 0.0);
-            link->tau_ext() += cr.cross(ff);
-
-            // buoyancy
-            double volume = 0.0;
-            if(fdLink->density() != 0.0) {
-                volume = link->mass() / fdLink->density();
-            }
-            Vector3 fb = density * gravity * volume * -1.0;
-            link->f_ext() += fb;
-            Vector3 cb = link->T() * fdLink->centerOfBuoyancy();
-            link->tau_ext() += cb.cross(fb);
-
-            Vector3 v = link->v();
-            Vector3 w = link->w();
-            double cd = 0.0;
-            if(density > 10.0) {
-                cd = fdLink->cdw();
-            } else {
-                cd = fdLink->cda();
+            Mapping& node = *fdLink->link()->info();
+            if(!node.find("density")->isValid() || !node.find("centerOfBuoyancy")->isValid()
+               || !node.find("surface")->isValid()) {
+                targets.push_back(fdLink);
             }
+        }
+    }
 
-            //drag
-            Vector3 fd = Vector3::Zero();
-            Vector3 td = Vector3::Zero();
-            //viscous drag
-            Vector3 fv = Vector3::Zero();
-            Vector3 tv = Vector3::Zero();
-
-            // Force
-            for(int k = 0; k < 3; ++k) {
-                double sign = 1.0;
-                int index = 1;
-                if(v[k] >= 0.0) {
-                    sign = -1.0;
-                    index = 0;
-                }
-                fd[k] = 0.5 * density * v[k] * v[k] * fdLink->surface()[k * 2 + index] * cd * sign;
-                double cv = fdLink->cv();
-                fv[k] = cv * viscosity * fabs(v[k]) * sign;
-            }
+    string cacheDirectory = FDLinkShape::defaultCacheDirectory();
+    vector<FDLinkShapePtr> shapes(targets.size());
+    workerPool.run(targets.size(), [&](int i){
+        FDLinkShapePtr shape = new FDLinkShape;
+        if(shape->build(targets[i]->link(), shapeResolution, cacheDirectory)) {
+            shapes[i] = shape;
+        }
+    });
 
-            // Moment
-            for(int k = 0; k < 3; ++k) {
-                double sign = 1.0;
-                int index = 1;
-                int index0 = (k + 1) % 3;
-                int index1 = (k + 2) % 3;
-                if(w[k] >= 0.0) {
-                    sign = -1.0;
-                    index = 0;
-                }
-                td[k] = density * w[k] * w[k] * (fdLink->surface()[index0 * 2 + index] + fdLink->surface()[index1 * 2 + index]) * fdLink->td() * sign;
-                double cv = fdLink->cv();
-                tv[k] = cv * viscosity * fabs(w[k]) * sign;
-            }
+    // hand-written entries in the link info take precedence
+    for(size_t i = 0; i < targets.size(); i++) {
+        FDLinkShape* shape = shapes[i];
+        if(!shape) {
+            continue;
+        }
+        FDLink* fdLink = targets[i];
+        Link* link = fdLink->link();
+        Mapping& node = *link->info();
+        if(!node.find("density")->isValid() && shape->volume() > 0.0) {
+            fdLink->setDensity(link->mass() / shape->volume());
+        }
+        if(!node.find("centerOfBuoyancy")->isValid() && shape->volume() > 0.0) {
+            fdLink->setCenterOfBuoyancy(shape->centroid());
+        }
+        if(!node.find("surface")->isValid()) {
+            fdLink->setSurface(shape->surface());
+        }
+    }
+}
+
+
+void FluidDynamicsSimulatorItemImpl::buildAreaGrid()
+{
+    // an edited area is read here on the main thread, and the simulation
+    // thread only swaps in the finished grid
+    unique_ptr<AreaGrid> grid(new AreaGrid);
+    for(int i = 0; i < items.size(); i++) {
+        grid->addArea(items[i]);
+    }
+    grid->build();
+
+    lock_guard<mutex> lock(areaGridMutex);
+    builtAreaGrid = std::move(grid);
+    isAreaGridBuilt.store(true, memory_order_release);
+}
 
-            link->f_ext() += fd;
-            link->tau_ext() += cr.cross(fd) + td;
-            link->f_ext() += fv;
-            link->tau_ext() += cr.cross(fv) + tv;
+
+void FluidDynamicsSimulatorItemImpl::takeAreaGrid()
+{
+    if(isAreaGridBuilt.exchange(false, memory_order_acq_rel)) {
+        lock_guard<mutex> lock(areaGridMutex);
+        // a grid built after the exchange was taken with the previous one
+        if(builtAreaGrid) {
+            areaGrid = std::move(builtAreaGrid);
         }
     }
+}
+
 
-    // Thruster
-    for(int k = 0; k < thrusters.size(); k++) {
-        Thruster* thruster = thrusters[k];
-        Link* link = thruster->link();
-        FluidAreaItem* item = isCollided(link);
-        if(item) {
-            double density = item->density();
-            if(density > 10.0) {
-                Matrix3 R = link->R() * thruster->R_local();
-                const Vector3 f = R * (Vector3::UnitX() * (thruster->force() + thruster->forceOffset()));
-                const Vector3 p = link->T() * thruster->p_local();
-                Vector3 tau_ext = R * (Vector3::UnitX() * (thruster->torque() + thruster->torqueOffset()));
-                if(thruster->on()) {
-                    link->f_ext() += f;
-                    link->tau_ext() += p.cross(f) + tau_ext;
-                }
+void FluidDynamicsSimulatorItemImpl::onPreDynamicsFunction()
+{
+    takeAreaGrid();
+
+    {
+        // time-varying flow fields advance here, before the links sample them
+        StageProfiler::ScopedTimer timer(profiler, FlowFieldStage);
+        double time = simulatorItem->currentTime();
+        // the properties are copied once a frame, so the worker threads
+        // below never read the items
+        for(int i = 0; i < items.size(); i++) {
+            areaDensities[i] = items[i]->density();
+            areaViscosities[i] = items[i]->viscosity();
+            areaFlows[i] = items[i]->flow();
+            if(flowFieldSequences[i]) {
+                flowFieldSequences[i]->update(time);
             }
         }
     }
 
-    // Rotor
-    for(int k = 0; k < rotors.size(); k++) {
-        Rotor* rotor = rotors[k];
-        Link* link = rotor->link();
-        FluidAreaItem* item = isCollided(link);
-        if(item) {
-            double density = item->density();
-            if(density < 10.0) {
-                double n = rotor->kv() * rotor->voltage();
-                double d3 = rotor->diameter() / 10.0;
-                double p1 = rotor->pitch() / 10.0;
-                double k = rotor->k();
-                double g = fabs(gravity[2]);
-                if(n <= 0.0) {
-                    n = link->dq_target() * 30.0 / PI;
-                } else {
-                    double dir = 1.0;
-                    if(rotor->reverse()) {
-                        dir *= -1.0;
-                    }
-                    link->dq_target() = n * PI / 30.0 * dir;
-                }
-                double n2 = n / 1000.0;
-                double staticForce = k * d3 * d3 * d3 * p1 * n2 * n2 * g / 1000.0;
-
-                Matrix3 R = link->R() * rotor->R_local();
-                const Vector3 f = R * (Vector3::UnitZ() * (rotor->force() + rotor->forceOffset() + staticForce));
-                const Vector3 p = link->T() * rotor->p_local();
-                Vector3 tau_ext = R * (Vector3::UnitZ() * (rotor->torque() + rotor->torqueOffset()));
-                if(rotor->on()) {
-                    link->f_ext() += f;
-                    link->tau_ext() += p.cross(f) + tau_ext;
-                }
-            }
+    {
+        // each chunk of links writes only to its own links, so the result
+        // does not depend on the number of threads or the order of the chunks
+        StageProfiler::ScopedTimer timer(profiler, LinkStage);
+        int numLinks = fdLinks.size();
+        int numChunks = (numLinks + LINK_CHUNK_SIZE - 1) / LINK_CHUNK_SIZE;
+        workerPool.run(numChunks, [&](int chunk){
+            int begin = chunk * LINK_CHUNK_SIZE;
+            updateFDLinks(begin, std::min(begin + LINK_CHUNK_SIZE, numLinks));
+        });
+    }
+
+    {
+        StageProfiler::ScopedTimer timer(profiler, DeviceStage);
+        devices.update(gravity, linkAreas, areaDensities);
+    }
+
+    profiler.endFrame();
+}
+
+
+void FluidDynamicsSimulatorItemImpl::updateFDLinks(const int& begin, const int& end)
+{
+    for(int i = begin; i < end; i++) {
+        double density = 0.0;
+        double viscosity = 0.0;
+        Vector3 flow = Vector3::Zero();
+        Link* link = fdLinks.link(i);
+        int area = areaGrid->findArea(link->T().translation());
+        linkAreas[i] = area;
+        if(area >= 0) {
+            density = areaDensities[area];
+            viscosity = areaViscosities[area];
+            flow = sampleFlow(area, link->T().translation());
+        }
+        fdLinks.setFluid(i, density, viscosity, flow);
+        if(isPartialImmersionEnabled) {
+            updateBuoyancy(i);
         }
     }
+
+    // flow, buoyancy, drag and viscous drag
+    fdLinks.update(gravity, begin, end);
+}
+
+
+void FluidDynamicsSimulatorItemImpl::updateBuoyancy(const int& index)
+{
+    ImmersionVolume* volume = immersionVolumes[index];
+    if(!volume) {
+        return;
+    }
+    Vector3 shift;
+    double density = volume->submerge(fdLinks.link(index)->T(), *areaGrid, areaDensities, shift);
+    fdLinks.setBuoyancy(index, density, fdLinks.centerOfBuoyancy(index) + shift);
 }
 
 
@@ -299,53 +472,16 @@ void FluidDynamicsSimulatorItemImpl::createFDBody(Body* body)
 }
 
 
-FluidAreaItem* FluidDynamicsSimulatorItemImpl::isCollided(const Link* link)
+Vector3 FluidDynamicsSimulatorItemImpl::sampleFlow(const int& area, const Vector3& p) const
 {
-    FluidAreaItem* targetItem = nullptr;
-
-    for(int k = 0; k < items.size(); k++) {
-        FluidAreaItem* item = items[k];
-        Vector3 p = link->T().translation();
-        Vector3 translation = item->translation();
-        Vector3 rpy = item->rotation() * TO_RADIAN;
-        Matrix3 m = rotFromRpy(rpy);
-
-        if(item->type() == AreaItem::BOX) {
-            Vector3 size = item->size();
-            Vector3 minRange = translation - size / 2.0;
-            Vector3 maxRange = translation + size / 2.0;
-            if((minRange[0] <= p[0]) && (p[0] <= maxRange[0])
-                    && (minRange[1] <= p[1]) && (p[1] <= maxRange[1])
-                    && (minRange[2] <= p[2]) && (p[2] <= maxRange[2])
-                    ) {
-                targetItem = item;
-            }
-        } else if(item->type() == AreaItem::CYLINDER) {
-            Vector3 a = m * (Vector3(0.0, 1.0, 0.0) * item->height() / 2.0) + translation;
-            Vector3 b = m * (Vector3(0.0, 1.0, 0.0) * item->height() / 2.0 * -1.0) + translation;
-            Vector3 c = a - b;
-            Vector3 d = p - b;
-            double cd = c.dot(d);
-            if((0.0 < cd) && (cd < c.dot(c))) {
-                double r2 = d.dot(d) - d.dot(c) * d.dot(c) / c.dot(c);
-                double rp2 =  item->radius() * item->radius();
-                if(r2 < rp2) {
-                    targetItem = item;
-                }
-            }
-        } else if(item->type() == AreaItem::SPHERE) {
-            Vector3 r = translation - p;
-            if(r.norm() <= item->radius()) {
-                targetItem = item;
-            }
-        }
-        WorldItem* worldItem = item->findOwnerItem<WorldItem>();
-        if(!worldItem) {
-            targetItem = nullptr;
-        }
+    Vector3 flow;
+    if(flowFields[area] && flowFields[area]->sample(p, flow)) {
+        return flow;
     }
-
-    return targetItem;
+    if(flowFieldSequences[area] && flowFieldSequences[area]->sample(p, flow)) {
+        return flow;
+    }
+    return areaFlows[area];
 }
 
 
@@ -364,7 +500,17 @@ void FluidDynamicsSimulatorItem::doPutProperties(PutPropertyFunction& putPropert
         
 void FluidDynamicsSimulatorItemImpl::doPutProperties(PutPropertyFunction& putProperty)
 {
-
+    putProperty.min(1)(_("Number of threads"), numThreads,
+                       [&](int value){ numThreads = value; return true; });
+    putProperty(_("Partial immersion"), isPartialImmersionEnabled, changeProperty(isPartialImmersionEnabled));
+    putProperty.min(1)(_("Immersion resolution"), immersionResolution,
+                       [&](int value){ immersionResolution = value; return true; });
+    putProperty(_("Derive coefficients"), isCoefficientDerivationEnabled,
+                changeProperty(isCoefficientDerivationEnabled));
+    putProperty.min(1)(_("Shape resolution"), shapeResolution,
+                       [&](int value){ shapeResolution = value; return true; });
+    putProperty(_("Implicit drag"), isImplicitDragEnabled, changeProperty(isImplicitDragEnabled));
+    profiler.putProperties(putProperty);
 }
 
 
@@ -377,6 +523,13 @@ bool FluidDynamicsSimulatorItem::store(Archive& archive)
 
 bool FluidDynamicsSimulatorItemImpl::store(Archive& archive)
 {
+    archive.write("numThreads", numThreads);
+    archive.write("partialImmersion", isPartialImmersionEnabled);
+    archive.write("immersionResolution", immersionResolution);
+    archive.write("deriveCoefficients", isCoefficientDerivationEnabled);
+    archive.write("shapeResolution", shapeResolution);
+    archive.write("implicitDrag", isImplicitDragEnabled);
+    profiler.store(archive);
     return true;
 }
 
@@ -390,5 +543,12 @@ bool FluidDynamicsSimulatorItem::restore(const Archive& archive)
 
 bool FluidDynamicsSimulatorItemImpl::restore(const Archive& archive)
 {
+    archive.read("numThreads", numThreads);
+    archive.read("partialImmersion", isPartialImmersionEnabled);
+    archive.read("immersionResolution", immersionResolution);
+    archive.read("deriveCoefficients", isCoefficientDerivationEnabled);
+    archive.read("shapeResolution", shapeResolution);
+    archive.read("implicitDrag", isImplicitDragEnabled);
+    profiler.restore(archive);
     return true;
 }
@@ -0,0 +1,215 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "ImmersionVolume.h"
+#include <cnoid/MeshExtractor>
+#include <cnoid/SceneDrawables>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+using namespace cnoid;
+
+namespace cnoid {
+
+class ImmersionVolumeImpl
+{
+public:
+    ImmersionVolumeImpl(ImmersionVolume* self);
+
+    ImmersionVolume* self;
+    vector<Vector3> samples;
+    Vector3 centroid;
+    Vector3 center;
+    double radius;
+
+    bool build(Link* link, const int& resolution);
+};
+
+}
+
+
+ImmersionVolume::ImmersionVolume()
+{
+    impl = new ImmersionVolumeImpl(this);
+}
+
+
+ImmersionVolumeImpl::ImmersionVolumeImpl(ImmersionVolume* self)
+    : self(self)
+{
+    samples.clear();
+    centroid << 0.0, 0.0, 0.0;
+    center << 0.0, 0.0, 0.0;
+    radius = 0.0;
+}
+
+
+ImmersionVolume::~ImmersionVolume()
+{
+    delete impl;
+}
+
+
+bool ImmersionVolume::build(Link* link, const int& resolution)
+{
+    return impl->build(link, resolution);
+}
+
+
+bool ImmersionVolumeImpl::build(Link* link, const int& resolution)
+{
+    samples.clear();
+    SgNode* shape = link->collisionShape();
+    if(!shape) {
+        return false;
+    }
+    MeshExtractor extractor;
+    SgMeshPtr mesh = extractor.integrate(shape);
+    if(!mesh || !mesh->hasVertices() || !mesh->numTriangles()) {
+        return false;
+    }
+
+    const SgVertexArray& vertices = *mesh->vertices();
+    Vector3 lower = vertices[0].cast<double>();
+    Vector3 upper = lower;
+    for(auto& vertex : vertices) {
+        lower = lower.cwiseMin(vertex.cast<double>());
+        upper = upper.cwiseMax(vertex.cast<double>());
+    }
+    center = (lower + upper) / 2.0;
+    radius = (upper - lower).norm() / 2.0;
+
+    double edge = (upper - lower).maxCoeff() / std::max(resolution, 1);
+    if(edge <= 0.0) {
+        return false;
+    }
+    int n[3];
+    for(int i = 0; i < 3; ++i) {
+        n[i] = std::max(1, (int)ceil((upper[i] - lower[i]) / edge));
+    }
+
+    // cast a ray along x through the centre of every (y, z) column and
+    // fill the voxels between pairs of crossings; the small offset keeps
+    // the rays off shared edges of the triangles
+    const double offset = edge * 1.0e-4;
+    auto columnY = [&](int j){ return lower[1] + (j + 0.5) * edge + offset; };
+    auto columnZ = [&](int k){ return lower[2] + (k + 0.5) * edge + offset; };
+    vector<vector<double>> crossings(n[1] * n[2]);
+
+    for(int t = 0; t < mesh->numTriangles(); ++t) {
+        auto triangle = mesh->triangle(t);
+        Vector3 a = vertices[triangle[0]].cast<double>();
+        Vector3 b = vertices[triangle[1]].cast<double>();
+        Vector3 c = vertices[triangle[2]].cast<double>();
+        double det = (b[1] - a[1]) * (c[2] - a[2]) - (c[1] - a[1]) * (b[2] - a[2]);
+        if(fabs(det) < 1.0e-20) {
+            continue;
+        }
+        int j0 = std::max(0, (int)floor((std::min({ a[1], b[1], c[1] }) - lower[1]) / edge - 0.5));
+        int j1 = std::min(n[1] - 1, (int)ceil((std::max({ a[1], b[1], c[1] }) - lower[1]) / edge - 0.5));
+        int k0 = std::max(0, (int)floor((std::min({ a[2], b[2], c[2] }) - lower[2]) / edge - 0.5));
+        int k1 = std::min(n[2] - 1, (int)ceil((std::max({ a[2], b[2], c[2] }) - lower[2]) / edge - 0.5));
+        for(int j = j0; j <= j1; ++j) {
+            for(int k = k0; k <= k1; ++k) {
+                double y = columnY(j) - a[1];
+                double z = columnZ(k) - a[2];
+                double u = (y * (c[2] - a[2]) - (c[1] - a[1]) * z) / det;
+                double v = ((b[1] - a[1]) * z - y * (b[2] - a[2])) / det;
+                if((u >= 0.0) && (v >= 0.0) && (u + v <= 1.0)) {
+                    crossings[j * n[2] + k].push_back(a[0] + u * (b[0] - a[0]) + v * (c[0] - a[0]));
+                }
+            }
+        }
+    }
+
+    Vector3 sum = Vector3::Zero();
+    for(int j = 0; j < n[1]; ++j) {
+        for(int k = 0; k < n[2]; ++k) {
+            vector<double>& xs = crossings[j * n[2] + k];
+            std::sort(xs.begin(), xs.end());
+            for(size_t m = 0; m + 1 < xs.size(); m += 2) {
+                for(int i = 0; i < n[0]; ++i) {
+                    double x = lower[0] + (i + 0.5) * edge;
+                    if((xs[m] <= x) && (x <= xs[m + 1])) {
+                        Vector3 sample(x, columnY(j) - offset, columnZ(k) - offset);
+                        samples.push_back(sample);
+                        sum += sample;
+                    }
+                }
+            }
+        }
+    }
+
+    if(samples.empty()) {
+        return false;
+    }
+    centroid = sum / samples.size();
+    return true;
+}
+
+
+int ImmersionVolume::numSamples() const
+{
+    return impl->samples.size();
+}
+
+
+const Vector3& ImmersionVolume::sample(const int& index) const
+{
+    return impl->samples[index];
+}
+
+
+const Vector3& ImmersionVolume::centroid() const
+{
+    return impl->centroid;
+}
+
+
+const Vector3& ImmersionVolume::center() const
+{
+    return impl->center;
+}
+
+
+double ImmersionVolume::radius() const
+{
+    return impl->radius;
+}
+
+
+double ImmersionVolume::submerge(const Isometry3& T, const AreaGrid& areaGrid, const vector<double>& densities,
+                                 Vector3& out_shift) const
+{
+    out_shift.setZero();
+    Vector3 center = T * impl->center;
+
+    // fast paths for volumes entirely in one area or away from all areas
+    int areaIndex = areaGrid.findArea(center, impl->radius);
+    if(areaIndex >= 0) {
+        return densities[areaIndex];
+    } else if(!areaGrid.overlaps(center, impl->radius)) {
+        return 0.0;
+    }
+
+    // near a boundary, weight each voxel with the density of its area and
+    // move the centre of buoyancy by the shift of the submerged centroid
+    double sum = 0.0;
+    Vector3 moment = Vector3::Zero();
+    for(auto& sample : impl->samples) {
+        int k = areaGrid.findArea(T * sample);
+        if(k >= 0) {
+            sum += densities[k];
+            moment += densities[k] * sample;
+        }
+    }
+    if(sum > 0.0) {
+        out_shift = moment / sum - impl->centroid;
+        return sum / impl->samples.size();
+    }
+    return 0.0;
+}
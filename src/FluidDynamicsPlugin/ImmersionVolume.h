@@ -0,0 +1,57 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_FLUID_DYNAMICS_PLUGIN_IMMERSION_VOLUME_H
+#define CNOID_FLUID_DYNAMICS_PLUGIN_IMMERSION_VOLUME_H
+
+#include <cnoid/EigenTypes>
+#include <cnoid/Link>
+#include <vector>
+#include "AreaGrid.h"
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class ImmersionVolumeImpl;
+
+/**
+   Voxelised volume of the collision shape of a link.
+   The centres of the voxels inside the shape are kept in link
+   coordinates together with the bounding sphere of the shape, so the
+   submerged part of the link can be estimated by testing the samples
+   against the fluid areas.
+   submerge() returns the density of the fluid averaged over the volume
+   placed at T, with densities[i] for the i-th area of the grid, and the
+   shift of the centre of buoyancy by the submerged part. A volume
+   entirely in one area or away from all areas is not sampled.
+*/
+class CNOID_EXPORT ImmersionVolume : public Referenced
+{
+public:
+    ImmersionVolume();
+    virtual ~ImmersionVolume();
+
+    bool build(Link* link, const int& resolution);
+
+    int numSamples() const;
+    const Vector3& sample(const int& index) const;
+    const Vector3& centroid() const;
+    const Vector3& center() const;
+    double radius() const;
+
+    double submerge(const Isometry3& T, const AreaGrid& areaGrid, const std::vector<double>& densities,
+                    Vector3& out_shift) const;
+
+private:
+    ImmersionVolume(const ImmersionVolume& org);
+    ImmersionVolumeImpl* impl;
+    friend class ImmersionVolumeImpl;
+};
+
+typedef ref_ptr<ImmersionVolume> ImmersionVolumePtr;
+
+}
+
+#endif // CNOID_FLUID_DYNAMICS_PLUGIN_IMMERSION_VOLUME_H
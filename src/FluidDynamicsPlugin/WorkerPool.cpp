@@ -0,0 +1,173 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "WorkerPool.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace cnoid;
+
+namespace cnoid {
+
+class WorkerPoolImpl
+{
+public:
+    WorkerPoolImpl(WorkerPool* self);
+    ~WorkerPoolImpl();
+
+    WorkerPool* self;
+    vector<thread> threads;
+    mutex jobMutex;
+    condition_variable jobCondition;
+    condition_variable doneCondition;
+    const function<void(int chunk)>* func;
+    int numChunks;
+    atomic<int> nextChunk;
+    int numBusyWorkers;
+    unsigned long generation;
+    bool isStopping;
+
+    void start(const int& numWorkers);
+    void stop();
+    void work(unsigned long lastGeneration);
+    void processChunks();
+};
+
+}
+
+
+WorkerPool::WorkerPool()
+{
+    impl = new WorkerPoolImpl(this);
+}
+
+
+WorkerPoolImpl::WorkerPoolImpl(WorkerPool* self)
+    : self(self),
+      nextChunk(0)
+{
+    func = nullptr;
+    numChunks = 0;
+    numBusyWorkers = 0;
+    generation = 0;
+    isStopping = false;
+}
+
+
+WorkerPool::~WorkerPool()
+{
+    delete impl;
+}
+
+
+WorkerPoolImpl::~WorkerPoolImpl()
+{
+    stop();
+}
+
+
+void WorkerPool::setNumThreads(const int& numThreads)
+{
+    int numWorkers = std::max(numThreads, 1) - 1;
+    if(numWorkers != (int)impl->threads.size()) {
+        impl->stop();
+        impl->start(numWorkers);
+    }
+}
+
+
+int WorkerPool::numThreads() const
+{
+    return impl->threads.size() + 1;
+}
+
+
+void WorkerPoolImpl::start(const int& numWorkers)
+{
+    isStopping = false;
+    for(int i = 0; i < numWorkers; ++i) {
+        threads.emplace_back([this, g = generation](){ work(g); });
+    }
+}
+
+
+void WorkerPoolImpl::stop()
+{
+    {
+        lock_guard<mutex> lock(jobMutex);
+        isStopping = true;
+    }
+    jobCondition.notify_all();
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+}
+
+
+void WorkerPool::run(const int& numChunks, const std::function<void(int chunk)>& func)
+{
+    if(impl->threads.empty() || numChunks <= 1) {
+        for(int i = 0; i < numChunks; ++i) {
+            func(i);
+        }
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(impl->jobMutex);
+        impl->func = &func;
+        impl->numChunks = numChunks;
+        impl->nextChunk = 0;
+        impl->numBusyWorkers = impl->threads.size();
+        ++impl->generation;
+    }
+    impl->jobCondition.notify_all();
+
+    impl->processChunks();
+
+    unique_lock<mutex> lock(impl->jobMutex);
+    impl->doneCondition.wait(lock, [&](){ return impl->numBusyWorkers == 0; });
+    impl->func = nullptr;
+}
+
+
+void WorkerPoolImpl::work(unsigned long lastGeneration)
+{
+    while(true) {
+        {
+            unique_lock<mutex> lock(jobMutex);
+            jobCondition.wait(lock, [&](){ return isStopping || generation != lastGeneration; });
+            if(isStopping) {
+                return;
+            }
+            lastGeneration = generation;
+        }
+
+        processChunks();
+
+        {
+            lock_guard<mutex> lock(jobMutex);
+            --numBusyWorkers;
+        }
+        doneCondition.notify_one();
+    }
+}
+
+
+void WorkerPoolImpl::processChunks()
+{
+    while(true) {
+        int chunk = nextChunk.fetch_add(1);
+        if(chunk >= numChunks) {
+            break;
+        }
+        (*func)(chunk);
+    }
+}
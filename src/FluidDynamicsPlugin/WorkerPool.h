@@ -0,0 +1,41 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_FLUID_DYNAMICS_PLUGIN_WORKER_POOL_H
+#define CNOID_FLUID_DYNAMICS_PLUGIN_WORKER_POOL_H
+
+#include <functional>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class WorkerPoolImpl;
+
+/**
+   Fixed set of worker threads that process the chunks of one job.
+   Idle workers take the next unprocessed chunk, so uneven chunks are
+   balanced at run time. The calling thread works on the job as well and
+   run() returns when every chunk is done.
+*/
+class CNOID_EXPORT WorkerPool
+{
+public:
+    WorkerPool();
+    virtual ~WorkerPool();
+
+    void setNumThreads(const int& numThreads);
+    int numThreads() const;
+
+    void run(const int& numChunks, const std::function<void(int chunk)>& func);
+
+private:
+    WorkerPool(const WorkerPool& org);
+    WorkerPoolImpl* impl;
+    friend class WorkerPoolImpl;
+};
+
+}
+
+#endif // CNOID_FLUID_DYNAMICS_PLUGIN_WORKER_POOL_H
@@ -11,11 +11,18 @@
 #include <cnoid/MultiValueSeqItem>
 #include <cnoid/PutPropertyFunction>
 #include <cnoid/SimulatorItem>
+#include <cnoid/StageProfiler>
 #include "gettext.h"
 
 using namespace cnoid;
 using namespace std;
 
+namespace {
+
+enum ProfileStage { JoystickStage };
+
+}
+
 namespace cnoid {
 
 class JoystickLoggerItemImpl
@@ -29,8 +36,10 @@ public:
     vector<MultiValueSeqItem*> joystickStaSeqItems;
     bool isJoystickStatesRecordingEnabled;
     int frame;
+    StageProfiler profiler;
 
     bool initializeSimulation(SimulatorItem* simulatorItem);
+    void finalizeSimulation();
     void onPostDynamicsFunction();
     void doPutProperties(PutPropertyFunction& putProperty);
     bool store(Archive& archive);
@@ -53,6 +62,8 @@ JoystickLoggerItemImpl::JoystickLoggerItemImpl(JoystickLoggerItem* self)
     joystickStaSeqItems.clear();
     isJoystickStatesRecordingEnabled = false;
     frame = 0;
+    profiler.setTextDomain(CNOID_GETTEXT_DOMAIN_NAME);
+    profiler.addStage(N_("joysticks"));
 }
 
 
@@ -71,6 +82,7 @@ JoystickLoggerItemImpl::JoystickLoggerItemImpl(JoystickLoggerItem* self, const J
     joystickStaSeqItems = org.joystickStaSeqItems;
     isJoystickStatesRecordingEnabled = org.isJoystickStatesRecordingEnabled;
     frame = org.frame;
+    profiler = org.profiler;
 }
 
 
@@ -124,6 +136,7 @@ bool JoystickLoggerItemImpl::initializeSimulation(SimulatorItem* simulatorItem)
             joystickStaSeq->setFrameRate(1.0 / simulatorItem->worldTimeStep());
         }
 
+        profiler.initialize(self, simulatorItem->worldTimeStep());
         simulatorItem->addPostDynamicsFunction([&](){ onPostDynamicsFunction(); });
     }
 
@@ -131,8 +144,21 @@ bool JoystickLoggerItemImpl::initializeSimulation(SimulatorItem* simulatorItem)
 }
 
 
+void JoystickLoggerItem::finalizeSimulation()
+{
+    impl->finalizeSimulation();
+}
+
+
+void JoystickLoggerItemImpl::finalizeSimulation()
+{
+    profiler.finalize();
+}
+
+
 void JoystickLoggerItemImpl::onPostDynamicsFunction()
 {
+    StageProfiler::ScopedTimer timer(profiler, JoystickStage);
     for(size_t i = 0; i < joysticks.size(); ++i) {
         Joystick* joystick = joysticks[i];
         joystick->readCurrentState();
@@ -148,6 +174,8 @@ void JoystickLoggerItemImpl::onPostDynamicsFunction()
     }
 
     frame++;
+    timer.stop();
+    profiler.endFrame();
 }
 
 
@@ -167,6 +195,7 @@ void JoystickLoggerItem::doPutProperties(PutPropertyFunction& putProperty)
 void JoystickLoggerItemImpl::doPutProperties(PutPropertyFunction& putProperty)
 {
     putProperty(_("Record joystick states"), isJoystickStatesRecordingEnabled, changeProperty(isJoystickStatesRecordingEnabled));
+    profiler.putProperties(putProperty);
 }
 
 
@@ -180,6 +209,7 @@ bool JoystickLoggerItem::store(Archive& archive)
 bool JoystickLoggerItemImpl::store(Archive& archive)
 {
     archive.write("recordJoystickStates", isJoystickStatesRecordingEnabled);
+    profiler.store(archive);
     return true;
 }
 
@@ -194,5 +224,6 @@ bool JoystickLoggerItem::restore(const Archive& archive)
 bool JoystickLoggerItemImpl::restore(const Archive& archive)
 {
     archive.read("recordJoystickStates", isJoystickStatesRecordingEnabled);
+    profiler.restore(archive);
     return true;
 }
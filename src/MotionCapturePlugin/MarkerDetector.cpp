@@ -0,0 +1,130 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "MarkerDetector.h"
+#include <cnoid/EigenUtil>
+#include <cnoid/Link>
+#include <vector>
+
+using namespace std;
+using namespace cnoid;
+
+namespace cnoid {
+
+class MarkerDetectorImpl
+{
+public:
+    MarkerDetectorImpl(MarkerDetector* self);
+
+    MarkerDetector* self;
+    vector<MotionCaptureCamera*> cameras;
+    vector<PassiveMarker*> markers;
+    vector<PassiveMarker*> capturedMarkers;
+};
+
+}
+
+
+MarkerDetector::MarkerDetector()
+{
+    impl = new MarkerDetectorImpl(this);
+}
+
+
+MarkerDetectorImpl::MarkerDetectorImpl(MarkerDetector* self)
+    : self(self)
+{
+
+}
+
+
+MarkerDetector::~MarkerDetector()
+{
+    delete impl;
+}
+
+
+void MarkerDetector::clear()
+{
+    impl->cameras.clear();
+    impl->markers.clear();
+    impl->capturedMarkers.clear();
+}
+
+
+void MarkerDetector::addCamera(MotionCaptureCamera* camera)
+{
+    impl->cameras.push_back(camera);
+}
+
+
+void MarkerDetector::addMarker(PassiveMarker* marker)
+{
+    impl->markers.push_back(marker);
+}
+
+
+void MarkerDetector::detect()
+{
+    vector<PassiveMarker*>& capturedMarkers = impl->capturedMarkers;
+    capturedMarkers.clear();
+    for(size_t i = 0; i < impl->cameras.size(); i++) {
+        MotionCaptureCamera* camera = impl->cameras[i];
+        Link* clink = camera->link();
+        double rangehy = camera->focalLength() * tan((double)camera->fieldOfView() / 2.0 * TO_RADIAN);
+        double rangehz = rangehy * 2.0 / camera->aspectRatio()[0] * camera->aspectRatio()[1] / 2.0;
+        Matrix3 m = clink->R() * camera->R_local();
+        Vector3 cp = clink->T().translation() + m * camera->p_local();
+        Vector3 o = cp + m * (Vector3(0.0, 0.0, 0.0));
+        Vector3 a = cp + m * (Vector3(camera->focalLength(), rangehy,  rangehz));
+        Vector3 b = cp + m * (Vector3(camera->focalLength(), rangehy, -rangehz));
+        Vector3 c = cp + m * (Vector3(camera->focalLength(), -rangehy, -rangehz));
+        Vector3 d = cp + m * (Vector3(camera->focalLength(), -rangehy,  rangehz));
+
+        Vector3 oa = a - o;
+        Vector3 ob = b - o;
+        Vector3 oc = c - o;
+        Vector3 od = d - o;
+
+        for(size_t j = 0; j < impl->markers.size(); j++) {
+            PassiveMarker* marker = impl->markers[j];
+            Link* mlink = marker->link();
+            Vector3 mp = mlink->T().translation() + mlink->R() * marker->R_local() * marker->p_local();
+            Vector3 op = mp - o;
+            Vector3 ap = mp - a;
+            Vector3 bp = mp - b;
+            Vector3 cp = mp - c;
+            Vector3 dp = mp - d;
+
+            double voabc = fabs(oa.cross(ob).dot(oc)) / 6.0;
+            double vpoab = fabs(-op.cross(-ap).dot(-bp)) / 6.0;
+            double vpobc = fabs(-op.cross(-bp).dot(-cp)) / 6.0;
+            double vpoca = fabs(-op.cross(-cp).dot(-ap)) / 6.0;
+            double vpabc = fabs(-ap.cross(-bp).dot(-cp)) / 6.0;
+
+            double voacd = fabs(oa.cross(oc).dot(od)) / 6.0;
+            double vpoac = fabs(-op.cross(-ap).dot(-cp)) / 6.0;
+            double vpocd = fabs(-op.cross(-cp).dot(-dp)) / 6.0;
+            double vpoda = fabs(-op.cross(-dp).dot(-ap)) / 6.0;
+            double vpacd = fabs(-ap.cross(-cp).dot(-dp)) / 6.0;
+
+            int v0 = voabc * 1000.0;
+            int v1 = (vpoab + vpobc + vpoca + vpabc) * 1000.0;
+            int v2 = voacd * 1000.0;
+            int v3 = (vpoac + vpocd + vpoda + vpacd) * 1000.0;
+
+            if((v0 >= v1) || (v2 >= v3)) {
+                capturedMarkers.push_back(marker);
+            }
+            marker->setTransparency(0.9);
+            marker->notifyStateChange();
+        }
+    }
+    for(size_t i = 0; i < capturedMarkers.size(); i++) {
+        PassiveMarker* marker = capturedMarkers[i];
+        marker->setTransparency(0.0);
+        marker->notifyStateChange();
+    }
+}
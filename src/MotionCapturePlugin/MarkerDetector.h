@@ -0,0 +1,46 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_MOTION_CAPTURE_PLUGIN_MARKER_DETECTOR_H
+#define CNOID_MOTION_CAPTURE_PLUGIN_MARKER_DETECTOR_H
+
+#include "MotionCaptureCamera.h"
+#include "PassiveMarker.h"
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class MarkerDetectorImpl;
+
+/**
+   Detection of the passive markers in the view of the motion capture
+   cameras. The view of a camera is the pyramid from the camera to the
+   rectangle at its focal length, split into two tetrahedra; a marker is
+   in the view when it is in one of them, which is tested by comparing
+   the volume of the tetrahedron with the sum of the volumes of the four
+   tetrahedra that the marker makes with its faces. detect() makes the
+   markers in the view of any camera opaque and the others transparent.
+*/
+class CNOID_EXPORT MarkerDetector
+{
+public:
+    MarkerDetector();
+    virtual ~MarkerDetector();
+
+    void clear();
+    void addCamera(MotionCaptureCamera* camera);
+    void addMarker(PassiveMarker* marker);
+
+    void detect();
+
+private:
+    MarkerDetector(const MarkerDetector& org);
+    MarkerDetectorImpl* impl;
+    friend class MarkerDetectorImpl;
+};
+
+}
+
+#endif // CNOID_MOTION_CAPTURE_PLUGIN_MARKER_DETECTOR_H
@@ -8,10 +8,11 @@
 
 #include <cnoid/Device>
 #include <cnoid/ValueTree>
+#include "exportdecl.h"
 
 namespace cnoid {
 
-class MotionCaptureCamera : public Device
+class CNOID_EXPORT MotionCaptureCamera : public Device
 {
 public:
     MotionCaptureCamera();
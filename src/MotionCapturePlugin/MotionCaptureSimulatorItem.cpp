@@ -6,13 +6,14 @@
 #include "MotionCaptureSimulatorItem.h"
 #include <cnoid/Archive>
 #include <cnoid/EigenTypes>
-#include <cnoid/EigenUtil>
 #include <cnoid/Item>
 #include <cnoid/ItemManager>
 #include <cnoid/PutPropertyFunction>
 #include <cnoid/SimulatorItem>
+#include <cnoid/StageProfiler>
 #include <QDateTime>
 #include "gettext.h"
+#include "MarkerDetector.h"
 #include "MarkerPointItem.h"
 #include "MotionCaptureCamera.h"
 #include "PassiveMarker.h"
@@ -20,6 +21,12 @@
 using namespace std;
 using namespace cnoid;
 
+namespace {
+
+enum ProfileStage { MarkerStage };
+
+}
+
 namespace cnoid {
 
 class MotionCaptureSimulatorItemImpl
@@ -31,19 +38,21 @@ public:
     MotionCaptureSimulatorItem* self;
     DeviceList<PassiveMarker> markers;
     DeviceList<MotionCaptureCamera> cameras;
+    MarkerDetector detector;
     MarkerPointItem* item;
     double cycleTime;
     bool record;
     double timeStep;
     string fileName;
     int frame;
+    StageProfiler profiler;
 
     bool initializeSimulation(SimulatorItem* simulatorItem);
     void finalizeSimulation();
     void doPutProperties(PutPropertyFunction& putProperty);
     bool store(Archive& archive);
     bool restore(const Archive& archive);
-    void onMarkerDetection();
+    void onPreDynamicsFunction(const bool& isGeneration);
     void onMarkerGeneration();
 };
 
@@ -68,6 +77,8 @@ MotionCaptureSimulatorItemImpl::MotionCaptureSimulatorItemImpl(MotionCaptureSimu
     timeStep = 0.0;
     fileName.clear();
     frame = 0;
+    profiler.setTextDomain(CNOID_GETTEXT_DOMAIN_NAME);
+    profiler.addStage(N_("markers"));
 }
 
 
@@ -92,6 +103,7 @@ MotionCaptureSimulatorItemImpl::MotionCaptureSimulatorItemImpl(MotionCaptureSimu
     timeStep = org.timeStep;
     fileName = org.fileName;
     frame = org.frame;
+    profiler = org.profiler;
 }
 
 
@@ -127,6 +139,15 @@ bool MotionCaptureSimulatorItemImpl::initializeSimulation(SimulatorItem* simulat
         markers << body->devices();
         cameras << body->devices();
     }
+    detector.clear();
+    for(size_t i = 0; i < cameras.size(); ++i) {
+        detector.addCamera(cameras[i]);
+    }
+    for(size_t i = 0; i < markers.size(); ++i) {
+        detector.addMarker(markers[i]);
+    }
+
+    profiler.initialize(self, timeStep);
 
     QDateTime dateTime = QDateTime::currentDateTime();
     string date = dateTime.toString("yyyyMMdd_hhmmss").toStdString();
@@ -150,9 +171,9 @@ bool MotionCaptureSimulatorItemImpl::initializeSimulation(SimulatorItem* simulat
             item->addLabel(label);
         }
 
-        simulatorItem->addPreDynamicsFunction([&](){ onMarkerGeneration(); });
+        simulatorItem->addPreDynamicsFunction([&](){ onPreDynamicsFunction(true); });
     } else {
-        simulatorItem->addPreDynamicsFunction([&](){ onMarkerDetection(); });
+        simulatorItem->addPreDynamicsFunction([&](){ onPreDynamicsFunction(false); });
     }
     return true;
 }
@@ -167,69 +188,20 @@ void MotionCaptureSimulatorItem::finalizeSimulation()
 void MotionCaptureSimulatorItemImpl::finalizeSimulation()
 {
     item->setChecked(true);
+    profiler.finalize();
 }
 
 
-void MotionCaptureSimulatorItemImpl::onMarkerDetection()
+void MotionCaptureSimulatorItemImpl::onPreDynamicsFunction(const bool& isGeneration)
 {
-    vector<PassiveMarker*> capturedMarkers;
-    for(size_t i = 0; i < cameras.size(); i++) {
-        MotionCaptureCamera* camera = cameras[i];
-        Link* clink = camera->link();
-        double rangehy = camera->focalLength() * tan((double)camera->fieldOfView() / 2.0 * TO_RADIAN);
-        double rangehz = rangehy * 2.0 / camera->aspectRatio()[0] * camera->aspectRatio()[1] / 2.0;
-        Matrix3 m = clink->R() * camera->R_local();
-        Vector3 cp = clink->T().translation() + m * camera->p_local();
-        Vector3 o = cp + m * (Vector3(0.0, 0.0, 0.0));
-        Vector3 a = cp + m * (Vector3(camera->focalLength(), rangehy,  rangehz));
-        Vector3 b = cp + m * (Vector3(camera->focalLength(), rangehy, -rangehz));
-        Vector3 c = cp + m * (Vector3(camera->focalLength(), -rangehy, -rangehz));
-        Vector3 d = cp + m * (Vector3(camera->focalLength(), -rangehy,  rangehz));
-
-        Vector3 oa = a - o;
-        Vector3 ob = b - o;
-        Vector3 oc = c - o;
-        Vector3 od = d - o;
-
-        for(size_t j = 0; j < markers.size(); j++) {
-            PassiveMarker* marker = markers[j];
-            Link* mlink = marker->link();
-            Vector3 mp = mlink->T().translation() + mlink->R() * marker->R_local() * marker->p_local();
-            Vector3 op = mp - o;
-            Vector3 ap = mp - a;
-            Vector3 bp = mp - b;
-            Vector3 cp = mp - c;
-            Vector3 dp = mp - d;
-
-            double voabc = fabs(oa.cross(ob).dot(oc)) / 6.0;
-            double vpoab = fabs(-op.cross(-ap).dot(-bp)) / 6.0;
-            double vpobc = fabs(-op.cross(-bp).dot(-cp)) / 6.0;
-            double vpoca = fabs(-op.cross(-cp).dot(-ap)) / 6.0;
-            double vpabc = fabs(-ap.cross(-bp).dot(-cp)) / 6.0;
-
-            double voacd = fabs(oa.cross(oc).dot(od)) / 6.0;
-            double vpoac = fabs(-op.cross(-ap).dot(-cp)) / 6.0;
-            double vpocd = fabs(-op.cross(-cp).dot(-dp)) / 6.0;
-            double vpoda = fabs(-op.cross(-dp).dot(-ap)) / 6.0;
-            double vpacd = fabs(-ap.cross(-cp).dot(-dp)) / 6.0;
-
-            int v0 = voabc * 1000.0;
-            int v1 = (vpoab + vpobc + vpoca + vpabc) * 1000.0;
-            int v2 = voacd * 1000.0;
-            int v3 = (vpoac + vpocd + vpoda + vpacd) * 1000.0;
-
-            if((v0 >= v1) || (v2 >= v3)) {
-                capturedMarkers.push_back(marker);
-            }
-            marker->setTransparency(0.9);
-            marker->notifyStateChange();
-        }
-    }
-    for(size_t i = 0; i < capturedMarkers.size(); i++) {
-        PassiveMarker* marker = capturedMarkers[i];
-        marker->setTransparency(0.0);
-        marker->notifyStateChange();
+    StageProfiler::ScopedTimer timer(profiler, MarkerStage);
+    if(isGeneration) {
+        onMarkerGeneration();
+    } else {
+        detector.detect();
     }
+    timer.stop();
+    profiler.endFrame();
 }
 
 
@@ -279,6 +251,7 @@ void MotionCaptureSimulatorItemImpl::doPutProperties(PutPropertyFunction& putPro
 {
     putProperty(_("Record"), record, changeProperty(record));
     putProperty(_("CycleTime"), cycleTime, changeProperty(cycleTime));
+    profiler.putProperties(putProperty);
 }
 
 
@@ -293,6 +266,7 @@ bool MotionCaptureSimulatorItemImpl::store(Archive& archive)
 {
     archive.write("record", record);
     archive.write("cycleTime", cycleTime);
+    profiler.store(archive);
     return true;
 }
 
@@ -308,5 +282,6 @@ bool MotionCaptureSimulatorItemImpl::restore(const Archive& archive)
 {
     archive.read("record", record);
     archive.read("cycleTime", cycleTime);
+    profiler.restore(archive);
     return true;
 }
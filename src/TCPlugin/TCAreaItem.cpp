@@ -11,6 +11,7 @@
 #include <cnoid/PutPropertyFunction>
 #include <cnoid/YAMLReader>
 #include <cnoid/YAMLWriter>
+#include <cctype>
 #include "gettext.h"
 
 using namespace std;
@@ -18,6 +19,59 @@ using namespace cnoid;
 
 namespace {
 
+vector<string> splitAddresses(const string& addresses)
+{
+    vector<string> elements;
+    string element;
+    for(auto& c : addresses) {
+        if(c == ',' || isspace(static_cast<unsigned char>(c))) {
+            if(!element.empty()) {
+                elements.push_back(element);
+                element.clear();
+            }
+        } else {
+            element += c;
+        }
+    }
+    if(!element.empty()) {
+        elements.push_back(element);
+    }
+    return elements;
+}
+
+
+// a list of addresses is read as "sourceIPs: [ ... ]", and a single
+// address as "sourceIP: ..."
+bool readAddresses(Mapping& node, const string& listKey, const string& key, string& out_addresses)
+{
+    Listing* addressList = node.findListing(listKey);
+    if(addressList->isValid()) {
+        out_addresses.clear();
+        for(int i = 0; i < addressList->size(); ++i) {
+            out_addresses += (i ? ", " : "") + addressList->at(i)->toString();
+        }
+        return true;
+    }
+    return node.read(key, out_addresses);
+}
+
+
+void putAddresses(YAMLWriter* writer, const string& listKey, const string& key, const string& addresses)
+{
+    vector<string> elements = splitAddresses(addresses);
+    if(elements.size() <= 1) {
+        writer->putKeyValue(key, addresses);
+        return;
+    }
+    writer->putKey(listKey);
+    writer->startFlowStyleListing();
+    for(auto& element : elements) {
+        writer->putScalar(element);
+    }
+    writer->endListing();
+}
+
+
 void loadItem(Mapping& node, TCAreaItem* item)
 {
     string s;
@@ -31,8 +85,8 @@ void loadItem(Mapping& node, TCAreaItem* item)
     if(node.read("outboundDelay", d)) item->setOutboundDelay(d);
     if(node.read("outboundRate", d)) item->setOutboundRate(d);
     if(node.read("outboundLoss", d)) item->setOutboundLoss(d);
-    if(node.read("sourceIP", s)) item->setSource(s);
-    if(node.read("destinationIP", s)) item->setDestination(s);
+    if(readAddresses(node, "sourceIPs", "sourceIP", s)) item->setSource(s);
+    if(readAddresses(node, "destinationIPs", "destinationIP", s)) item->setDestination(s);
 
     if(node.read("name", s)) item->setName(s);
     if(read(node, "translation", v)) item->setTranslation(v);
@@ -229,8 +283,8 @@ bool TCAreaItem::save(TCAreaItem* item, const string& filename)
         writer.putKeyValue("outboundRate", item->outboundRate());
         writer.putKeyValue("outboundLoss", item->outboundLoss());
 
-        writer.putKeyValue("sourceIP", item->source());
-        writer.putKeyValue("destinationIP", item->destination());
+        putAddresses(&writer, "sourceIPs", "sourceIP", item->source());
+        putAddresses(&writer, "destinationIPs", "destinationIP", item->destination());
 
         putKeyVector3(&writer, "diffuseColor", item->diffuseColor());
         putKeyVector3(&writer, "emissiveColor", item->emissiveColor());
@@ -343,6 +397,12 @@ string TCAreaItem::source() const
 }
 
 
+vector<string> TCAreaItem::sources() const
+{
+    return splitAddresses(impl->source);
+}
+
+
 void TCAreaItem::setDestination(const string& destination)
 {
     impl->destination = destination;
@@ -355,6 +415,12 @@ string TCAreaItem::destination() const
 }
 
 
+vector<string> TCAreaItem::destinations() const
+{
+    return splitAddresses(impl->destination);
+}
+
+
 Item* TCAreaItem::doDuplicate() const
 {
     return new TCAreaItem(*this);
@@ -7,6 +7,8 @@
 #define CNOID_TC_PLUGIN_TC_AREA_ITEM_H
 
 #include <src/FluidDynamicsPlugin/AreaItem.h>
+#include <string>
+#include <vector>
 
 namespace cnoid {
 
@@ -35,10 +37,14 @@ public:
     double outboundRate() const;
     void setOutboundLoss(const double& outboundLoss);
     double outboundLoss() const;
+    // a source or a destination is a list of addresses separated by
+    // commas, such as "10.0.0.1/32, 10.0.1.0/24"
     void setSource(const std::string& source);
     std::string source() const;
+    std::vector<std::string> sources() const;
     void setDestination(const std::string& destination);
     std::string destination() const;
+    std::vector<std::string> destinations() const;
 
     static bool load(TCAreaItem* item, const std::string& filename);
     static bool save(TCAreaItem* item, const std::string& filename);
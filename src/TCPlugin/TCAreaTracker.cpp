@@ -0,0 +1,209 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "TCAreaTracker.h"
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+struct BodyState
+{
+    Link* link;
+    Vector3 p;
+    int area;
+    int hysteresisIndex;  // the area that reached further in that step
+};
+
+struct SlotState
+{
+    int currentIndex;
+    double changeTime;
+    bool init;
+};
+
+}
+
+
+namespace cnoid {
+
+class TCAreaTrackerImpl
+{
+public:
+    TCAreaTrackerImpl(TCAreaTracker* self);
+
+    TCAreaTracker* self;
+    AreaGrid areaGrid;
+    vector<BodyState> bodies;
+    vector<SlotState> slots;
+    vector<TCAreaTracker::Change> changes;
+    bool isSlotPerBody;
+    double dwellTime;
+    double hysteresis;
+
+    int findArea(BodyState& body, const int& hysteresisIndex);
+    void change(const int& slot, const int& index, const double& time);
+};
+
+}
+
+
+TCAreaTracker::TCAreaTracker()
+{
+    impl = new TCAreaTrackerImpl(this);
+}
+
+
+TCAreaTrackerImpl::TCAreaTrackerImpl(TCAreaTracker* self)
+    : self(self)
+{
+    isSlotPerBody = false;
+    dwellTime = 0.0;
+    hysteresis = 0.0;
+}
+
+
+TCAreaTracker::~TCAreaTracker()
+{
+    delete impl;
+}
+
+
+void TCAreaTracker::clear()
+{
+    impl->areaGrid.clear();
+    impl->bodies.clear();
+    impl->slots.clear();
+    impl->changes.clear();
+}
+
+
+void TCAreaTracker::addArea(AreaItem* item)
+{
+    impl->areaGrid.addArea(item);
+}
+
+
+void TCAreaTracker::addBody(Link* link)
+{
+    BodyState body;
+    body.link = link;
+    body.p = link->T().translation();
+    body.area = -1;
+    body.hysteresisIndex = -1;
+    impl->bodies.push_back(body);
+}
+
+
+void TCAreaTracker::build(const bool& isSlotPerBody)
+{
+    impl->areaGrid.build();
+    impl->isSlotPerBody = isSlotPerBody;
+    SlotState slot;
+    slot.currentIndex = numAreas();
+    slot.changeTime = 0.0;
+    slot.init = false;
+    impl->slots.assign(isSlotPerBody ? impl->bodies.size() : 1, slot);
+    impl->changes.reserve(impl->slots.size());
+}
+
+
+const AreaGrid& TCAreaTracker::areaGrid() const
+{
+    return impl->areaGrid;
+}
+
+
+int TCAreaTracker::numAreas() const
+{
+    return impl->areaGrid.numAreas();
+}
+
+
+int TCAreaTracker::numBodies() const
+{
+    return impl->bodies.size();
+}
+
+
+int TCAreaTracker::numSlots() const
+{
+    return impl->slots.size();
+}
+
+
+void TCAreaTracker::setDwellTime(const double& dwellTime)
+{
+    impl->dwellTime = dwellTime;
+}
+
+
+void TCAreaTracker::setHysteresis(const double& hysteresis)
+{
+    impl->hysteresis = hysteresis;
+}
+
+
+int TCAreaTracker::keepArea(const int& area, const int& hysteresisIndex, const Vector3& p) const
+{
+    if((hysteresisIndex > area) && (hysteresisIndex < numAreas())
+       && impl->areaGrid.contains(hysteresisIndex, p, impl->hysteresis)) {
+        return hysteresisIndex;
+    }
+    return area;
+}
+
+
+const vector<TCAreaTracker::Change>& TCAreaTracker::update(const double& time)
+{
+    impl->changes.clear();
+    int noArea = numAreas();
+
+    if(impl->isSlotPerBody) {
+        for(size_t i = 0; i < impl->bodies.size(); ++i) {
+            int area = impl->findArea(impl->bodies[i], impl->slots[i].currentIndex);
+            impl->change(i, area >= 0 ? area : noArea, time);
+        }
+    } else {
+        // the last body in an area decides
+        int index = noArea;
+        for(auto& body : impl->bodies) {
+            int area = impl->findArea(body, impl->slots[0].currentIndex);
+            if(area >= 0) {
+                index = area;
+            }
+        }
+        impl->change(0, index, time);
+    }
+    return impl->changes;
+}
+
+
+int TCAreaTrackerImpl::findArea(BodyState& body, const int& hysteresisIndex)
+{
+    const Vector3 p = body.link->T().translation();
+    if((p == body.p) && (body.hysteresisIndex == hysteresisIndex)) {
+        return body.area;
+    }
+    body.p = p;
+    body.area = self->keepArea(areaGrid.findArea(p), hysteresisIndex, p);
+    body.hysteresisIndex = hysteresisIndex;
+    return body.area;
+}
+
+
+void TCAreaTrackerImpl::change(const int& slot, const int& index, const double& time)
+{
+    SlotState& state = slots[slot];
+    if(index != state.currentIndex) {
+        if(!state.init || (time - state.changeTime >= dwellTime)) {
+            changes.push_back({ slot, index });
+            state.currentIndex = index;
+            state.changeTime = time;
+            state.init = true;
+        }
+    }
+}
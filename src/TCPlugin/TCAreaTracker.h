@@ -0,0 +1,67 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_TC_PLUGIN_TC_AREA_TRACKER_H
+#define CNOID_TC_PLUGIN_TC_AREA_TRACKER_H
+
+#include <cnoid/EigenTypes>
+#include <cnoid/Link>
+#include <src/FluidDynamicsPlugin/AreaGrid.h>
+#include <vector>
+#include "exportdecl.h"
+
+namespace cnoid {
+
+class TCAreaTrackerImpl;
+
+/**
+   Area of the bodies followed by TCSimulatorItem in a step. A body keeps
+   its last position and area, so the grid is searched again only when the
+   body has moved or the area that reaches further has changed; the
+   current area of a slot reaches further by the hysteresis, so that a
+   body on its boundary does not leave and enter it again.
+
+   With one slot for each body every body has its own area, and with a
+   single slot the last body in an area decides. update() returns the
+   slots whose area has changed since the dwell time or more, with
+   numAreas() standing for no area.
+*/
+class CNOID_EXPORT TCAreaTracker
+{
+public:
+    struct Change
+    {
+        int slot;
+        int index;
+    };
+
+    TCAreaTracker();
+    virtual ~TCAreaTracker();
+
+    void clear();
+    void addArea(AreaItem* item);
+    void addBody(Link* link);
+    void build(const bool& isSlotPerBody);
+
+    const AreaGrid& areaGrid() const;
+    int numAreas() const;
+    int numBodies() const;
+    int numSlots() const;
+
+    void setDwellTime(const double& dwellTime);
+    void setHysteresis(const double& hysteresis);
+    int keepArea(const int& area, const int& hysteresisIndex, const Vector3& p) const;
+
+    const std::vector<Change>& update(const double& time);
+
+private:
+    TCAreaTracker(const TCAreaTracker& org);
+    TCAreaTrackerImpl* impl;
+    friend class TCAreaTrackerImpl;
+};
+
+}
+
+#endif // CNOID_TC_PLUGIN_TC_AREA_TRACKER_H
@@ -0,0 +1,329 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "TCBatch.h"
+#include <fmt/format.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "gettext.h"
+
+extern char** environ;
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+// commands kept to name the command of a failed line
+const int HistorySize = 1024;
+// time given to tc to finish the written commands when it is stopped
+const int StopTimeout = 2000;
+
+}
+
+
+namespace cnoid {
+
+class TCBatchImpl
+{
+public:
+    TCBatchImpl(TCBatch* self);
+    ~TCBatchImpl();
+
+    TCBatch* self;
+    vector<string> arguments;
+    pid_t pid;
+    int inputFd;
+    thread reader;
+    std::atomic<bool> isProcessRunning;
+    std::atomic<bool> isStopping;
+    mutex writeMutex;
+    mutex historyMutex;
+    vector<string> history;
+    int numLines;
+    mutex exitMutex;
+    condition_variable exitCondition;
+    bool isExited;
+    Signal<void(const string& command, const string& message)> sigCommandFailed;
+    string errorMessage;
+
+    bool startProcess();
+    void stop();
+    void readErrors(const int& fd);
+    void onErrorLine(const string& text, string& io_messages);
+};
+
+}
+
+
+TCBatch::TCBatch()
+{
+    impl = new TCBatchImpl(this);
+}
+
+
+TCBatchImpl::TCBatchImpl(TCBatch* self)
+    : self(self),
+      isProcessRunning(false),
+      isStopping(false)
+{
+    arguments.clear();
+    pid = -1;
+    inputFd = -1;
+    history.resize(HistorySize);
+    numLines = 0;
+    isExited = true;
+    errorMessage.clear();
+}
+
+
+TCBatch::~TCBatch()
+{
+    delete impl;
+}
+
+
+TCBatchImpl::~TCBatchImpl()
+{
+    stop();
+}
+
+
+bool TCBatch::start(const vector<string>& arguments)
+{
+    impl->stop();
+    lock_guard<mutex> lock(impl->writeMutex);
+    impl->arguments = arguments;
+    return impl->startProcess();
+}
+
+
+bool TCBatchImpl::startProcess()
+{
+    if(arguments.empty()) {
+        errorMessage = _("No command is given to tc.");
+        return false;
+    }
+    if(reader.joinable()) {
+        reader.join();
+    }
+
+    // the standard input is a socket so that a write to a process that
+    // has exited fails with EPIPE instead of raising SIGPIPE
+    int input[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, input) < 0) {
+        errorMessage = fmt::format(_("{0} cannot be started: {1}"), arguments[0], strerror(errno));
+        return false;
+    }
+    int error[2];
+    if(pipe2(error, O_CLOEXEC) < 0) {
+        errorMessage = fmt::format(_("{0} cannot be started: {1}"), arguments[0], strerror(errno));
+        ::close(input[0]);
+        ::close(input[1]);
+        return false;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, input[1], STDIN_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, error[1], STDERR_FILENO);
+    vector<char*> argv;
+    for(auto& argument : arguments) {
+        argv.push_back(const_cast<char*>(argument.c_str()));
+    }
+    argv.push_back(nullptr);
+    int result = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    ::close(input[1]);
+    ::close(error[1]);
+    if(result != 0) {
+        errorMessage = fmt::format(_("{0} cannot be started: {1}"), arguments[0], strerror(result));
+        ::close(input[0]);
+        ::close(error[0]);
+        pid = -1;
+        return false;
+    }
+
+    inputFd = input[0];
+    {
+        lock_guard<mutex> lock(historyMutex);
+        numLines = 0;
+    }
+    isExited = false;
+    isStopping = false;
+    isProcessRunning = true;
+    int errorFd = error[0];
+    reader = thread([this, errorFd](){ readErrors(errorFd); });
+    return true;
+}
+
+
+void TCBatch::stop()
+{
+    impl->stop();
+}
+
+
+void TCBatchImpl::stop()
+{
+    lock_guard<mutex> lock(writeMutex);
+    if(inputFd >= 0) {
+        // tc exits when it has read the last command
+        isStopping = true;
+        ::close(inputFd);
+        inputFd = -1;
+    }
+    if(reader.joinable()) {
+        {
+            unique_lock<mutex> exitLock(exitMutex);
+            if(!exitCondition.wait_for(exitLock, chrono::milliseconds(StopTimeout), [&](){ return isExited; })) {
+                kill(pid, SIGTERM);
+            }
+        }
+        reader.join();
+    }
+    pid = -1;
+}
+
+
+bool TCBatch::isRunning() const
+{
+    return impl->isProcessRunning;
+}
+
+
+bool TCBatch::write(const vector<string>& commands)
+{
+    lock_guard<mutex> lock(impl->writeMutex);
+    if(!impl->isProcessRunning) {
+        if(impl->inputFd >= 0) {
+            ::close(impl->inputFd);
+            impl->inputFd = -1;
+        }
+        if(!impl->startProcess()) {
+            return false;
+        }
+    }
+
+    string text;
+    {
+        lock_guard<mutex> historyLock(impl->historyMutex);
+        for(auto& command : commands) {
+            impl->history[impl->numLines++ % HistorySize] = command;
+            text += command;
+            text += '\n';
+        }
+    }
+
+    size_t offset = 0;
+    while(offset < text.size()) {
+        ssize_t result = send(impl->inputFd, text.data() + offset, text.size() - offset, MSG_NOSIGNAL);
+        if(result < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            impl->errorMessage = fmt::format(_("Commands cannot be written to tc: {0}"), strerror(errno));
+            return false;
+        }
+        offset += result;
+    }
+    return true;
+}
+
+
+void TCBatchImpl::readErrors(const int& fd)
+{
+    string buffer;
+    string messages;
+    char data[4096];
+    while(true) {
+        ssize_t size = ::read(fd, data, sizeof(data));
+        if(size < 0 && errno == EINTR) {
+            continue;
+        }
+        if(size <= 0) {
+            break;
+        }
+        buffer.append(data, size);
+        size_t begin = 0;
+        size_t end;
+        while((end = buffer.find('\n', begin)) != string::npos) {
+            onErrorLine(buffer.substr(begin, end - begin), messages);
+            begin = end + 1;
+        }
+        buffer.erase(0, begin);
+    }
+    if(!buffer.empty()) {
+        onErrorLine(buffer, messages);
+    }
+    ::close(fd);
+
+    // the end of the standard error is taken as the exit, so stop() never
+    // signals a pid that has been reaped
+    {
+        lock_guard<mutex> lock(exitMutex);
+        isExited = true;
+    }
+    exitCondition.notify_all();
+    int status;
+    waitpid(pid, &status, 0);
+    isProcessRunning = false;
+
+    if(!isStopping) {
+        messages += messages.empty() ? "" : " ";
+        messages += _("tc has exited.");
+    }
+    if(!messages.empty()) {
+        sigCommandFailed(string(), messages);
+    }
+}
+
+
+void TCBatchImpl::onErrorLine(const string& text, string& io_messages)
+{
+    int line;
+    if(sscanf(text.c_str(), "Command failed -:%d", &line) != 1) {
+        if(!text.empty()) {
+            io_messages += io_messages.empty() ? "" : " ";
+            io_messages += text;
+        }
+        return;
+    }
+
+    string command;
+    {
+        lock_guard<mutex> lock(historyMutex);
+        if(line > 0 && line <= numLines && numLines - line < HistorySize) {
+            command = history[(line - 1) % HistorySize];
+        }
+    }
+    sigCommandFailed(command, io_messages);
+    io_messages.clear();
+}
+
+
+SignalProxy<void(const string& command, const string& message)> TCBatch::sigCommandFailed()
+{
+    return impl->sigCommandFailed;
+}
+
+
+const string& TCBatch::errorMessage() const
+{
+    return impl->errorMessage;
+}
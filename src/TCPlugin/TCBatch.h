@@ -0,0 +1,53 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_TC_PLUGIN_TC_BATCH_H
+#define CNOID_TC_PLUGIN_TC_BATCH_H
+
+#include <cnoid/Signal>
+#include <string>
+#include <vector>
+
+namespace cnoid {
+
+class TCBatchImpl;
+
+/**
+   Keeps one "tc -force -batch -" process for the whole simulation and
+   writes the commands of a reconfiguration to its standard input at
+   once, instead of spawning a process for every command. The commands
+   are written without the leading "tc", as in a batch file.
+
+   tc reports a failed command on its standard error as the messages of
+   the command followed by "Command failed -:<line>". A thread reads the
+   standard error and emits sigCommandFailed() with the command of that
+   line, so the signal is emitted outside the thread that wrote it.
+   A process that has exited is started again by the next write().
+*/
+class TCBatch
+{
+public:
+    TCBatch();
+    virtual ~TCBatch();
+
+    // the arguments of the process, e.g. { "sudo", "tc", "-force", "-batch", "-" }
+    bool start(const std::vector<std::string>& arguments);
+    void stop();
+    bool isRunning() const;
+
+    bool write(const std::vector<std::string>& commands);
+
+    SignalProxy<void(const std::string& command, const std::string& message)> sigCommandFailed();
+    const std::string& errorMessage() const;
+
+private:
+    TCBatch(const TCBatch& org);
+    TCBatchImpl* impl;
+    friend class TCBatchImpl;
+};
+
+}
+
+#endif // CNOID_TC_PLUGIN_TC_BATCH_H
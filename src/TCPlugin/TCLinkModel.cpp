@@ -0,0 +1,356 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "TCLinkModel.h"
+#include <cnoid/MeshExtractor>
+#include <cnoid/SceneDrawables>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#define DELAY_MAX 100000.0
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+// loss of 50 % at no margin, falling by e for every 2 dB of margin
+const double LossSlope = 2.0;
+// margin at which the rate reaches the maximum rate
+const double FullRateMargin = 30.0;
+const int LeafSize = 4;
+const int StackSize = 64;
+
+struct Triangle
+{
+    Vector3 a;
+    Vector3 e1;
+    Vector3 e2;
+    Vector3 centroid;
+    Vector3 lower;
+    Vector3 upper;
+};
+
+// leaves have no children and hold triangles[begin, end)
+struct BvhNode
+{
+    Vector3 lower;
+    Vector3 upper;
+    int begin;
+    int end;
+    int left;
+    int right;
+};
+
+}
+
+namespace cnoid {
+
+class TCLinkModelImpl
+{
+public:
+    TCLinkModelImpl(TCLinkModel* self);
+
+    TCLinkModel* self;
+    vector<Triangle> triangles;
+    vector<BvhNode> nodes;
+    Vector3 baseStation;
+    double pathLossExponent;
+    double referenceLoss;
+    double wallLoss;
+    double linkBudget;
+    double maxRate;
+    double baseDelay;
+    double cacheDistance;
+
+    int buildNode(const int& begin, const int& end);
+    int countCrossings(const Vector3& p) const;
+};
+
+}
+
+
+TCLinkModel::TCLinkModel()
+{
+    impl = new TCLinkModelImpl(this);
+}
+
+
+TCLinkModelImpl::TCLinkModelImpl(TCLinkModel* self)
+    : self(self)
+{
+    triangles.clear();
+    nodes.clear();
+    baseStation << 0.0, 0.0, 0.0;
+    pathLossExponent = 2.0;
+    referenceLoss = 40.0;
+    wallLoss = 10.0;
+    linkBudget = 90.0;
+    maxRate = 0.0;
+    baseDelay = 1.0;
+    cacheDistance = 0.1;
+}
+
+
+TCLinkModel::~TCLinkModel()
+{
+    delete impl;
+}
+
+
+void TCLinkModel::clear()
+{
+    impl->triangles.clear();
+    impl->nodes.clear();
+}
+
+
+void TCLinkModel::addObstacle(Link* link)
+{
+    SgNode* shape = link->collisionShape();
+    if(!shape) {
+        return;
+    }
+    MeshExtractor extractor;
+    SgMeshPtr mesh = extractor.integrate(shape);
+    if(!mesh || !mesh->hasVertices() || !mesh->numTriangles()) {
+        return;
+    }
+
+    // obstacles are static, so their triangles are kept in world coordinates
+    const SgVertexArray& vertices = *mesh->vertices();
+    const Isometry3& T = link->T();
+    for(int t = 0; t < mesh->numTriangles(); ++t) {
+        auto triangle = mesh->triangle(t);
+        Vector3 a = T * vertices[triangle[0]].cast<double>();
+        Vector3 b = T * vertices[triangle[1]].cast<double>();
+        Vector3 c = T * vertices[triangle[2]].cast<double>();
+        Triangle tri;
+        tri.a = a;
+        tri.e1 = b - a;
+        tri.e2 = c - a;
+        tri.centroid = (a + b + c) / 3.0;
+        tri.lower = a.cwiseMin(b).cwiseMin(c);
+        tri.upper = a.cwiseMax(b).cwiseMax(c);
+        impl->triangles.push_back(tri);
+    }
+}
+
+
+void TCLinkModel::build()
+{
+    impl->nodes.clear();
+    if(!impl->triangles.empty()) {
+        impl->nodes.reserve(2 * impl->triangles.size() / LeafSize + 1);
+        impl->buildNode(0, impl->triangles.size());
+    }
+}
+
+
+int TCLinkModelImpl::buildNode(const int& begin, const int& end)
+{
+    int index = nodes.size();
+    nodes.push_back(BvhNode());
+    Vector3 lower = triangles[begin].lower;
+    Vector3 upper = triangles[begin].upper;
+    Vector3 centroidLower = triangles[begin].centroid;
+    Vector3 centroidUpper = centroidLower;
+    for(int i = begin + 1; i < end; ++i) {
+        lower = lower.cwiseMin(triangles[i].lower);
+        upper = upper.cwiseMax(triangles[i].upper);
+        centroidLower = centroidLower.cwiseMin(triangles[i].centroid);
+        centroidUpper = centroidUpper.cwiseMax(triangles[i].centroid);
+    }
+
+    int left = -1;
+    int right = -1;
+    if(end - begin > LeafSize) {
+        // median split along the longest extent of the centroids
+        int axis;
+        (centroidUpper - centroidLower).maxCoeff(&axis);
+        int middle = (begin + end) / 2;
+        std::nth_element(triangles.begin() + begin, triangles.begin() + middle, triangles.begin() + end,
+                         [axis](const Triangle& t1, const Triangle& t2){ return t1.centroid[axis] < t2.centroid[axis]; });
+        left = buildNode(begin, middle);
+        right = buildNode(middle, end);
+    }
+
+    BvhNode& node = nodes[index];
+    node.lower = lower;
+    node.upper = upper;
+    node.begin = begin;
+    node.end = end;
+    node.left = left;
+    node.right = right;
+    return index;
+}
+
+
+int TCLinkModel::numTriangles() const
+{
+    return impl->triangles.size();
+}
+
+
+void TCLinkModel::setBaseStation(const Vector3& baseStation)
+{
+    impl->baseStation = baseStation;
+}
+
+
+void TCLinkModel::setPathLossExponent(const double& pathLossExponent)
+{
+    impl->pathLossExponent = pathLossExponent;
+}
+
+
+void TCLinkModel::setReferenceLoss(const double& referenceLoss)
+{
+    impl->referenceLoss = referenceLoss;
+}
+
+
+void TCLinkModel::setWallLoss(const double& wallLoss)
+{
+    impl->wallLoss = wallLoss;
+}
+
+
+void TCLinkModel::setLinkBudget(const double& linkBudget)
+{
+    impl->linkBudget = linkBudget;
+}
+
+
+void TCLinkModel::setMaxRate(const double& maxRate)
+{
+    impl->maxRate = maxRate;
+}
+
+
+void TCLinkModel::setBaseDelay(const double& baseDelay)
+{
+    impl->baseDelay = baseDelay;
+}
+
+
+void TCLinkModel::setCacheDistance(const double& cacheDistance)
+{
+    impl->cacheDistance = cacheDistance;
+}
+
+
+int TCLinkModel::countWalls(const Vector3& p) const
+{
+    // a wall has two faces, so every second crossing passes through one
+    return (impl->countCrossings(p) + 1) / 2;
+}
+
+
+int TCLinkModelImpl::countCrossings(const Vector3& p) const
+{
+    if(nodes.empty()) {
+        return 0;
+    }
+
+    // the segment from the base station to p, with t in [0, 1]
+    const Vector3& origin = baseStation;
+    const Vector3 direction = p - origin;
+    Vector3 inverse;
+    for(int i = 0; i < 3; ++i) {
+        inverse[i] = direction[i] != 0.0 ? 1.0 / direction[i] : std::copysign(1.0e300, direction[i]);
+    }
+
+    int numCrossings = 0;
+    int stack[StackSize];
+    int top = 0;
+    stack[top++] = 0;
+    while(top > 0) {
+        const BvhNode& node = nodes[stack[--top]];
+        double t0 = 0.0;
+        double t1 = 1.0;
+        for(int i = 0; i < 3; ++i) {
+            double tNear = (node.lower[i] - origin[i]) * inverse[i];
+            double tFar = (node.upper[i] - origin[i]) * inverse[i];
+            if(tNear > tFar) {
+                std::swap(tNear, tFar);
+            }
+            t0 = std::max(t0, tNear);
+            t1 = std::min(t1, tFar);
+        }
+        if(t0 > t1) {
+            continue;
+        }
+        if(node.left >= 0) {
+            if(top + 2 <= StackSize) {
+                stack[top++] = node.left;
+                stack[top++] = node.right;
+            }
+            continue;
+        }
+
+        // Moller-Trumbore intersection of the segment with each triangle
+        for(int i = node.begin; i < node.end; ++i) {
+            const Triangle& triangle = triangles[i];
+            Vector3 q = direction.cross(triangle.e2);
+            double det = triangle.e1.dot(q);
+            if(fabs(det) < 1.0e-12) {
+                continue;
+            }
+            double invDet = 1.0 / det;
+            Vector3 s = origin - triangle.a;
+            double u = s.dot(q) * invDet;
+            if(u < 0.0 || u > 1.0) {
+                continue;
+            }
+            Vector3 r = s.cross(triangle.e1);
+            double v = direction.dot(r) * invDet;
+            if(v < 0.0 || u + v > 1.0) {
+                continue;
+            }
+            double t = triangle.e2.dot(r) * invDet;
+            if(t > 0.0 && t < 1.0) {
+                ++numCrossings;
+            }
+        }
+    }
+    return numCrossings;
+}
+
+
+double TCLinkModel::pathLoss(const Vector3& p, const int& numWalls) const
+{
+    double distance = std::max((p - impl->baseStation).norm(), 1.0);
+    return impl->referenceLoss + 10.0 * impl->pathLossExponent * log10(distance)
+        + numWalls * impl->wallLoss;
+}
+
+
+void TCLinkModel::evaluate(const Vector3& p, Probe& probe, TCNetlink::Netem& out_netem) const
+{
+    // the walls on the line of sight change little while the body moves
+    // within the cache distance
+    if(!probe.isValid || (p - probe.p).norm() > impl->cacheDistance) {
+        probe.p = p;
+        probe.numWalls = countWalls(p);
+        probe.isValid = true;
+    }
+
+    double margin = impl->linkBudget - pathLoss(p, probe.numWalls);
+    double loss = 100.0 / (1.0 + exp(std::min(margin / LossSlope, 700.0)));
+    out_netem.loss = loss < 0.01 ? 0.0 : loss;
+
+    // netem takes a rate of 0 as unlimited, so a rate is never below 1 kbps
+    if(impl->maxRate > 0.0) {
+        double capacity = log2(1.0 + pow(10.0, margin / 10.0)) / log2(1.0 + pow(10.0, FullRateMargin / 10.0));
+        out_netem.rate = std::max(1.0, impl->maxRate * std::min(capacity, 1.0));
+    } else {
+        out_netem.rate = 0.0;
+    }
+
+    double delivery = std::max(1.0 - out_netem.loss / 100.0, 0.01);
+    out_netem.delay = std::min(impl->baseDelay / delivery, DELAY_MAX);
+}
@@ -0,0 +1,71 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_TC_PLUGIN_TC_LINK_MODEL_H
+#define CNOID_TC_PLUGIN_TC_LINK_MODEL_H
+
+#include <cnoid/EigenTypes>
+#include <cnoid/Link>
+#include "TCNetlink.h"
+
+namespace cnoid {
+
+class TCLinkModelImpl;
+
+/**
+   Continuous quality of the radio link between a base station and a
+   body. The path loss follows the log-distance model
+     PL(d) = L0 + 10 n log10(d / 1m) + W Lw
+   where W is the number of walls on the line of sight, counted by
+   casting a ray through the collision meshes of the obstacles added
+   before build(). The margin of the link budget over the path loss
+   gives the loss with a logistic curve, the rate with the Shannon
+   capacity relative to a margin of 30 dB, and the delay from the base
+   delay and the expected number of retransmissions.
+
+   A probe keeps the last ray cast of a body, and evaluate() casts a new
+   ray only when the body has moved further than the cache distance.
+*/
+class TCLinkModel
+{
+public:
+    struct Probe
+    {
+        Probe() : numWalls(0), isValid(false) { }
+        Vector3 p;
+        int numWalls;
+        bool isValid;
+    };
+
+    TCLinkModel();
+    virtual ~TCLinkModel();
+
+    void clear();
+    void addObstacle(Link* link);
+    void build();
+    int numTriangles() const;
+
+    void setBaseStation(const Vector3& baseStation);
+    void setPathLossExponent(const double& pathLossExponent);
+    void setReferenceLoss(const double& referenceLoss);
+    void setWallLoss(const double& wallLoss);
+    void setLinkBudget(const double& linkBudget);
+    void setMaxRate(const double& maxRate);
+    void setBaseDelay(const double& baseDelay);
+    void setCacheDistance(const double& cacheDistance);
+
+    int countWalls(const Vector3& p) const;
+    double pathLoss(const Vector3& p, const int& numWalls) const;
+    void evaluate(const Vector3& p, Probe& probe, TCNetlink::Netem& out_netem) const;
+
+private:
+    TCLinkModel(const TCLinkModel& org);
+    TCLinkModelImpl* impl;
+    friend class TCLinkModelImpl;
+};
+
+}
+
+#endif // CNOID_TC_PLUGIN_TC_LINK_MODEL_H
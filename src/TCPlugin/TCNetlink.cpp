@@ -0,0 +1,747 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "TCNetlink.h"
+#include <fmt/format.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <arpa/inet.h>
+#include <linux/capability.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/pkt_cls.h>
+#include <linux/pkt_sched.h>
+#include <linux/rtnetlink.h>
+#include <linux/tc_act/tc_mirred.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+const int RequestSize = 4096;
+const int ResponseSize = 8192;
+
+// the kernel converts psched ticks to nanoseconds with this shift
+const int PschedShift = 6;
+
+const int U32Divisor = 256;
+
+// u32 handles keep the table in the upper 12 bits and the bucket in the
+// next 8 bits
+uint32_t u32Handle(const int& table, const int& bucket)
+{
+    return ((uint32_t)table << 20) | ((uint32_t)bucket << 12);
+}
+
+bool parsePrefix(const string& text, uint32_t& out_address, uint32_t& out_mask)
+{
+    size_t slash = text.find('/');
+    string address = text.substr(0, slash);
+    int length = 32;
+    if(slash != string::npos) {
+        char* end;
+        length = strtol(text.c_str() + slash + 1, &end, 10);
+        if(*end || (length < 0) || (length > 32)) {
+            return false;
+        }
+    }
+    in_addr addr;
+    if(inet_pton(AF_INET, address.c_str(), &addr) != 1) {
+        return false;
+    }
+    out_mask = length ? htonl(0xffffffffu << (32 - length)) : 0;
+    out_address = addr.s_addr & out_mask;
+    return true;
+}
+
+}
+
+
+namespace cnoid {
+
+class TCNetlinkImpl
+{
+public:
+    TCNetlinkImpl(TCNetlink* self);
+    ~TCNetlinkImpl();
+
+    TCNetlink* self;
+    int fd;
+    uint32_t sequence;
+    TCNetlink::ErrorType errorType;
+    string errorMessage;
+
+    // requests are built in place without touching the heap
+    alignas(NLMSG_ALIGNTO) char request[RequestSize];
+    alignas(NLMSG_ALIGNTO) char response[ResponseSize];
+
+    bool open();
+    void close();
+    bool setError(const TCNetlink::ErrorType& type, const string& message);
+    bool findDevice(const string& device, int& out_index);
+
+    nlmsghdr* begin(const uint16_t& type, const uint16_t& flags);
+    tcmsg* beginTc(const uint16_t& type, const uint16_t& flags, const int& index,
+                   const uint32_t& parent, const uint32_t& handle, const uint32_t& info);
+    void append(const void* data, const int& size);
+    void addAttribute(const uint16_t& type, const void* data, const int& size);
+    void addString(const uint16_t& type, const char* value);
+    int beginNested(const uint16_t& type);
+    void endNested(const int& offset);
+    bool commit(const bool& ignoreMissing = false);
+    string kernelMessage(const nlmsghdr* header, const nlmsgerr* error) const;
+
+    bool setNetemQdisc(const string& device, const uint16_t& flags, const uint32_t& parent,
+                       const uint32_t& handle, const TCNetlink::Netem& netem);
+    bool addU32Filter(const int& index, const uint32_t& parent, const int& prio,
+                      const tc_u32_key* keys, const int& numKeys, const uint32_t& flowid,
+                      const int& targetIndex, const uint32_t& hash = 0);
+    bool addAddressFilter(const string& device, const uint32_t& parent, const int& prio,
+                          const string& source, const string& destination,
+                          const uint32_t& flowid, const uint32_t& hash);
+};
+
+}
+
+
+TCNetlink::TCNetlink()
+{
+    impl = new TCNetlinkImpl(this);
+}
+
+
+TCNetlinkImpl::TCNetlinkImpl(TCNetlink* self)
+    : self(self)
+{
+    fd = -1;
+    sequence = 0;
+    errorType = TCNetlink::NO_ERROR;
+    errorMessage.clear();
+}
+
+
+TCNetlink::~TCNetlink()
+{
+    delete impl;
+}
+
+
+TCNetlinkImpl::~TCNetlinkImpl()
+{
+    close();
+}
+
+
+bool TCNetlink::hasNetAdminCapability()
+{
+    __user_cap_header_struct header;
+    __user_cap_data_struct data[_LINUX_CAPABILITY_U32S_3];
+    header.version = _LINUX_CAPABILITY_VERSION_3;
+    header.pid = 0;
+    if(syscall(SYS_capget, &header, data) != 0) {
+        return false;
+    }
+    return data[CAP_TO_INDEX(CAP_NET_ADMIN)].effective & CAP_TO_MASK(CAP_NET_ADMIN);
+}
+
+
+bool TCNetlink::open()
+{
+    return impl->open();
+}
+
+
+bool TCNetlinkImpl::open()
+{
+    close();
+    errorType = TCNetlink::NO_ERROR;
+    errorMessage.clear();
+
+    if(!TCNetlink::hasNetAdminCapability()) {
+        return setError(TCNetlink::PERMISSION_ERROR,
+                        _("The process does not have the CAP_NET_ADMIN capability."));
+    }
+
+    fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if(fd < 0) {
+        return setError(TCNetlink::SOCKET_ERROR,
+                        fmt::format(_("A netlink socket cannot be opened: {0}"), strerror(errno)));
+    }
+    sockaddr_nl address;
+    memset(&address, 0, sizeof(address));
+    address.nl_family = AF_NETLINK;
+    if(bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        string message = strerror(errno);
+        close();
+        return setError(TCNetlink::SOCKET_ERROR,
+                        fmt::format(_("A netlink socket cannot be opened: {0}"), message));
+    }
+
+    // ask for the reason of a failure and not for a copy of the request
+    int on = 1;
+#ifdef NETLINK_EXT_ACK
+    setsockopt(fd, SOL_NETLINK, NETLINK_EXT_ACK, &on, sizeof(on));
+#endif
+#ifdef NETLINK_CAP_ACK
+    setsockopt(fd, SOL_NETLINK, NETLINK_CAP_ACK, &on, sizeof(on));
+#endif
+    return true;
+}
+
+
+void TCNetlink::close()
+{
+    impl->close();
+}
+
+
+void TCNetlinkImpl::close()
+{
+    if(fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+
+bool TCNetlink::isOpen() const
+{
+    return impl->fd >= 0;
+}
+
+
+bool TCNetlinkImpl::setError(const TCNetlink::ErrorType& type, const string& message)
+{
+    errorType = type;
+    errorMessage = message;
+    return false;
+}
+
+
+bool TCNetlink::hasDevice(const string& device) const
+{
+    return if_nametoindex(device.c_str()) != 0;
+}
+
+
+bool TCNetlinkImpl::findDevice(const string& device, int& out_index)
+{
+    if(fd < 0) {
+        return setError(TCNetlink::SOCKET_ERROR, _("The netlink socket is not open."));
+    }
+    out_index = if_nametoindex(device.c_str());
+    if(!out_index) {
+        return setError(TCNetlink::DEVICE_ERROR,
+                        fmt::format(_("Network device \"{0}\" does not exist."), device));
+    }
+    return true;
+}
+
+
+nlmsghdr* TCNetlinkImpl::begin(const uint16_t& type, const uint16_t& flags)
+{
+    memset(request, 0, NLMSG_HDRLEN);
+    nlmsghdr* header = reinterpret_cast<nlmsghdr*>(request);
+    header->nlmsg_len = NLMSG_HDRLEN;
+    header->nlmsg_type = type;
+    header->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    header->nlmsg_seq = ++sequence;
+    return header;
+}
+
+
+tcmsg* TCNetlinkImpl::beginTc(const uint16_t& type, const uint16_t& flags, const int& index,
+                              const uint32_t& parent, const uint32_t& handle, const uint32_t& info)
+{
+    begin(type, flags);
+    tcmsg message;
+    memset(&message, 0, sizeof(message));
+    message.tcm_family = AF_UNSPEC;
+    message.tcm_ifindex = index;
+    message.tcm_parent = parent;
+    message.tcm_handle = handle;
+    message.tcm_info = info;
+    append(&message, sizeof(message));
+    return reinterpret_cast<tcmsg*>(NLMSG_DATA(request));
+}
+
+
+void TCNetlinkImpl::append(const void* data, const int& size)
+{
+    nlmsghdr* header = reinterpret_cast<nlmsghdr*>(request);
+    int length = NLMSG_ALIGN(size);
+    if(header->nlmsg_len + length > RequestSize) {
+        return;
+    }
+    char* tail = request + header->nlmsg_len;
+    memcpy(tail, data, size);
+    memset(tail + size, 0, length - size);
+    header->nlmsg_len += length;
+}
+
+
+void TCNetlinkImpl::addAttribute(const uint16_t& type, const void* data, const int& size)
+{
+    nlmsghdr* header = reinterpret_cast<nlmsghdr*>(request);
+    int length = RTA_LENGTH(size);
+    if(header->nlmsg_len + RTA_ALIGN(length) > RequestSize) {
+        return;
+    }
+    rtattr* attribute = reinterpret_cast<rtattr*>(request + header->nlmsg_len);
+    attribute->rta_type = type;
+    attribute->rta_len = length;
+    memcpy(RTA_DATA(attribute), data, size);
+    memset(reinterpret_cast<char*>(attribute) + length, 0, RTA_ALIGN(length) - length);
+    header->nlmsg_len += RTA_ALIGN(length);
+}
+
+
+void TCNetlinkImpl::addString(const uint16_t& type, const char* value)
+{
+    addAttribute(type, value, strlen(value) + 1);
+}
+
+
+int TCNetlinkImpl::beginNested(const uint16_t& type)
+{
+    int offset = reinterpret_cast<nlmsghdr*>(request)->nlmsg_len;
+    addAttribute(type, nullptr, 0);
+    return offset;
+}
+
+
+void TCNetlinkImpl::endNested(const int& offset)
+{
+    rtattr* attribute = reinterpret_cast<rtattr*>(request + offset);
+    attribute->rta_len = reinterpret_cast<nlmsghdr*>(request)->nlmsg_len - offset;
+}
+
+
+bool TCNetlinkImpl::commit(const bool& ignoreMissing)
+{
+    nlmsghdr* header = reinterpret_cast<nlmsghdr*>(request);
+    sockaddr_nl kernel;
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+    if(sendto(fd, request, header->nlmsg_len, 0,
+              reinterpret_cast<sockaddr*>(&kernel), sizeof(kernel)) < 0) {
+        return setError(TCNetlink::SOCKET_ERROR,
+                        fmt::format(_("A netlink request cannot be sent: {0}"), strerror(errno)));
+    }
+
+    while(true) {
+        ssize_t length = recv(fd, response, sizeof(response), 0);
+        if(length < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return setError(TCNetlink::SOCKET_ERROR,
+                            fmt::format(_("A netlink response cannot be received: {0}"), strerror(errno)));
+        }
+        int remaining = length;
+        for(nlmsghdr* reply = reinterpret_cast<nlmsghdr*>(response);
+            NLMSG_OK(reply, remaining); reply = NLMSG_NEXT(reply, remaining)) {
+            if((reply->nlmsg_seq != header->nlmsg_seq) || (reply->nlmsg_type != NLMSG_ERROR)) {
+                continue;
+            }
+            const nlmsgerr* error = reinterpret_cast<const nlmsgerr*>(NLMSG_DATA(reply));
+            int code = -error->error;
+            if(!code || (ignoreMissing && ((code == ENOENT) || (code == EINVAL)))) {
+                errorType = TCNetlink::NO_ERROR;
+                errorMessage.clear();
+                return true;
+            }
+            string message = kernelMessage(reply, error);
+            if(message.empty()) {
+                message = strerror(code);
+            }
+            if((code == EPERM) || (code == EACCES)) {
+                return setError(TCNetlink::PERMISSION_ERROR, message);
+            } else if(code == ENODEV) {
+                return setError(TCNetlink::DEVICE_ERROR, message);
+            }
+            return setError(TCNetlink::KERNEL_ERROR, message);
+        }
+    }
+}
+
+
+string TCNetlinkImpl::kernelMessage(const nlmsghdr* header, const nlmsgerr* error) const
+{
+#ifdef NLM_F_ACK_TLVS
+    if(!(header->nlmsg_flags & NLM_F_ACK_TLVS)) {
+        return string();
+    }
+    // the attributes follow the copy of the request, which is capped to
+    // its header when NETLINK_CAP_ACK is on
+    int offset = sizeof(nlmsgerr);
+    if(!(header->nlmsg_flags & NLM_F_CAPPED)) {
+        offset += error->msg.nlmsg_len - NLMSG_HDRLEN;
+    }
+    const char* data = reinterpret_cast<const char*>(NLMSG_DATA(header)) + NLMSG_ALIGN(offset);
+    int remaining = (int)header->nlmsg_len - (int)(data - reinterpret_cast<const char*>(header));
+    for(const rtattr* attribute = reinterpret_cast<const rtattr*>(data);
+        RTA_OK(attribute, remaining); attribute = RTA_NEXT(attribute, remaining)) {
+        if(attribute->rta_type == NLMSGERR_ATTR_MSG) {
+            return string(reinterpret_cast<const char*>(RTA_DATA(attribute)));
+        }
+    }
+#endif
+    return string();
+}
+
+
+bool TCNetlink::addIfbDevice(const string& device)
+{
+    if(!isOpen()) {
+        return impl->setError(SOCKET_ERROR, _("The netlink socket is not open."));
+    }
+    // the kernel loads the ifb module on demand
+    impl->begin(RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL);
+    ifinfomsg message;
+    memset(&message, 0, sizeof(message));
+    message.ifi_family = AF_UNSPEC;
+    impl->append(&message, sizeof(message));
+    impl->addString(IFLA_IFNAME, device.c_str());
+    int linkInfo = impl->beginNested(IFLA_LINKINFO);
+    impl->addString(IFLA_INFO_KIND, "ifb");
+    impl->endNested(linkInfo);
+    return impl->commit();
+}
+
+
+bool TCNetlink::deleteDevice(const string& device)
+{
+    int index;
+    if(!impl->findDevice(device, index)) {
+        return false;
+    }
+    impl->begin(RTM_DELLINK, 0);
+    ifinfomsg message;
+    memset(&message, 0, sizeof(message));
+    message.ifi_family = AF_UNSPEC;
+    message.ifi_index = index;
+    impl->append(&message, sizeof(message));
+    return impl->commit();
+}
+
+
+bool TCNetlink::setDeviceUp(const string& device, const bool& on)
+{
+    int index;
+    if(!impl->findDevice(device, index)) {
+        return false;
+    }
+    impl->begin(RTM_NEWLINK, 0);
+    ifinfomsg message;
+    memset(&message, 0, sizeof(message));
+    message.ifi_family = AF_UNSPEC;
+    message.ifi_index = index;
+    message.ifi_flags = on ? IFF_UP : 0;
+    message.ifi_change = IFF_UP;
+    impl->append(&message, sizeof(message));
+    return impl->commit();
+}
+
+
+bool TCNetlink::addIngressQdisc(const string& device)
+{
+    int index;
+    if(!impl->findDevice(device, index)) {
+        return false;
+    }
+    impl->beginTc(RTM_NEWQDISC, NLM_F_CREATE | NLM_F_EXCL, index,
+                  TC_H_INGRESS, TC_H_MAKE(TC_H_INGRESS, 0), 0);
+    impl->addString(TCA_KIND, "ingress");
+    return impl->commit();
+}
+
+
+bool TCNetlink::addPrioQdisc(const string& device, const uint32_t& handle, const int& bands)
+{
+    return addPrioQdisc(device, TC_H_ROOT, handle, bands);
+}
+
+
+bool TCNetlink::addPrioQdisc(const string& device, const uint32_t& parent, const uint32_t& handle,
+                             const int& bands)
+{
+    int index;
+    if(!impl->findDevice(device, index)) {
+        return false;
+    }
+    if((bands < 2) || (bands > TCQ_PRIO_BANDS)) {
+        return impl->setError(ARGUMENT_ERROR,
+                              fmt::format(_("A prio qdisc cannot have {0} bands."), bands));
+    }
+    // every priority goes to the first band unless a filter says otherwise
+    tc_prio_qopt options;
+    memset(&options, 0, sizeof(options));
+    options.bands = bands;
+    impl->beginTc(RTM_NEWQDISC, NLM_F_CREATE | NLM_F_EXCL, index, parent, handle, 0);
+    impl->addString(TCA_KIND, "prio");
+    impl->addAttribute(TCA_OPTIONS, &options, sizeof(options));
+    return impl->commit();
+}
+
+
+bool TCNetlink::addNetemQdisc(const string& device, const uint32_t& parent, const uint32_t& handle,
+                              const Netem& netem)
+{
+    return impl->setNetemQdisc(device, NLM_F_CREATE | NLM_F_EXCL, parent, handle, netem);
+}
+
+
+bool TCNetlink::changeNetemQdisc(const string& device, const uint32_t& parent, const uint32_t& handle,
+                                 const Netem& netem)
+{
+    return impl->setNetemQdisc(device, 0, parent, handle, netem);
+}
+
+
+bool TCNetlinkImpl::setNetemQdisc(const string& device, const uint16_t& flags, const uint32_t& parent,
+                                  const uint32_t& handle, const TCNetlink::Netem& netem)
+{
+    int index;
+    if(!findDevice(device, index)) {
+        return false;
+    }
+
+    int64_t latency = (int64_t)(std::max(netem.delay, 0.0) * 1.0e6);
+    uint64_t rate = (uint64_t)(std::max(netem.rate, 0.0) * 1000.0);
+    double loss = std::min(std::max(netem.loss, 0.0), 100.0) / 100.0;
+
+    tc_netem_qopt options;
+    memset(&options, 0, sizeof(options));
+    options.latency = (uint32_t)std::min<int64_t>(latency >> PschedShift, UINT32_MAX);
+    options.limit = std::max(netem.limit, 1);
+    options.loss = (uint32_t)(loss * UINT32_MAX);
+
+    beginTc(RTM_NEWQDISC, flags, index, parent, handle, 0);
+    addString(TCA_KIND, "netem");
+
+    // netem takes its fixed options first and the attributes after them;
+    // the rate is always sent because a change keeps a rate that is left out
+    int offset = beginNested(TCA_OPTIONS);
+    append(&options, sizeof(options));
+    if(latency > 0) {
+        addAttribute(TCA_NETEM_LATENCY64, &latency, sizeof(latency));
+    }
+    tc_netem_rate netemRate;
+    memset(&netemRate, 0, sizeof(netemRate));
+    if(rate >= (1ULL << 32)) {
+        addAttribute(TCA_NETEM_RATE64, &rate, sizeof(rate));
+        netemRate.rate = ~0U;
+    } else {
+        netemRate.rate = (uint32_t)rate;
+    }
+    addAttribute(TCA_NETEM_RATE, &netemRate, sizeof(netemRate));
+    endNested(offset);
+    return commit();
+}
+
+
+bool TCNetlink::deleteRootQdisc(const string& device)
+{
+    int index;
+    if(!impl->findDevice(device, index)) {
+        return false;
+    }
+    impl->beginTc(RTM_DELQDISC, 0, index, TC_H_ROOT, 0, 0);
+    return impl->commit(true);
+}
+
+
+bool TCNetlink::deleteIngressQdisc(const string& device)
+{
+    int index;
+    if(!impl->findDevice(device, index)) {
+        return false;
+    }
+    impl->beginTc(RTM_DELQDISC, 0, index, TC_H_INGRESS, TC_H_MAKE(TC_H_INGRESS, 0), 0);
+    return impl->commit(true);
+}
+
+
+bool TCNetlink::addU32Filter(const string& device, const uint32_t& parent, const int& prio,
+                             const string& source, const string& destination, const uint32_t& flowid)
+{
+    return impl->addAddressFilter(device, parent, prio, source, destination, flowid, 0);
+}
+
+
+bool TCNetlink::addU32Filter(const string& device, const uint32_t& parent, const int& prio,
+                             const string& source, const string& destination, const uint32_t& flowid,
+                             const int& table, const int& bucket)
+{
+    if(table <= 0 || table > 0xfff || bucket < 0 || bucket >= U32Divisor) {
+        return impl->setError(ARGUMENT_ERROR,
+                              fmt::format(_("{0:x}:{1:x}: is not a bucket of a u32 hash table."), table, bucket));
+    }
+    return impl->addAddressFilter(device, parent, prio, source, destination, flowid, u32Handle(table, bucket));
+}
+
+
+bool TCNetlinkImpl::addAddressFilter(const string& device, const uint32_t& parent, const int& prio,
+                                     const string& source, const string& destination,
+                                     const uint32_t& flowid, const uint32_t& hash)
+{
+    int index;
+    if(!findDevice(device, index)) {
+        return false;
+    }
+    uint32_t address[2];
+    uint32_t mask[2];
+    if(!parsePrefix(source, address[0], mask[0])) {
+        return setError(TCNetlink::ARGUMENT_ERROR,
+                        fmt::format(_("\"{0}\" is not an IPv4 address."), source));
+    }
+    if(!parsePrefix(destination, address[1], mask[1])) {
+        return setError(TCNetlink::ARGUMENT_ERROR,
+                        fmt::format(_("\"{0}\" is not an IPv4 address."), destination));
+    }
+
+    // the source and destination addresses are at bytes 12 and 16 of the IP header
+    tc_u32_key keys[2];
+    memset(keys, 0, sizeof(keys));
+    for(int i = 0; i < 2; ++i) {
+        keys[i].val = address[i];
+        keys[i].mask = mask[i];
+        keys[i].off = 12 + i * 4;
+    }
+    return addU32Filter(index, parent, prio, keys, 2, flowid, 0, hash);
+}
+
+
+bool TCNetlink::addU32HashTable(const string& device, const uint32_t& parent, const int& prio,
+                                const int& table)
+{
+    int index;
+    if(!impl->findDevice(device, index)) {
+        return false;
+    }
+    if(table <= 0 || table > 0xfff) {
+        return impl->setError(ARGUMENT_ERROR,
+                              fmt::format(_("{0:x}: is not a u32 hash table."), table));
+    }
+    uint32_t divisor = U32Divisor;
+    impl->beginTc(RTM_NEWTFILTER, NLM_F_CREATE | NLM_F_EXCL, index, parent, u32Handle(table, 0),
+                  TC_H_MAKE((uint32_t)prio << 16, htons(ETH_P_IP)));
+    impl->addString(TCA_KIND, "u32");
+    int options = impl->beginNested(TCA_OPTIONS);
+    impl->addAttribute(TCA_U32_DIVISOR, &divisor, sizeof(divisor));
+    impl->endNested(options);
+    return impl->commit();
+}
+
+
+bool TCNetlink::addU32HashLink(const string& device, const uint32_t& parent, const int& prio,
+                               const int& table, const int& offset)
+{
+    int index;
+    if(!impl->findDevice(device, index)) {
+        return false;
+    }
+    if(table <= 0 || table > 0xfff) {
+        return impl->setError(ARGUMENT_ERROR,
+                              fmt::format(_("{0:x}: is not a u32 hash table."), table));
+    }
+
+    // match every packet, and hash it on the lowest octet of the address
+    // as "hashkey mask 0x000000ff at <offset> link <table>:"
+    alignas(tc_u32_sel) char buffer[sizeof(tc_u32_sel) + sizeof(tc_u32_key)];
+    tc_u32_sel* selector = reinterpret_cast<tc_u32_sel*>(buffer);
+    memset(buffer, 0, sizeof(buffer));
+    selector->nkeys = 1;
+    selector->keys[0].off = offset;
+    selector->hmask = htonl(U32Divisor - 1);
+    selector->hoff = offset;
+    uint32_t link = u32Handle(table, 0);
+
+    impl->beginTc(RTM_NEWTFILTER, NLM_F_CREATE | NLM_F_EXCL, index, parent, 0,
+                  TC_H_MAKE((uint32_t)prio << 16, htons(ETH_P_IP)));
+    impl->addString(TCA_KIND, "u32");
+    int options = impl->beginNested(TCA_OPTIONS);
+    impl->addAttribute(TCA_U32_LINK, &link, sizeof(link));
+    impl->addAttribute(TCA_U32_SEL, buffer, sizeof(buffer));
+    impl->endNested(options);
+    return impl->commit();
+}
+
+
+bool TCNetlink::addMirredFilter(const string& device, const string& targetDevice)
+{
+    int index;
+    int targetIndex;
+    if(!impl->findDevice(device, index) || !impl->findDevice(targetDevice, targetIndex)) {
+        return false;
+    }
+    tc_u32_key key;
+    memset(&key, 0, sizeof(key));
+    return impl->addU32Filter(index, TC_H_MAKE(TC_H_INGRESS, 0), 0, &key, 1, 0, targetIndex);
+}
+
+
+bool TCNetlinkImpl::addU32Filter(const int& index, const uint32_t& parent, const int& prio,
+                                 const tc_u32_key* keys, const int& numKeys, const uint32_t& flowid,
+                                 const int& targetIndex, const uint32_t& hash)
+{
+    alignas(tc_u32_sel) char buffer[sizeof(tc_u32_sel) + 2 * sizeof(tc_u32_key)];
+    tc_u32_sel* selector = reinterpret_cast<tc_u32_sel*>(buffer);
+    memset(buffer, 0, sizeof(buffer));
+    selector->flags = TC_U32_TERMINAL;
+    selector->nkeys = numKeys;
+    memcpy(selector->keys, keys, numKeys * sizeof(tc_u32_key));
+
+    beginTc(RTM_NEWTFILTER, NLM_F_CREATE | NLM_F_EXCL, index, parent, 0,
+            TC_H_MAKE((uint32_t)prio << 16, htons(ETH_P_IP)));
+    addString(TCA_KIND, "u32");
+    int options = beginNested(TCA_OPTIONS);
+    if(hash) {
+        addAttribute(TCA_U32_HASH, &hash, sizeof(hash));
+    }
+    if(flowid) {
+        addAttribute(TCA_U32_CLASSID, &flowid, sizeof(flowid));
+    }
+    addAttribute(TCA_U32_SEL, buffer, sizeof(tc_u32_sel) + numKeys * sizeof(tc_u32_key));
+    if(targetIndex) {
+        // action mirred egress redirect dev <target>
+        tc_mirred mirred;
+        memset(&mirred, 0, sizeof(mirred));
+        mirred.action = TC_ACT_STOLEN;
+        mirred.eaction = TCA_EGRESS_REDIR;
+        mirred.ifindex = targetIndex;
+        int actions = beginNested(TCA_U32_ACT);
+        int action = beginNested(1);
+        addString(TCA_ACT_KIND, "mirred");
+        int actionOptions = beginNested(TCA_ACT_OPTIONS);
+        addAttribute(TCA_MIRRED_PARMS, &mirred, sizeof(mirred));
+        endNested(actionOptions);
+        endNested(action);
+        endNested(actions);
+    }
+    endNested(options);
+    return commit();
+}
+
+
+TCNetlink::ErrorType TCNetlink::errorType() const
+{
+    return impl->errorType;
+}
+
+
+const string& TCNetlink::errorMessage() const
+{
+    return impl->errorMessage;
+}
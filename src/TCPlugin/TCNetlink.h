@@ -0,0 +1,102 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_TC_PLUGIN_TC_NETLINK_H
+#define CNOID_TC_PLUGIN_TC_NETLINK_H
+
+#include <cstdint>
+#include <string>
+
+namespace cnoid {
+
+class TCNetlinkImpl;
+
+/**
+   Programs the qdiscs and filters used by TCSimulatorItem over an
+   rtnetlink socket instead of running the tc and ip commands.
+   Every request waits for the acknowledgement of the kernel, so a
+   failed request is reported by its return value together with
+   errorType() and errorMessage().
+
+   The process needs CAP_NET_ADMIN, which can be granted once with
+     sudo setcap cap_net_admin+ep choreonoid
+   open() fails with PERMISSION_ERROR when the capability is missing.
+   Handles follow the notation of tc: 0x00010002 is "1:2". A qdisc added
+   without a parent is the root qdisc of the device.
+*/
+class TCNetlink
+{
+public:
+    enum ErrorType {
+        NO_ERROR,
+        SOCKET_ERROR,
+        PERMISSION_ERROR,
+        DEVICE_ERROR,
+        ARGUMENT_ERROR,
+        KERNEL_ERROR
+    };
+
+    struct Netem
+    {
+        Netem() : delay(0.0), rate(0.0), loss(0.0), limit(2000) { }
+        double delay; // [ms]
+        double rate;  // [kbps], kilobytes per second as in tc
+        double loss;  // [%]
+        int limit;    // [packets]
+    };
+
+    TCNetlink();
+    virtual ~TCNetlink();
+
+    static bool hasNetAdminCapability();
+
+    bool open();
+    void close();
+    bool isOpen() const;
+
+    bool hasDevice(const std::string& device) const;
+    bool addIfbDevice(const std::string& device);
+    bool deleteDevice(const std::string& device);
+    bool setDeviceUp(const std::string& device, const bool& on);
+
+    bool addIngressQdisc(const std::string& device);
+    bool addPrioQdisc(const std::string& device, const uint32_t& handle, const int& bands);
+    bool addPrioQdisc(const std::string& device, const uint32_t& parent, const uint32_t& handle,
+                      const int& bands);
+    bool addNetemQdisc(const std::string& device, const uint32_t& parent, const uint32_t& handle,
+                       const Netem& netem);
+    bool changeNetemQdisc(const std::string& device, const uint32_t& parent, const uint32_t& handle,
+                          const Netem& netem);
+    bool deleteRootQdisc(const std::string& device);
+    bool deleteIngressQdisc(const std::string& device);
+
+    bool addU32Filter(const std::string& device, const uint32_t& parent, const int& prio,
+                      const std::string& source, const std::string& destination,
+                      const uint32_t& flowid);
+
+    // a u32 hash table of 256 buckets, selected by the lowest octet of the
+    // address at the offset of the IP header (12 for the source, 16 for
+    // the destination); tables are numbered from 1 to 0xfff as "table:"
+    bool addU32HashTable(const std::string& device, const uint32_t& parent, const int& prio,
+                         const int& table);
+    bool addU32HashLink(const std::string& device, const uint32_t& parent, const int& prio,
+                        const int& table, const int& offset);
+    bool addU32Filter(const std::string& device, const uint32_t& parent, const int& prio,
+                      const std::string& source, const std::string& destination,
+                      const uint32_t& flowid, const int& table, const int& bucket);
+    bool addMirredFilter(const std::string& device, const std::string& targetDevice);
+
+    ErrorType errorType() const;
+    const std::string& errorMessage() const;
+
+private:
+    TCNetlink(const TCNetlink& org);
+    TCNetlinkImpl* impl;
+    friend class TCNetlinkImpl;
+};
+
+}
+
+#endif // CNOID_TC_PLUGIN_TC_NETLINK_H
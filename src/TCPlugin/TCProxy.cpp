@@ -0,0 +1,1154 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "TCProxy.h"
+#include <fmt/format.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include "gettext.h"
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+const int64_t TickTime = 100000;                  // [ns]
+const int WheelSize = 1 << 16;                    // 6.5 s of ticks in a round
+const int64_t BurstTime = 10000000;               // [ns] of the rate in the bucket
+const int64_t RetransmissionTimeout = 200000000;  // [ns]
+const int64_t UdpIdleTime = 60000000000;          // [ns]
+const size_t BufferSize = 65536;
+const size_t MaxQueuedBytes = 16 << 20;
+const int SocketBufferSize = 4 << 20;
+const size_t MaxFreePackets = 4096;
+const int MaxEvents = 64;
+const int MaxReads = 32;
+
+enum EndpointType { ListenEndpoint, ClientEndpoint, ServerEndpoint, TimerEndpoint, WakeEndpoint };
+
+struct Route;
+struct Flow;
+struct Direction;
+
+struct Endpoint
+{
+    EndpointType type;
+    Route* route;
+    Flow* flow;
+    uint32_t events;
+    bool isRemoved;
+};
+
+struct Packet
+{
+    Packet* next;
+    Direction* direction;
+    int64_t tick;
+    size_t offset;
+    bool isFin;
+    vector<char> data;
+};
+
+// netem of a direction in the units of the relay
+struct Impairment
+{
+    Impairment() : delay(0), rate(0.0), loss(0.0), limit(2000) { }
+    int64_t delay;  // [ns]
+    double rate;    // [bytes/ns], 0 for unlimited
+    double loss;    // [0, 1]
+    int limit;      // [packets]
+};
+
+struct Direction
+{
+    Flow* flow;
+    bool isToServer;
+    Packet* head;  // due packets that wait for the socket
+    Packet* tail;
+    int numPackets;  // in the wheel and in the queue
+    size_t numBytes;
+    int64_t lastDeparture;
+    double bucketTime;  // when the bucket runs empty
+    bool isBad;         // state of the Gilbert-Elliott model
+    bool isEof;
+    bool isShutdown;
+    bool isReadBlocked;
+};
+
+// a UDP client or a TCP connection of a route
+struct Flow
+{
+    Route* route;
+    int clientFd;  // the listening socket for UDP
+    int serverFd;
+    sockaddr_in clientAddress;
+    uint64_t key;
+    Direction toServer;
+    Direction toClient;
+    Endpoint clientEndpoint;
+    Endpoint serverEndpoint;
+    bool isConnecting;
+    bool isClosed;
+    int64_t lastActive;
+    uint64_t random;
+};
+
+struct Route
+{
+    TCProxy::Protocol protocol;
+    int port;
+    sockaddr_in target;
+    int listenFd;
+    Endpoint endpoint;
+    Impairment inbound;
+    Impairment outbound;
+    unordered_map<uint64_t, Flow*> udpFlows;
+};
+
+int64_t monotonicTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+Impairment toImpairment(const TCNetlink::Netem& netem)
+{
+    // the rate is in kilobytes per second as in tc
+    Impairment impairment;
+    impairment.delay = (int64_t)(netem.delay * 1.0e6);
+    impairment.rate = netem.rate * 1000.0 / 1.0e9;
+    impairment.loss = std::min(std::max(netem.loss / 100.0, 0.0), 1.0);
+    impairment.limit = netem.limit;
+    return impairment;
+}
+
+
+double uniform(uint64_t& state)
+{
+    // xorshift64*
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return ((state * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+}
+
+
+namespace cnoid {
+
+class TCProxyImpl
+{
+public:
+    TCProxyImpl(TCProxy* self);
+    ~TCProxyImpl();
+
+    TCProxy* self;
+    vector<Route*> routes;
+    thread relay;
+    std::atomic<bool> isStopping;
+    int epollFd;
+    int timerFd;
+    int wakeFd;
+    Endpoint timerEndpoint;
+    Endpoint wakeEndpoint;
+    string errorMessage;
+
+    // parameters set by the simulation and copied by the relay
+    mutex configMutex;
+    vector<TCNetlink::Netem> inboundNetems;
+    vector<TCNetlink::Netem> outboundNetems;
+    TCProxy::LossModel lossModel;
+    double burstLength;
+    std::atomic<uint64_t> configGeneration;
+
+    // the rest is owned by the relay thread
+    uint64_t appliedGeneration;
+    TCProxy::LossModel currentLossModel;
+    double currentBurstLength;
+    vector<Packet*> slotHeads;
+    vector<Packet*> slotTails;
+    vector<uint64_t> occupiedSlots;
+    int64_t currentTick;
+    int64_t armedTick;
+    int numScheduled;
+    unordered_set<Flow*> flows;
+    vector<Flow*> closedFlows;
+    vector<Packet*> freePackets;
+    vector<char> buffer;
+    int64_t nextExpiry;
+    std::atomic<uint64_t> numForwarded;
+    std::atomic<uint64_t> numDropped;
+
+    bool start();
+    void stop();
+    bool setError(const string& message);
+    bool addEndpoint(const int& fd, Endpoint* endpoint, const uint32_t& events);
+    void setEvents(const int& fd, Endpoint* endpoint, const uint32_t& events);
+    void run();
+    void applyConfig();
+    void onUdpReceive(Route* route, const int64_t& now);
+    void onAccept(Route* route, const int64_t& now);
+    void onFlowEvent(Endpoint* endpoint, const uint32_t& events, const int64_t& now);
+    Flow* openFlow(Route* route, const int& clientFd, const int64_t& now);
+    void initializeDirection(Direction& direction, Flow* flow, const bool& isToServer);
+    void closeFlow(Flow* flow);
+    void collectFlows();
+    void expireFlows(const int64_t& now);
+    void updateEvents(Flow* flow);
+    void read(Flow* flow, Direction& direction, const int& fd, const int64_t& now);
+    void enqueue(Direction& direction, Packet* packet, const int64_t& now);
+    bool isLost(Direction& direction, const Impairment& impairment);
+    void schedule(Packet* packet);
+    void deliver(Packet* packet);
+    void flush(Direction& direction);
+    void processWheel(const int64_t& now);
+    int64_t findOccupiedTick(const int64_t& from, const int64_t& to) const;
+    void armTimer();
+    Packet* newPacket(const char* data, const size_t& size);
+    void releasePacket(Packet* packet);
+};
+
+}
+
+
+TCProxy::TCProxy()
+{
+    impl = new TCProxyImpl(this);
+}
+
+
+TCProxyImpl::TCProxyImpl(TCProxy* self)
+    : self(self),
+      isStopping(false),
+      configGeneration(0),
+      numForwarded(0),
+      numDropped(0)
+{
+    routes.clear();
+    epollFd = -1;
+    timerFd = -1;
+    wakeFd = -1;
+    timerEndpoint.type = TimerEndpoint;
+    wakeEndpoint.type = WakeEndpoint;
+    errorMessage.clear();
+    lossModel = TCProxy::BERNOULLI;
+    burstLength = 1.0;
+    appliedGeneration = 0;
+    currentLossModel = TCProxy::BERNOULLI;
+    currentBurstLength = 1.0;
+    currentTick = 0;
+    armedTick = -1;
+    numScheduled = 0;
+    nextExpiry = 0;
+}
+
+
+TCProxy::~TCProxy()
+{
+    delete impl;
+}
+
+
+TCProxyImpl::~TCProxyImpl()
+{
+    stop();
+    for(auto& route : routes) {
+        delete route;
+    }
+}
+
+
+void TCProxy::clearRoutes()
+{
+    impl->stop();
+    for(auto& route : impl->routes) {
+        delete route;
+    }
+    impl->routes.clear();
+    impl->inboundNetems.clear();
+    impl->outboundNetems.clear();
+}
+
+
+int TCProxy::addRoute(const Protocol& protocol, const int& port,
+                      const std::string& targetAddress, const int& targetPort)
+{
+    sockaddr_in target;
+    memset(&target, 0, sizeof(target));
+    target.sin_family = AF_INET;
+    target.sin_port = htons(targetPort);
+    if((port <= 0) || (port > 65535) || (targetPort <= 0) || (targetPort > 65535)
+       || (inet_pton(AF_INET, targetAddress.c_str(), &target.sin_addr) != 1)) {
+        impl->setError(fmt::format(_("\"{0}:{1}\" is not a target of a route."), targetAddress, targetPort));
+        return -1;
+    }
+
+    Route* route = new Route;
+    route->protocol = protocol;
+    route->port = port;
+    route->target = target;
+    route->listenFd = -1;
+    route->endpoint.type = ListenEndpoint;
+    route->endpoint.route = route;
+    route->endpoint.flow = nullptr;
+    impl->routes.push_back(route);
+    lock_guard<mutex> lock(impl->configMutex);
+    impl->inboundNetems.push_back(TCNetlink::Netem());
+    impl->outboundNetems.push_back(TCNetlink::Netem());
+    ++impl->configGeneration;
+    return impl->routes.size() - 1;
+}
+
+
+int TCProxy::numRoutes() const
+{
+    return impl->routes.size();
+}
+
+
+bool TCProxy::start()
+{
+    return impl->start();
+}
+
+
+bool TCProxyImpl::start()
+{
+    stop();
+    errorMessage.clear();
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if((epollFd < 0) || (timerFd < 0) || (wakeFd < 0)
+       || !addEndpoint(timerFd, &timerEndpoint, EPOLLIN) || !addEndpoint(wakeFd, &wakeEndpoint, EPOLLIN)) {
+        setError(fmt::format(_("The proxy cannot be started: {0}"), strerror(errno)));
+        stop();
+        return false;
+    }
+
+    int on = 1;
+    for(auto& route : routes) {
+        bool isUdp = route->protocol == TCProxy::UDP;
+        route->listenFd = socket(AF_INET, (isUdp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(route->port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bool result = route->listenFd >= 0;
+        if(result) {
+            setsockopt(route->listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if(isUdp) {
+                setsockopt(route->listenFd, SOL_SOCKET, SO_RCVBUF, &SocketBufferSize, sizeof(SocketBufferSize));
+                setsockopt(route->listenFd, SOL_SOCKET, SO_SNDBUF, &SocketBufferSize, sizeof(SocketBufferSize));
+            }
+            result = (bind(route->listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+                && (isUdp || (listen(route->listenFd, SOMAXCONN) == 0))
+                && addEndpoint(route->listenFd, &route->endpoint, EPOLLIN);
+        }
+        if(!result) {
+            setError(fmt::format(_("Port {0} of the proxy cannot be opened: {1}"), route->port, strerror(errno)));
+            stop();
+            return false;
+        }
+    }
+
+    slotHeads.assign(WheelSize, nullptr);
+    slotTails.assign(WheelSize, nullptr);
+    occupiedSlots.assign(WheelSize / 64, 0);
+    currentTick = monotonicTime() / TickTime;
+    armedTick = -1;
+    numScheduled = 0;
+    nextExpiry = 0;
+    buffer.resize(BufferSize);
+    appliedGeneration = configGeneration - 1;
+    isStopping = false;
+    relay = thread([this](){ run(); });
+    return true;
+}
+
+
+void TCProxy::stop()
+{
+    impl->stop();
+}
+
+
+void TCProxyImpl::stop()
+{
+    if(relay.joinable()) {
+        isStopping = true;
+        uint64_t value = 1;
+        if(::write(wakeFd, &value, sizeof(value)) < 0) {
+            // the relay wakes up within a second anyway
+        }
+        relay.join();
+    }
+
+    // nothing is forwarded any more, so packets and flows go at once
+    for(auto& head : slotHeads) {
+        while(head) {
+            Packet* next = head->next;
+            delete head;
+            head = next;
+        }
+    }
+    slotHeads.clear();
+    slotTails.clear();
+    occupiedSlots.clear();
+    numScheduled = 0;
+    for(auto& flow : flows) {
+        closeFlow(flow);
+        for(Direction* direction : { &flow->toServer, &flow->toClient }) {
+            while(direction->head) {
+                Packet* next = direction->head->next;
+                delete direction->head;
+                direction->head = next;
+            }
+        }
+        delete flow;
+    }
+    flows.clear();
+    closedFlows.clear();
+    for(auto& packet : freePackets) {
+        delete packet;
+    }
+    freePackets.clear();
+
+    for(auto& route : routes) {
+        route->udpFlows.clear();
+        if(route->listenFd >= 0) {
+            ::close(route->listenFd);
+            route->listenFd = -1;
+        }
+    }
+    for(int* fd : { &epollFd, &timerFd, &wakeFd }) {
+        if(*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+
+bool TCProxy::isRunning() const
+{
+    return impl->relay.joinable();
+}
+
+
+void TCProxy::setNetem(const int& route, const TCNetlink::Netem& inbound, const TCNetlink::Netem& outbound)
+{
+    lock_guard<mutex> lock(impl->configMutex);
+    for(size_t i = 0; i < impl->inboundNetems.size(); ++i) {
+        if((route < 0) || (route == (int)i)) {
+            impl->inboundNetems[i] = inbound;
+            impl->outboundNetems[i] = outbound;
+        }
+    }
+    ++impl->configGeneration;
+}
+
+
+void TCProxy::setLossModel(const LossModel& lossModel, const double& burstLength)
+{
+    lock_guard<mutex> lock(impl->configMutex);
+    impl->lossModel = lossModel;
+    impl->burstLength = burstLength;
+    ++impl->configGeneration;
+}
+
+
+uint64_t TCProxy::numForwardedPackets() const
+{
+    return impl->numForwarded;
+}
+
+
+uint64_t TCProxy::numDroppedPackets() const
+{
+    return impl->numDropped;
+}
+
+
+const std::string& TCProxy::errorMessage() const
+{
+    return impl->errorMessage;
+}
+
+
+bool TCProxyImpl::setError(const string& message)
+{
+    errorMessage = message;
+    return false;
+}
+
+
+bool TCProxyImpl::addEndpoint(const int& fd, Endpoint* endpoint, const uint32_t& events)
+{
+    epoll_event event;
+    event.events = events;
+    event.data.ptr = endpoint;
+    endpoint->events = events;
+    endpoint->isRemoved = false;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+
+void TCProxyImpl::setEvents(const int& fd, Endpoint* endpoint, const uint32_t& events)
+{
+    if(!endpoint->isRemoved && (endpoint->events != events)) {
+        epoll_event event;
+        event.events = events;
+        event.data.ptr = endpoint;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+        endpoint->events = events;
+    }
+}
+
+
+void TCProxyImpl::run()
+{
+    epoll_event events[MaxEvents];
+    while(!isStopping) {
+        armTimer();
+        int n = epoll_wait(epollFd, events, MaxEvents, 1000);
+        if((n < 0) && (errno != EINTR)) {
+            break;
+        }
+        int64_t now = monotonicTime();
+        applyConfig();
+        // the wheel is brought up to now, so that a packet that is already
+        // due when it is read leaves at once
+        processWheel(now);
+        for(int i = 0; i < n; ++i) {
+            Endpoint* endpoint = static_cast<Endpoint*>(events[i].data.ptr);
+            uint64_t value;
+            switch(endpoint->type) {
+            case TimerEndpoint:
+            case WakeEndpoint:
+                if(::read(endpoint->type == TimerEndpoint ? timerFd : wakeFd, &value, sizeof(value)) < 0) {
+                    // already cleared
+                }
+                break;
+            case ListenEndpoint:
+                if(endpoint->route->protocol == TCProxy::UDP) {
+                    onUdpReceive(endpoint->route, now);
+                } else {
+                    onAccept(endpoint->route, now);
+                }
+                break;
+            default:
+                onFlowEvent(endpoint, events[i].events, now);
+                break;
+            }
+        }
+        processWheel(monotonicTime());
+        if(now >= nextExpiry) {
+            expireFlows(now);
+            nextExpiry = now + 1000000000;
+        }
+        collectFlows();
+    }
+}
+
+
+void TCProxyImpl::applyConfig()
+{
+    uint64_t generation = configGeneration.load(memory_order_acquire);
+    if(generation == appliedGeneration) {
+        return;
+    }
+    lock_guard<mutex> lock(configMutex);
+    for(size_t i = 0; i < routes.size(); ++i) {
+        routes[i]->inbound = toImpairment(inboundNetems[i]);
+        routes[i]->outbound = toImpairment(outboundNetems[i]);
+    }
+    currentLossModel = lossModel;
+    currentBurstLength = std::max(burstLength, 1.0);
+    appliedGeneration = configGeneration;
+}
+
+
+void TCProxyImpl::onUdpReceive(Route* route, const int64_t& now)
+{
+    for(int i = 0; i < MaxReads; ++i) {
+        sockaddr_in address;
+        socklen_t length = sizeof(address);
+        ssize_t size = recvfrom(route->listenFd, buffer.data(), buffer.size(), 0,
+                                reinterpret_cast<sockaddr*>(&address), &length);
+        if(size < 0) {
+            break;
+        }
+
+        // every client address has a socket of its own towards the target,
+        // which carries the replies back to that client
+        uint64_t key = ((uint64_t)address.sin_addr.s_addr << 16) | address.sin_port;
+        Flow* flow;
+        auto found = route->udpFlows.find(key);
+        if(found != route->udpFlows.end()) {
+            flow = found->second;
+        } else {
+            flow = openFlow(route, route->listenFd, now);
+            if(!flow) {
+                ++numDropped;
+                continue;
+            }
+            flow->clientAddress = address;
+            flow->key = key;
+            route->udpFlows[key] = flow;
+        }
+        flow->lastActive = now;
+        enqueue(flow->toServer, newPacket(buffer.data(), size), now);
+    }
+}
+
+
+void TCProxyImpl::onAccept(Route* route, const int64_t& now)
+{
+    for(int i = 0; i < MaxReads; ++i) {
+        int fd = accept4(route->listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0) {
+            break;
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if(!openFlow(route, fd, now)) {
+            ::close(fd);
+        }
+    }
+}
+
+
+Flow* TCProxyImpl::openFlow(Route* route, const int& clientFd, const int64_t& now)
+{
+    bool isUdp = route->protocol == TCProxy::UDP;
+    int fd = socket(AF_INET, (isUdp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        return nullptr;
+    }
+    int on = 1;
+    if(isUdp) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &SocketBufferSize, sizeof(SocketBufferSize));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &SocketBufferSize, sizeof(SocketBufferSize));
+    } else {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    int result = connect(fd, reinterpret_cast<const sockaddr*>(&route->target), sizeof(route->target));
+    if((result != 0) && (errno != EINPROGRESS)) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    Flow* flow = new Flow;
+    flow->route = route;
+    flow->clientFd = clientFd;
+    flow->serverFd = fd;
+    memset(&flow->clientAddress, 0, sizeof(flow->clientAddress));
+    flow->key = 0;
+    initializeDirection(flow->toServer, flow, true);
+    initializeDirection(flow->toClient, flow, false);
+    flow->clientEndpoint.type = ClientEndpoint;
+    flow->clientEndpoint.route = route;
+    flow->clientEndpoint.flow = flow;
+    flow->clientEndpoint.isRemoved = true;
+    flow->serverEndpoint.type = ServerEndpoint;
+    flow->serverEndpoint.route = route;
+    flow->serverEndpoint.flow = flow;
+    flow->serverEndpoint.isRemoved = true;
+    flow->isConnecting = !isUdp && (result != 0);
+    flow->isClosed = false;
+    flow->lastActive = now;
+    flow->random = (reinterpret_cast<uintptr_t>(flow) ^ (uint64_t)now) | 1;
+    flows.insert(flow);
+
+    // the listening socket of a UDP route stays with the route
+    bool isAdded = addEndpoint(fd, &flow->serverEndpoint, EPOLLIN | (flow->isConnecting ? (uint32_t)EPOLLOUT : 0u));
+    if(isAdded && !isUdp) {
+        isAdded = addEndpoint(clientFd, &flow->clientEndpoint, EPOLLIN);
+    }
+    if(!isAdded) {
+        // the caller closes the accepted socket
+        if(!isUdp) {
+            flow->clientFd = -1;
+        }
+        closeFlow(flow);
+        return nullptr;
+    }
+    return flow;
+}
+
+
+void TCProxyImpl::initializeDirection(Direction& direction, Flow* flow, const bool& isToServer)
+{
+    direction.flow = flow;
+    direction.isToServer = isToServer;
+    direction.head = nullptr;
+    direction.tail = nullptr;
+    direction.numPackets = 0;
+    direction.numBytes = 0;
+    direction.lastDeparture = 0;
+    direction.bucketTime = 0.0;
+    direction.isBad = false;
+    direction.isEof = false;
+    direction.isShutdown = false;
+    direction.isReadBlocked = false;
+}
+
+
+void TCProxyImpl::closeFlow(Flow* flow)
+{
+    if(flow->isClosed) {
+        return;
+    }
+    flow->isClosed = true;
+    if(flow->route->protocol == TCProxy::UDP) {
+        flow->route->udpFlows.erase(flow->key);
+    } else if(flow->clientFd >= 0) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, flow->clientFd, nullptr);
+        ::close(flow->clientFd);
+    }
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, flow->serverFd, nullptr);
+    ::close(flow->serverFd);
+
+    // the packets in the wheel are dropped when they become due
+    for(Direction* direction : { &flow->toServer, &flow->toClient }) {
+        while(direction->head) {
+            Packet* packet = direction->head;
+            direction->head = packet->next;
+            ++numDropped;
+            releasePacket(packet);
+        }
+        direction->tail = nullptr;
+    }
+    closedFlows.push_back(flow);
+}
+
+
+void TCProxyImpl::collectFlows()
+{
+    // a closed flow stays until the events and packets that refer to it are gone
+    auto end = std::remove_if(closedFlows.begin(), closedFlows.end(), [&](Flow* flow){
+        if(flow->toServer.numPackets || flow->toClient.numPackets) {
+            return false;
+        }
+        flows.erase(flow);
+        delete flow;
+        return true;
+    });
+    closedFlows.erase(end, closedFlows.end());
+}
+
+
+void TCProxyImpl::expireFlows(const int64_t& now)
+{
+    vector<Flow*> idleFlows;
+    for(auto& route : routes) {
+        for(auto& element : route->udpFlows) {
+            Flow* flow = element.second;
+            if((now - flow->lastActive > UdpIdleTime)
+               && !flow->toServer.numPackets && !flow->toClient.numPackets) {
+                idleFlows.push_back(flow);
+            }
+        }
+    }
+    for(auto& flow : idleFlows) {
+        closeFlow(flow);
+    }
+}
+
+
+void TCProxyImpl::updateEvents(Flow* flow)
+{
+    if(flow->isClosed || (flow->route->protocol == TCProxy::UDP)) {
+        return;
+    }
+    const Direction& toServer = flow->toServer;
+    const Direction& toClient = flow->toClient;
+    uint32_t clientEvents = ((toServer.isReadBlocked || toServer.isEof) ? 0u : (uint32_t)EPOLLIN)
+        | (toClient.head ? (uint32_t)EPOLLOUT : 0u);
+    uint32_t serverEvents = ((toClient.isReadBlocked || toClient.isEof) ? 0u : (uint32_t)EPOLLIN)
+        | ((toServer.head || flow->isConnecting) ? (uint32_t)EPOLLOUT : 0u);
+    setEvents(flow->clientFd, &flow->clientEndpoint, clientEvents);
+    setEvents(flow->serverFd, &flow->serverEndpoint, serverEvents);
+}
+
+
+void TCProxyImpl::onFlowEvent(Endpoint* endpoint, const uint32_t& events, const int64_t& now)
+{
+    Flow* flow = endpoint->flow;
+    if(flow->isClosed) {
+        return;
+    }
+    bool isServer = endpoint->type == ServerEndpoint;
+    int fd = isServer ? flow->serverFd : flow->clientFd;
+    Direction& input = isServer ? flow->toClient : flow->toServer;
+    Direction& output = isServer ? flow->toServer : flow->toClient;
+
+    if(flow->route->protocol == TCProxy::UDP) {
+        flow->lastActive = now;
+        for(int i = 0; (i < MaxReads) && !flow->isClosed; ++i) {
+            ssize_t size = recv(fd, buffer.data(), buffer.size(), 0);
+            if(size < 0) {
+                break;
+            }
+            enqueue(input, newPacket(buffer.data(), size), now);
+        }
+        return;
+    }
+
+    if(isServer && flow->isConnecting && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if(error) {
+            closeFlow(flow);
+            return;
+        }
+        flow->isConnecting = false;
+    }
+    if(events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        read(flow, input, fd, now);
+    }
+    if(!flow->isClosed && (events & EPOLLOUT)) {
+        flush(output);
+    }
+    if(!flow->isClosed && (events & EPOLLHUP)) {
+        // the peer is gone; what it sent still goes to the other side, and
+        // what goes to it is dropped
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        endpoint->isRemoved = true;
+        output.isShutdown = true;
+        while(output.head) {
+            Packet* packet = output.head;
+            output.head = packet->next;
+            ++numDropped;
+            releasePacket(packet);
+        }
+        output.tail = nullptr;
+        if(flow->toServer.isShutdown && flow->toClient.isShutdown) {
+            closeFlow(flow);
+            return;
+        }
+    }
+    updateEvents(flow);
+}
+
+
+void TCProxyImpl::read(Flow* flow, Direction& direction, const int& fd, const int64_t& now)
+{
+    for(int i = 0; (i < MaxReads) && !direction.isReadBlocked && !direction.isEof; ++i) {
+        ssize_t size = recv(fd, buffer.data(), buffer.size(), 0);
+        if(size > 0) {
+            enqueue(direction, newPacket(buffer.data(), size), now);
+            if(direction.numBytes > MaxQueuedBytes) {
+                direction.isReadBlocked = true;
+            }
+        } else if(size == 0) {
+            // the end of the stream follows the data with the same delay
+            direction.isEof = true;
+            Packet* packet = newPacket(nullptr, 0);
+            packet->isFin = true;
+            enqueue(direction, packet, now);
+        } else {
+            if((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+                closeFlow(flow);
+            }
+            break;
+        }
+        if(flow->isClosed) {
+            break;
+        }
+    }
+}
+
+
+void TCProxyImpl::enqueue(Direction& direction, Packet* packet, const int64_t& now)
+{
+    Flow* flow = direction.flow;
+    Route* route = flow->route;
+    const Impairment& impairment = direction.isToServer ? route->outbound : route->inbound;
+    bool isTcp = route->protocol == TCProxy::TCP;
+    size_t size = packet->data.size();
+    packet->direction = &direction;
+    ++direction.numPackets;
+    direction.numBytes += size;
+
+    int64_t delay = impairment.delay;
+    if(!isTcp && (direction.numPackets > impairment.limit)) {
+        ++numDropped;
+        releasePacket(packet);
+        return;
+    }
+    if(!packet->isFin && isLost(direction, impairment)) {
+        if(!isTcp) {
+            ++numDropped;
+            releasePacket(packet);
+            return;
+        }
+        delay = 3 * delay + RetransmissionTimeout;
+    }
+
+    // the bucket holds BurstTime of the rate, and a packet leaves when the
+    // bucket has the tokens for it
+    int64_t departure = now;
+    if(impairment.rate > 0.0) {
+        direction.bucketTime = std::max(direction.bucketTime, (double)(now - BurstTime));
+        direction.bucketTime += size / impairment.rate;
+        departure = std::max(departure, (int64_t)direction.bucketTime);
+    }
+    // a direction keeps its order when the delay becomes shorter
+    int64_t lastDeparture = direction.lastDeparture;
+    departure = std::max(departure + delay, lastDeparture);
+    direction.lastDeparture = departure;
+    // a packet that is due leaves now, unless the one before it is still
+    // waiting for its tick in the wheel
+    if((departure <= now) && ((lastDeparture + TickTime - 1) / TickTime <= currentTick)) {
+        packet->tick = currentTick;
+    } else {
+        packet->tick = (departure + TickTime - 1) / TickTime;
+    }
+    schedule(packet);
+}
+
+
+bool TCProxyImpl::isLost(Direction& direction, const Impairment& impairment)
+{
+    double p = impairment.loss;
+    if(p <= 0.0) {
+        return false;
+    }
+    if(p >= 1.0) {
+        return true;
+    }
+    uint64_t& random = direction.flow->random;
+    if(currentLossModel == TCProxy::BERNOULLI) {
+        return uniform(random) < p;
+    }
+
+    // Gilbert model: the bad state loses every packet and lasts for the
+    // burst length on average, and the good state is left often enough
+    // for the mean loss to be p
+    double r = 1.0 / currentBurstLength;
+    double q = std::min(p * r / (1.0 - p), 1.0);
+    if(direction.isBad) {
+        direction.isBad = uniform(random) >= r;
+    } else {
+        direction.isBad = uniform(random) < q;
+    }
+    return direction.isBad;
+}
+
+
+void TCProxyImpl::schedule(Packet* packet)
+{
+    if(packet->tick <= currentTick) {
+        deliver(packet);
+        return;
+    }
+    int slot = packet->tick & (WheelSize - 1);
+    packet->next = nullptr;
+    if(slotTails[slot]) {
+        slotTails[slot]->next = packet;
+    } else {
+        slotHeads[slot] = packet;
+        occupiedSlots[slot >> 6] |= uint64_t(1) << (slot & 63);
+    }
+    slotTails[slot] = packet;
+    ++numScheduled;
+}
+
+
+void TCProxyImpl::deliver(Packet* packet)
+{
+    Direction& direction = *packet->direction;
+    if(direction.flow->isClosed || direction.isShutdown) {
+        ++numDropped;
+        releasePacket(packet);
+        return;
+    }
+    packet->next = nullptr;
+    if(direction.tail) {
+        direction.tail->next = packet;
+    } else {
+        direction.head = packet;
+    }
+    direction.tail = packet;
+    flush(direction);
+}
+
+
+void TCProxyImpl::flush(Direction& direction)
+{
+    Flow* flow = direction.flow;
+    bool isUdp = flow->route->protocol == TCProxy::UDP;
+    int fd = direction.isToServer ? flow->serverFd : flow->clientFd;
+
+    while(direction.head && !flow->isClosed) {
+        Packet* packet = direction.head;
+        if(packet->isFin) {
+            shutdown(fd, SHUT_WR);
+            direction.isShutdown = true;
+        } else if(isUdp) {
+            // a datagram that the socket does not take is lost as on a full link
+            ssize_t result;
+            if(direction.isToServer) {
+                result = send(fd, packet->data.data(), packet->data.size(), 0);
+            } else {
+                result = sendto(fd, packet->data.data(), packet->data.size(), 0,
+                                reinterpret_cast<const sockaddr*>(&flow->clientAddress), sizeof(flow->clientAddress));
+            }
+            ++(result < 0 ? numDropped : numForwarded);
+        } else {
+            if(direction.isToServer && flow->isConnecting) {
+                break;
+            }
+            ssize_t result = send(fd, packet->data.data() + packet->offset,
+                                  packet->data.size() - packet->offset, MSG_NOSIGNAL);
+            if(result < 0) {
+                if((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+                    break;
+                }
+                closeFlow(flow);
+                return;
+            }
+            packet->offset += result;
+            if(packet->offset < packet->data.size()) {
+                break;
+            }
+            ++numForwarded;
+        }
+        direction.head = packet->next;
+        if(!direction.head) {
+            direction.tail = nullptr;
+        }
+        releasePacket(packet);
+    }
+
+    if(flow->isClosed) {
+        return;
+    }
+    if(direction.isReadBlocked && (direction.numBytes < MaxQueuedBytes / 2)) {
+        direction.isReadBlocked = false;
+    }
+    if(flow->toServer.isShutdown && flow->toClient.isShutdown) {
+        closeFlow(flow);
+        return;
+    }
+    updateEvents(flow);
+}
+
+
+void TCProxyImpl::processWheel(const int64_t& now)
+{
+    int64_t targetTick = now / TickTime;
+    while(currentTick < targetTick) {
+        currentTick = numScheduled ? findOccupiedTick(currentTick, targetTick) : targetTick;
+        int slot = currentTick & (WheelSize - 1);
+        Packet* packet = slotHeads[slot];
+        if(!packet) {
+            continue;
+        }
+        slotHeads[slot] = nullptr;
+        slotTails[slot] = nullptr;
+        occupiedSlots[slot >> 6] &= ~(uint64_t(1) << (slot & 63));
+
+        // packets of later rounds go back to the slot
+        while(packet) {
+            Packet* next = packet->next;
+            --numScheduled;
+            schedule(packet);
+            packet = next;
+        }
+    }
+}
+
+
+int64_t TCProxyImpl::findOccupiedTick(const int64_t& from, const int64_t& to) const
+{
+    // the first occupied slot after from, or to when there is none up to it
+    int64_t limit = std::min(to, from + WheelSize);
+    int64_t tick = from + 1;
+    while(tick <= limit) {
+        int slot = tick & (WheelSize - 1);
+        uint64_t bits = occupiedSlots[slot >> 6] >> (slot & 63);
+        if(bits) {
+            int64_t found = tick + __builtin_ctzll(bits);
+            return found <= limit ? found : to;
+        }
+        tick += 64 - (slot & 63);
+    }
+    return to;
+}
+
+
+void TCProxyImpl::armTimer()
+{
+    int64_t tick = numScheduled ? findOccupiedTick(currentTick, currentTick + WheelSize) : -1;
+    if(tick == armedTick) {
+        return;
+    }
+    itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if(tick >= 0) {
+        int64_t time = tick * TickTime;
+        spec.it_value.tv_sec = time / 1000000000;
+        spec.it_value.tv_nsec = time % 1000000000;
+    }
+    timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    armedTick = tick;
+}
+
+
+Packet* TCProxyImpl::newPacket(const char* data, const size_t& size)
+{
+    Packet* packet;
+    if(freePackets.empty()) {
+        packet = new Packet;
+    } else {
+        packet = freePackets.back();
+        freePackets.pop_back();
+    }
+    packet->next = nullptr;
+    packet->direction = nullptr;
+    packet->tick = 0;
+    packet->offset = 0;
+    packet->isFin = false;
+    packet->data.assign(data, data + size);
+    return packet;
+}
+
+
+void TCProxyImpl::releasePacket(Packet* packet)
+{
+    Direction& direction = *packet->direction;
+    --direction.numPackets;
+    direction.numBytes -= packet->data.size();
+    if(freePackets.size() < MaxFreePackets) {
+        freePackets.push_back(packet);
+    } else {
+        delete packet;
+    }
+}
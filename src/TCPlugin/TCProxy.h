@@ -0,0 +1,68 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_TC_PLUGIN_TC_PROXY_H
+#define CNOID_TC_PLUGIN_TC_PROXY_H
+
+#include <cstdint>
+#include <string>
+#include "TCNetlink.h"
+
+namespace cnoid {
+
+class TCProxyImpl;
+
+/**
+   Userspace relay that impairs the traffic between local clients and
+   the targets of its routes, for hosts where the qdiscs of the kernel
+   cannot be configured. A route listens on a port of 127.0.0.1 and
+   forwards every UDP client or TCP connection to its target; the
+   clients connect to the listening port instead of the target.
+
+   The traffic to the target takes the outbound netem of the route and
+   the traffic back to the client the inbound one. Each direction of a
+   flow has a delay queue on a timer wheel with a resolution of 100 us,
+   a token bucket that holds 10 ms of the rate, and Bernoulli or
+   Gilbert-Elliott loss. A lost TCP segment cannot be dropped from the
+   byte stream, so it is delayed by a retransmission timeout instead.
+
+   The relay runs on its own thread with epoll. setNetem() only copies
+   the parameters, which the relay picks up before its next packet.
+*/
+class TCProxy
+{
+public:
+    enum Protocol { UDP, TCP };
+    enum LossModel { BERNOULLI, GILBERT_ELLIOTT };
+
+    TCProxy();
+    virtual ~TCProxy();
+
+    void clearRoutes();
+    int addRoute(const Protocol& protocol, const int& port,
+                 const std::string& targetAddress, const int& targetPort);
+    int numRoutes() const;
+
+    bool start();
+    void stop();
+    bool isRunning() const;
+
+    // a route of -1 sets every route
+    void setNetem(const int& route, const TCNetlink::Netem& inbound, const TCNetlink::Netem& outbound);
+    void setLossModel(const LossModel& lossModel, const double& burstLength);
+
+    uint64_t numForwardedPackets() const;
+    uint64_t numDroppedPackets() const;
+    const std::string& errorMessage() const;
+
+private:
+    TCProxy(const TCProxy& org);
+    TCProxyImpl* impl;
+    friend class TCProxyImpl;
+};
+
+}
+
+#endif // CNOID_TC_PLUGIN_TC_PROXY_H
@@ -6,14 +6,30 @@
 #include "TCSimulatorItem.h"
 #include <cnoid/Archive>
 #include <cnoid/Body>
+#include <cnoid/BodyItem>
+#include <cnoid/BodyMotionItem>
+#include <cnoid/EigenArchive>
 #include <cnoid/EigenUtil>
 #include <cnoid/ItemManager>
+#include <cnoid/LogFile>
+#include <cnoid/MessageView>
+#include <cnoid/MultiValueSeqItem>
 #include <cnoid/Process>
 #include <cnoid/PutPropertyFunction>
 #include <cnoid/RootItem>
 #include <cnoid/SimulatorItem>
-#include <cnoid/WorldItem>
+#include <cnoid/StageProfiler>
+#include <cnoid/YAMLReader>
 #include <fmt/format.h>
+#include <src/FluidDynamicsPlugin/WorkerPool.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <memory>
+#include <thread>
 #include <stdlib.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
@@ -21,17 +37,94 @@
 #include <unistd.h>
 #include "gettext.h"
 #include "TCAreaItem.h"
+#include "TCAreaTracker.h"
+#include "TCBatch.h"
+#include "TCLinkModel.h"
+#include "TCNetlink.h"
+#include "TCProxy.h"
+#include "TCTimeline.h"
 
 #define IFR_MAX 10
 #define DELAY_MAX 100000
 #define RATE_MAX 11000000
 #define LOSS_MAX 100.0
 
+// bodies with a network profile are grouped by 16 below the 15 free bands
+// of the root prio qdisc, as a prio qdisc has at most 16 bands
+#define BANDS_PER_GROUP 16
+#define GROUP_MAX 15
+
+// filters to more hosts than this are hashed on the last octet of the host
+#define U32_LINEAR_MAX 4
+#define U32_HASH_TABLE 2
+
 using namespace std;
 using namespace cnoid;
 
 namespace {
 
+enum ProfileStage { AreaStage, CommandStage, LinkModelStage };
+enum BackendID { KernelBackend, ProxyBackend, NumBackends };
+enum LossModelID { BernoulliLoss, GilbertElliottLoss, NumLossModels };
+
+// the steps of the recorded motions that a worker searches at a time
+const int ScheduleChunkSize = 256;
+
+// netem parameters of an area, copied when the simulation starts so that
+// the worker thread never reads the items
+struct TrafficState
+{
+    TrafficState() : sources(1, "0.0.0.0/0"), destinations(1, "0.0.0.0/0") { }
+    TCNetlink::Netem inbound;
+    TCNetlink::Netem outbound;
+    vector<string> sources;
+    vector<string> destinations;
+};
+
+// a u32 filter with the addresses as they appear on the device
+struct AddressFilter
+{
+    string source;
+    string destination;
+    uint32_t flowid;
+};
+
+// addresses of the traffic of a body that is controlled on its own
+struct NetworkProfile
+{
+    string body;
+    vector<string> sources;
+    vector<string> destinations;
+};
+
+// area of a body from the last step in which it was evaluated
+struct BodyArea
+{
+    Link* link;
+    bool init;
+    TCLinkModel::Probe probe;
+    TCNetlink::Netem netem;  // the last netem posted by the link model
+    MultiSE3SeqPtr motion;   // the recorded motion of the body, if any
+};
+
+// an area transition of a slot found in the recorded motions
+struct ScheduledChange
+{
+    double time;
+    int slot;
+    int index;
+};
+
+// a listening port of the proxy, optionally following a body of a profile
+struct ProxyRoute
+{
+    TCProxy::Protocol protocol;
+    int port;
+    string targetAddress;
+    int targetPort;
+    string body;
+};
+
 vector<string> split(const string& s, char delim)
 {
     vector<string> elements;
@@ -45,6 +138,154 @@ vector<string> split(const string& s, char delim)
     return elements;
 }
 
+
+string netemEffects(const TCNetlink::Netem& netem)
+{
+    string effects;
+    if(netem.delay > 0.0) {
+        effects += " delay " + (fmt::format("{0:.2f}", netem.delay)) + "ms";
+    }
+    if(netem.rate > 0.0) {
+        effects += " rate " + (fmt::format("{0:.2f}", netem.rate)) + "kbps";
+    }
+    if(netem.loss > 0.0) {
+        effects += " loss " + (fmt::format("{0:.2f}", netem.loss)) + "%";
+    }
+    return effects;
+}
+
+
+// handles of the tree for the i-th body of a profile: band 1:(g + 2) of
+// the root leads to the prio qdisc (100 + g): of its group g, and band
+// (i % 16 + 1) of that qdisc to the netem qdisc (1000 + i): of the body
+uint32_t groupClass(const int& body) { return 0x10000 | (body / BANDS_PER_GROUP + 2); }
+uint32_t groupHandle(const int& body) { return (uint32_t)(0x100 + body / BANDS_PER_GROUP) << 16; }
+uint32_t bodyClass(const int& body) { return groupHandle(body) | (body % BANDS_PER_GROUP + 1); }
+uint32_t bodyHandle(const int& body) { return (uint32_t)(0x1000 + body) << 16; }
+
+string tcHandle(const uint32_t& handle)
+{
+    if(handle & 0xffff) {
+        return fmt::format("{0:x}:{1:x}", handle >> 16, handle & 0xffff);
+    }
+    return fmt::format("{0:x}:", handle >> 16);
+}
+
+
+// the last octet of a host address, or -1 for a network
+int hostOctet(const string& address)
+{
+    vector<string> ip_mask = split(address, '/');
+    if(ip_mask.empty() || (ip_mask.size() == 2 && atoi(ip_mask[1].c_str()) != 32)) {
+        return -1;
+    }
+    vector<string> elements = split(ip_mask[0], '.');
+    return elements.size() == 4 ? atoi(elements[3].c_str()) : -1;
+}
+
+
+// the traffic from the sources to the destinations; the redirected
+// ingress traffic has the addresses swapped
+void appendFilters(vector<AddressFilter>& io_filters, const vector<string>& sources,
+                   const vector<string>& destinations, const bool& isIngress, const uint32_t& flowid)
+{
+    for(auto& source : sources) {
+        for(auto& destination : destinations) {
+            AddressFilter filter;
+            filter.source = isIngress ? destination : source;
+            filter.destination = isIngress ? source : destination;
+            filter.flowid = flowid;
+            io_filters.push_back(filter);
+        }
+    }
+}
+
+
+// the destinations of the traffic are the hosts in the hash table, which
+// are the sources of the redirected ingress traffic
+int hashedBucket(const AddressFilter& filter, const bool& isIngress)
+{
+    return hostOctet(isIngress ? filter.source : filter.destination);
+}
+
+
+bool isHashed(const vector<AddressFilter>& filters, const bool& isIngress)
+{
+    int numHosts = std::count_if(filters.begin(), filters.end(),
+                                 [&](const AddressFilter& f){ return hashedBucket(f, isIngress) >= 0; });
+    return numHosts > U32_LINEAR_MAX;
+}
+
+
+// a packet to one of many hosts is compared with the filters of one
+// bucket of the hash table at prio 1 instead of all of them, and the
+// filters to networks follow at prio 2
+string filterCommands(const string& device, const uint32_t& parent, const vector<AddressFilter>& filters,
+                      const bool& isIngress)
+{
+    string message;
+    bool isHashEnabled = isHashed(filters, isIngress);
+    if(isHashEnabled) {
+        message += (fmt::format("sudo tc filter add dev {0} parent {1} prio 1 handle {2:x}: protocol ip u32 divisor 256;"
+                                "sudo tc filter add dev {0} protocol ip parent {1} prio 1 u32 "
+                                "match ip {3} 0.0.0.0/0 hashkey mask 0x000000ff at {4} link {2:x}:;",
+                                device, tcHandle(parent), U32_HASH_TABLE,
+                                isIngress ? "src" : "dst", isIngress ? 12 : 16));
+    }
+    for(auto& filter : filters) {
+        int bucket = isHashEnabled ? hashedBucket(filter, isIngress) : -1;
+        if(bucket >= 0) {
+            message += (fmt::format("sudo tc filter add dev {0} protocol ip parent {1} prio 1 u32 ht {2:x}:{3:x}: "
+                                    "match ip src {4} match ip dst {5} flowid {6};",
+                                    device, tcHandle(parent), U32_HASH_TABLE, bucket,
+                                    filter.source, filter.destination, tcHandle(filter.flowid)));
+        } else {
+            message += (fmt::format("sudo tc filter add dev {0} protocol ip parent {1} prio 2 u32 "
+                                    "match ip src {2} match ip dst {3} flowid {4};",
+                                    device, tcHandle(parent), filter.source, filter.destination,
+                                    tcHandle(filter.flowid)));
+        }
+    }
+    return message;
+}
+
+
+bool addFilters(TCNetlink& netlink, const string& device, const uint32_t& parent,
+                const vector<AddressFilter>& filters, const bool& isIngress)
+{
+    bool isHashEnabled = isHashed(filters, isIngress);
+    bool result = !isHashEnabled
+        || (netlink.addU32HashTable(device, parent, 1, U32_HASH_TABLE)
+            && netlink.addU32HashLink(device, parent, 1, U32_HASH_TABLE, isIngress ? 12 : 16));
+    for(size_t i = 0; (i < filters.size()) && result; ++i) {
+        const AddressFilter& filter = filters[i];
+        int bucket = isHashEnabled ? hashedBucket(filter, isIngress) : -1;
+        if(bucket >= 0) {
+            result = netlink.addU32Filter(device, parent, 1, filter.source, filter.destination,
+                                          filter.flowid, U32_HASH_TABLE, bucket);
+        } else {
+            result = netlink.addU32Filter(device, parent, 2, filter.source, filter.destination,
+                                          filter.flowid);
+        }
+    }
+    return result;
+}
+
+
+void readAddresses(Mapping* node, const string& listKey, const string& key, vector<string>& out_addresses)
+{
+    Listing* addressList = node->findListing(listKey);
+    if(addressList->isValid()) {
+        for(int i = 0; i < addressList->size(); ++i) {
+            out_addresses.push_back(addressList->at(i)->toString());
+        }
+    }
+    string address;
+    if(node->read(key, address)) {
+        out_addresses.push_back(address);
+    }
+}
+
 }
 
 
@@ -57,7 +298,10 @@ public:
     TCSimulatorItemImpl(TCSimulatorItem* self, const TCSimulatorItemImpl& org);
 
     TCSimulatorItem* self;
-    vector<Body*> bodies;
+    SimulatorItem* simulatorItem;
+    vector<BodyArea> bodyAreas;
+    string profileFile;
+    vector<NetworkProfile> bodyProfiles;
     ItemList<TCAreaItem> items;
     Selection interface;
     Selection ifbDevice;
@@ -65,8 +309,69 @@ public:
     vector<string> ifbDeviceNames;
     string interfaceName;
     string ifbDeviceName;
-    int prevItemId;
+    TCAreaTracker areaTracker;
+    WorkerPool workerPool;
     bool init;
+    StageProfiler profiler;
+    TCNetlink netlink;
+    TCBatch batch;
+    bool isIfbDeviceCreated;
+    double dwellTime;
+    double hysteresis;
+    TCLinkModel linkModel;
+    bool isLinkModelEnabled;
+    Vector3 baseStation;
+    double pathLossExponent;
+    double referenceLoss;
+    double wallLoss;
+    double linkBudget;
+    double maxRate;
+    double baseDelay;
+    double updateRate;
+    double cacheDistance;
+    double delayStep;
+    double rateStep;
+    double lossStep;
+    double nextUpdateTime;
+    TCNetlink::Netem netem;
+    Selection backend;
+    string proxyRoutes;
+    Selection lossModel;
+    double burstLength;
+    TCProxy proxy;
+    bool isProxyEnabled;
+    vector<string> routeBodies;
+
+    // the last state of traffics[] posted by the simulation thread; later
+    // posts overwrite earlier ones that the worker has not taken yet
+    vector<TrafficState> traffics;
+    thread worker;
+    mutex workerMutex;
+    condition_variable workerCondition;
+    unique_ptr<std::atomic<int>[]> requestedIndices;
+    int numRequestSlots;
+    std::atomic<bool> isRequested;
+    bool isWorkerStopping;
+
+    // the simulation time and the clock of the last request of a slot
+    TCTimeline timeline;
+    bool isTimelineEnabled;
+    double timelineRate;
+    string timelineFile;
+    unique_ptr<std::atomic<double>[]> requestedTimes;
+    unique_ptr<std::atomic<int64_t>[]> requestedClocks;
+
+    // with the link model a slot carries a generation of linkTraffics[],
+    // which is guarded by workerMutex
+    vector<TrafficState> linkTraffics;
+    vector<int> linkGenerations;
+
+    // the area transitions of the recorded motions, posted in order
+    bool isScheduleEnabled;
+    double leadTime;
+    bool isScheduled;
+    vector<ScheduledChange> schedule;
+    size_t nextChange;
 
     bool initializeSimulation(SimulatorItem* simulatorItem);
     void finalizeSimulation();
@@ -74,11 +379,39 @@ public:
     bool store(Archive& archive);
     bool restore(const Archive& archive);
     void onPreDynamicsFunction();
+    bool buildSchedule();
+    void onScheduleUpdate(const double& time);
+    bool loadProfiles(const string& filename, vector<NetworkProfile>& out_profiles,
+                      string& out_errorMessage) const;
+    bool parseRoutes(const string& routes, vector<ProxyRoute>& out_routes,
+                     string& out_errorMessage) const;
+    void startWorker();
+    int initialIndex() const;
+    void stopWorker();
+    void post(const int& slot, const int& index);
+    void runWorker();
+    void apply(const int& slot, const TrafficState& traffic, const bool& isApplied);
+    void onLinkModelUpdate(const double& time);
+    void postLinkTraffic(const int& slot, const TCNetlink::Netem& netem);
+    bool isQuantumExceeded(const TCNetlink::Netem& netem, const TCNetlink::Netem& postedNetem) const;
+    void record(const int& slot, const int& area, const TrafficState& traffic);
+    void finalizeTimeline();
     void onTCInitialize();
     void onTCClear();
     void onTCFinalize();
-    void onTCExecute(TCAreaItem* item);
+    void onTCExecute(const TrafficState& traffic);
+    void onTCBuild();
+    void onTCChange(const int& body, const TrafficState& traffic);
     void onCommandExecute(const string& message);
+    void onBatchCommandFailed(const string& command, const string& message);
+    void onNetlinkInitialize();
+    void onNetlinkClear();
+    void onNetlinkFinalize();
+    void onNetlinkExecute(const TrafficState& traffic);
+    void onNetlinkBuild();
+    void onNetlinkChange(const int& body, const TrafficState& traffic);
+    void onProxyInitialize();
+    void putNetlinkError();
     bool onAddressCheck(const string& address) const;
 };
 
@@ -92,9 +425,14 @@ TCSimulatorItem::TCSimulatorItem()
 
 
 TCSimulatorItemImpl::TCSimulatorItemImpl(TCSimulatorItem* self)
-    : self(self)
+    : self(self),
+      isRequested(false)
 {
-    bodies.clear();
+    simulatorItem = nullptr;
+    bodyAreas.clear();
+    profileFile.clear();
+    bodyProfiles.clear();
+    numRequestSlots = 0;
     items.clear();
     interface.clear();
     ifbDevice.clear();
@@ -102,8 +440,49 @@ TCSimulatorItemImpl::TCSimulatorItemImpl(TCSimulatorItem* self)
     ifbDeviceNames.clear();
     interfaceName.clear();
     ifbDeviceName.clear();
-    prevItemId = INT_MAX;
     init = false;
+    isIfbDeviceCreated = false;
+    dwellTime = 0.0;
+    hysteresis = 0.0;
+    isLinkModelEnabled = false;
+    baseStation << 0.0, 0.0, 0.0;
+    pathLossExponent = 2.0;
+    referenceLoss = 40.0;
+    wallLoss = 10.0;
+    linkBudget = 90.0;
+    maxRate = 0.0;
+    baseDelay = 1.0;
+    updateRate = 10.0;
+    cacheDistance = 0.1;
+    delayStep = 1.0;
+    rateStep = 10.0;
+    lossStep = 1.0;
+    nextUpdateTime = 0.0;
+    backend.setSymbol(KernelBackend, N_("Kernel"));
+    backend.setSymbol(ProxyBackend, N_("Proxy"));
+    backend.select(KernelBackend);
+    proxyRoutes.clear();
+    lossModel.setSymbol(BernoulliLoss, N_("Bernoulli"));
+    lossModel.setSymbol(GilbertElliottLoss, N_("Gilbert-Elliott"));
+    lossModel.select(BernoulliLoss);
+    burstLength = 4.0;
+    isProxyEnabled = false;
+    routeBodies.clear();
+    isWorkerStopping = false;
+    isTimelineEnabled = false;
+    timelineRate = 100.0;
+    timelineFile.clear();
+    isScheduleEnabled = false;
+    leadTime = 0.0;
+    isScheduled = false;
+    schedule.clear();
+    nextChange = 0;
+    profiler.setTextDomain(CNOID_GETTEXT_DOMAIN_NAME);
+    profiler.addStage(N_("areas"));
+    profiler.addStage(N_("commands"));
+    profiler.addStage(N_("link model"));
+    batch.sigCommandFailed().connect(
+        [&](const string& command, const string& message){ onBatchCommandFailed(command, message); });
 
     struct ifreq ifr[IFR_MAX];
     struct ifconf ifc;
@@ -142,9 +521,14 @@ TCSimulatorItem::TCSimulatorItem(const TCSimulatorItem &org)
 
 
 TCSimulatorItemImpl::TCSimulatorItemImpl(TCSimulatorItem* self, const TCSimulatorItemImpl& org)
-    : self(self)
+    : self(self),
+      isRequested(false)
 {
-    bodies.clear();
+    simulatorItem = nullptr;
+    bodyAreas.clear();
+    profileFile = org.profileFile;
+    bodyProfiles.clear();
+    numRequestSlots = 0;
     items.clear();
     interface = org.interface;
     ifbDevice = org.ifbDevice;
@@ -152,8 +536,42 @@ TCSimulatorItemImpl::TCSimulatorItemImpl(TCSimulatorItem* self, const TCSimulato
     ifbDeviceNames = org.ifbDeviceNames;
     interfaceName = org.interfaceName;
     ifbDeviceName = org.ifbDeviceName;
-    prevItemId = org.prevItemId;
-    init = org.init;
+    init = false;
+    profiler = org.profiler;
+    isIfbDeviceCreated = false;
+    dwellTime = org.dwellTime;
+    hysteresis = org.hysteresis;
+    isLinkModelEnabled = org.isLinkModelEnabled;
+    baseStation = org.baseStation;
+    pathLossExponent = org.pathLossExponent;
+    referenceLoss = org.referenceLoss;
+    wallLoss = org.wallLoss;
+    linkBudget = org.linkBudget;
+    maxRate = org.maxRate;
+    baseDelay = org.baseDelay;
+    updateRate = org.updateRate;
+    cacheDistance = org.cacheDistance;
+    delayStep = org.delayStep;
+    rateStep = org.rateStep;
+    lossStep = org.lossStep;
+    nextUpdateTime = 0.0;
+    batch.sigCommandFailed().connect(
+        [&](const string& command, const string& message){ onBatchCommandFailed(command, message); });
+    backend = org.backend;
+    proxyRoutes = org.proxyRoutes;
+    lossModel = org.lossModel;
+    burstLength = org.burstLength;
+    isProxyEnabled = false;
+    routeBodies.clear();
+    isWorkerStopping = false;
+    isTimelineEnabled = org.isTimelineEnabled;
+    timelineRate = org.timelineRate;
+    timelineFile = org.timelineFile;
+    isScheduleEnabled = org.isScheduleEnabled;
+    leadTime = org.leadTime;
+    isScheduled = false;
+    schedule.clear();
+    nextChange = 0;
 }
 
 
@@ -178,26 +596,168 @@ bool TCSimulatorItem::initializeSimulation(SimulatorItem* simulatorItem)
 
 bool TCSimulatorItemImpl::initializeSimulation(SimulatorItem* simulatorItem)
 {
-    bodies.clear();
+    this->simulatorItem = simulatorItem;
+    bodyAreas.clear();
+    bodyProfiles.clear();
     items.clear();
-    prevItemId = INT_MAX;
+    areaTracker.clear();
     init = false;
-    vector<SimulationBody*> simulationBodies = simulatorItem->simulationBodies();
-    if(simulationBodies.size()) {
-        for(size_t i = 0; i < simulationBodies.size(); i++) {
-            bodies.push_back(simulationBodies[i]->body());
-        }
-
-        simulatorItem->addPreDynamicsFunction([&](){ onPreDynamicsFunction(); });
-    }
 
     RootItem* rootItem = RootItem::instance();
     items = rootItem->checkedItems<TCAreaItem>();
+    traffics.clear();
     for(size_t i = 0; i < items.size(); i++) {
         TCAreaItem* item = items[i];
         item->setId(i);
+        areaTracker.addArea(item);
+        TrafficState traffic;
+        traffic.inbound.delay = item->inboundDelay();
+        traffic.inbound.rate = item->inboundRate();
+        traffic.inbound.loss = item->inboundLoss();
+        traffic.outbound.delay = item->outboundDelay();
+        traffic.outbound.rate = item->outboundRate();
+        traffic.outbound.loss = item->outboundLoss();
+        vector<string> sources = item->sources();
+        vector<string> destinations = item->destinations();
+        sources.erase(std::remove_if(sources.begin(), sources.end(),
+                                     [&](const string& a){ return !onAddressCheck(a); }), sources.end());
+        destinations.erase(std::remove_if(destinations.begin(), destinations.end(),
+                                          [&](const string& a){ return !onAddressCheck(a); }), destinations.end());
+        if(!sources.empty()) {
+            traffic.sources = sources;
+        }
+        if(!destinations.empty()) {
+            traffic.destinations = destinations;
+        }
+        traffics.push_back(traffic);
     }
+    // outside every area the traffic is not impaired
+    traffics.push_back(TrafficState());
+
+    vector<NetworkProfile> profiles;
+    if(!profileFile.empty()) {
+        string message;
+        if(!loadProfiles(profileFile, profiles, message)) {
+            MessageView::instance()->putln(
+                fmt::format(_("Network profiles cannot be loaded: {0}"), message),
+                MessageView::Warning);
+        }
+    }
+
+    // static bodies never change their area, and with network profiles
+    // only the bodies that have one are followed
+    vector<SimulationBody*> simulationBodies = simulatorItem->simulationBodies();
+    ItemList<BodyMotionItem> motionItems;
+    if(isScheduleEnabled && !isLinkModelEnabled) {
+        motionItems = rootItem->checkedItems<BodyMotionItem>();
+    }
+    for(size_t i = 0; i < simulationBodies.size(); i++) {
+        Body* body = simulationBodies[i]->body();
+        if(body->isStaticModel()) {
+            continue;
+        }
+        if(!profiles.empty()) {
+            auto profile = std::find_if(profiles.begin(), profiles.end(),
+                                        [&](const NetworkProfile& p){ return p.body == body->name(); });
+            if(profile == profiles.end()) {
+                continue;
+            }
+            if(bodyProfiles.size() >= BANDS_PER_GROUP * GROUP_MAX) {
+                MessageView::instance()->putln(
+                    fmt::format(_("{0} has no traffic control; at most {1} bodies can have a network profile."),
+                                body->name(), BANDS_PER_GROUP * GROUP_MAX),
+                    MessageView::Warning);
+                continue;
+            }
+            bodyProfiles.push_back(*profile);
+        }
+        BodyArea bodyArea;
+        bodyArea.link = body->rootLink();
+        bodyArea.init = false;
+        for(auto& motionItem : motionItems) {
+            if(motionItem->findOwnerItem<BodyItem>() == simulationBodies[i]->bodyItem()) {
+                const MultiSE3SeqPtr& seq = motionItem->motion()->linkPosSeq();
+                if(seq->numParts() > 0 && seq->numFrames() > 0 && seq->frameRate() > 0.0) {
+                    bodyArea.motion = seq;
+                    break;
+                }
+            }
+        }
+        bodyAreas.push_back(bodyArea);
+        areaTracker.addBody(bodyArea.link);
+    }
+
+    // the grid is built once like the traffic of the areas above, so that
+    // an area moved during a run keeps both its place and its traffic
+    // until the next run, and the simulation thread never reads the items
+    areaTracker.setDwellTime(dwellTime);
+    areaTracker.setHysteresis(hysteresis);
+    areaTracker.build(!bodyProfiles.empty());
+    if(simulationBodies.size()) {
+        simulatorItem->addPreDynamicsFunction([&](){ onPreDynamicsFunction(); });
+    }
+
+    // one slot for the whole interface, or one for each body of a profile
+    numRequestSlots = bodyProfiles.empty() ? 1 : bodyProfiles.size();
+    requestedIndices.reset(new std::atomic<int>[numRequestSlots]);
+    requestedTimes.reset(new std::atomic<double>[numRequestSlots]);
+    requestedClocks.reset(new std::atomic<int64_t>[numRequestSlots]);
+    for(int i = 0; i < numRequestSlots; ++i) {
+        requestedTimes[i] = 0.0;
+        requestedClocks[i] = 0;
+    }
+    timeline.clear(numRequestSlots);
+
+    // the link model takes the static bodies as obstacles
+    linkModel.clear();
+    linkTraffics.clear();
+    linkGenerations.clear();
+    nextUpdateTime = 0.0;
+    if(isLinkModelEnabled) {
+        for(size_t i = 0; i < simulationBodies.size(); i++) {
+            Body* body = simulationBodies[i]->body();
+            if(body->isStaticModel()) {
+                for(int j = 0; j < body->numLinks(); ++j) {
+                    linkModel.addObstacle(body->link(j));
+                }
+            }
+        }
+        linkModel.build();
+        linkModel.setBaseStation(baseStation);
+        linkModel.setPathLossExponent(pathLossExponent);
+        linkModel.setReferenceLoss(referenceLoss);
+        linkModel.setWallLoss(wallLoss);
+        linkModel.setLinkBudget(linkBudget);
+        linkModel.setMaxRate(maxRate);
+        linkModel.setBaseDelay(baseDelay);
+        linkModel.setCacheDistance(cacheDistance);
+        linkTraffics.resize(numRequestSlots, TrafficState());
+        linkGenerations.resize(numRequestSlots, -1);
+    }
+
+    isScheduled = false;
+    schedule.clear();
+    nextChange = 0;
+    if(isScheduleEnabled && !isLinkModelEnabled) {
+        isScheduled = buildSchedule();
+        if(isScheduled) {
+            MessageView::instance()->putln(
+                fmt::format(_("{0} area transitions are scheduled from the recorded motions."),
+                            schedule.size()));
+        } else {
+            MessageView::instance()->putln(
+                _("The area transitions cannot be scheduled, as a followed body has no checked motion; "
+                  "the areas are tested at every step."),
+                MessageView::Warning);
+        }
+    }
+
     onTCInitialize();
+    if(!bodyProfiles.empty()) {
+        onTCBuild();
+    }
+    startWorker();
+    profiler.initialize(self, simulatorItem->worldTimeStep());
     return true;
 }
 
@@ -210,8 +770,11 @@ void TCSimulatorItem::finalizeSimulation()
 
 void TCSimulatorItemImpl::finalizeSimulation()
 {
+    stopWorker();
     onTCClear();
     onTCFinalize();
+    finalizeTimeline();
+    profiler.finalize();
 }
 
 
@@ -234,6 +797,35 @@ void TCSimulatorItemImpl::doPutProperties(PutPropertyFunction& putProperty)
                 [&](int index){ return interface.select(index); });
     putProperty(_("IFB Device"), ifbDevice,
                 [&](int index){ return ifbDevice.select(index); });
+    putProperty(_("Backend"), backend,
+                [&](int index){ return backend.select(index); });
+    putProperty(_("Proxy routes"), proxyRoutes, changeProperty(proxyRoutes));
+    putProperty(_("Loss model"), lossModel,
+                [&](int index){ return lossModel.select(index); });
+    putProperty.min(1.0)(_("Burst length"), burstLength, changeProperty(burstLength));
+    putProperty.min(0.0)(_("Dwell time"), dwellTime, changeProperty(dwellTime));
+    putProperty.min(0.0)(_("Hysteresis"), hysteresis, changeProperty(hysteresis));
+    putProperty(_("Network profiles"), profileFile, changeProperty(profileFile));
+    putProperty(_("Link model"), isLinkModelEnabled, changeProperty(isLinkModelEnabled));
+    putProperty(_("Base station"), str(baseStation),
+                [&](const string& value){ return toVector3(value, baseStation); });
+    putProperty.min(0.0)(_("Path loss exponent"), pathLossExponent, changeProperty(pathLossExponent));
+    putProperty(_("Reference loss"), referenceLoss, changeProperty(referenceLoss));
+    putProperty.min(0.0)(_("Wall loss"), wallLoss, changeProperty(wallLoss));
+    putProperty(_("Link budget"), linkBudget, changeProperty(linkBudget));
+    putProperty.min(0.0)(_("Maximum rate"), maxRate, changeProperty(maxRate));
+    putProperty.min(0.0)(_("Base delay"), baseDelay, changeProperty(baseDelay));
+    putProperty.min(0.0)(_("Update rate"), updateRate, changeProperty(updateRate));
+    putProperty.min(0.0)(_("Ray cache distance"), cacheDistance, changeProperty(cacheDistance));
+    putProperty.min(0.0)(_("Delay step"), delayStep, changeProperty(delayStep));
+    putProperty.min(0.0)(_("Rate step"), rateStep, changeProperty(rateStep));
+    putProperty.min(0.0)(_("Loss step"), lossStep, changeProperty(lossStep));
+    putProperty(_("Motion schedule"), isScheduleEnabled, changeProperty(isScheduleEnabled));
+    putProperty.min(0.0)(_("Lead time"), leadTime, changeProperty(leadTime));
+    putProperty(_("Record timeline"), isTimelineEnabled, changeProperty(isTimelineEnabled));
+    putProperty.min(0.0)(_("Timeline rate"), timelineRate, changeProperty(timelineRate));
+    putProperty(_("Timeline file"), timelineFile, changeProperty(timelineFile));
+    profiler.putProperties(putProperty);
 }
 
 
@@ -248,6 +840,36 @@ bool TCSimulatorItemImpl::store(Archive& archive)
 {
     archive.write("interface", interface.selectedSymbol(), DOUBLE_QUOTED);
     archive.write("ifbDevice", ifbDevice.selectedSymbol(), DOUBLE_QUOTED);
+    archive.write("backend", backend.selectedSymbol());
+    archive.write("proxyRoutes", proxyRoutes, DOUBLE_QUOTED);
+    archive.write("lossModel", lossModel.selectedSymbol());
+    archive.write("burstLength", burstLength);
+    archive.write("dwellTime", dwellTime);
+    archive.write("hysteresis", hysteresis);
+    if(!profileFile.empty()) {
+        archive.writeRelocatablePath("networkProfiles", profileFile);
+    }
+    archive.write("linkModel", isLinkModelEnabled);
+    write(archive, "baseStation", baseStation);
+    archive.write("pathLossExponent", pathLossExponent);
+    archive.write("referenceLoss", referenceLoss);
+    archive.write("wallLoss", wallLoss);
+    archive.write("linkBudget", linkBudget);
+    archive.write("maxRate", maxRate);
+    archive.write("baseDelay", baseDelay);
+    archive.write("updateRate", updateRate);
+    archive.write("rayCacheDistance", cacheDistance);
+    archive.write("delayStep", delayStep);
+    archive.write("rateStep", rateStep);
+    archive.write("lossStep", lossStep);
+    archive.write("motionSchedule", isScheduleEnabled);
+    archive.write("leadTime", leadTime);
+    archive.write("recordTimeline", isTimelineEnabled);
+    archive.write("timelineRate", timelineRate);
+    if(!timelineFile.empty()) {
+        archive.writeRelocatablePath("timelineFile", timelineFile);
+    }
+    profiler.store(archive);
     return true;
 }
 
@@ -268,70 +890,459 @@ bool TCSimulatorItemImpl::restore(const Archive& archive)
     if(archive.read("ifbDevice", symbol)) {
         ifbDevice.select(symbol);
     }
+    if(archive.read("backend", symbol)) {
+        backend.select(symbol);
+    }
+    archive.read("proxyRoutes", proxyRoutes);
+    if(archive.read("lossModel", symbol)) {
+        lossModel.select(symbol);
+    }
+    archive.read("burstLength", burstLength);
+    archive.read("dwellTime", dwellTime);
+    archive.read("hysteresis", hysteresis);
+    archive.readRelocatablePath("networkProfiles", profileFile);
+    archive.read("linkModel", isLinkModelEnabled);
+    read(archive, "baseStation", baseStation);
+    archive.read("pathLossExponent", pathLossExponent);
+    archive.read("referenceLoss", referenceLoss);
+    archive.read("wallLoss", wallLoss);
+    archive.read("linkBudget", linkBudget);
+    archive.read("maxRate", maxRate);
+    archive.read("baseDelay", baseDelay);
+    archive.read("updateRate", updateRate);
+    archive.read("rayCacheDistance", cacheDistance);
+    archive.read("delayStep", delayStep);
+    archive.read("rateStep", rateStep);
+    archive.read("lossStep", lossStep);
+    archive.read("motionSchedule", isScheduleEnabled);
+    archive.read("leadTime", leadTime);
+    archive.read("recordTimeline", isTimelineEnabled);
+    archive.read("timelineRate", timelineRate);
+    archive.readRelocatablePath("timelineFile", timelineFile);
+    profiler.restore(archive);
     return true;
 }
 
 
 void TCSimulatorItemImpl::onPreDynamicsFunction()
 {
-    TCAreaItem* currentItem = new TCAreaItem();
-    for(size_t i = 0; i < bodies.size(); i++) {
-        Body* body = bodies[i];
-        if(!body->isStaticModel()) {
-            Link* link = body->rootLink();
-            Vector3 p = link->T().translation();
-            for(int j = 0; j < items.size(); j++) {
-                TCAreaItem* item = items[j];
-                Vector3 translation = item->translation();
-                Vector3 rotation = item->rotation();
-                Matrix3 s = rotFromRpy(rotation * TO_RADIAN);
-
-                WorldItem* worldItem = item->findOwnerItem<WorldItem>();
-                if(worldItem) {
-                    if(item->type() == AreaItem::BOX) {
-                        Vector3 size = item->size();
-                        Vector3 minRange = translation - size / 2.0;
-                        Vector3 maxRange = translation + size / 2.0;
-                        if((minRange[0] <= p[0]) && (p[0] <= maxRange[0])
-                                && (minRange[1] <= p[1]) && (p[1] <= maxRange[1])
-                                && (minRange[2] <= p[2]) && (p[2] <= maxRange[2])
-                                ) {
-                            currentItem = item;
-                        }
-                    } else if(item->type() == AreaItem::CYLINDER) {
-                        Vector3 a = s * (Vector3(0.0, 1.0, 0.0) * item->height() / 2.0) + translation;
-                        Vector3 b = s * (Vector3(0.0, 1.0, 0.0) * item->height() / 2.0 * -1.0) + translation;
-                        Vector3 c = a - b;
-                        Vector3 d = p - b;
-                        double cd = c.dot(d);
-                        if((0.0 < cd) && (cd < c.dot(c))) {
-                            double r2 = d.dot(d) - d.dot(c) * d.dot(c) / c.dot(c);
-                            double rp2 =  item->radius() * item->radius();
-                            if(r2 < rp2) {
-                                currentItem = item;
-                            }
-                        }
-                    } else if(item->type() == AreaItem::SPHERE) {
-                        Vector3 r = translation - p;
-                        if(r.norm() <= item->radius()) {
-                            currentItem = item;
-                        }
+    if(isTimelineEnabled) {
+        timeline.collect();
+    }
+
+    if(isScheduled) {
+        // the transitions are known, so no area is tested
+        onScheduleUpdate(simulatorItem->currentTime());
+        profiler.endFrame();
+        return;
+    }
+
+    StageProfiler::ScopedTimer areaTimer(profiler, AreaStage);
+    double time = simulatorItem->currentTime();
+
+    if(isLinkModelEnabled) {
+        // the link model replaces the areas
+        areaTimer.stop();
+        onLinkModelUpdate(time);
+        profiler.endFrame();
+        return;
+    }
+
+    // every body of a profile has its own netem qdiscs and slot
+    const vector<TCAreaTracker::Change>& changes = areaTracker.update(time);
+    areaTimer.stop();
+
+    for(auto& change : changes) {
+        StageProfiler::ScopedTimer commandTimer(profiler, CommandStage);
+        post(change.slot, change.index);
+    }
+    profiler.endFrame();
+}
+
+
+bool TCSimulatorItemImpl::buildSchedule()
+{
+    if(bodyAreas.empty()) {
+        return false;
+    }
+    double timeStep = simulatorItem->worldTimeStep();
+    int numSteps = 0;
+    for(auto& bodyArea : bodyAreas) {
+        if(!bodyArea.motion) {
+            return false;
+        }
+        double duration = bodyArea.motion->numFrames() / bodyArea.motion->frameRate();
+        numSteps = std::max(numSteps, (int)ceil(duration / timeStep));
+    }
+
+    // the position of a body at a step is the frame of its motion at that
+    // time, and the last frame after the motion has ended
+    auto position = [&](const BodyArea& bodyArea, const int& step) -> Vector3 {
+        const MultiSE3Seq& seq = *bodyArea.motion;
+        int frame = std::min((int)lround(step * timeStep * seq.frameRate()), seq.numFrames() - 1);
+        return seq.at(frame, 0).translation();
+    };
+
+    // the steps are independent until the hysteresis and the dwell time
+    // come in, so the grid is searched in chunks of time on every core
+    int numBodies = bodyAreas.size();
+    vector<int> areas((size_t)numSteps * numBodies);
+    int numChunks = (numSteps + ScheduleChunkSize - 1) / ScheduleChunkSize;
+    workerPool.setNumThreads(std::max(1, (int)thread::hardware_concurrency()));
+    workerPool.run(numChunks, [&](int chunk){
+        int end = std::min(numSteps, (chunk + 1) * ScheduleChunkSize);
+        for(int step = chunk * ScheduleChunkSize; step < end; ++step) {
+            for(int i = 0; i < numBodies; ++i) {
+                areas[(size_t)step * numBodies + i] = areaTracker.areaGrid().findArea(position(bodyAreas[i], step));
+            }
+        }
+    });
+
+    // the hysteresis and the dwell time depend on the transitions before,
+    // so they are applied in order as TCAreaTracker::update() does
+    int noArea = items.size();
+    auto areaAt = [&](const int& step, const int& i, const int& hysteresisIndex){
+        return areaTracker.keepArea(areas[(size_t)step * numBodies + i], hysteresisIndex,
+                                    position(bodyAreas[i], step));
+    };
+
+    int numSlots = bodyProfiles.empty() ? 1 : numBodies;
+    vector<int> indices(numSlots, noArea);
+    vector<double> changeTimes(numSlots, 0.0);
+    vector<bool> inits(numSlots, false);
+    for(int step = 0; step < numSteps; ++step) {
+        double time = step * timeStep;
+        for(int slot = 0; slot < numSlots; ++slot) {
+            int index = noArea;
+            if(!bodyProfiles.empty()) {
+                int area = areaAt(step, slot, indices[slot]);
+                index = area >= 0 ? area : noArea;
+            } else {
+                // the last body in an area decides
+                for(int i = 0; i < numBodies; ++i) {
+                    int area = areaAt(step, i, indices[slot]);
+                    if(area >= 0) {
+                        index = area;
                     }
                 }
             }
+            if(index != indices[slot]) {
+                if(!inits[slot] || (time - changeTimes[slot] >= dwellTime)) {
+                    schedule.push_back({ time, slot, index });
+                    indices[slot] = index;
+                    changeTimes[slot] = time;
+                    inits[slot] = true;
+                }
+            }
         }
     }
+    return true;
+}
 
-    if(currentItem->id() != prevItemId) {
-        if(!init) {
-            onTCExecute(currentItem);
-            init = true;
-        } else {
-            onTCClear();
-            onTCExecute(currentItem);
+
+void TCSimulatorItemImpl::onScheduleUpdate(const double& time)
+{
+    // a transition is posted the lead time before it is due, so that the
+    // worker has reconfigured the qdiscs when the body gets there
+    while(nextChange < schedule.size() && schedule[nextChange].time <= time + leadTime) {
+        StageProfiler::ScopedTimer commandTimer(profiler, CommandStage);
+        const ScheduledChange& change = schedule[nextChange++];
+        post(change.slot, change.index);
+    }
+}
+
+
+void TCSimulatorItemImpl::onLinkModelUpdate(const double& time)
+{
+    if(time < nextUpdateTime) {
+        return;
+    }
+    nextUpdateTime = updateRate > 0.0 ? time + 1.0 / updateRate : time;
+
+    StageProfiler::ScopedTimer modelTimer(profiler, LinkModelStage);
+    if(!bodyProfiles.empty()) {
+        for(size_t i = 0; i < bodyAreas.size(); ++i) {
+            BodyArea& bodyArea = bodyAreas[i];
+            TCNetlink::Netem netem;
+            linkModel.evaluate(bodyArea.link->T().translation(), bodyArea.probe, netem);
+            if(!bodyArea.init || isQuantumExceeded(netem, bodyArea.netem)) {
+                postLinkTraffic(i, netem);
+                bodyArea.netem = netem;
+                bodyArea.init = true;
+            }
         }
+        return;
+    }
+
+    // the worst link decides for the whole interface
+    TCNetlink::Netem worst;
+    for(auto& bodyArea : bodyAreas) {
+        TCNetlink::Netem netem;
+        linkModel.evaluate(bodyArea.link->T().translation(), bodyArea.probe, netem);
+        worst.delay = std::max(worst.delay, netem.delay);
+        worst.loss = std::max(worst.loss, netem.loss);
+        if(netem.rate > 0.0) {
+            worst.rate = worst.rate > 0.0 ? std::min(worst.rate, netem.rate) : netem.rate;
+        }
+    }
+    if(!bodyAreas.empty() && (!init || isQuantumExceeded(worst, netem))) {
+        postLinkTraffic(0, worst);
+        netem = worst;
+        init = true;
+    }
+}
+
+
+void TCSimulatorItemImpl::postLinkTraffic(const int& slot, const TCNetlink::Netem& netem)
+{
+    // the uplink and the downlink share the quality of the radio link
+    {
+        lock_guard<mutex> lock(workerMutex);
+        linkTraffics[slot].inbound = netem;
+        linkTraffics[slot].outbound = netem;
+    }
+    post(slot, ++linkGenerations[slot]);
+}
+
+
+bool TCSimulatorItemImpl::isQuantumExceeded(const TCNetlink::Netem& netem, const TCNetlink::Netem& postedNetem) const
+{
+    // a change of the rate is relative, and a rate of 0 is unlimited
+    if((netem.rate > 0.0) != (postedNetem.rate > 0.0)) {
+        return true;
     }
-    prevItemId = currentItem->id();
+    double rateChange = fabs(netem.rate - postedNetem.rate);
+    return (fabs(netem.delay - postedNetem.delay) >= delayStep)
+        || (fabs(netem.loss - postedNetem.loss) >= lossStep)
+        || ((netem.rate > 0.0) && (rateChange >= rateStep / 100.0 * std::max(netem.rate, postedNetem.rate)));
+}
+
+
+/*
+   A network profile file lists the addresses of the traffic of each body:
+
+     profiles:
+       - body: AizuSpiderSA
+         sourceIPs: [ 192.168.1.10/32 ]
+         destinationIPs: [ 192.168.1.100/32 ]
+       - body: DoubleArmV7A
+         sourceIP: 192.168.1.11/32
+         destinationIP: 0.0.0.0/0
+
+   Addresses that are left out match any address.
+*/
+bool TCSimulatorItemImpl::loadProfiles(const string& filename, vector<NetworkProfile>& out_profiles,
+                                       string& out_errorMessage) const
+{
+    YAMLReader reader;
+    if(!reader.load(filename)) {
+        out_errorMessage = reader.errorMessage();
+        return false;
+    }
+    ValueNode* topNode = reader.document();
+    Listing* profileList = topNode->isMapping() ? topNode->toMapping()->findListing("profiles") : nullptr;
+    if(!profileList || !profileList->isValid()) {
+        out_errorMessage = fmt::format(_("Network profiles \"{0}\" has no profiles."), filename);
+        return false;
+    }
+    for(int i = 0; i < profileList->size(); ++i) {
+        Mapping* info = profileList->at(i)->toMapping();
+        NetworkProfile profile;
+        if(!info->read("body", profile.body)) {
+            out_errorMessage = fmt::format(_("Profile {0} of network profiles \"{1}\" needs a body."),
+                                           i, filename);
+            out_profiles.clear();
+            return false;
+        }
+        vector<string> sources;
+        vector<string> destinations;
+        readAddresses(info, "sourceIPs", "sourceIP", sources);
+        readAddresses(info, "destinationIPs", "destinationIP", destinations);
+        for(auto& address : sources) {
+            if(onAddressCheck(address)) {
+                profile.sources.push_back(address);
+            }
+        }
+        for(auto& address : destinations) {
+            if(onAddressCheck(address)) {
+                profile.destinations.push_back(address);
+            }
+        }
+        if(profile.sources.empty()) {
+            profile.sources.push_back("0.0.0.0/0");
+        }
+        if(profile.destinations.empty()) {
+            profile.destinations.push_back("0.0.0.0/0");
+        }
+        out_profiles.push_back(profile);
+    }
+    return true;
+}
+
+
+void TCSimulatorItemImpl::startWorker()
+{
+    for(int i = 0; i < numRequestSlots; ++i) {
+        requestedIndices[i] = initialIndex();
+    }
+    isRequested = false;
+    isWorkerStopping = false;
+    worker = thread([this](){ runWorker(); });
+}
+
+
+int TCSimulatorItemImpl::initialIndex() const
+{
+    // the trees built for the profiles start without impairment, and the
+    // generations of the link model start at 0
+    return (bodyProfiles.empty() || isLinkModelEnabled) ? -1 : (int)items.size();
+}
+
+
+void TCSimulatorItemImpl::stopWorker()
+{
+    if(worker.joinable()) {
+        {
+            lock_guard<mutex> lock(workerMutex);
+            isWorkerStopping = true;
+        }
+        workerCondition.notify_all();
+        worker.join();
+    }
+}
+
+
+void TCSimulatorItemImpl::post(const int& slot, const int& index)
+{
+    // a busy worker finds the new index when it is done; only an idle
+    // worker has to be woken, which takes the mutex so the wakeup is not lost
+    if(isTimelineEnabled) {
+        requestedTimes[slot].store(simulatorItem->currentTime(), memory_order_relaxed);
+        requestedClocks[slot].store(chrono::steady_clock::now().time_since_epoch().count(),
+                                    memory_order_relaxed);
+    }
+    requestedIndices[slot].store(index, memory_order_release);
+    if(!isRequested.exchange(true, memory_order_acq_rel)) {
+        {
+            lock_guard<mutex> lock(workerMutex);
+        }
+        workerCondition.notify_one();
+    }
+}
+
+
+void TCSimulatorItemImpl::runWorker()
+{
+    vector<int> appliedIndices(numRequestSlots, initialIndex());
+    while(true) {
+        {
+            unique_lock<mutex> lock(workerMutex);
+            workerCondition.wait(lock, [&](){ return isWorkerStopping || isRequested.load(); });
+            if(isWorkerStopping) {
+                break;
+            }
+        }
+        // clearing the flag with exchange pairs with the exchange in post(),
+        // so an index stored before the flag was set is seen below
+        if(!isRequested.exchange(false, memory_order_acq_rel)) {
+            continue;
+        }
+        for(int i = 0; i < numRequestSlots; ++i) {
+            int index = requestedIndices[i].load(memory_order_acquire);
+            if(index < 0 || index == appliedIndices[i]) {
+                continue;
+            }
+            if(isLinkModelEnabled) {
+                TrafficState traffic;
+                {
+                    lock_guard<mutex> lock(workerMutex);
+                    traffic = linkTraffics[i];
+                }
+                apply(i, traffic, appliedIndices[i] >= 0);
+                record(i, -1, traffic);
+            } else {
+                apply(i, traffics[index], appliedIndices[i] >= 0);
+                record(i, index, traffics[index]);
+            }
+            appliedIndices[i] = index;
+        }
+    }
+}
+
+
+void TCSimulatorItemImpl::record(const int& slot, const int& area, const TrafficState& traffic)
+{
+    if(!isTimelineEnabled) {
+        return;
+    }
+    // a later request may have replaced the time of the applied one, which
+    // is then recorded at the later time
+    TCTimeline::Event event;
+    event.time = requestedTimes[slot].load(memory_order_relaxed);
+    event.slot = slot;
+    event.area = area;
+    event.inbound = traffic.inbound;
+    event.outbound = traffic.outbound;
+    if(!isProxyEnabled && !netlink.isOpen()) {
+        // the commands have only been written to the tc process, which
+        // does not tell when they have taken effect
+        event.latency = nan("");
+    } else {
+        chrono::steady_clock::duration latency(
+            chrono::steady_clock::now().time_since_epoch().count() - requestedClocks[slot].load(memory_order_relaxed));
+        event.latency = chrono::duration<double, milli>(latency).count();
+    }
+    timeline.push(event);
+}
+
+
+void TCSimulatorItemImpl::finalizeTimeline()
+{
+    if(!isTimelineEnabled) {
+        return;
+    }
+    // the worker has stopped, so every event is in the ring
+    timeline.collect();
+
+    MultiValueSeqItem* timelineItem = new MultiValueSeqItem;
+    timelineItem->setName("Network Timeline - " + self->name());
+    self->addSubItem(timelineItem);
+    timelineItem->seq()->setSeqContentName("NetworkTimelineSeq");
+    timeline.fill(*timelineItem->seq(), timelineRate, simulatorItem->currentTime());
+
+    if(timeline.numDroppedEvents() > 0) {
+        MessageView::instance()->putln(
+            fmt::format(_("{0} changes of the network are missing from the timeline."),
+                        timeline.numDroppedEvents()),
+            MessageView::Warning);
+    }
+
+    if(!timelineFile.empty()) {
+        vector<string> slotNames;
+        for(auto& profile : bodyProfiles) {
+            slotNames.push_back(profile.body);
+        }
+        bool result = isCsvFile(timelineFile) ? timeline.writeCsv(timelineFile, slotNames)
+            : timeline.writeBinary(timelineFile);
+        if(!result) {
+            MessageView::instance()->putln(
+                fmt::format(_("The timeline cannot be written to \"{0}\"."), timelineFile),
+                MessageView::Warning);
+        }
+    }
+}
+
+
+void TCSimulatorItemImpl::apply(const int& slot, const TrafficState& traffic, const bool& isApplied)
+{
+    if(!bodyProfiles.empty()) {
+        onTCChange(slot, traffic);
+        return;
+    }
+    if(isApplied) {
+        onTCClear();
+    }
+    onTCExecute(traffic);
 }
 
 
@@ -348,16 +1359,45 @@ void TCSimulatorItemImpl::onTCInitialize()
         }
     }
 
+    isProxyEnabled = backend.is(ProxyBackend);
+    if(isProxyEnabled) {
+        onProxyInitialize();
+        return;
+    }
+
+    if(netlink.open()) {
+        onNetlinkInitialize();
+        return;
+    }
+    MessageView::instance()->putln(
+        fmt::format(_("Traffic control falls back to the tc command: {0}"), netlink.errorMessage()));
+
     string message = (fmt::format("sudo modprobe ifb;"
                                   "sudo modprobe act_mirred;"
                                   "sudo ip link set dev {0} up;",
                                 ifbDeviceName));
     onCommandExecute(message);
+
+    // the qdiscs and filters are written to one tc process for the whole
+    // simulation, and onCommandExecute() runs each command if it fails
+    if(!batch.start({ "sudo", "tc", "-force", "-batch", "-" })) {
+        MessageView::instance()->putln(batch.errorMessage(), MessageView::Warning);
+    }
 }
 
 
 void TCSimulatorItemImpl::onTCClear()
 {
+    // the proxy replaces the parameters of its routes in place
+    if(isProxyEnabled) {
+        return;
+    }
+
+    if(netlink.isOpen()) {
+        onNetlinkClear();
+        return;
+    }
+
     string message = (fmt::format("sudo tc qdisc del dev {0} ingress;"
                                   "sudo tc qdisc del dev {1} root;"
                                   "sudo tc qdisc del dev {0} root;",
@@ -368,6 +1408,20 @@ void TCSimulatorItemImpl::onTCClear()
 
 void TCSimulatorItemImpl::onTCFinalize()
 {
+    if(isProxyEnabled) {
+        proxy.stop();
+        isProxyEnabled = false;
+        return;
+    }
+
+    if(netlink.isOpen()) {
+        onNetlinkFinalize();
+        return;
+    }
+
+    // the qdiscs are deleted before the module of the ifb device
+    batch.stop();
+
     string message = (fmt::format("sudo ip link set dev {0} down;"
                                   "sudo rmmod ifb;",
                                   ifbDeviceName));
@@ -375,58 +1429,34 @@ void TCSimulatorItemImpl::onTCFinalize()
 }
 
 
-void TCSimulatorItemImpl::onTCExecute(TCAreaItem* item)
+void TCSimulatorItemImpl::onTCExecute(const TrafficState& traffic)
 {
-    double inboundDelay = item->inboundDelay();
-    double inboundLoss = item->inboundLoss();
-    double inboundRate = item->inboundRate();
-    double outboundDelay = item->outboundDelay();
-    double outboundLoss = item->outboundLoss();
-    double outboundRate = item->outboundRate();
-
-    string inboundEffects;
-    string outboundEffects;
-
-    if(inboundDelay > 0.0) {
-        inboundEffects += " delay " + (fmt::format("{0:.2f}", inboundDelay)) + "ms";
-    }
-    if(inboundRate > 0.0) {
-        inboundEffects += " rate " + (fmt::format("{0:.2f}", inboundRate)) + "kbps";
-    }
-    if(inboundLoss > 0.0) {
-        inboundEffects += " loss " + (fmt::format("{0:.2f}", inboundLoss)) + "%";
+    // the clients of the proxy choose the traffic by the port, so the
+    // addresses of the area are not matched
+    if(isProxyEnabled) {
+        proxy.setNetem(-1, traffic.inbound, traffic.outbound);
+        return;
     }
 
-    if(outboundDelay > 0.0) {
-        outboundEffects += " delay " + (fmt::format("{0:.2f}", outboundDelay)) + "ms";
-    }
-    if(outboundRate > 0.0) {
-        outboundEffects += " rate " + (fmt::format("{0:.2f}", outboundRate)) + "kbps";
-    }
-    if(outboundLoss > 0.0) {
-        outboundEffects += " loss " + (fmt::format("{0:.2f}", outboundLoss)) + "%";
+    if(netlink.isOpen()) {
+        onNetlinkExecute(traffic);
+        return;
     }
 
-    string srcipName = item->source();
-    string dstipName = item->destination();
-    if(!onAddressCheck(srcipName)) {
-        srcipName = "0.0.0.0/0";
-    }
-    if(!onAddressCheck(dstipName)) {
-        dstipName = "0.0.0.0/0";
-    }
+    string inboundEffects = netemEffects(traffic.inbound);
+    string outboundEffects = netemEffects(traffic.outbound);
 
-    string srcMessage;
-    string dstMessage;
+    vector<AddressFilter> dstFilters;
+    vector<AddressFilter> srcFilters;
+    appendFilters(dstFilters, traffic.sources, traffic.destinations, true, 0x10002);
+    appendFilters(srcFilters, traffic.sources, traffic.destinations, false, 0x10002);
 
-    if((!srcipName.empty()) && (!dstipName.empty())) {
-        dstMessage = (fmt::format("sudo tc qdisc add dev {0} parent 1:2 handle 20: netem limit 2000{1};"
-                                  "sudo tc filter add dev {0} protocol ip parent 1: prio 2 u32 match ip src {2} match ip dst {3} flowid 1:2;",
-                                ifbDeviceName, inboundEffects, dstipName, srcipName));
-        srcMessage = (fmt::format("sudo tc qdisc add dev {0} parent 1:2 handle 20: netem limit 2000{1};"
-                                  "sudo tc filter add dev {0} protocol ip parent 1: prio 2 u32 match ip src {2} match ip dst {3} flowid 1:2;",
-                                interfaceName, outboundEffects, srcipName, dstipName));
-    }
+    string dstMessage = (fmt::format("sudo tc qdisc add dev {0} parent 1:2 handle 20: netem limit 2000{1};",
+                                     ifbDeviceName, inboundEffects))
+        + filterCommands(ifbDeviceName, 0x10000, dstFilters, true);
+    string srcMessage = (fmt::format("sudo tc qdisc add dev {0} parent 1:2 handle 20: netem limit 2000{1};",
+                                     interfaceName, outboundEffects))
+        + filterCommands(interfaceName, 0x10000, srcFilters, false);
 
     string message = (fmt::format("sudo tc qdisc add dev {0} ingress handle ffff:;"
                                   "sudo tc filter add dev {0} parent ffff: protocol ip u32 match u32 0 0 action mirred egress redirect dev {1};"
@@ -443,13 +1473,329 @@ void TCSimulatorItemImpl::onTCExecute(TCAreaItem* item)
 }
 
 
+void TCSimulatorItemImpl::onTCBuild()
+{
+    if(isProxyEnabled) {
+        return;
+    }
+
+    if(netlink.isOpen()) {
+        onNetlinkBuild();
+        return;
+    }
+
+    int numGroups = (bodyProfiles.size() + BANDS_PER_GROUP - 1) / BANDS_PER_GROUP;
+    string message = (fmt::format("sudo tc qdisc add dev {0} ingress handle ffff:;"
+                                  "sudo tc filter add dev {0} parent ffff: protocol ip u32 match u32 0 0 action mirred egress redirect dev {1};",
+                                  interfaceName, ifbDeviceName));
+    for(int k = 0; k < 2; ++k) {
+        // the redirected ingress traffic has the addresses swapped
+        const string& device = k == 0 ? ifbDeviceName : interfaceName;
+        message += (fmt::format("sudo tc qdisc add dev {0} root handle 1: "
+                                "prio bands {1} priomap 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0;"
+                                "sudo tc qdisc add dev {0} parent 1:1 handle 10: netem limit 2000;",
+                                device, numGroups + 1));
+        for(int g = 0; g < numGroups; ++g) {
+            int body = g * BANDS_PER_GROUP;
+            message += (fmt::format("sudo tc qdisc add dev {0} parent {1} handle {2} "
+                                    "prio bands {3} priomap 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0;",
+                                    device, tcHandle(groupClass(body)), tcHandle(groupHandle(body)), BANDS_PER_GROUP));
+        }
+        vector<AddressFilter> rootFilters;
+        vector<vector<AddressFilter>> groupFilters(numGroups);
+        for(size_t i = 0; i < bodyProfiles.size(); ++i) {
+            const NetworkProfile& profile = bodyProfiles[i];
+            message += (fmt::format("sudo tc qdisc add dev {0} parent {1} handle {2} netem limit 2000;",
+                                    device, tcHandle(bodyClass(i)), tcHandle(bodyHandle(i))));
+            appendFilters(rootFilters, profile.sources, profile.destinations, k == 0, groupClass(i));
+            appendFilters(groupFilters[i / BANDS_PER_GROUP], profile.sources, profile.destinations, k == 0, bodyClass(i));
+        }
+        message += filterCommands(device, 0x10000, rootFilters, k == 0);
+        for(int g = 0; g < numGroups; ++g) {
+            message += filterCommands(device, groupHandle(g * BANDS_PER_GROUP), groupFilters[g], k == 0);
+        }
+    }
+    onCommandExecute(message);
+}
+
+
+void TCSimulatorItemImpl::onTCChange(const int& body, const TrafficState& traffic)
+{
+    if(isProxyEnabled) {
+        for(size_t i = 0; i < routeBodies.size(); ++i) {
+            if(routeBodies[i] == bodyProfiles[body].body) {
+                proxy.setNetem(i, traffic.inbound, traffic.outbound);
+            }
+        }
+        return;
+    }
+
+    if(netlink.isOpen()) {
+        onNetlinkChange(body, traffic);
+        return;
+    }
+
+    // tc qdisc change keeps the parameters that are left out, so the netem
+    // qdisc of the body is replaced
+    string message = (fmt::format("sudo tc qdisc del dev {0} parent {2} handle {3};"
+                                  "sudo tc qdisc add dev {0} parent {2} handle {3} netem limit 2000{4};"
+                                  "sudo tc qdisc del dev {1} parent {2} handle {3};"
+                                  "sudo tc qdisc add dev {1} parent {2} handle {3} netem limit 2000{5};",
+                                  ifbDeviceName, interfaceName, tcHandle(bodyClass(body)), tcHandle(bodyHandle(body)),
+                                  netemEffects(traffic.inbound), netemEffects(traffic.outbound)));
+    onCommandExecute(message);
+}
+
+
 void TCSimulatorItemImpl::onCommandExecute(const string& message)
 {
+    // consecutive tc commands go to the batch in one write, and the other
+    // commands wait until the tc commands before them have been written
+    static const string prefix = "sudo tc ";
     vector<string> commands = split(message, ';');
+    vector<string> batchCommands;
+    auto flush = [&](){
+        if(!batchCommands.empty() && !(batch.isRunning() && batch.write(batchCommands))) {
+            for(auto& command : batchCommands) {
+                Process::execute(QString::fromStdString(prefix + command));
+            }
+        }
+        batchCommands.clear();
+    };
     for(size_t i = 0; i < commands.size(); ++i) {
+        if(commands[i].compare(0, prefix.size(), prefix) == 0) {
+            batchCommands.push_back(commands[i].substr(prefix.size()));
+            continue;
+        }
+        flush();
         QString command = QString::fromStdString(commands[i]);
         Process::execute(command);
     }
+    flush();
+}
+
+
+void TCSimulatorItemImpl::onBatchCommandFailed(const string& command, const string& message)
+{
+    // clearing deletes the qdiscs whether they have been added or not
+    if(command.compare(0, 10, "qdisc del ") == 0) {
+        return;
+    }
+    if(command.empty()) {
+        MessageView::instance()->putln(
+            fmt::format(_("Traffic control cannot be configured: {0}"), message),
+            MessageView::Warning);
+    } else {
+        MessageView::instance()->putln(
+            fmt::format(_("Traffic control cannot be configured by \"tc {0}\": {1}"), command, message),
+            MessageView::Warning);
+    }
+}
+
+
+void TCSimulatorItemImpl::onNetlinkInitialize()
+{
+    // the kernel loads the ifb module itself when the device is created
+    isIfbDeviceCreated = false;
+    if(!netlink.hasDevice(ifbDeviceName)) {
+        if(!netlink.addIfbDevice(ifbDeviceName)) {
+            putNetlinkError();
+            return;
+        }
+        isIfbDeviceCreated = true;
+    }
+    if(!netlink.setDeviceUp(ifbDeviceName, true)) {
+        putNetlinkError();
+    }
+}
+
+
+void TCSimulatorItemImpl::onNetlinkClear()
+{
+    if(!netlink.deleteIngressQdisc(interfaceName)) {
+        putNetlinkError();
+    }
+    if(!netlink.deleteRootQdisc(ifbDeviceName)) {
+        putNetlinkError();
+    }
+    if(!netlink.deleteRootQdisc(interfaceName)) {
+        putNetlinkError();
+    }
+}
+
+
+void TCSimulatorItemImpl::onNetlinkFinalize()
+{
+    if(!netlink.setDeviceUp(ifbDeviceName, false)) {
+        putNetlinkError();
+    }
+    if(isIfbDeviceCreated && !netlink.deleteDevice(ifbDeviceName)) {
+        putNetlinkError();
+    }
+    isIfbDeviceCreated = false;
+    netlink.close();
+}
+
+
+void TCSimulatorItemImpl::onNetlinkExecute(const TrafficState& traffic)
+{
+    const TCNetlink::Netem& inbound = traffic.inbound;
+    const TCNetlink::Netem& outbound = traffic.outbound;
+    TCNetlink::Netem none;
+    vector<AddressFilter> dstFilters;
+    vector<AddressFilter> srcFilters;
+    appendFilters(dstFilters, traffic.sources, traffic.destinations, true, 0x10002);
+    appendFilters(srcFilters, traffic.sources, traffic.destinations, false, 0x10002);
+
+    // the same tree as the tc commands: ingress traffic is redirected to
+    // the ifb device, and band 1:2 of a prio qdisc on either device
+    // delays the traffic between the addresses
+    bool result = netlink.addIngressQdisc(interfaceName)
+        && netlink.addMirredFilter(interfaceName, ifbDeviceName)
+        && netlink.addPrioQdisc(ifbDeviceName, 0x10000, 16)
+        && netlink.addNetemQdisc(ifbDeviceName, 0x10001, 0x100000, none)
+        && netlink.addNetemQdisc(ifbDeviceName, 0x10002, 0x200000, inbound)
+        && addFilters(netlink, ifbDeviceName, 0x10000, dstFilters, true)
+        && netlink.addPrioQdisc(interfaceName, 0x10000, 16)
+        && netlink.addNetemQdisc(interfaceName, 0x10001, 0x100000, none)
+        && netlink.addNetemQdisc(interfaceName, 0x10002, 0x200000, outbound)
+        && addFilters(netlink, interfaceName, 0x10000, srcFilters, false);
+    if(!result) {
+        putNetlinkError();
+    }
+}
+
+
+void TCSimulatorItemImpl::onNetlinkBuild()
+{
+    int numGroups = (bodyProfiles.size() + BANDS_PER_GROUP - 1) / BANDS_PER_GROUP;
+    TCNetlink::Netem none;
+
+    // band 1:1 keeps the traffic of no profile, band 1:(g + 2) leads to
+    // the group of a body, and a band of the group to the body
+    bool result = netlink.addIngressQdisc(interfaceName)
+        && netlink.addMirredFilter(interfaceName, ifbDeviceName);
+    for(int k = 0; (k < 2) && result; ++k) {
+        // the redirected ingress traffic has the addresses swapped
+        const string& device = k == 0 ? ifbDeviceName : interfaceName;
+        result = netlink.addPrioQdisc(device, 0x10000, numGroups + 1)
+            && netlink.addNetemQdisc(device, 0x10001, 0x100000, none);
+        for(int g = 0; (g < numGroups) && result; ++g) {
+            int body = g * BANDS_PER_GROUP;
+            result = netlink.addPrioQdisc(device, groupClass(body), groupHandle(body), BANDS_PER_GROUP);
+        }
+        vector<AddressFilter> rootFilters;
+        vector<vector<AddressFilter>> groupFilters(numGroups);
+        for(size_t i = 0; (i < bodyProfiles.size()) && result; ++i) {
+            const NetworkProfile& profile = bodyProfiles[i];
+            result = netlink.addNetemQdisc(device, bodyClass(i), bodyHandle(i), none);
+            appendFilters(rootFilters, profile.sources, profile.destinations, k == 0, groupClass(i));
+            appendFilters(groupFilters[i / BANDS_PER_GROUP], profile.sources, profile.destinations, k == 0, bodyClass(i));
+        }
+        result = result && addFilters(netlink, device, 0x10000, rootFilters, k == 0);
+        for(int g = 0; (g < numGroups) && result; ++g) {
+            result = addFilters(netlink, device, groupHandle(g * BANDS_PER_GROUP), groupFilters[g], k == 0);
+        }
+    }
+    if(!result) {
+        putNetlinkError();
+    }
+}
+
+
+void TCSimulatorItemImpl::onNetlinkChange(const int& body, const TrafficState& traffic)
+{
+    bool result = netlink.changeNetemQdisc(ifbDeviceName, bodyClass(body), bodyHandle(body), traffic.inbound)
+        && netlink.changeNetemQdisc(interfaceName, bodyClass(body), bodyHandle(body), traffic.outbound);
+    if(!result) {
+        putNetlinkError();
+    }
+}
+
+
+void TCSimulatorItemImpl::onProxyInitialize()
+{
+    vector<ProxyRoute> routes;
+    string message;
+    if(!parseRoutes(proxyRoutes, routes, message)) {
+        MessageView::instance()->putln(
+            fmt::format(_("Proxy routes cannot be read: {0}"), message),
+            MessageView::Warning);
+    }
+
+    proxy.clearRoutes();
+    routeBodies.clear();
+    for(auto& route : routes) {
+        if(proxy.addRoute(route.protocol, route.port, route.targetAddress, route.targetPort) < 0) {
+            MessageView::instance()->putln(proxy.errorMessage(), MessageView::Warning);
+            continue;
+        }
+        routeBodies.push_back(route.body);
+    }
+    proxy.setLossModel(lossModel.is(GilbertElliottLoss) ? TCProxy::GILBERT_ELLIOTT : TCProxy::BERNOULLI,
+                       burstLength);
+    if(!proxy.start()) {
+        MessageView::instance()->putln(proxy.errorMessage(), MessageView::Warning);
+        return;
+    }
+    for(auto& route : routes) {
+        MessageView::instance()->putln(
+            fmt::format(_("The proxy relays 127.0.0.1:{0} to {1}:{2}."),
+                        route.port, route.targetAddress, route.targetPort));
+        // with network profiles, a route follows the profile of its body only
+        if(!bodyProfiles.empty()
+           && std::none_of(bodyProfiles.begin(), bodyProfiles.end(),
+                           [&](const NetworkProfile& p){ return p.body == route.body; })) {
+            MessageView::instance()->putln(
+                fmt::format(_("Port {0} of the proxy is not impaired, as no network profile has its body."),
+                            route.port),
+                MessageView::Warning);
+        }
+    }
+}
+
+
+bool TCSimulatorItemImpl::parseRoutes(const string& routes, vector<ProxyRoute>& out_routes,
+                                      string& out_errorMessage) const
+{
+    // "udp 15000 127.0.0.1:5000 Robot; tcp 18080 127.0.0.1:8080"
+    bool result = true;
+    vector<string> entries = split(routes, ';');
+    for(auto& entry : entries) {
+        vector<string> fields = split(entry, ' ');
+        if(fields.empty()) {
+            continue;
+        }
+        ProxyRoute route;
+        size_t colon = fields.size() >= 3 ? fields[2].rfind(':') : string::npos;
+        bool isValid = (fields.size() == 3 || fields.size() == 4)
+            && (fields[0] == "udp" || fields[0] == "tcp")
+            && colon != string::npos;
+        if(isValid) {
+            route.protocol = fields[0] == "udp" ? TCProxy::UDP : TCProxy::TCP;
+            route.port = atoi(fields[1].c_str());
+            route.targetAddress = fields[2].substr(0, colon);
+            route.targetPort = atoi(fields[2].substr(colon + 1).c_str());
+            route.body = fields.size() == 4 ? fields[3] : string();
+            isValid = route.port > 0 && route.port <= 65535
+                && route.targetPort > 0 && route.targetPort <= 65535;
+        }
+        if(!isValid) {
+            out_errorMessage = fmt::format(_("\"{0}\" is not a route."), entry);
+            result = false;
+            continue;
+        }
+        out_routes.push_back(route);
+    }
+    return result;
+}
+
+
+void TCSimulatorItemImpl::putNetlinkError()
+{
+    MessageView::instance()->putln(
+        fmt::format(_("Traffic control cannot be configured: {0}"), netlink.errorMessage()),
+        MessageView::Warning);
 }
 
 
@@ -0,0 +1,200 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#include "TCTimeline.h"
+#include <cnoid/LogFile>
+#include <cnoid/SpscRing>
+#include <fmt/format.h>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+
+using namespace std;
+using namespace cnoid;
+
+namespace {
+
+// the simulation thread collects the ring every step
+const int RingSize = 4096;
+const uint32_t BinaryVersion = 1;
+
+}
+
+
+namespace cnoid {
+
+class TCTimelineImpl
+{
+public:
+    TCTimelineImpl(TCTimeline* self);
+
+    TCTimeline* self;
+    int numSlots;
+    SpscRing<TCTimeline::Event> ring;
+    vector<TCTimeline::Event> events;
+};
+
+}
+
+
+TCTimeline::TCTimeline()
+{
+    impl = new TCTimelineImpl(this);
+}
+
+
+TCTimelineImpl::TCTimelineImpl(TCTimeline* self)
+    : self(self),
+      ring(RingSize)
+{
+    numSlots = 0;
+    events.clear();
+}
+
+
+TCTimeline::~TCTimeline()
+{
+    delete impl;
+}
+
+
+void TCTimeline::clear(const int& numSlots)
+{
+    impl->numSlots = numSlots;
+    impl->ring.clear();
+    impl->events.clear();
+}
+
+
+int TCTimeline::numSlots() const
+{
+    return impl->numSlots;
+}
+
+
+bool TCTimeline::push(const Event& event)
+{
+    return impl->ring.push(event);
+}
+
+
+void TCTimeline::collect()
+{
+    impl->ring.popAll(impl->events);
+}
+
+
+int TCTimeline::numEvents() const
+{
+    return impl->events.size();
+}
+
+
+const TCTimeline::Event& TCTimeline::event(const int& index) const
+{
+    return impl->events[index];
+}
+
+
+int TCTimeline::numDroppedEvents() const
+{
+    return impl->ring.numDroppedItems();
+}
+
+
+void TCTimeline::fill(MultiValueSeq& seq, const double& frameRate, const double& endTime) const
+{
+    int numParts = impl->numSlots * NumPartsPerSlot;
+    int numFrames = frameRate > 0.0 ? (int)floor(endTime * frameRate) + 1 : 0;
+    seq.setNumParts(numParts);
+    seq.setDimension(0, numParts, 1);
+    if(frameRate > 0.0) {
+        seq.setFrameRate(frameRate);
+    }
+    seq.setNumFrames(numFrames);
+
+    // the events of a slot are in the order of their requests, but the
+    // slots are applied in turn, so each slot walks its own events
+    vector<const Event*> slotEvents;
+    for(int slot = 0; slot < impl->numSlots; ++slot) {
+        slotEvents.clear();
+        for(auto& event : impl->events) {
+            if(event.slot == slot) {
+                slotEvents.push_back(&event);
+            }
+        }
+        const Event* current = nullptr;
+        size_t next = 0;
+        for(int frame = 0; frame < numFrames; ++frame) {
+            double time = frame / frameRate;
+            for(; next < slotEvents.size() && slotEvents[next]->time <= time; ++next) {
+                current = slotEvents[next];
+            }
+            MultiValueSeq::Frame p = seq.frame(frame);
+            int offset = slot * NumPartsPerSlot;
+            if(!current) {
+                p[offset] = -1.0;
+                for(int i = 1; i < NumPartsPerSlot; ++i) {
+                    p[offset + i] = 0.0;
+                }
+                continue;
+            }
+            p[offset] = current->area;
+            p[offset + 1] = current->inbound.delay;
+            p[offset + 2] = current->inbound.rate;
+            p[offset + 3] = current->inbound.loss;
+            p[offset + 4] = current->outbound.delay;
+            p[offset + 5] = current->outbound.rate;
+            p[offset + 6] = current->outbound.loss;
+            p[offset + 7] = current->latency;
+        }
+    }
+}
+
+
+bool TCTimeline::writeCsv(const string& filename, const vector<string>& slotNames) const
+{
+    ofstream file(filename);
+    if(!file) {
+        return false;
+    }
+    file << "time_s,slot,body,area,inbound_delay_ms,inbound_rate_kbps,inbound_loss_percent,"
+            "outbound_delay_ms,outbound_rate_kbps,outbound_loss_percent,latency_ms\n";
+    for(auto& event : impl->events) {
+        const string& name = event.slot < (int)slotNames.size() ? slotNames[event.slot] : string();
+        file << fmt::format("{0:.6f},{1},{2},{3},{4:.3f},{5:.3f},{6:.3f},{7:.3f},{8:.3f},{9:.3f},{10:.6f}\n",
+                            event.time, event.slot, name, event.area,
+                            event.inbound.delay, event.inbound.rate, event.inbound.loss,
+                            event.outbound.delay, event.outbound.rate, event.outbound.loss,
+                            event.latency);
+    }
+    return (bool)file;
+}
+
+
+bool TCTimeline::writeBinary(const string& filename) const
+{
+    LittleEndianWriter writer(filename);
+    if(!writer.isGood()) {
+        return false;
+    }
+    writer.writeBytes("TCTL", 4);
+    writer.write(BinaryVersion);
+    writer.write((uint32_t)impl->numSlots);
+    writer.write((uint32_t)impl->events.size());
+    for(auto& event : impl->events) {
+        writer.write(event.time);
+        writer.write((int32_t)event.slot);
+        writer.write((int32_t)event.area);
+        writer.write((float)event.inbound.delay);
+        writer.write((float)event.inbound.rate);
+        writer.write((float)event.inbound.loss);
+        writer.write((float)event.outbound.delay);
+        writer.write((float)event.outbound.rate);
+        writer.write((float)event.outbound.loss);
+        writer.write((float)event.latency);
+    }
+    return writer.isGood();
+}
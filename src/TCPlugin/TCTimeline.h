@@ -0,0 +1,79 @@
+/**
+   \file
+   \author Kenta Suzuki
+*/
+
+#ifndef CNOID_TC_PLUGIN_TC_TIMELINE_H
+#define CNOID_TC_PLUGIN_TC_TIMELINE_H
+
+#include <cnoid/MultiValueSeq>
+#include <string>
+#include <vector>
+#include "TCNetlink.h"
+
+namespace cnoid {
+
+class TCTimelineImpl;
+
+/**
+   Timeline of the network conditions applied by TCSimulatorItem. The
+   thread that applies a reconfiguration pushes an event into a ring
+   buffer without locking, and the thread that runs the simulation
+   collects the events of the ring; push() and collect() may run at the
+   same time, but neither on two threads at once. An event that finds
+   the ring full is dropped and counted.
+
+   fill() samples the events into a sequence with NumPartsPerSlot parts
+   for every slot: the area, the inbound delay, rate and loss, the
+   outbound delay, rate and loss, and the latency of the event in effect.
+   Before the first event of a slot the area is -1. The latency is NaN
+   when the network is changed with the tc command, since the end of the
+   reconfiguration cannot be told there.
+
+   The binary file written by writeBinary() starts with "TCTL", the
+   version, the number of slots and the number of events as 32-bit
+   integers, followed by 44 bytes for each event: the time as a double,
+   the slot and the area as 32-bit integers, and the six netem
+   parameters and the latency as floats, all little-endian.
+*/
+class TCTimeline
+{
+public:
+    static const int NumPartsPerSlot = 8;
+
+    struct Event
+    {
+        double time;     // simulation time of the request [s]
+        int slot;
+        int area;        // -1 for the link model
+        TCNetlink::Netem inbound;
+        TCNetlink::Netem outbound;
+        double latency;  // from the request to the end of the reconfiguration [ms], or NaN
+    };
+
+    TCTimeline();
+    virtual ~TCTimeline();
+
+    void clear(const int& numSlots);
+    int numSlots() const;
+
+    bool push(const Event& event);
+    void collect();
+
+    int numEvents() const;
+    const Event& event(const int& index) const;
+    int numDroppedEvents() const;
+
+    void fill(MultiValueSeq& seq, const double& frameRate, const double& endTime) const;
+    bool writeCsv(const std::string& filename, const std::vector<std::string>& slotNames) const;
+    bool writeBinary(const std::string& filename) const;
+
+private:
+    TCTimeline(const TCTimeline& org);
+    TCTimelineImpl* impl;
+    friend class TCTimelineImpl;
+};
+
+}
+
+#endif // CNOID_TC_PLUGIN_TC_TIMELINE_H
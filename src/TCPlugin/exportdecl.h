@@ -0,0 +1,37 @@
+#ifndef CNOID_TCPLUGIN_EXPORTDECL_H_INCLUDED
+# define CNOID_TCPLUGIN_EXPORTDECL_H_INCLUDED
+
+# if defined _WIN32 || defined __CYGWIN__
+#  define CNOID_TCPLUGIN_DLLIMPORT __declspec(dllimport)
+#  define CNOID_TCPLUGIN_DLLEXPORT __declspec(dllexport)
+#  define CNOID_TCPLUGIN_DLLLOCAL
+# else
+#  if __GNUC__ >= 4
+#   define CNOID_TCPLUGIN_DLLIMPORT __attribute__ ((visibility("default")))
+#   define CNOID_TCPLUGIN_DLLEXPORT __attribute__ ((visibility("default")))
+#   define CNOID_TCPLUGIN_DLLLOCAL  __attribute__ ((visibility("hidden")))
+#  else
+#   define CNOID_TCPLUGIN_DLLIMPORT
+#   define CNOID_TCPLUGIN_DLLEXPORT
+#   define CNOID_TCPLUGIN_DLLLOCAL
+#  endif
+# endif
+
+# ifdef CNOID_TCPLUGIN_STATIC
+#  define CNOID_TCPLUGIN_DLLAPI
+#  define CNOID_TCPLUGIN_LOCAL
+# else
+#  ifdef CnoidTCPlugin_EXPORTS
+#   define CNOID_TCPLUGIN_DLLAPI CNOID_TCPLUGIN_DLLEXPORT
+#  else
+#   define CNOID_TCPLUGIN_DLLAPI CNOID_TCPLUGIN_DLLIMPORT
+#  endif
+#  define CNOID_TCPLUGIN_LOCAL CNOID_TCPLUGIN_DLLLOCAL
+# endif
+
+#endif
+
+#ifdef CNOID_EXPORT
+# undef CNOID_EXPORT
+#endif
+#define CNOID_EXPORT CNOID_TCPLUGIN_DLLAPI